@@ -0,0 +1,441 @@
+// Shared benchmark harness: clocks, thread pinning, running a function on several threads at once, and reporting
+// results (repeated after a warm-up) as text and as JSON.
+//
+// Common options, accepted by every benchmark that calls bench_init():
+//   --reps=N       Measured repetitions of each case (default 5)
+//   --warmup=N     Unmeasured repetitions before them (default 1)
+//   --no-pin       Don't pin threads to CPUs
+//   --filter=STR   Only run cases whose name contains STR
+//   --json=PATH    Also write the results to PATH as a JSON array
+//   --perf         Also report hardware performance counters per op (cycles, instructions, cache misses, LLC misses,
+//                  branch misses, context switches), via perf_event_open(). Counters that the kernel refuses (no PMU,
+//                  or a restrictive /proc/sys/kernel/perf_event_paranoid) are reported as n/a, except context switches,
+//                  which fall back to getrusage().
+
+#pragma once
+#define _GNU_SOURCE
+#include "eb_chan.h"
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define BENCH_MAX_THREADS 256
+#define BENCH_MAX_REPS 101
+/* The number of most recent runs whose counter values are kept, for reports to average over */
+#define BENCH_PERF_MAX_RUNS BENCH_MAX_REPS
+
+typedef enum {
+    bench_perf_cycles,
+    bench_perf_instructions,
+    bench_perf_cache_misses,
+    bench_perf_llc_misses,
+    bench_perf_branch_misses,
+    bench_perf_context_switches,
+    bench_perf_count
+} bench_perf_counter;
+
+static const struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} k_bench_perf[bench_perf_count] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"cache_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"llc_misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {"branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"context_switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+};
+
+/* A counter's value, with the times it was enabled and running (which differ when the kernel multiplexes counters) */
+typedef struct {
+    uint64_t value;
+    uint64_t enabled;
+    uint64_t running;
+} bench_perf_sample;
+
+typedef struct {
+    size_t reps;
+    size_t warmup;
+    bool pin;
+    const char *filter;
+    const char *json_path;
+    FILE *json;
+    size_t nresults;
+
+    /* Performance counters (see bench_perf_begin()) */
+    bool perf;
+    int perf_fds[bench_perf_count];
+    bench_perf_sample perf_start[bench_perf_count];
+    /* The counts of the most recent runs, in a ring; negative for counters that are unavailable */
+    double perf_runs[BENCH_PERF_MAX_RUNS][bench_perf_count];
+    size_t perf_nruns;
+} bench_config;
+
+static bench_config g_bench = {.reps = 5, .warmup = 1, .pin = true};
+
+static uint64_t bench_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/* CPU time consumed by every thread of the process */
+static uint64_t bench_cpu_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+static size_t bench_ncpus() {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0 ? (size_t)n : 1);
+}
+
+/* Pins the calling thread to 'cpu' (modulo the number of CPUs), unless pinning is disabled */
+static void bench_pin(int cpu) {
+    if (!g_bench.pin) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % (int)bench_ncpus(), &set);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    assert(!err);
+}
+
+/* Returns the value of option 'name' (e.g. "--ops=") in argv, or NULL */
+static const char *bench_arg(int argc, const char *argv[], const char *name) {
+    for (int i = 1; i < argc; i++) {
+        if (!strncmp(argv[i], name, strlen(name))) {
+            return argv[i] + strlen(name);
+        }
+    }
+    return NULL;
+}
+
+/* Returns the size_t value of option 'name', or 'def' */
+static size_t bench_arg_size(int argc, const char *argv[], const char *name, size_t def) {
+    const char *v = bench_arg(argc, argv, name);
+    return (v ? strtoull(v, NULL, 10) : def);
+}
+
+/* Opens the counters for the calling process, including the threads that it creates from now on. Counters that can't be
+   opened are left at -1. */
+static void bench_perf_open() {
+    size_t nopen = 0;
+    int err = 0;
+    for (size_t i = 0; i < bench_perf_count; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = k_bench_perf[i].type;
+        attr.config = k_bench_perf[i].config;
+        attr.inherit = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+            /* perf_event_paranoid >= 2 only allows counting user space */
+            attr.exclude_kernel = 1;
+            fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+        if (fd < 0) {
+            err = errno;
+        }
+        g_bench.perf_fds[i] = fd;
+        nopen += (fd >= 0);
+    }
+
+    if (nopen < bench_perf_count) {
+        fprintf(stderr, "perf: %zu of %d counters unavailable (%s); they're reported as n/a%s\n",
+            bench_perf_count - nopen, bench_perf_count, strerror(err),
+            (g_bench.perf_fds[bench_perf_context_switches] < 0 ? ", except context switches (via getrusage())" : ""));
+    }
+}
+
+static bench_perf_sample bench_perf_read(bench_perf_counter counter) {
+    bench_perf_sample sample = {0};
+    int fd = g_bench.perf_fds[counter];
+    if (fd >= 0) {
+        ssize_t n = read(fd, &sample, sizeof(sample));
+        assert(n == sizeof(sample));
+    } else if (counter == bench_perf_context_switches) {
+        /* Fall back to the process' (every thread's) context switches */
+        struct rusage ru;
+        int err = getrusage(RUSAGE_SELF, &ru);
+        assert(!err);
+        sample.value = (uint64_t)(ru.ru_nvcsw + ru.ru_nivcsw);
+        sample.enabled = sample.running = 1;
+    }
+    return sample;
+}
+
+/* Begin/end a run whose counts are recorded (bench_parallel() calls these). Threads that the run creates must have
+   exited before _end(), because their counts are only added to the process' when they exit. */
+static void bench_perf_begin() {
+    if (!g_bench.perf) {
+        return;
+    }
+    for (size_t i = 0; i < bench_perf_count; i++) {
+        g_bench.perf_start[i] = bench_perf_read((bench_perf_counter)i);
+    }
+}
+
+static void bench_perf_end() {
+    if (!g_bench.perf) {
+        return;
+    }
+    double *run = g_bench.perf_runs[g_bench.perf_nruns % BENCH_PERF_MAX_RUNS];
+    for (size_t i = 0; i < bench_perf_count; i++) {
+        bench_perf_sample end = bench_perf_read((bench_perf_counter)i);
+        bench_perf_sample *start = &g_bench.perf_start[i];
+        uint64_t running = end.running - start->running;
+        if (g_bench.perf_fds[i] < 0 && i != bench_perf_context_switches) {
+            run[i] = -1;
+        } else if (!running) {
+            /* The counter was never scheduled during the run */
+            run[i] = 0;
+        } else {
+            /* Scale up counts that the kernel multiplexed with other counters */
+            run[i] = (double)(end.value - start->value) * (end.enabled - start->enabled) / running;
+        }
+    }
+    g_bench.perf_nruns++;
+}
+
+/* Fills 'per_op' with the mean counts per op of the last 'nruns' runs, which each performed 'ops' ops. Returns false if
+   the counters are disabled. Unavailable counters are negative. */
+static bool bench_perf_per_op(size_t ops, size_t nruns, double per_op[bench_perf_count]) {
+    if (!g_bench.perf) {
+        return false;
+    }
+    assert(nruns > 0 && nruns <= g_bench.perf_nruns && nruns <= BENCH_PERF_MAX_RUNS);
+    for (size_t i = 0; i < bench_perf_count; i++) {
+        double sum = 0;
+        for (size_t r = g_bench.perf_nruns - nruns; r < g_bench.perf_nruns; r++) {
+            double v = g_bench.perf_runs[r % BENCH_PERF_MAX_RUNS][i];
+            sum = (v < 0 || sum < 0 ? -1 : sum + v);
+        }
+        per_op[i] = (sum < 0 ? -1 : sum / ((double)nruns * ops));
+    }
+    return true;
+}
+
+/* Appends the per-op counts from bench_perf_per_op() to the text report */
+static void bench_perf_print(const double per_op[bench_perf_count]) {
+    for (size_t i = 0; i < bench_perf_count; i++) {
+        if (per_op[i] < 0) {
+            printf(" %s=n/a", k_bench_perf[i].name);
+        } else {
+            printf(" %s=%.3g", k_bench_perf[i].name, per_op[i]);
+        }
+    }
+}
+
+/* Appends the per-op counts from bench_perf_per_op() as fields of the current JSON object (null if unavailable) */
+static void bench_perf_json(const double per_op[bench_perf_count]) {
+    for (size_t i = 0; i < bench_perf_count; i++) {
+        if (per_op[i] < 0) {
+            fprintf(g_bench.json, ", \"%s_per_op\": null", k_bench_perf[i].name);
+        } else {
+            fprintf(g_bench.json, ", \"%s_per_op\": %.4f", k_bench_perf[i].name, per_op[i]);
+        }
+    }
+}
+
+/* Parses the common options, and opens the JSON output */
+static void bench_init(int argc, const char *argv[]) {
+    g_bench.reps = bench_arg_size(argc, argv, "--reps=", g_bench.reps);
+    g_bench.warmup = bench_arg_size(argc, argv, "--warmup=", g_bench.warmup);
+    g_bench.filter = bench_arg(argc, argv, "--filter=");
+    g_bench.json_path = bench_arg(argc, argv, "--json=");
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--no-pin")) {
+            g_bench.pin = false;
+        } else if (!strcmp(argv[i], "--perf")) {
+            g_bench.perf = true;
+        }
+    }
+    assert(g_bench.reps > 0 && g_bench.reps <= BENCH_MAX_REPS);
+
+    if (g_bench.perf) {
+        bench_perf_open();
+    }
+
+    if (g_bench.json_path) {
+        g_bench.json = fopen(g_bench.json_path, "w");
+        assert(g_bench.json);
+        fprintf(g_bench.json, "{\"ncpus\": %zu, \"pinned\": %s, \"reps\": %zu, \"results\": [", bench_ncpus(),
+            (g_bench.pin ? "true" : "false"), g_bench.reps);
+    }
+}
+
+/* Closes the JSON output */
+static void bench_finish() {
+    if (g_bench.json) {
+        fprintf(g_bench.json, "\n]}\n");
+        fclose(g_bench.json);
+        g_bench.json = NULL;
+    }
+}
+
+/* Returns whether case 'name' passes --filter */
+static bool bench_selected(const char *name) {
+    return (!g_bench.filter || strstr(name, g_bench.filter));
+}
+
+typedef void (*bench_thread_fn)(void *arg, size_t idx);
+
+typedef struct {
+    bench_thread_fn fn;
+    void *arg;
+    size_t idx;
+    volatile int *go;
+} bench_thread_args;
+
+static void *bench_thread(void *p) {
+    bench_thread_args *a = p;
+    bench_pin((int)a->idx);
+    while (!*a->go) {
+        sched_yield();
+    }
+    a->fn(a->arg, a->idx);
+    return NULL;
+}
+
+/* Runs fn(arg, idx) on 'nthreads' threads (thread idx pinned to CPU idx), started together. Returns the wall time from
+   the start until every thread returned, in nanoseconds. */
+static uint64_t bench_parallel(size_t nthreads, bench_thread_fn fn, void *arg) {
+    assert(nthreads > 0 && nthreads <= BENCH_MAX_THREADS);
+
+    volatile int go = 0;
+    pthread_t threads[BENCH_MAX_THREADS];
+    bench_thread_args args[BENCH_MAX_THREADS];
+    for (size_t i = 0; i < nthreads; i++) {
+        args[i] = (bench_thread_args){.fn = fn, .arg = arg, .idx = i, .go = &go};
+        int err = pthread_create(&threads[i], NULL, bench_thread, &args[i]);
+        assert(!err);
+    }
+
+    bench_perf_begin();
+    uint64_t start = bench_now_ns();
+    __sync_synchronize();
+    go = 1;
+    for (size_t i = 0; i < nthreads; i++) {
+        int err = pthread_join(threads[i], NULL);
+        assert(!err);
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    bench_perf_end();
+    return elapsed;
+}
+
+static int bench_cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+/* Emits 'params' (comma-separated key=value pairs with numeric values) as fields of the current JSON object */
+static void bench_json_params(const char *params) {
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", params);
+    for (char *save = NULL, *kv = strtok_r(buf, ",", &save); kv; kv = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(kv, '=');
+        if (eq) {
+            *eq = 0;
+            fprintf(g_bench.json, ", \"%s\": %s", kv, eq + 1);
+        }
+    }
+}
+
+/* Reports a case whose repetitions each performed 'ops' ops in 'elapsed[i]' nanoseconds. 'params' is a comma-separated
+   list of key=value pairs with numeric values (e.g. "threads=4,cap=64"), which is also emitted as JSON fields. */
+static void bench_report(const char *name, const char *params, size_t ops, uint64_t elapsed[], size_t nreps) {
+    qsort(elapsed, nreps, sizeof(*elapsed), bench_cmp_u64);
+    double median = (double)elapsed[nreps / 2] / ops;
+    double min = (double)elapsed[0] / ops;
+    double max = (double)elapsed[nreps - 1] / ops;
+
+    double perf[bench_perf_count];
+    bool has_perf = bench_perf_per_op(ops, nreps, perf);
+
+    printf("%-24s %-32s ns/op=%9.1f (min %9.1f, max %9.1f) ops/sec=%.3g", name, params, median, min, max,
+        1e9 / median);
+    if (has_perf) {
+        bench_perf_print(perf);
+    }
+    printf("\n");
+    fflush(stdout);
+
+    if (g_bench.json) {
+        fprintf(g_bench.json, "%s\n  {\"name\": \"%s\"", (g_bench.nresults ? "," : ""), name);
+        bench_json_params(params);
+        fprintf(g_bench.json, ", \"ops\": %zu, \"ns_per_op\": %.2f, \"ns_per_op_min\": %.2f, \"ns_per_op_max\": %.2f, "
+            "\"ops_per_sec\": %.1f", ops, median, min, max, 1e9 / median);
+        if (has_perf) {
+            bench_perf_json(perf);
+        }
+        fprintf(g_bench.json, "}");
+        g_bench.nresults++;
+    }
+}
+
+/* Returns the 'p' quantile (0 <= p <= 1) of 'sorted', which holds 'n' ascending samples */
+static uint64_t bench_quantile(const uint64_t sorted[], size_t n, double p) {
+    size_t idx = (size_t)(p * n);
+    return sorted[idx < n ? idx : n - 1];
+}
+
+/* Reports the distribution of 'n' latency samples (in nanoseconds) as min/p50/p90/p99/p99.9/max. Sorts 'samples'.
+   'params' is formatted as for bench_report(). The performance counters are reported per sample, from the last run. */
+static void bench_report_latency(const char *name, const char *params, uint64_t samples[], size_t n) {
+    assert(n > 0);
+    qsort(samples, n, sizeof(*samples), bench_cmp_u64);
+    static const struct {
+        const char *label;
+        double p;
+    } k_quantiles[] = {{"min", 0}, {"p50", .5}, {"p90", .9}, {"p99", .99}, {"p99.9", .999}, {"max", 1}};
+    const size_t k_nquantiles = sizeof(k_quantiles) / sizeof(*k_quantiles);
+
+    printf("%-40s %-32s", name, params);
+    for (size_t i = 0; i < k_nquantiles; i++) {
+        printf(" %s=%llu", k_quantiles[i].label, (unsigned long long)bench_quantile(samples, n, k_quantiles[i].p));
+    }
+    printf(" (ns)");
+    double perf[bench_perf_count];
+    bool has_perf = bench_perf_per_op(n, 1, perf);
+    if (has_perf) {
+        bench_perf_print(perf);
+    }
+    printf("\n");
+    fflush(stdout);
+
+    if (g_bench.json) {
+        fprintf(g_bench.json, "%s\n  {\"name\": \"%s\"", (g_bench.nresults ? "," : ""), name);
+        bench_json_params(params);
+        fprintf(g_bench.json, ", \"samples\": %zu", n);
+        for (size_t i = 0; i < k_nquantiles; i++) {
+            fprintf(g_bench.json, ", \"%s_ns\": %llu", k_quantiles[i].label,
+                (unsigned long long)bench_quantile(samples, n, k_quantiles[i].p));
+        }
+        if (has_perf) {
+            bench_perf_json(perf);
+        }
+        fprintf(g_bench.json, "}");
+        g_bench.nresults++;
+    }
+}
@@ -0,0 +1,247 @@
+// Memory footprint benchmark: creates N idle channels, then parks M threads in eb_chan_select_list(), each receiving
+// from 'fanin' of the channels. Reports the resident memory (RSS) and the memory allocated through eb_chan's allocator
+// per channel and per parked waiter, and how long it took to create the channels, park the waiters and tear
+// everything down (close the channels, join the threads and release the channels).
+//
+// A waiter's allocated bytes are its port (including its semaphore, whose size is reported separately) and its slots in
+// the port lists of the channels it waits on. Its RSS also includes its thread's stack, which --stack sizes. Each case
+// runs in a child process, so that the RSS of earlier cases doesn't skew later ones.
+//
+//   $ ./bench footprint.c -- --chans=1000000 --waiters=100000 --fanins=1,4
+//
+// Usage: footprint [--chans=N] [--waiters=N] [--fanins=LIST] [--stack=KB] [common options]
+// where LIST is a comma-separated list of numbers.
+
+#include "benchglue.h"
+#include <semaphore.h>
+#include <sys/wait.h>
+
+#define MAX_FANINS 16
+
+static size_t g_nchans = 100000;
+static size_t g_nwaiters = 1000;
+static size_t g_stack_kb = 64;
+
+/* Returns the resident set size of the process in bytes */
+static uint64_t rss_bytes() {
+    FILE *f = fopen("/proc/self/statm", "r");
+    assert(f);
+    unsigned long long size = 0, resident = 0;
+    int n = fscanf(f, "%llu %llu", &size, &resident);
+    assert(n == 2);
+    fclose(f);
+    return (uint64_t)resident * (uint64_t)sysconf(_SC_PAGESIZE);
+}
+
+static uint64_t alloc_bytes() {
+    eb_chan_alloc_counts counts;
+    eb_chan_alloc_stats(&counts);
+    return counts.bytes_in_use;
+}
+
+typedef struct {
+    eb_chan *chans;
+    size_t fanin;
+    size_t idx;
+    int *started;
+} waiter_args;
+
+/* Selects to receive from 'fanin' consecutive channels, until they're closed */
+static void *waiter(void *arg) {
+    waiter_args *a = arg;
+    eb_chan_op ops[MAX_FANINS];
+    eb_chan_op *opptrs[MAX_FANINS];
+    for (size_t i = 0; i < a->fanin; i++) {
+        ops[i] = eb_chan_op_recv(a->chans[(a->idx * a->fanin + i) % g_nchans]);
+        opptrs[i] = &ops[i];
+    }
+    __sync_add_and_fetch(a->started, 1);
+    eb_chan_op *op = eb_chan_select_list(eb_nsec_forever, opptrs, a->fanin);
+    assert(op && op->res == eb_chan_res_closed);
+    return NULL;
+}
+
+/* Returns the number of times waiters parked on the channels that waiters use */
+static uint64_t parks(eb_chan chans[], size_t fanin) {
+    uint64_t n = 0;
+    size_t used = (g_nwaiters * fanin < g_nchans ? g_nwaiters * fanin : g_nchans);
+    for (size_t i = 0; i < used; i++) {
+        eb_chan_counters counters;
+        if (!eb_chan_stats(chans[i], &counters)) {
+            return UINT64_MAX;
+        }
+        n += counters.parks;
+    }
+    return n;
+}
+
+typedef struct {
+    uint64_t create_ns;
+    uint64_t park_ns;
+    uint64_t teardown_ns;
+    double chan_rss;
+    double chan_alloc;
+    double waiter_rss;
+    double waiter_alloc;
+} result;
+
+static result run_case(size_t cap, size_t fanin) {
+    result r;
+    eb_chan *chans = malloc(g_nchans * sizeof(*chans));
+    waiter_args *args = malloc(g_nwaiters * sizeof(*args));
+    pthread_t *threads = malloc(g_nwaiters * sizeof(*threads));
+    assert(chans && args && threads);
+    /* Touch the bookkeeping arrays, so that their pages don't count towards the channels or waiters */
+    memset(chans, 0, g_nchans * sizeof(*chans));
+    memset(args, 0, g_nwaiters * sizeof(*args));
+    memset(threads, 0, g_nwaiters * sizeof(*threads));
+
+    /* Channels */
+    uint64_t rss0 = rss_bytes(), alloc0 = alloc_bytes(), start = bench_now_ns();
+    for (size_t i = 0; i < g_nchans; i++) {
+        chans[i] = eb_chan_create(cap);
+        assert(chans[i]);
+    }
+    r.create_ns = bench_now_ns() - start;
+    uint64_t rss1 = rss_bytes(), alloc1 = alloc_bytes();
+
+    /* Waiters */
+    pthread_attr_t attr;
+    int err = pthread_attr_init(&attr);
+    assert(!err);
+    err = pthread_attr_setstacksize(&attr, g_stack_kb * 1024);
+    assert(!err);
+    int started = 0;
+    start = bench_now_ns();
+    for (size_t i = 0; i < g_nwaiters; i++) {
+        args[i] = (waiter_args){.chans = chans, .fanin = fanin, .idx = i, .started = &started};
+        err = pthread_create(&threads[i], &attr, waiter, &args[i]);
+        assert(!err);
+    }
+    err = pthread_attr_destroy(&attr);
+    assert(!err);
+    /* Wait until every waiter has parked (or, without per-channel statistics, until every waiter has started) */
+    while (*(volatile int *)&started < (int)g_nwaiters) {
+        usleep(1000);
+    }
+    for (uint64_t p; (p = parks(chans, fanin)) != UINT64_MAX && p < g_nwaiters * fanin;) {
+        usleep(1000);
+    }
+    r.park_ns = bench_now_ns() - start;
+    uint64_t rss2 = rss_bytes(), alloc2 = alloc_bytes();
+
+    /* Teardown */
+    start = bench_now_ns();
+    for (size_t i = 0; i < g_nchans; i++) {
+        eb_chan_close(chans[i]);
+    }
+    for (size_t i = 0; i < g_nwaiters; i++) {
+        err = pthread_join(threads[i], NULL);
+        assert(!err);
+    }
+    for (size_t i = 0; i < g_nchans; i++) {
+        eb_chan_release(chans[i]);
+    }
+    r.teardown_ns = bench_now_ns() - start;
+
+    r.chan_rss = (double)(int64_t)(rss1 - rss0) / g_nchans;
+    r.chan_alloc = (double)(int64_t)(alloc1 - alloc0) / g_nchans;
+    r.waiter_rss = (g_nwaiters ? (double)(int64_t)(rss2 - rss1) / g_nwaiters : 0);
+    r.waiter_alloc = (g_nwaiters ? (double)(int64_t)(alloc2 - alloc1) / g_nwaiters : 0);
+
+    free(chans);
+    free(args);
+    free(threads);
+    return r;
+}
+
+/* Runs a case in a child process, so that it starts with a clean heap */
+static bool run_case_isolated(size_t cap, size_t fanin, result *r) {
+    int fds[2];
+    int err = pipe(fds);
+    assert(!err);
+    fflush(NULL);
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (!pid) {
+        close(fds[0]);
+        result child = run_case(cap, fanin);
+        ssize_t n = write(fds[1], &child, sizeof(child));
+        _exit(n == sizeof(child) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    ssize_t n = read(fds[0], r, sizeof(*r));
+    close(fds[0]);
+    int status = 0;
+    pid_t waited = waitpid(pid, &status, 0);
+    assert(waited == pid);
+    return (n == sizeof(*r) && WIFEXITED(status) && !WEXITSTATUS(status));
+}
+
+int main(int argc, const char *argv[]) {
+    bench_init(argc, argv);
+    g_nchans = bench_arg_size(argc, argv, "--chans=", g_nchans);
+    g_nwaiters = bench_arg_size(argc, argv, "--waiters=", g_nwaiters);
+    g_stack_kb = bench_arg_size(argc, argv, "--stack=", g_stack_kb);
+    assert(g_nchans > 0);
+
+    size_t fanins[MAX_FANINS] = {1, 4, 16};
+    size_t nfanins = 3;
+    const char *list = bench_arg(argc, argv, "--fanins=");
+    if (list) {
+        nfanins = 0;
+        for (char *end = NULL; *list && nfanins < MAX_FANINS; list = (*end ? end + 1 : end)) {
+            fanins[nfanins++] = strtoull(list, &end, 10);
+            assert(end != list);
+        }
+    }
+
+    const struct {
+        const char *name;
+        size_t cap;
+    } k_chans[] = {{"unbuffered", 0}, {"buffered", 1}};
+
+    printf("%zu channels, %zu waiters with %zu KB stacks, sizeof(sem_t)=%zu\n", g_nchans, g_nwaiters, g_stack_kb,
+        sizeof(sem_t));
+    for (size_t c = 0; c < sizeof(k_chans) / sizeof(*k_chans); c++) {
+        for (size_t f = 0; f < nfanins; f++) {
+            size_t fanin = fanins[f];
+            assert(fanin > 0 && fanin <= MAX_FANINS);
+            char name[64];
+            snprintf(name, sizeof(name), "footprint/%s", k_chans[c].name);
+            if (!bench_selected(name)) {
+                continue;
+            }
+
+            result r;
+            if (!run_case_isolated(k_chans[c].cap, fanin, &r)) {
+                printf("%-24s fanin=%-3zu failed (resource limits? see ulimit -u and /proc/sys/kernel/threads-max)\n",
+                    name, fanin);
+                continue;
+            }
+
+            printf("%-24s fanin=%-3zu chan: rss=%.0fB alloc=%.0fB  waiter: rss=%.0fB alloc=%.0fB  "
+                "create=%.1fms park=%.1fms teardown=%.1fms\n", name, fanin, r.chan_rss, r.chan_alloc, r.waiter_rss,
+                r.waiter_alloc, r.create_ns / 1e6, r.park_ns / 1e6, r.teardown_ns / 1e6);
+            fflush(stdout);
+
+            if (g_bench.json) {
+                char params[128];
+                snprintf(params, sizeof(params), "cap=%zu,fanin=%zu,chans=%zu,waiters=%zu,stack_kb=%zu",
+                    k_chans[c].cap, fanin, g_nchans, g_nwaiters, g_stack_kb);
+                fprintf(g_bench.json, "%s\n  {\"name\": \"%s\"", (g_bench.nresults ? "," : ""), name);
+                bench_json_params(params);
+                fprintf(g_bench.json, ", \"chan_rss_bytes\": %.1f, \"chan_alloc_bytes\": %.1f, "
+                    "\"waiter_rss_bytes\": %.1f, \"waiter_alloc_bytes\": %.1f, \"sem_bytes\": %zu, "
+                    "\"create_ns\": %llu, \"park_ns\": %llu, \"teardown_ns\": %llu}", r.chan_rss, r.chan_alloc,
+                    r.waiter_rss, r.waiter_alloc, sizeof(sem_t), (unsigned long long)r.create_ns,
+                    (unsigned long long)r.park_ns, (unsigned long long)r.teardown_ns);
+                g_bench.nresults++;
+            }
+        }
+    }
+
+    bench_finish();
+    return 0;
+}
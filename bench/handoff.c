@@ -0,0 +1,119 @@
+// Handoff latency benchmark: several receivers pinned across the machine's caches park on one channel, and a sender
+// pinned to CPU 0 hands each of them a timestamped value. Reports the sender-to-receiver handoff latency, and how often
+// the woken receiver shared an L2/L3 with the sender. Compare against a build without cache-locality-aware wakeups:
+//
+//   $ ./bench handoff.c
+//   $ CFLAGS=-DEB_CHAN_WAKE_LOCALITY=0 ./bench handoff.c
+//
+// Usage: handoff [rounds] [receivers]
+
+#include "benchglue.h"
+
+#define MAX_RECEIVERS 64
+
+static size_t g_rounds = 2000;
+static size_t g_nreceivers = 8;
+
+/* Returns the first CPU sharing the L3 (cache index 3, falling back to 2) with 'cpu' */
+static int l3_id(int cpu) {
+    for (int idx = 3; idx >= 2; idx--) {
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", cpu, idx);
+        FILE *f = fopen(path, "r");
+        if (f) {
+            int id = -1;
+            if (fscanf(f, "%d", &id) != 1) {
+                id = -1;
+            }
+            fclose(f);
+            return id;
+        }
+    }
+    return -1;
+}
+
+typedef struct {
+    eb_chan c;
+    eb_chan done;
+    int cpu;
+} receiver_args;
+
+static void *receiver(void *arg) {
+    receiver_args *args = arg;
+    bench_pin(args->cpu);
+    for (;;) {
+        const void *val;
+        if (eb_chan_recv(args->c, &val) != eb_chan_res_ok) {
+            break;
+        }
+        uint64_t latency = bench_now_ns() - (uint64_t)(uintptr_t)val;
+        /* Report the latency and which receiver was woken */
+        eb_chan_res res = eb_chan_send(args->done, (const void *)(uintptr_t)latency);
+        assert(res == eb_chan_res_ok);
+        res = eb_chan_send(args->done, (const void *)args);
+        assert(res == eb_chan_res_ok);
+    }
+    return NULL;
+}
+
+int main(int argc, const char *argv[]) {
+    if (argc > 1) {
+        g_rounds = strtoull(argv[1], NULL, 10);
+    }
+    if (argc > 2) {
+        g_nreceivers = strtoull(argv[2], NULL, 10);
+    }
+    assert(g_nreceivers > 0 && g_nreceivers <= MAX_RECEIVERS);
+
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int sender_cpu = 0;
+    int sender_l3 = l3_id(sender_cpu);
+
+    /* Spread the receivers over every CPU except the sender's (when possible), so that some share its cache and some don't */
+    eb_chan c = eb_chan_create(0);
+    eb_chan done = eb_chan_create(0);
+    receiver_args args[MAX_RECEIVERS];
+    pthread_t threads[MAX_RECEIVERS];
+    for (size_t i = 0; i < g_nreceivers; i++) {
+        int cpu = (ncpus > 1 ? 1 + (int)(i % (size_t)(ncpus - 1)) : 0);
+        args[i] = (receiver_args){.c = c, .done = done, .cpu = cpu};
+        int err = pthread_create(&threads[i], NULL, receiver, &args[i]);
+        assert(!err);
+    }
+
+    bench_pin(sender_cpu);
+    uint64_t *latencies = calloc(g_rounds, sizeof(*latencies));
+    size_t near = 0;
+    for (size_t i = 0; i < g_rounds; i++) {
+        /* Give every receiver time to park */
+        usleep(200);
+
+        eb_chan_res res = eb_chan_send(c, (const void *)(uintptr_t)bench_now_ns());
+        assert(res == eb_chan_res_ok);
+        const void *latency, *woken;
+        res = eb_chan_recv(done, &latency);
+        assert(res == eb_chan_res_ok);
+        res = eb_chan_recv(done, &woken);
+        assert(res == eb_chan_res_ok);
+        latencies[i] = (uint64_t)(uintptr_t)latency;
+        near += (l3_id(((const receiver_args *)woken)->cpu) == sender_l3);
+    }
+
+    eb_chan_close(c);
+    for (size_t i = 0; i < g_nreceivers; i++) {
+        int err = pthread_join(threads[i], NULL);
+        assert(!err);
+    }
+
+    qsort(latencies, g_rounds, sizeof(*latencies), bench_cmp_u64);
+    uint64_t sum = 0;
+    for (size_t i = 0; i < g_rounds; i++) {
+        sum += latencies[i];
+    }
+    printf("handoff: receivers=%zu rounds=%zu mean_ns=%.0f p50_ns=%llu p99_ns=%llu shared_cache_wakeups=%.1f%%\n",
+        g_nreceivers, g_rounds, (double)sum / g_rounds, (unsigned long long)latencies[g_rounds / 2],
+        (unsigned long long)latencies[(g_rounds * 99) / 100], (100.0 * near) / g_rounds);
+
+    free(latencies);
+    return 0;
+}
@@ -0,0 +1,165 @@
+// Microbenchmarks of the individual channel operations, across 1..2×ncpus threads:
+//
+//   buffered     Producers send through a buffered channel to consumers (a single thread sends and receives)
+//   unbuffered   Producers hand values to consumers through an unbuffered channel
+//   try          Every thread alternates _try_send() and _try_recv() on a shared buffered channel
+//   select       Every thread sends to one of 'width' shared buffered channels, then selects to receive from all of them
+//   close        Every thread creates, closes and releases unbuffered channels
+//
+// Builds with EB_CHAN_BUFFERED_ONLY=1 skip the unbuffered case, and close buffered channels instead.
+//
+// Reports ns/op and ops/sec, as the median of the repetitions (see benchglue.h for the common options):
+//
+//   $ ./bench micro.c -- --json=micro.json
+//
+// Usage: micro [--ops=N] [--threads=N] [common options]
+
+#include "benchglue.h"
+
+#define MAX_WIDTH 8
+#define BUF_CAP 64
+
+typedef struct {
+    size_t nthreads;
+    size_t ops;
+    size_t nproducers;
+    int producers_left;
+    eb_chan chans[MAX_WIDTH];
+    size_t width;
+    size_t cap;
+} run;
+
+/* Returns thread idx's share of 'n' ops split across 'k' threads */
+static size_t share(size_t n, size_t k, size_t idx) {
+    return (n / k) + (idx < n % k);
+}
+
+static void producer_consumer(void *arg, size_t idx) {
+    run *r = arg;
+    eb_chan c = r->chans[0];
+    if (r->nthreads == 1) {
+        for (size_t i = 0; i < r->ops; i++) {
+            eb_chan_res res = eb_chan_send(c, NULL);
+            assert(res == eb_chan_res_ok);
+            res = eb_chan_recv(c, NULL);
+            assert(res == eb_chan_res_ok);
+        }
+    } else if (idx < r->nproducers) {
+        size_t n = share(r->ops, r->nproducers, idx);
+        for (size_t i = 0; i < n; i++) {
+            eb_chan_res res = eb_chan_send(c, NULL);
+            assert(res == eb_chan_res_ok);
+        }
+        /* The last producer closes the channel, which stops the consumers */
+        if (!__sync_sub_and_fetch(&r->producers_left, 1)) {
+            eb_chan_close(c);
+        }
+    } else {
+        while (eb_chan_recv(c, NULL) == eb_chan_res_ok);
+    }
+}
+
+static void try_ops(void *arg, size_t idx) {
+    run *r = arg;
+    size_t n = share(r->ops, r->nthreads, idx);
+    for (size_t i = 0; i < n; i++) {
+        if (i & 1) {
+            eb_chan_try_recv(r->chans[0], NULL);
+        } else {
+            eb_chan_try_send(r->chans[0], NULL);
+        }
+    }
+}
+
+static void select_ops(void *arg, size_t idx) {
+    run *r = arg;
+    eb_chan_op ops[MAX_WIDTH];
+    eb_chan_op *opptrs[MAX_WIDTH];
+    for (size_t i = 0; i < r->width; i++) {
+        ops[i] = eb_chan_op_recv(r->chans[i]);
+        opptrs[i] = &ops[i];
+    }
+
+    /* Each thread has at most one value in flight, so the sends never block */
+    size_t n = share(r->ops, r->nthreads, idx);
+    for (size_t i = 0; i < n; i++) {
+        eb_chan_res res = eb_chan_send(r->chans[(idx + i) % r->width], NULL);
+        assert(res == eb_chan_res_ok);
+        eb_chan_op *op = eb_chan_select_list(eb_nsec_forever, opptrs, r->width);
+        assert(op);
+    }
+}
+
+static void close_ops(void *arg, size_t idx) {
+    run *r = arg;
+    size_t n = share(r->ops, r->nthreads, idx);
+    for (size_t i = 0; i < n; i++) {
+        eb_chan c = eb_chan_create(r->cap);
+        assert(c);
+        eb_chan_close(c);
+        eb_chan_release(c);
+    }
+}
+
+static void run_case(const char *name, bench_thread_fn fn, size_t nthreads, size_t width, size_t cap, size_t ops) {
+    if (!bench_selected(name)) {
+        return;
+    }
+
+    uint64_t elapsed[BENCH_MAX_REPS];
+    for (size_t rep = 0; rep < g_bench.warmup + g_bench.reps; rep++) {
+        run r = {
+            .nthreads = nthreads,
+            .ops = ops,
+            .nproducers = (nthreads > 1 ? nthreads / 2 : 1),
+            .width = width,
+            .cap = cap,
+        };
+        r.producers_left = (int)r.nproducers;
+        for (size_t i = 0; i < width; i++) {
+            r.chans[i] = eb_chan_create(cap);
+            assert(r.chans[i]);
+        }
+
+        uint64_t t = bench_parallel(nthreads, fn, &r);
+        if (rep >= g_bench.warmup) {
+            elapsed[rep - g_bench.warmup] = t;
+        }
+
+        for (size_t i = 0; i < width; i++) {
+            eb_chan_release(r.chans[i]);
+        }
+    }
+
+    char params[128];
+    snprintf(params, sizeof(params), "threads=%zu,width=%zu,cap=%zu", nthreads, width, cap);
+    bench_report(name, params, ops, elapsed, g_bench.reps);
+}
+
+int main(int argc, const char *argv[]) {
+    bench_init(argc, argv);
+    size_t ops = bench_arg_size(argc, argv, "--ops=", 1000000);
+    size_t max_threads = bench_arg_size(argc, argv, "--threads=", 2 * bench_ncpus());
+    assert(max_threads > 0 && max_threads <= BENCH_MAX_THREADS);
+
+    /* 1, 2, 4, ... threads, up to and including 'max_threads' */
+    for (size_t nthreads = 1;; nthreads = (nthreads * 2 < max_threads ? nthreads * 2 : max_threads)) {
+        size_t cap = (nthreads > BUF_CAP ? nthreads : BUF_CAP);
+        run_case("buffered", producer_consumer, nthreads, 1, cap, ops);
+        if (nthreads > 1 && !EB_CHAN_BUFFERED_ONLY) {
+            run_case("unbuffered", producer_consumer, nthreads, 1, 0, ops);
+        }
+        run_case("try", try_ops, nthreads, 1, cap, ops);
+        for (size_t width = 1; width <= MAX_WIDTH; width *= 2) {
+            run_case("select", select_ops, nthreads, width, cap, ops);
+        }
+        run_case("close", close_ops, nthreads, 1, (EB_CHAN_BUFFERED_ONLY ? 1 : 0), ops / 10);
+
+        if (nthreads == max_threads) {
+            break;
+        }
+    }
+
+    bench_finish();
+    return 0;
+}
@@ -0,0 +1,113 @@
+// Cross-socket benchmark: a producer and a consumer pinned to different NUMA nodes stream values through a buffered
+// channel, comparing the channel's placement (default, producer's node, consumer's node, first consumer).
+//
+// Usage: numa [iterations] [capacity]
+
+#include "benchglue.h"
+
+static size_t g_iterations = 1000000;
+static size_t g_capacity = 64;
+
+/* Returns the first CPU of NUMA node 'node', or -1 if the node doesn't exist */
+static int node_first_cpu(int node) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return (node == 0 ? 0 : -1);
+    }
+
+    int cpu = -1;
+    if (fscanf(f, "%d", &cpu) != 1) {
+        cpu = -1;
+    }
+    fclose(f);
+    return cpu;
+}
+
+typedef struct {
+    eb_chan c;
+    int cpu;
+} consumer_args;
+
+static void *consumer(void *arg) {
+    consumer_args *args = arg;
+    bench_pin(args->cpu);
+    for (size_t i = 0; i < g_iterations; i++) {
+        eb_chan_res res = eb_chan_recv(args->c, NULL);
+        assert(res == eb_chan_res_ok);
+    }
+    return NULL;
+}
+
+typedef enum {
+    placement_default,
+    placement_producer_node,
+    placement_consumer_node,
+    placement_first_consumer,
+} placement;
+
+static const char *placement_name(placement p) {
+    switch (p) {
+        case placement_default: return "default";
+        case placement_producer_node: return "producer-node";
+        case placement_consumer_node: return "consumer-node";
+        case placement_first_consumer: return "first-consumer";
+    }
+    return "?";
+}
+
+static double run(placement p, int producer_node, int consumer_node) {
+    int producer_cpu = node_first_cpu(producer_node);
+    int consumer_cpu = node_first_cpu(consumer_node);
+
+    /* Create the channel from the producer's CPU, so that the default (first-touch) placement is the producer's node */
+    bench_pin(producer_cpu);
+    eb_chan c = NULL;
+    switch (p) {
+        case placement_default: c = eb_chan_create(g_capacity); break;
+        case placement_producer_node: c = eb_chan_create_on_node(g_capacity, producer_node); break;
+        case placement_consumer_node: c = eb_chan_create_on_node(g_capacity, consumer_node); break;
+        case placement_first_consumer: c = eb_chan_create_on_node(g_capacity, eb_chan_node_first_consumer); break;
+    }
+    assert(c);
+
+    consumer_args args = {.c = c, .cpu = consumer_cpu};
+    pthread_t t;
+    uint64_t start = bench_now_ns();
+    int err = pthread_create(&t, NULL, consumer, &args);
+    assert(!err);
+    for (size_t i = 0; i < g_iterations; i++) {
+        eb_chan_res res = eb_chan_send(c, (const void *)i);
+        assert(res == eb_chan_res_ok);
+    }
+    err = pthread_join(t, NULL);
+    assert(!err);
+    uint64_t elapsed = bench_now_ns() - start;
+
+    eb_chan_release(c);
+    return (double)elapsed / g_iterations;
+}
+
+int main(int argc, const char *argv[]) {
+    if (argc > 1) {
+        g_iterations = strtoull(argv[1], NULL, 10);
+    }
+    if (argc > 2) {
+        g_capacity = strtoull(argv[2], NULL, 10);
+    }
+
+    int consumer_node = 1;
+    if (node_first_cpu(consumer_node) < 0) {
+        printf("numa: only one NUMA node; producer and consumer share node 0\n");
+        consumer_node = 0;
+    }
+
+    for (placement p = placement_default; p <= placement_first_consumer; p++) {
+        double ns = run(p, 0, consumer_node);
+        printf("numa: placement=%-14s producer_node=0 consumer_node=%d capacity=%zu ns/op=%.1f\n",
+            placement_name(p), consumer_node, g_capacity, ns);
+    }
+
+    return 0;
+}
@@ -0,0 +1,186 @@
+// Round-trip latency benchmark: two threads bounce a token over a pair of channels (unbuffered, and buffered with a
+// capacity of 1), and every round trip is timed. Reports min/p50/p90/p99/p99.9/max for each placement of the two
+// threads: the same CPU, sibling hyperthreads, different cores of the same socket, and different sockets. Placements
+// that the machine doesn't have are skipped.
+//
+// The spin-vs-park configuration is chosen through the EB_CHAN_SPIN_ATTEMPTS environment variable (see
+// eb_chan_config_get()):
+//
+//   $ ./bench pingpong.c                                           # mixed: spin, then park
+//   $ EB_CHAN_SPIN_ATTEMPTS=0 ./bench pingpong.c                   # park-only
+//   $ EB_CHAN_SPIN_ATTEMPTS=1000000000 ./bench pingpong.c          # spin-only
+//
+// Usage: pingpong [--rounds=N] [common options]
+
+#include "benchglue.h"
+
+/* Returns the name of the configured spin-vs-park mode */
+static const char *mode() {
+    eb_chan_config config;
+    eb_chan_config_get(&config);
+    return (!config.spin_attempts ? "park" : (config.spin_attempts >= 1000000 ? "spin" : "mixed"));
+}
+
+/* Reads the integer in /sys/devices/system/cpu/cpu<cpu>/topology/<name>, or returns -1 */
+static int topology_id(int cpu, const char *name) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+
+    int id = -1;
+    if (fscanf(f, "%d", &id) != 1) {
+        id = -1;
+    }
+    fclose(f);
+    return id;
+}
+
+typedef enum {
+    placement_same_cpu,
+    placement_sibling,
+    placement_same_socket,
+    placement_cross_socket,
+    placement_count
+} placement;
+
+static const char *const k_placement_names[placement_count] = {"same-cpu", "sibling", "same-socket", "cross-socket"};
+
+/* Returns a CPU that has placement 'p' relative to 'cpu', or -1 if there isn't one */
+static int partner_cpu(int cpu, placement p) {
+    if (p == placement_same_cpu) {
+        return cpu;
+    }
+
+    int package = topology_id(cpu, "physical_package_id");
+    int core = topology_id(cpu, "core_id");
+    if (package < 0 || core < 0) {
+        return -1;
+    }
+    for (int other = 0; other < (int)bench_ncpus(); other++) {
+        int other_package = topology_id(other, "physical_package_id");
+        int other_core = topology_id(other, "core_id");
+        if (other == cpu || other_package < 0 || other_core < 0) {
+            continue;
+        }
+        bool same_package = (other_package == package);
+        bool same_core = (same_package && other_core == core);
+        if ((p == placement_sibling && same_core) ||
+            (p == placement_same_socket && same_package && !same_core) ||
+            (p == placement_cross_socket && !same_package)) {
+            return other;
+        }
+    }
+    return -1;
+}
+
+typedef struct {
+    eb_chan ping;
+    eb_chan pong;
+    int cpu;
+} ponger_args;
+
+/* Returns every token received on 'ping' via 'pong', until 'ping' is closed */
+static void *ponger(void *arg) {
+    ponger_args *a = arg;
+    bench_pin(a->cpu);
+    const void *token;
+    while (eb_chan_recv(a->ping, &token) == eb_chan_res_ok) {
+        eb_chan_res res = eb_chan_send(a->pong, token);
+        assert(res == eb_chan_res_ok);
+    }
+    return NULL;
+}
+
+/* Bounces 'rounds' round trips from a thread on 'cpu_a' to one on 'cpu_b' (-1 for unpinned threads), storing the
+   round-trip times in 'samples' (if non-NULL) */
+static void pingpong(size_t cap, int cpu_a, int cpu_b, size_t rounds, uint64_t samples[]) {
+    ponger_args args = {.ping = eb_chan_create(cap), .pong = eb_chan_create(cap), .cpu = cpu_b};
+    assert(args.ping && args.pong);
+    bench_perf_begin();
+    pthread_t thread;
+    int err = pthread_create(&thread, NULL, ponger, &args);
+    assert(!err);
+    if (cpu_a >= 0) {
+        bench_pin(cpu_a);
+    }
+
+    for (size_t i = 0; i < rounds; i++) {
+        const void *token;
+        uint64_t start = bench_now_ns();
+        eb_chan_res res = eb_chan_send(args.ping, (const void *)(uintptr_t)i);
+        assert(res == eb_chan_res_ok);
+        res = eb_chan_recv(args.pong, &token);
+        assert(res == eb_chan_res_ok);
+        uint64_t end = bench_now_ns();
+        assert((uintptr_t)token == i);
+        if (samples) {
+            samples[i] = end - start;
+        }
+    }
+
+    eb_chan_close(args.ping);
+    err = pthread_join(thread, NULL);
+    assert(!err);
+    bench_perf_end();
+    eb_chan_release(args.ping);
+    eb_chan_release(args.pong);
+}
+
+int main(int argc, const char *argv[]) {
+    bench_init(argc, argv);
+    size_t rounds = bench_arg_size(argc, argv, "--rounds=", 100000);
+    assert(rounds > 0);
+    /* --warmup counts repetitions elsewhere; here each unit of warm-up is a tenth of the measured rounds */
+    size_t warmup = g_bench.warmup * (rounds / 10);
+    uint64_t *samples = malloc(rounds * sizeof(*samples));
+    assert(samples);
+
+    const struct {
+        const char *name;
+        size_t cap;
+    } k_chans[] = {{"unbuffered", 0}, {"buffered", 1}};
+
+    for (size_t c = 0; c < sizeof(k_chans) / sizeof(*k_chans); c++) {
+        for (placement p = 0; p < placement_count; p++) {
+            char name[64];
+            snprintf(name, sizeof(name), "pingpong/%s/%s/%s", k_chans[c].name, mode(),
+                (g_bench.pin ? k_placement_names[p] : "unpinned"));
+            if (!bench_selected(name)) {
+                continue;
+            }
+
+            int cpu_a = (g_bench.pin ? 0 : -1);
+            int cpu_b = (g_bench.pin ? partner_cpu(0, p) : -1);
+            if (g_bench.pin && cpu_b < 0) {
+                printf("%-40s skipped (no such CPU pair)\n", name);
+                continue;
+            }
+            if (g_bench.pin && cpu_a == cpu_b && !strcmp(mode(), "spin")) {
+                /* Two spinning threads sharing a CPU only make progress when the scheduler preempts one of them */
+                printf("%-40s skipped (spin-only threads sharing a CPU)\n", name);
+                continue;
+            }
+
+            if (warmup) {
+                pingpong(k_chans[c].cap, cpu_a, cpu_b, warmup, NULL);
+            }
+            pingpong(k_chans[c].cap, cpu_a, cpu_b, rounds, samples);
+
+            char params[128];
+            snprintf(params, sizeof(params), "cap=%zu,cpu_a=%d,cpu_b=%d", k_chans[c].cap, cpu_a, cpu_b);
+            bench_report_latency(name, params, samples, rounds);
+
+            /* Without pinning, every placement is the same */
+            if (!g_bench.pin) {
+                break;
+            }
+        }
+    }
+
+    free(samples);
+    bench_finish();
+    return 0;
+}
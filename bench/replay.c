@@ -0,0 +1,276 @@
+// Replays a traffic capture (see eb_chan_capture_start()) against this build of the library: recreates the captured
+// channels, and runs one thread per captured thread that issues the same ops at the same times. Reports, per channel,
+// how long the ops waited when captured and when replayed, and the buffer depth, so that tuning changes can be compared
+// against real traffic shapes. For example, to compare the default spin budget against parking immediately:
+//
+//   $ ./bench replay.c -- /tmp/capture.bin
+//   $ EB_CHAN_SPIN_ATTEMPTS=0 ./bench replay.c -- /tmp/capture.bin
+//
+// Ops from selects are replayed as single sends/recvs. A replayed op that can't complete within --timeout-ms (e.g. a
+// receive whose value was sent before the capture started) is abandoned and counted as unmatched.
+//
+// Usage: replay <capture> [--speed=F] [--timeout-ms=N] [common options]
+// where --speed scales the arrival rate (2 replays twice as fast).
+
+#include "benchglue.h"
+
+#define MAX_CHANS 65536
+
+typedef struct {
+    uint64_t time;
+    uint32_t wait;
+    uint32_t chan;
+    uint32_t depth;
+    uint16_t thread;
+    uint8_t type;
+    uint8_t flags;
+    /* Filled in by the replay */
+    uint64_t replay_wait;
+    uint32_t replay_depth;
+    bool unmatched;
+} record;
+
+typedef struct {
+    bool defined;
+    size_t cap;
+    char name[256];
+    eb_chan c;
+} chan_info;
+
+static record *g_records = NULL;
+static size_t g_nrecords = 0;
+static chan_info *g_chans = NULL;
+static double g_speed = 1;
+static eb_nsec g_timeout = 1000 * eb_nsec_per_msec;
+static uint64_t g_start = 0;
+
+static uint64_t get(const uint8_t *p, size_t n) {
+    uint64_t v = 0;
+    for (size_t i = n; i > 0; i--) {
+        v = (v << 8) | p[i - 1];
+    }
+    return v;
+}
+
+/* Reads the capture at 'path' into g_records and g_chans */
+static void load(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "replay: can't open %s\n", path);
+        exit(1);
+    }
+    char magic[8];
+    if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) || memcmp(magic, EB_CHAN_CAPTURE_MAGIC, sizeof(magic))) {
+        fprintf(stderr, "replay: %s isn't a capture\n", path);
+        exit(1);
+    }
+
+    size_t cap = 1024;
+    g_records = malloc(cap * sizeof(*g_records));
+    g_chans = calloc(MAX_CHANS, sizeof(*g_chans));
+    assert(g_records && g_chans);
+    uint8_t b[EB_CHAN_CAPTURE_RECORD_SIZE];
+    while (fread(b, 1, sizeof(b), f) == sizeof(b)) {
+        record r = {
+            .time = get(b, 8), .wait = (uint32_t)get(b + 8, 4), .chan = (uint32_t)get(b + 12, 4),
+            .depth = (uint32_t)get(b + 16, 4), .thread = (uint16_t)get(b + 20, 2), .type = b[22], .flags = b[23],
+        };
+        assert(r.chan < MAX_CHANS);
+        if (r.type == eb_chan_capture_define) {
+            chan_info *c = &g_chans[r.chan];
+            c->defined = true;
+            c->cap = r.depth;
+            size_t name_len = fread(c->name, 1, r.thread, f);
+            assert(name_len == r.thread);
+            c->name[r.thread] = 0;
+            continue;
+        }
+
+        if (g_nrecords == cap) {
+            cap *= 2;
+            g_records = realloc(g_records, cap * sizeof(*g_records));
+            assert(g_records);
+        }
+        g_records[g_nrecords++] = r;
+    }
+    fclose(f);
+}
+
+/* Sleeps until 'ns' after the replay started, spinning for the last stretch */
+static void wait_until(uint64_t ns) {
+    uint64_t deadline = g_start + (uint64_t)(ns / g_speed);
+    for (uint64_t now = bench_now_ns(); now < deadline; now = bench_now_ns()) {
+        uint64_t left = deadline - now;
+        if (left > 100000) {
+            struct timespec ts = {.tv_sec = 0, .tv_nsec = (long)(left - 50000)};
+            nanosleep(&ts, NULL);
+        }
+    }
+}
+
+/* Replays the ops of captured thread 'idx', in order */
+static void replay_thread(void *arg, size_t idx) {
+    (void)arg;
+    for (size_t i = 0; i < g_nrecords; i++) {
+        record *r = &g_records[i];
+        if (r->thread != idx) {
+            continue;
+        }
+
+        wait_until(r->time);
+        eb_chan c = g_chans[r->chan].c;
+        bool try = (r->flags & eb_chan_capture_try);
+        uint64_t start = bench_now_ns();
+        if (r->type == eb_chan_capture_close) {
+            eb_chan_close(c);
+        } else {
+            eb_chan_op op = (r->type == eb_chan_capture_send ? eb_chan_op_send(c, NULL) : eb_chan_op_recv(c));
+            r->unmatched = !eb_chan_select((try ? eb_nsec_zero : g_timeout), &op);
+            /* The op should complete the same way it did when it was captured */
+            r->unmatched = (r->unmatched || ((op.res == eb_chan_res_closed) != !!(r->flags & eb_chan_capture_closed)));
+        }
+        r->replay_wait = bench_now_ns() - start;
+        r->replay_depth = (uint32_t)eb_chan_buf_len(c);
+    }
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+/* Reports the captured and replayed waits and depths of channel 'id' */
+static void report_chan(uint32_t id) {
+    size_t n = 0;
+    for (size_t i = 0; i < g_nrecords; i++) {
+        n += (g_records[i].chan == id && g_records[i].type != eb_chan_capture_close);
+    }
+    if (!n) {
+        return;
+    }
+
+    uint32_t *waits = malloc(n * sizeof(*waits));
+    uint64_t *replay_waits = malloc(n * sizeof(*replay_waits));
+    assert(waits && replay_waits);
+    size_t j = 0, unmatched = 0;
+    uint32_t depth_max = 0, replay_depth_max = 0;
+    for (size_t i = 0; i < g_nrecords; i++) {
+        record *r = &g_records[i];
+        if (r->chan != id || r->type == eb_chan_capture_close) {
+            continue;
+        }
+        waits[j] = r->wait;
+        replay_waits[j] = r->replay_wait;
+        j++;
+        unmatched += r->unmatched;
+        depth_max = (r->depth > depth_max ? r->depth : depth_max);
+        replay_depth_max = (r->replay_depth > replay_depth_max ? r->replay_depth : replay_depth_max);
+    }
+    qsort(waits, n, sizeof(*waits), cmp_u32);
+    qsort(replay_waits, n, sizeof(*replay_waits), bench_cmp_u64);
+
+    chan_info *c = &g_chans[id];
+    char name[300];
+    snprintf(name, sizeof(name), "%s", (c->name[0] ? c->name : ""));
+    if (!name[0]) {
+        snprintf(name, sizeof(name), "#%u", id);
+    }
+    uint32_t p50 = waits[n / 2], p99 = waits[(n * 99) / 100];
+    uint64_t replay_p50 = replay_waits[n / 2], replay_p99 = replay_waits[(n * 99) / 100];
+    printf("%-24s cap=%-6zu ops=%-8zu wait_p50=%u/%llu wait_p99=%u/%llu depth_max=%u/%u unmatched=%zu\n", name, c->cap,
+        n, p50, (unsigned long long)replay_p50, p99, (unsigned long long)replay_p99, depth_max, replay_depth_max,
+        unmatched);
+
+    if (g_bench.json) {
+        fprintf(g_bench.json, "%s\n  {\"name\": \"replay\", \"chan\": \"", (g_bench.nresults ? "," : ""));
+        /* Escape the channel's name */
+        for (const char *p = name; *p; p++) {
+            if (*p == '"' || *p == '\\') {
+                fprintf(g_bench.json, "\\%c", *p);
+            } else if ((unsigned char)*p < 0x20) {
+                fprintf(g_bench.json, "\\u%04x", *p);
+            } else {
+                fputc(*p, g_bench.json);
+            }
+        }
+        char params[128];
+        snprintf(params, sizeof(params), "cap=%zu,ops=%zu,unmatched=%zu", c->cap, n, unmatched);
+        fprintf(g_bench.json, "\"");
+        bench_json_params(params);
+        fprintf(g_bench.json, ", \"captured_wait_p50_ns\": %u, \"replayed_wait_p50_ns\": %llu, "
+            "\"captured_wait_p99_ns\": %u, \"replayed_wait_p99_ns\": %llu, \"captured_depth_max\": %u, "
+            "\"replayed_depth_max\": %u}", p50, (unsigned long long)replay_p50, p99, (unsigned long long)replay_p99,
+            depth_max, replay_depth_max);
+        g_bench.nresults++;
+    }
+
+    free(waits);
+    free(replay_waits);
+}
+
+int main(int argc, const char *argv[]) {
+    bench_init(argc, argv);
+    const char *path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2)) {
+            path = argv[i];
+        }
+    }
+    if (!path) {
+        fprintf(stderr, "Usage: replay <capture> [--speed=F] [--timeout-ms=N] [common options]\n");
+        return 1;
+    }
+    const char *speed = bench_arg(argc, argv, "--speed=");
+    g_speed = (speed ? strtod(speed, NULL) : 1);
+    g_timeout = bench_arg_size(argc, argv, "--timeout-ms=", 1000) * eb_nsec_per_msec;
+    assert(g_speed > 0);
+
+    load(path);
+    size_t nthreads = 0;
+    uint64_t duration = 0;
+    for (size_t i = 0; i < g_nrecords; i++) {
+        record *r = &g_records[i];
+        nthreads = (r->thread + 1u > nthreads ? r->thread + 1u : nthreads);
+        duration = (r->time + r->wait > duration ? r->time + r->wait : duration);
+    }
+    if (nthreads > BENCH_MAX_THREADS) {
+        fprintf(stderr, "replay: the capture has %zu threads; at most %d are supported\n", nthreads, BENCH_MAX_THREADS);
+        return 1;
+    }
+
+    /* Recreate the channels */
+    for (size_t i = 0; i < g_nrecords; i++) {
+        chan_info *c = &g_chans[g_records[i].chan];
+        if (!c->c) {
+            if (!c->defined) {
+                fprintf(stderr, "replay: channel #%u isn't defined; assuming it's unbuffered\n", g_records[i].chan);
+            }
+            c->c = eb_chan_create(c->cap);
+            assert(c->c);
+            if (c->name[0]) {
+                bool named = eb_chan_set_name(c->c, c->name);
+                assert(named);
+            }
+        }
+    }
+
+    printf("%zu ops on %zu threads over %.1fms, replayed at %gx (waits in ns, captured/replayed)\n", g_nrecords,
+        nthreads, duration / 1e6, g_speed);
+    if (nthreads) {
+        g_start = bench_now_ns();
+        uint64_t elapsed = bench_parallel(nthreads, replay_thread, NULL);
+        printf("replayed in %.1fms\n", elapsed / 1e6);
+    }
+
+    for (uint32_t id = 0; id < MAX_CHANS; id++) {
+        if (g_chans[id].c) {
+            report_chan(id);
+            eb_chan_release(g_chans[id].c);
+        }
+    }
+
+    free(g_records);
+    free(g_chans);
+    bench_finish();
+    return 0;
+}
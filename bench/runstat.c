@@ -0,0 +1,43 @@
+// Runs a command and reports its wall time, CPU time (user + system) and peak RSS, as measured by wait4().
+//
+// Usage: runstat <label> <command> [arguments...]
+
+#include "benchglue.h"
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+int main(int argc, const char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: runstat <label> <command> [arguments...]\n");
+        return 2;
+    }
+
+    uint64_t start = bench_now_ns();
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (!pid) {
+        execvp(argv[2], (char *const *)&argv[2]);
+        perror("execvp");
+        _exit(127);
+    }
+
+    int status = 0;
+    struct rusage usage;
+    pid_t waited = wait4(pid, &status, 0, &usage);
+    assert(waited == pid);
+    uint64_t wall = bench_now_ns() - start;
+
+    uint64_t cpu_us = ((uint64_t)usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 + usage.ru_utime.tv_usec +
+        usage.ru_stime.tv_usec;
+    #if __APPLE__
+        /* Darwin reports ru_maxrss in bytes rather than kilobytes */
+        long maxrss_kb = usage.ru_maxrss / 1024;
+    #else
+        long maxrss_kb = usage.ru_maxrss;
+    #endif
+
+    bool ok = (WIFEXITED(status) && !WEXITSTATUS(status));
+    printf("%-32s wall_ms=%10.1f cpu_ms=%10.1f maxrss_kb=%8ld%s\n", argv[1], wall / 1e6, cpu_us / 1e3, maxrss_kb,
+        (ok ? "" : " (failed)"));
+    return (ok ? 0 : 1);
+}
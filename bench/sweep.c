@@ -0,0 +1,263 @@
+// Scalability sweep: producers send through 'chans' channels of capacity 'cap' to consumers that each select over
+// 'width' of them, for every combination of the producer count, consumer count, channel count, capacity and select
+// width. Each (chans, cap, width) combination prints a producers × consumers matrix of throughput (Mops/sec) and CPU
+// time per op (ns), where an op is one value passing from a producer to a consumer:
+//
+//   - A cell is marked '!' when its throughput is more than 10% below that of the cell with one step fewer producers
+//     or consumers, i.e. where adding threads made things worse
+//   - A cell is marked '*' when it's oversubscribed (more threads than CPUs), which is where eb_spinlock and the spin
+//     loop in eb_chan_select_list() behave worst
+//
+// By default the thread counts go up to 2×ncpus per side, so the oversubscribed region is always covered:
+//
+//   $ ./bench sweep.c -- --producers=1,4 --chans=1,4 --json=sweep.json
+//
+// Usage: sweep [--ops=N] [--producers=LIST] [--consumers=LIST] [--chans=LIST] [--caps=LIST] [--widths=LIST]
+//              [common options]
+// where LIST is a comma-separated list of numbers.
+
+#include "benchglue.h"
+
+#define MAX_LIST 16
+#define MAX_CHANS 64
+#define DROP_THRESHOLD 0.9
+
+typedef struct {
+    size_t vals[MAX_LIST];
+    size_t len;
+} list;
+
+/* Parses the comma-separated list of option 'name', or returns 'def' */
+static list list_arg(int argc, const char *argv[], const char *name, list def) {
+    const char *v = bench_arg(argc, argv, name);
+    if (!v) {
+        return def;
+    }
+
+    list l = {.len = 0};
+    for (char *end = NULL; *v && l.len < MAX_LIST; v = (*end ? end + 1 : end)) {
+        l.vals[l.len++] = strtoull(v, &end, 10);
+        assert(end != v);
+    }
+    assert(l.len > 0);
+    return l;
+}
+
+/* Returns 1, 2, 4, ... up to and including 'max' */
+static list powers_of_two(size_t max) {
+    list l = {.len = 0};
+    for (size_t n = 1; l.len < MAX_LIST; n = (n * 2 < max ? n * 2 : max)) {
+        l.vals[l.len++] = n;
+        if (n == max) {
+            break;
+        }
+    }
+    return l;
+}
+
+typedef struct {
+    size_t nproducers;
+    size_t nchans;
+    size_t width;
+    size_t ops;
+    int producers_left;
+    eb_chan chans[MAX_CHANS];
+} run;
+
+static void worker(void *arg, size_t idx) {
+    run *r = arg;
+    if (idx < r->nproducers) {
+        /* Producers send their share of the ops round-robin over every channel */
+        size_t n = (r->ops / r->nproducers) + (idx < r->ops % r->nproducers);
+        for (size_t i = 0; i < n; i++) {
+            eb_chan_res res = eb_chan_send(r->chans[(idx + i) % r->nchans], NULL);
+            assert(res == eb_chan_res_ok);
+        }
+        /* The last producer closes every channel, which stops the consumers */
+        if (!__sync_sub_and_fetch(&r->producers_left, 1)) {
+            for (size_t i = 0; i < r->nchans; i++) {
+                eb_chan_close(r->chans[i]);
+            }
+        }
+    } else {
+        /* Consumers select over 'width' consecutive channels, dropping each one once it's closed and drained */
+        size_t consumer = idx - r->nproducers;
+        eb_chan_op ops[MAX_CHANS];
+        eb_chan_op *opptrs[MAX_CHANS];
+        size_t nops = r->width;
+        for (size_t i = 0; i < nops; i++) {
+            ops[i] = eb_chan_op_recv(r->chans[(consumer + i) % r->nchans]);
+            opptrs[i] = &ops[i];
+        }
+        while (nops) {
+            eb_chan_op *op = eb_chan_select_list(eb_nsec_forever, opptrs, nops);
+            assert(op);
+            if (op->res == eb_chan_res_closed) {
+                for (size_t i = 0; i < nops; i++) {
+                    if (opptrs[i] == op) {
+                        opptrs[i] = opptrs[--nops];
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+typedef struct {
+    bool valid;
+    double mops;
+    double cpu_ns;
+    double perf[bench_perf_count];
+    bool has_perf;
+} cell;
+
+/* Runs one case, returning its median throughput and CPU time per op */
+static cell run_case(size_t nproducers, size_t nconsumers, size_t nchans, size_t cap, size_t width, size_t ops) {
+    uint64_t elapsed[BENCH_MAX_REPS];
+    uint64_t cpu[BENCH_MAX_REPS];
+    for (size_t rep = 0; rep < g_bench.warmup + g_bench.reps; rep++) {
+        run r = {.nproducers = nproducers, .nchans = nchans, .width = width, .ops = ops};
+        r.producers_left = (int)nproducers;
+        for (size_t i = 0; i < nchans; i++) {
+            r.chans[i] = eb_chan_create(cap);
+            assert(r.chans[i]);
+        }
+
+        uint64_t cpu_start = bench_cpu_ns();
+        uint64_t t = bench_parallel(nproducers + nconsumers, worker, &r);
+        uint64_t c = bench_cpu_ns() - cpu_start;
+        if (rep >= g_bench.warmup) {
+            elapsed[rep - g_bench.warmup] = t;
+            cpu[rep - g_bench.warmup] = c;
+        }
+
+        for (size_t i = 0; i < nchans; i++) {
+            eb_chan_release(r.chans[i]);
+        }
+    }
+
+    qsort(elapsed, g_bench.reps, sizeof(*elapsed), bench_cmp_u64);
+    qsort(cpu, g_bench.reps, sizeof(*cpu), bench_cmp_u64);
+    cell x = {
+        .valid = true,
+        .mops = (1e3 * ops) / elapsed[g_bench.reps / 2],
+        .cpu_ns = (double)cpu[g_bench.reps / 2] / ops,
+    };
+    x.has_perf = bench_perf_per_op(ops, g_bench.reps, x.perf);
+    return x;
+}
+
+/* Prints the producers × consumers matrix of one (chans, cap, width) combination */
+static void print_matrix(const char *title, list producers, list consumers, cell cells[MAX_LIST][MAX_LIST]) {
+    size_t ncpus = bench_ncpus();
+    printf("\n%s: Mops/sec (cpu ns/op)\n%-10s", title, "prod\\cons");
+    for (size_t c = 0; c < consumers.len; c++) {
+        printf(" %18zu", consumers.vals[c]);
+    }
+    printf("\n");
+
+    for (size_t p = 0; p < producers.len; p++) {
+        printf("%-10zu", producers.vals[p]);
+        for (size_t c = 0; c < consumers.len; c++) {
+            cell *x = &cells[p][c];
+            if (!x->valid) {
+                printf(" %18s", "-");
+                continue;
+            }
+            /* Compare against the neighbors with fewer threads */
+            double fewer = 0;
+            if (p > 0 && cells[p - 1][c].valid) {
+                fewer = cells[p - 1][c].mops;
+            }
+            if (c > 0 && cells[p][c - 1].valid && cells[p][c - 1].mops > fewer) {
+                fewer = cells[p][c - 1].mops;
+            }
+            bool drop = (x->mops < DROP_THRESHOLD * fewer);
+            bool over = (producers.vals[p] + consumers.vals[c] > ncpus);
+
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%.2f (%.0f)%s%s", x->mops, x->cpu_ns, (drop ? "!" : ""), (over ? "*" : ""));
+            printf(" %18s", buf);
+        }
+        printf("\n");
+    }
+    fflush(stdout);
+}
+
+int main(int argc, const char *argv[]) {
+    bench_init(argc, argv);
+    size_t ops = bench_arg_size(argc, argv, "--ops=", 200000);
+    size_t ncpus = bench_ncpus();
+    list producers = list_arg(argc, argv, "--producers=", powers_of_two(2 * ncpus));
+    list consumers = list_arg(argc, argv, "--consumers=", powers_of_two(2 * ncpus));
+    list chans = list_arg(argc, argv, "--chans=", (list){.vals = {1, 4}, .len = 2});
+    list caps = list_arg(argc, argv, "--caps=", (list){.vals = {0, 64}, .len = 2});
+    list widths = list_arg(argc, argv, "--widths=", (list){.vals = {1, 4}, .len = 2});
+    assert(ops > 0);
+
+    for (size_t k = 0; k < chans.len; k++) {
+        for (size_t w = 0; w < widths.len; w++) {
+            size_t nchans = chans.vals[k];
+            size_t width = widths.vals[w];
+            assert(nchans > 0 && nchans <= MAX_CHANS);
+            /* A consumer can't select over more channels than there are */
+            if (!width || width > nchans) {
+                continue;
+            }
+
+            for (size_t b = 0; b < caps.len; b++) {
+                size_t cap = caps.vals[b];
+                char title[64];
+                snprintf(title, sizeof(title), "sweep/chans=%zu,cap=%zu,width=%zu", nchans, cap, width);
+                if (!bench_selected(title)) {
+                    continue;
+                }
+
+                cell cells[MAX_LIST][MAX_LIST] = {{{0}}};
+                bool any = false;
+                for (size_t p = 0; p < producers.len; p++) {
+                    for (size_t c = 0; c < consumers.len; c++) {
+                        size_t np = producers.vals[p], nc = consumers.vals[c];
+                        /* Every channel needs a consumer, or its producers would block forever */
+                        if (!np || !nc || np + nc > BENCH_MAX_THREADS || nc + width - 1 < nchans) {
+                            continue;
+                        }
+
+                        cells[p][c] = run_case(np, nc, nchans, cap, width, ops);
+                        any = true;
+                        /* The counters don't fit in the matrix, so they get a line per case */
+                        if (cells[p][c].has_perf) {
+                            printf("%s producers=%zu consumers=%zu:", title, np, nc);
+                            bench_perf_print(cells[p][c].perf);
+                            printf("\n");
+                        }
+                        if (g_bench.json) {
+                            char params[128];
+                            snprintf(params, sizeof(params), "producers=%zu,consumers=%zu,chans=%zu,cap=%zu,width=%zu",
+                                np, nc, nchans, cap, width);
+                            fprintf(g_bench.json, "%s\n  {\"name\": \"sweep\"", (g_bench.nresults ? "," : ""));
+                            bench_json_params(params);
+                            fprintf(g_bench.json, ", \"ops\": %zu, \"ops_per_sec\": %.1f, \"cpu_ns_per_op\": %.2f, "
+                                "\"oversubscribed\": %s", ops, 1e6 * cells[p][c].mops, cells[p][c].cpu_ns,
+                                (np + nc > ncpus ? "true" : "false"));
+                            if (cells[p][c].has_perf) {
+                                bench_perf_json(cells[p][c].perf);
+                            }
+                            fprintf(g_bench.json, "}");
+                            g_bench.nresults++;
+                        }
+                    }
+                }
+                if (any) {
+                    print_matrix(title, producers, consumers, cells);
+                }
+            }
+        }
+    }
+
+    printf("\n! = >%.0f%% slower than with fewer threads, * = oversubscribed (more threads than the %zu CPUs), "
+        "- = skipped (a channel would have no consumer)\n", 100 * (1 - DROP_THRESHOLD), ncpus);
+    bench_finish();
+    return 0;
+}
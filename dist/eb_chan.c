@@ -7,7 +7,19 @@
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdarg.h>
 #include <sched.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <pthread.h>
 // #######################################################
 // ## eb_assert.h
 // #######################################################
@@ -15,14 +27,15 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-#define eb_no_op
+/* Whether failed sanity checks go unchecked. eb_sanity_or_bail() still evaluates its condition (some have side effects,
+   like performing the op whose result is checked) but no longer aborts, so a failed sanity check leads to undefined
+   behavior. eb_assert_or_recover() still takes its recovery action without reporting, and eb_assert_or_bail() (used
+   for failed allocations, API misuse and strict mode) is unaffected. assert() follows NDEBUG. */
+#ifndef EB_CHAN_NO_ASSERT
+    #define EB_CHAN_NO_ASSERT 0
+#endif
 
-#define eb_assert_or_recover(cond, action) ({                                                                 \
-    if (!(cond)) {                                                                                            \
-        eb_assert_print("Assertion failed", #cond, __FILE__, (uintmax_t)__LINE__, __PRETTY_FUNCTION__);       \
-        action;                                                                                               \
-    }                                                                                                         \
-})
+#define eb_no_op
 
 #define eb_assert_or_bail(cond, msg) ({                                                        \
     if (!(cond)) {                                                                             \
@@ -31,6 +44,26 @@
     }                                                                                          \
 })
 
+#if EB_CHAN_NO_ASSERT
+    #define eb_assert_or_recover(cond, action) ({      \
+        if (__builtin_expect(!(cond), 0)) {            \
+            action;                                    \
+        }                                              \
+    })
+    
+    #define eb_sanity_or_bail(cond, msg) ((void)(cond))
+#else
+    #define eb_assert_or_recover(cond, action) ({                                                                 \
+        if (!(cond)) {                                                                                            \
+            eb_assert_print("Assertion failed", #cond, __FILE__, (uintmax_t)__LINE__, __PRETTY_FUNCTION__);       \
+            action;                                                                                               \
+        }                                                                                                         \
+    })
+    
+    /* Checks an internal invariant, which only fails if eb_chan (or a caller violating its contract) has a bug */
+    #define eb_sanity_or_bail(cond, msg) eb_assert_or_bail(cond, msg)
+#endif
+
 void eb_assert_print(const char *msg, const char *cond, const char *file, uintmax_t line, const char *func);
 // #######################################################
 // ## eb_assert.c
@@ -45,33 +78,53 @@ void eb_assert_print(const char *msg, const char *cond, const char *file, uintma
                     "  Function: %s\n", msg, cond, file, line, func);
 }
 // #######################################################
-// ## eb_port.h
+// ## eb_alloc.h
 // #######################################################
 
 #include <stddef.h>
-#include <stdbool.h>
 
-typedef struct eb_port *eb_port;
-
-eb_port eb_port_create();
-eb_port eb_port_retain(eb_port p);
-void eb_port_release(eb_port p);
+/* ## Functions */
+/* Returns a copy of the current global allocator, so that objects can remember the allocator that allocated them. */
+eb_chan_allocator eb_alloc_global();
 
-void eb_port_signal(eb_port p);
-bool eb_port_wait(eb_port p, eb_nsec timeout);
+/* Allocate/free memory via allocator 'a'. Every allocation is counted (see eb_chan_alloc_stats()). */
+void *eb_alloc(const eb_chan_allocator *a, size_t size);
+void *eb_alloc_zeroed(const eb_chan_allocator *a, size_t size);
+void *eb_realloc(const eb_chan_allocator *a, void *ptr, size_t old_size, size_t new_size);
+void eb_free(const eb_chan_allocator *a, void *ptr, size_t size);
 // #######################################################
-// ## eb_port.c
+// ## eb_alloc.c
 // #######################################################
 
 #include <stdlib.h>
-#include <assert.h>
-#include <errno.h>
 #include <string.h>
+#include <assert.h>
+// #######################################################
+// ## eb_atomic.h
+// #######################################################
+
+
+#define eb_atomic_add(ptr, delta) __sync_add_and_fetch(ptr, delta) /* Returns the new value */
+#define eb_atomic_compare_and_swap(ptr, old, new) __sync_bool_compare_and_swap(ptr, old, new)
+#define eb_atomic_barrier() __sync_synchronize()
+#define eb_atomic_add_relaxed(ptr, delta) __atomic_add_fetch(ptr, delta, __ATOMIC_RELAXED) /* Returns the new value; imposes no ordering */
+#define eb_atomic_load_relaxed(ptr) __atomic_load_n(ptr, __ATOMIC_RELAXED)
+#define eb_atomic_store_relaxed(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELAXED)
+#define eb_atomic_load_acquire(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define eb_atomic_store_release(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+// #######################################################
+// ## eb_spinlock.h
+// #######################################################
+
+#include <stdbool.h>
+#include <stdint.h>
 // #######################################################
 // ## eb_sys.h
 // #######################################################
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #if __MACH__
     #define EB_SYS_DARWIN 1
@@ -81,101 +134,108 @@ bool eb_port_wait(eb_port p, eb_nsec timeout);
     #error Unsupported system
 #endif
 
-/* ## Variables */
-/* Returns the number of logical cores on the machine. _init must be called for this to be valid! */
-size_t eb_sys_ncores;
+/* The maximum number of CPUs whose topology is tracked */
+#define EB_SYS_MAX_CPUS 1024
+/* The maximum number of NUMA nodes that are tracked */
+#define EB_SYS_MAX_NODES 64
+/* The interval at which the machine's state is re-evaluated (see eb_sys_ncores) */
+#define EB_SYS_REFRESH_INTERVAL (eb_nsec_per_sec)
 
-/* ## Functions */
-void eb_sys_init();
-// #######################################################
-// ## eb_sys.c
-// #######################################################
+/* Whether the system calls that eb_chan makes are counted (see eb_chan_syscall_stats()). Defining
+   EB_CHAN_SYSCALL_STATS=0 removes the counting entirely. */
+#ifndef EB_CHAN_SYSCALL_STATS
+    #define EB_CHAN_SYSCALL_STATS 1
+#endif
 
-// #######################################################
-// ## eb_atomic.h
-// #######################################################
+/* Whether the process is assumed to be able to use more than one core, which resolves the single-core checks on the hot
+   paths at compile time (see eb_sys_uniprocessor()). A build with EB_CHAN_ASSUME_MULTICORE=1 keeps working on a single
+   core, but it spins where it would otherwise yield, unless eb_chan_config.yield_policy says to yield. */
+#ifndef EB_CHAN_ASSUME_MULTICORE
+    #define EB_CHAN_ASSUME_MULTICORE 0
+#endif
 
+/* ## Types */
+/* The system calls that are counted */
+typedef enum {
+    eb_sys_call_sem_post,       /* sem_post()/semaphore_signal() */
+    eb_sys_call_sem_wait,       /* sem_wait()/semaphore_wait() */
+    eb_sys_call_sem_timedwait,  /* sem_timedwait()/semaphore_timedwait(), with a non-zero timeout */
+    eb_sys_call_sem_trywait,    /* sem_trywait()/semaphore_timedwait(), with a zero timeout */
+    eb_sys_call_yield,          /* sched_yield() */
+    eb_sys_call_op,             /* Not a system call: completed ops, which the system calls are reported relative to */
+    eb_sys_call_count
+} eb_sys_call;
 
-#define eb_atomic_add(ptr, delta) __sync_add_and_fetch(ptr, delta) /* Returns the new value */
-#define eb_atomic_compare_and_swap(ptr, old, new) __sync_bool_compare_and_swap(ptr, old, new)
-#define eb_atomic_barrier() __sync_synchronize()
+/* ## Variables */
+/* Returns the number of cores that the process can effectively use in parallel: the number of logical cores on the
+   machine, limited by the process' CPU affinity and its cgroup CPU quota. This drives the spin-vs-yield decisions, and
+   is re-evaluated periodically by a thread that _init starts. _init must be called for this to be valid! */
+size_t eb_sys_ncores;
 
-#if EB_SYS_DARWIN
-    #include <mach/mach.h>
-#elif EB_SYS_LINUX
-    #include <unistd.h>
+/* ## Functions */
+/* Returns whether the process can only use one core, in which case spinning is pointless */
+#if EB_CHAN_ASSUME_MULTICORE
+    #define eb_sys_uniprocessor() false
+#else
+    #define eb_sys_uniprocessor() (eb_sys_ncores == 1)
 #endif
 
-size_t ncores() {
-    #if EB_SYS_DARWIN
-        host_basic_info_data_t info;
-        mach_msg_type_number_t count = HOST_BASIC_INFO_COUNT;
-        kern_return_t r = host_info(mach_host_self(), HOST_BASIC_INFO, (host_info_t)&info, &count);
-        eb_assert_or_recover(r == KERN_SUCCESS, return 0);
-        eb_assert_or_recover(count == HOST_BASIC_INFO_COUNT, return 0);
-        eb_assert_or_recover(info.logical_cpu > 0 && info.logical_cpu <= SIZE_MAX, return 0);
-        
-        return (size_t)info.logical_cpu;
-    #elif EB_SYS_LINUX
-        long ncores = sysconf(_SC_NPROCESSORS_ONLN);
-        eb_assert_or_recover(ncores > 0 && ncores <= SIZE_MAX, return 0);
-        
-        return (size_t)ncores;
-    #endif
-}
+void eb_sys_init();
 
-void eb_sys_init() {
-    if (!eb_sys_ncores) {
-        eb_atomic_compare_and_swap(&eb_sys_ncores, 0, ncores());
-    }
-}
-#if EB_SYS_DARWIN
-    #include <mach/mach.h>
-#elif EB_SYS_LINUX
-    #include <time.h>
-    #include <semaphore.h>
+/* Counts a call to 'call'. _counts() fills 'counts' with the totals, indexed by eb_sys_call. */
+#if EB_CHAN_SYSCALL_STATS
+    void eb_sys_call_add(eb_sys_call call);
+    void eb_sys_call_counts(uint64_t counts[eb_sys_call_count]);
+#else
+    #define eb_sys_call_add(call) ((void)0)
 #endif
+/* Yields the CPU via sched_yield(), counting the call */
+void eb_sys_yield();
+
+/* Returns an identifier for the calling thread that matches what the OS reports (the TID on Linux) */
+long eb_sys_thread_id();
+
+/* ## Topology */
+/* Returns the CPU that the calling thread is running on, or -1 if unknown */
+int eb_sys_cpu_current();
+/* Returns the number of NUMA nodes (1 if the machine isn't NUMA) */
+size_t eb_sys_node_count();
+/* Return an identifier for the physical core/L2 cache/L3 cache/NUMA node of 'cpu', such that CPUs sharing the
+   resource have equal identifiers. Returns -1 if 'cpu' is invalid or the topology is unknown. */
+int eb_sys_cpu_core(int cpu);
+int eb_sys_cpu_l2(int cpu);
+int eb_sys_cpu_l3(int cpu);
+int eb_sys_cpu_node(int cpu);
+/* Returns how closely CPUs 'a' and 'b' share resources: 4 if they share a physical core, 3 if they share an L2 cache,
+   2 if they share an L3 cache, 1 if they share a NUMA node, and 0 otherwise (or if either is unknown) */
+int eb_sys_cpu_proximity(int a, int b);
 // #######################################################
-// ## eb_spinlock.h
+// ## eb_sys.c
 // #######################################################
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sched.h>
-
-/* ## Types */
-typedef int eb_spinlock;
-#define EB_SPINLOCK_INIT 0
-
-/* ## Functions */
-#define eb_spinlock_try(l) eb_atomic_compare_and_swap(l, 0, 1)
-
-#define eb_spinlock_lock(l) ({             \
-    if (eb_sys_ncores > 1) {               \
-        while (!eb_spinlock_try(l));       \
-    } else {                               \
-        while (!eb_spinlock_try(l)) {      \
-            sched_yield();                 \
-        }                                  \
-    }                                      \
-})
-
-#define eb_spinlock_unlock(l) eb_atomic_compare_and_swap(l, 1, 0)
-
-//#define eb_spinlock_try(l) __sync_lock_test_and_set(l, 1) == 0
-//#define eb_spinlock_lock(l) while (!eb_spinlock_try(l))
-//#define eb_spinlock_unlock(l) __sync_lock_release(l)
-//
-//typedef OSSpinLock eb_spinlock;
-//#define eb_spinlock_try(l) OSSpinLockTry(l)
-//#define eb_spinlock_lock(l) OSSpinLockLock(l)
-//#define eb_spinlock_unlock(l) OSSpinLockUnlock(l)
+#include <time.h>
+#include <pthread.h>
 // #######################################################
 // ## eb_time.h
 // #######################################################
 
+#include <stdint.h>
 
 /* Returns the number of nanoseconds since an arbitrary point in time (usually the machine's boot time) */
 eb_nsec eb_time_now();
+
+/* _ticks() returns a cheap monotonic timestamp in arbitrary units (the invariant TSC on x86, where available), for
+   measuring short intervals. _ticks_init() must be called before _ticks() is used; it's idempotent, but the first call
+   calibrates the tick rate, which takes a few milliseconds. _ticks_to_nsec() converts a difference of ticks. */
+void eb_time_ticks_init();
+uint64_t eb_time_ticks();
+eb_nsec eb_time_ticks_to_nsec(uint64_t ticks);
 // #######################################################
 // ## eb_time.c
 // #######################################################
@@ -187,13 +247,19 @@ eb_nsec eb_time_now();
 #elif EB_SYS_LINUX
     #include <time.h>
 #endif
+#if __x86_64__ || __i386__
+    #include <cpuid.h>
+    #define EB_TIME_TSC 1
+#endif
 
 eb_nsec eb_time_now() {
 #if EB_SYS_DARWIN
     /* Initialize k_timebase_info, thread-safely */
     static mach_timebase_info_t k_timebase_info = NULL;
     if (!k_timebase_info) {
-        mach_timebase_info_t timebase_info = malloc(sizeof(*timebase_info));
+        eb_chan_allocator alloc = eb_alloc_global();
+        mach_timebase_info_t timebase_info = eb_alloc(&alloc, sizeof(*timebase_info));
+        eb_assert_or_recover(timebase_info, return 0);
         kern_return_t r = mach_timebase_info(timebase_info);
         eb_assert_or_recover(r == KERN_SUCCESS, return 0);
         
@@ -201,7 +267,7 @@ eb_nsec eb_time_now() {
         eb_atomic_barrier();
         
         if (!eb_atomic_compare_and_swap(&k_timebase_info, NULL, timebase_info)) {
-            free(timebase_info);
+            eb_free(&alloc, timebase_info, sizeof(*timebase_info));
             timebase_info = NULL;
         }
     }
@@ -216,477 +282,4505 @@ eb_nsec eb_time_now() {
 #endif
 }
 
-#define PORT_POOL_CAP 0x10
-static eb_spinlock g_port_pool_lock = EB_SPINLOCK_INIT;
-static eb_port g_port_pool[PORT_POOL_CAP];
-static size_t g_port_pool_len = 0;
+enum {
+    ticks_uninitialized,
+    ticks_initializing,
+    ticks_tsc,
+    ticks_clock,
+};
+static int g_ticks_state = ticks_uninitialized;
+static double g_nsec_per_tick = 1;
 
-struct eb_port {
-    unsigned int retain_count;
-    bool sem_valid;
-    bool signaled;
+void eb_time_ticks_init() {
+    if (eb_atomic_compare_and_swap(&g_ticks_state, ticks_uninitialized, ticks_initializing)) {
+        int state = ticks_clock;
+        #if EB_TIME_TSC
+            /* Only use the TSC if it's invariant (it ticks at a constant rate regardless of frequency scaling and sleep
+               states), which is reported by CPUID leaf 0x80000007 */
+            unsigned int eax, ebx, ecx, edx;
+            if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1 << 8))) {
+                /* Calibrate the TSC against our monotonic clock */
+                static const eb_nsec k_calibration_time = 2000000;
+                eb_nsec start = eb_time_now();
+                uint64_t start_ticks = __builtin_ia32_rdtsc();
+                eb_nsec elapsed;
+                while ((elapsed = eb_time_now() - start) < k_calibration_time);
+                uint64_t elapsed_ticks = __builtin_ia32_rdtsc() - start_ticks;
+                if (elapsed_ticks) {
+                    g_nsec_per_tick = (double)elapsed / elapsed_ticks;
+                    state = ticks_tsc;
+                }
+            }
+        #endif
+        
+        eb_atomic_barrier();
+        g_ticks_state = state;
+    } else {
+        /* Wait for the thread that's calibrating */
+        while (*((volatile int *)&g_ticks_state) == ticks_initializing);
+    }
+}
+
+uint64_t eb_time_ticks() {
+    #if EB_TIME_TSC
+        if (g_ticks_state == ticks_tsc) {
+            return __builtin_ia32_rdtsc();
+        }
+    #endif
+    return eb_time_now();
+}
+
+eb_nsec eb_time_ticks_to_nsec(uint64_t ticks) {
+    return (g_ticks_state == ticks_tsc ? (eb_nsec)(ticks * g_nsec_per_tick) : ticks);
+}
+
+#if EB_SYS_DARWIN
+    #include <mach/mach.h>
+#elif EB_SYS_LINUX
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <sys/syscall.h>
+    #if __x86_64__ || __i386__
+        #include <cpuid.h>
+    #endif
+    /* Declared here since <sched.h> only declares it with _GNU_SOURCE, which can't be defined this late in the
+       amalgamation. Every Linux libc provides it. */
+    int sched_getcpu(void);
+#endif
+
+/* Topology tables, indexed by CPU. Entries are -1 if unknown. */
+typedef struct {
+    size_t ncpus;
+    size_t nnodes;
+    int core[EB_SYS_MAX_CPUS];
+    int l2[EB_SYS_MAX_CPUS];
+    int l3[EB_SYS_MAX_CPUS];
+    int node[EB_SYS_MAX_CPUS];
+} topology;
+
+/* The topology tables, of which g_topology is the current one. Readers use it without synchronization, so a CPU hotplug
+   fills the other table and publishes it in the current one's place. The retired table is only refilled by the next
+   hotplug, at least EB_SYS_REFRESH_INTERVAL later, which is the grace period for readers that were still using it. (A
+   reader that overstays it can only get a stale proximity hint, since every lookup is bounded by the tables' size.) */
+static topology g_topologies[2] = {{.ncpus = 0, .nnodes = 1}, {.ncpus = 0, .nnodes = 1}};
+static topology *g_topology = &g_topologies[0];
+static bool g_topology_published = false;
+static size_t g_ncpus_online = 0;
+/* Whether the CPU supports RDTSCP, which Linux uses to expose the current CPU cheaply */
+static bool g_have_rdtscp = false;
+
+static int g_refreshing = 0;
+static pthread_t g_refresh_thread;
+
+size_t ncores() {
     #if EB_SYS_DARWIN
-        semaphore_t sem;
+        host_basic_info_data_t info;
+        mach_msg_type_number_t count = HOST_BASIC_INFO_COUNT;
+        kern_return_t r = host_info(mach_host_self(), HOST_BASIC_INFO, (host_info_t)&info, &count);
+        eb_assert_or_recover(r == KERN_SUCCESS, return 0);
+        eb_assert_or_recover(count == HOST_BASIC_INFO_COUNT, return 0);
+        eb_assert_or_recover(info.logical_cpu > 0 && info.logical_cpu <= SIZE_MAX, return 0);
+        
+        return (size_t)info.logical_cpu;
     #elif EB_SYS_LINUX
-        sem_t sem;
+        long ncores = sysconf(_SC_NPROCESSORS_ONLN);
+        eb_assert_or_recover(ncores > 0 && ncores <= SIZE_MAX, return 0);
+        
+        return (size_t)ncores;
     #endif
-};
+}
 
-static void eb_port_free(eb_port p) {
-    /* Allowing p==NULL so that this function can be called unconditionally on failure from eb_port_create() */
-    if (!p) {
-        return;
+#if EB_SYS_LINUX
+/* Reads a small file into 'buf' as a NUL-terminated string. Uses open()/read() instead of stdio so that we don't
+   allocate, since this can be called from the select slow path. */
+static bool read_file(const char *path, char *buf, size_t cap) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return false;
     }
     
-    bool added_to_pool = false;
-    if (p->sem_valid) {
-        /* Determine whether we should clear the reset the port because we're going to try adding the port to our pool. */
-        bool reset = false;
-        eb_spinlock_lock(&g_port_pool_lock);
-            reset = (g_port_pool_len < PORT_POOL_CAP);
-        eb_spinlock_unlock(&g_port_pool_lock);
-        
-        if (reset) {
-            eb_port_wait(p, eb_nsec_zero);
-        }
-        
-        /* Now that the port's reset, add it to the pool as long as it'll still fit. */
-        eb_spinlock_lock(&g_port_pool_lock);
-            if (g_port_pool_len < PORT_POOL_CAP) {
-                g_port_pool[g_port_pool_len] = p;
-                g_port_pool_len++;
-                added_to_pool = true;
-            }
-        eb_spinlock_unlock(&g_port_pool_lock);
-        
-        /* If we couldn't add the port to the pool, destroy the underlying semaphore. */
-        if (!added_to_pool) {
-            #if EB_SYS_DARWIN
-                kern_return_t r = semaphore_destroy(mach_task_self(), p->sem);
-                eb_assert_or_recover(r == KERN_SUCCESS, eb_no_op);
-            #elif EB_SYS_LINUX
-                int r = sem_destroy(&p->sem);
-                eb_assert_or_recover(!r, eb_no_op);
-            #endif
-            
-            p->sem_valid = false;
-        }
+    ssize_t len = read(fd, buf, cap - 1);
+    close(fd);
+    if (len <= 0) {
+        return false;
     }
     
-    if (!added_to_pool) {
-        free(p);
-        p = NULL;
+    buf[len] = 0;
+    return true;
+}
+
+/* Reads a file containing a single integer */
+static bool read_long(const char *path, long *out) {
+    char buf[64];
+    if (!read_file(path, buf, sizeof(buf))) {
+        return false;
     }
+    
+    char *end = NULL;
+    *out = strtol(buf, &end, 10);
+    return (end != buf);
 }
 
-eb_port eb_port_create() {
-    eb_port p = NULL;
+/* Parses the next range from a CPU list (e.g. "0-3,8,10-11"), advancing 's'. Returns false at the end of the list. */
+static bool cpulist_next(const char **s, long *lo, long *hi) {
+    char *end = NULL;
+    *lo = strtol(*s, &end, 10);
+    if (end == *s) {
+        return false;
+    }
     
-    /* First try to pop a port out of the pool */
-    eb_spinlock_lock(&g_port_pool_lock);
-        if (g_port_pool_len) {
-            g_port_pool_len--;
-            p = g_port_pool[g_port_pool_len];
+    *hi = *lo;
+    if (*end == '-') {
+        const char *hi_str = end + 1;
+        *hi = strtol(hi_str, &end, 10);
+        if (end == hi_str) {
+            return false;
         }
-    eb_spinlock_unlock(&g_port_pool_lock);
-    
-    if (p) {
-        /* We successfully popped a port out of the pool */
-        eb_assert_or_bail(!p->retain_count, "Sanity-check failed");
-    } else {
-        /* We couldn't get a port out of the pool */
-        /* Using calloc so that bytes are zeroed */
-        p = calloc(1, sizeof(*p));
-        eb_assert_or_recover(p, goto failed);
-        
-        /* Create the semaphore */
-        #if EB_SYS_DARWIN
-            kern_return_t r = semaphore_create(mach_task_self(), &p->sem, SYNC_POLICY_FIFO, 0);
-            eb_assert_or_recover(r == KERN_SUCCESS, goto failed);
-        #elif EB_SYS_LINUX
-            int r = sem_init(&p->sem, 0, 0);
-            eb_assert_or_recover(!r,  goto failed);
-        #endif
     }
     
-    p->sem_valid = true;
-    p->retain_count = 1;
-    return p;
-    failed: {
-        eb_port_free(p);
-        return NULL;
-    }
+    *s = (*end == ',' ? end + 1 : end);
+    return true;
 }
 
-eb_port eb_port_retain(eb_port p) {
-    assert(p);
-    eb_atomic_add(&p->retain_count, 1);
-    return p;
+/* Returns the first CPU in the CPU list file at 'path', or -1 */
+static int cpulist_first(const char *path) {
+    char buf[1024];
+    if (!read_file(path, buf, sizeof(buf))) {
+        return -1;
+    }
+    
+    const char *s = buf;
+    long lo, hi;
+    return (cpulist_next(&s, &lo, &hi) && lo >= 0 && lo < EB_SYS_MAX_CPUS ? (int)lo : -1);
 }
 
-void eb_port_release(eb_port p) {
-    assert(p);
-    if (eb_atomic_add(&p->retain_count, -1) == 0) {
+/* Returns the number of CPUs in the process' affinity mask, or 0 if unknown */
+static size_t affinity_ncores() {
+    unsigned long mask[EB_SYS_MAX_CPUS / (8 * sizeof(unsigned long))];
+    memset(mask, 0, sizeof(mask));
+    /* Using the raw syscall since sched_getaffinity() requires _GNU_SOURCE. It returns the size of the mask that was
+       written. */
+    long r = syscall(SYS_sched_getaffinity, 0, sizeof(mask), mask);
+    if (r <= 0) {
+        return 0;
+    }
+    
+    size_t result = 0;
+    for (size_t i = 0; i < (size_t)r / sizeof(*mask); i++) {
+        result += __builtin_popcountl(mask[i]);
+    }
+    return result;
+}
+
+/* Finds the path of the process' cgroup for 'controller' (or the v2 unified hierarchy if 'controller' is NULL) */
+static bool cgroup_path(const char *controller, char *out, size_t cap) {
+    char buf[4096];
+    if (!read_file("/proc/self/cgroup", buf, sizeof(buf))) {
+        return false;
+    }
+    
+    /* Each line has the form "hierarchy-ID:controller-list:cgroup-path" */
+    for (char *line = buf; line && *line;) {
+        char *next = strchr(line, '\n');
+        if (next) {
+            *next = 0;
+            next++;
+        }
+        
+        char *controllers = strchr(line, ':');
+        char *path = (controllers ? strchr(controllers + 1, ':') : NULL);
+        if (path) {
+            controllers++;
+            *path = 0;
+            path++;
+            
+            bool match = false;
+            if (!controller) {
+                match = !strcmp(line, "0:") || !*controllers;
+            } else {
+                /* Look for 'controller' in the comma-separated controller list */
+                size_t len = strlen(controller);
+                for (const char *c = controllers; c && *c; c = strchr(c, ',') ? strchr(c, ',') + 1 : NULL) {
+                    if (!strncmp(c, controller, len) && (c[len] == ',' || !c[len])) {
+                        match = true;
+                        break;
+                    }
+                }
+            }
+            
+            if (match && strlen(path) < cap) {
+                strcpy(out, path);
+                return true;
+            }
+        }
+        
+        line = next;
+    }
+    
+    return false;
+}
+
+/* Returns the number of cores permitted by the process' cgroup CPU quota (v1 or v2), or 0 if there's no quota */
+static size_t quota_ncores() {
+    char cg[1024];
+    char path[2048];
+    long quota = -1;
+    long period = 0;
+    
+    /* ## cgroup v2: cpu.max contains "$MAX $PERIOD", where $MAX is "max" if there's no limit */
+    const char *v2_roots[] = {"/sys/fs/cgroup", "/sys/fs/cgroup/unified"};
+    if (!cgroup_path(NULL, cg, sizeof(cg))) {
+        strcpy(cg, "/");
+    }
+    for (size_t i = 0; i < sizeof(v2_roots) / sizeof(*v2_roots) && quota < 0; i++) {
+        /* Try the process' own cgroup, and then the root (which is the process' cgroup within a cgroup namespace) */
+        const char *dirs[] = {cg, ""};
+        for (size_t j = 0; j < sizeof(dirs) / sizeof(*dirs) && quota < 0; j++) {
+            char buf[128];
+            snprintf(path, sizeof(path), "%s%s/cpu.max", v2_roots[i], dirs[j]);
+            if (read_file(path, buf, sizeof(buf))) {
+                if (!strncmp(buf, "max", 3)) {
+                    return 0;
+                }
+                char *end = NULL;
+                quota = strtol(buf, &end, 10);
+                period = strtol(end, NULL, 10);
+            }
+        }
+    }
+    
+    /* ## cgroup v1: cpu.cfs_quota_us is -1 if there's no limit */
+    if (quota < 0) {
+        const char *v1_roots[] = {"/sys/fs/cgroup/cpu", "/sys/fs/cgroup/cpu,cpuacct"};
+        if (!cgroup_path("cpu", cg, sizeof(cg))) {
+            strcpy(cg, "/");
+        }
+        for (size_t i = 0; i < sizeof(v1_roots) / sizeof(*v1_roots) && quota < 0; i++) {
+            const char *dirs[] = {cg, ""};
+            for (size_t j = 0; j < sizeof(dirs) / sizeof(*dirs); j++) {
+                snprintf(path, sizeof(path), "%s%s/cpu.cfs_quota_us", v1_roots[i], dirs[j]);
+                if (read_long(path, &quota)) {
+                    snprintf(path, sizeof(path), "%s%s/cpu.cfs_period_us", v1_roots[i], dirs[j]);
+                    if (!read_long(path, &period)) {
+                        quota = -1;
+                    }
+                    break;
+                }
+            }
+        }
+    }
+    
+    if (quota <= 0 || period <= 0) {
+        return 0;
+    }
+    
+    /* Round down (but to at least 1), since spinning with a fractional core just burns the quota */
+    size_t result = (size_t)(quota / period);
+    return (result ? result : 1);
+}
+
+/* Returns the identifier of the cache at 'level' that's shared by 'cpu', or -1 */
+static int cache_id(int cpu, long level) {
+    char path[256];
+    for (int i = 0;; i++) {
+        long l = 0;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, i);
+        if (!read_long(path, &l)) {
+            return -1;
+        }
+        
+        if (l == level) {
+            /* Skip instruction caches */
+            char type[32];
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/type", cpu, i);
+            if (read_file(path, type, sizeof(type)) && !strncmp(type, "Instruction", 11)) {
+                continue;
+            }
+            
+            /* Identify the cache by the first CPU that shares it */
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", cpu, i);
+            return cpulist_first(path);
+        }
+    }
+}
+#endif
+
+/* Determines the number of cores that we can effectively use in parallel */
+static size_t effective_ncores() {
+    size_t result = ncores();
+    #if EB_SYS_LINUX
+        size_t affinity = affinity_ncores();
+        if (affinity && affinity < result) {
+            result = affinity;
+        }
+        
+        size_t quota = quota_ncores();
+        if (quota && quota < result) {
+            result = quota;
+        }
+    #endif
+    /* Assume a uniprocessor if we couldn't determine anything */
+    return (result ? result : 1);
+}
+
+/* Reads the topology into the table that isn't current, and publishes it */
+static void topology_update() {
+    /* The first table is filled in place, since nothing has read its entries yet (they're guarded by ncpus = 0) */
+    topology *t = &g_topologies[0];
+    if (g_topology_published) {
+        t = (g_topology == &g_topologies[0] ? &g_topologies[1] : &g_topologies[0]);
+    }
+    size_t ncpus = 0;
+    t->ncpus = 0;
+    t->nnodes = 1;
+    
+    #if EB_SYS_LINUX
+        long conf = sysconf(_SC_NPROCESSORS_CONF);
+        ncpus = (conf > 0 ? (conf < EB_SYS_MAX_CPUS ? (size_t)conf : EB_SYS_MAX_CPUS) : 0);
+        
+        char path[256];
+        for (size_t cpu = 0; cpu < ncpus; cpu++) {
+            /* Identify the physical core by the first of its hyperthreads */
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%zu/topology/thread_siblings_list", cpu);
+            t->core[cpu] = cpulist_first(path);
+            t->l2[cpu] = cache_id((int)cpu, 2);
+            t->l3[cpu] = cache_id((int)cpu, 3);
+            t->node[cpu] = -1;
+        }
+        
+        /* Assign each CPU its NUMA node from the nodes' CPU lists */
+        char nodes[256];
+        if (read_file("/sys/devices/system/node/online", nodes, sizeof(nodes))) {
+            const char *s = nodes;
+            long node_lo, node_hi;
+            while (cpulist_next(&s, &node_lo, &node_hi)) {
+                if (node_hi >= (long)t->nnodes) {
+                    t->nnodes = (node_hi < EB_SYS_MAX_NODES ? (size_t)node_hi + 1 : EB_SYS_MAX_NODES);
+                }
+                for (long node = node_lo; node <= node_hi; node++) {
+                    char cpus[1024];
+                    snprintf(path, sizeof(path), "/sys/devices/system/node/node%ld/cpulist", node);
+                    if (!read_file(path, cpus, sizeof(cpus))) {
+                        continue;
+                    }
+                    
+                    const char *cs = cpus;
+                    long lo, hi;
+                    while (cpulist_next(&cs, &lo, &hi)) {
+                        for (long cpu = lo; cpu <= hi && cpu < (long)ncpus; cpu++) {
+                            t->node[cpu] = (int)node;
+                        }
+                    }
+                }
+            }
+        } else {
+            /* No NUMA support, so everything's on node 0 */
+            for (size_t cpu = 0; cpu < ncpus; cpu++) {
+                t->node[cpu] = 0;
+            }
+        }
+    #endif
+    
+    /* Make the entries visible before ncpus (which guards them), and ncpus before the table itself */
+    eb_atomic_barrier();
+    t->ncpus = ncpus;
+    eb_atomic_barrier();
+    *((topology *volatile *)&g_topology) = t;
+    g_topology_published = true;
+}
+
+/* Returns the current topology, which remains unchanged for at least EB_SYS_REFRESH_INTERVAL */
+static inline const topology *topology_current() {
+    return *((topology *volatile *)&g_topology);
+}
+
+/* Periodically re-evaluates eb_sys_ncores and the topology, which reads files (e.g. the cgroup's CPU quota), so that
+   no thread using channels pays for it */
+static void *refresh_thread(void *arg) {
+    for (;;) {
+        struct timespec ts = {.tv_sec = EB_SYS_REFRESH_INTERVAL / eb_nsec_per_sec,
+            .tv_nsec = EB_SYS_REFRESH_INTERVAL % eb_nsec_per_sec};
+        nanosleep(&ts, NULL);
+        
+        /* The topology only changes when CPUs are hotplugged, so only re-evaluate it then since it's comparatively
+           expensive */
+        size_t online = ncores();
+        if (online != g_ncpus_online) {
+            topology_update();
+            g_ncpus_online = online;
+        }
+        *((volatile size_t *)&eb_sys_ncores) = effective_ncores();
+    }
+    return NULL;
+}
+
+void eb_sys_init() {
+    if (!eb_sys_ncores) {
+        /* Only one thread performs the initial evaluation; the others wait for it so that eb_sys_ncores is valid
+           when we return. */
+        if (eb_atomic_compare_and_swap(&g_refreshing, 0, 1)) {
+            if (!eb_sys_ncores) {
+                g_ncpus_online = ncores();
+                #if EB_SYS_LINUX && (__x86_64__ || __i386__)
+                    unsigned int eax, ebx, ecx, edx;
+                    g_have_rdtscp = (__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) && (edx & (1 << 27)));
+                #endif
+                topology_update();
+                eb_atomic_barrier();
+                eb_atomic_compare_and_swap(&eb_sys_ncores, 0, effective_ncores());
+                
+                /* If the thread can't be created, the initial evaluation stands */
+                int r = pthread_create(&g_refresh_thread, NULL, refresh_thread, NULL);
+                eb_assert_or_recover(!r, eb_no_op);
+                if (!r) {
+                    pthread_detach(g_refresh_thread);
+                }
+            }
+            eb_atomic_compare_and_swap(&g_refreshing, 1, 0);
+        } else {
+            while (!*((volatile size_t *)&eb_sys_ncores));
+        }
+    }
+}
+
+long eb_sys_thread_id() {
+    #if EB_SYS_DARWIN
+        uint64_t tid = 0;
+        pthread_threadid_np(NULL, &tid);
+        return (long)tid;
+    #elif EB_SYS_LINUX
+        /* Using the raw syscall since gettid() requires _GNU_SOURCE */
+        return syscall(SYS_gettid);
+    #endif
+}
+
+#pragma mark - System call accounting -
+#if EB_CHAN_SYSCALL_STATS
+    /* Each thread counts its calls in thread-local storage, which only it writes, so counting needs no atomic
+       read-modify-writes. The threads' counters are listed so that they can be summed when they're read, and a thread's
+       counts are folded into g_calls_exited when it exits. */
+    typedef struct call_counter call_counter;
+    struct call_counter {
+        call_counter *prev;
+        call_counter *next;
+        bool registered;
+        uint64_t counts[eb_sys_call_count];
+    };
+    static __thread call_counter t_calls;
+    static call_counter *g_calls = NULL;
+    static uint64_t g_calls_exited[eb_sys_call_count];
+    static int g_calls_lock = 0;
+    static pthread_once_t g_calls_key_once = PTHREAD_ONCE_INIT;
+    static pthread_key_t g_calls_key;
+    
+    /* Guards the list of counters. eb_spinlock can't be used here since it counts its yields. */
+    static void calls_lock() {
+        while (!eb_atomic_compare_and_swap(&g_calls_lock, 0, 1)) {
+            sched_yield();
+        }
+    }
+    
+    static void calls_unlock() {
+        eb_atomic_compare_and_swap(&g_calls_lock, 1, 0);
+    }
+    
+    /* Called when a thread exits, to fold its counts into g_calls_exited before its thread-local storage goes away */
+    static void calls_cleanup(void *arg) {
+        call_counter *c = arg;
+        calls_lock();
+            if (c->prev) {
+                c->prev->next = c->next;
+            } else {
+                g_calls = c->next;
+            }
+            if (c->next) {
+                c->next->prev = c->prev;
+            }
+            for (size_t i = 0; i < eb_sys_call_count; i++) {
+                g_calls_exited[i] += c->counts[i];
+                c->counts[i] = 0;
+            }
+            c->registered = false;
+        calls_unlock();
+    }
+    
+    static void calls_key_create() {
+        int r = pthread_key_create(&g_calls_key, calls_cleanup);
+        eb_assert_or_bail(!r, "pthread_key_create() failed");
+    }
+    
+    /* Lists the current thread's counter, the first time it counts a call */
+    static void calls_register() {
+        call_counter *c = &t_calls;
+        c->registered = true;
+        pthread_once(&g_calls_key_once, calls_key_create);
+        int r = pthread_setspecific(g_calls_key, c);
+        eb_assert_or_recover(!r, return);
+        
+        calls_lock();
+            c->prev = NULL;
+            c->next = g_calls;
+            if (g_calls) {
+                g_calls->prev = c;
+            }
+            g_calls = c;
+        calls_unlock();
+    }
+    
+    void eb_sys_call_add(eb_sys_call call) {
+        if (!t_calls.registered) {
+            calls_register();
+        }
+        eb_atomic_store_relaxed(&t_calls.counts[call], t_calls.counts[call] + 1);
+    }
+    
+    void eb_sys_call_counts(uint64_t counts[eb_sys_call_count]) {
+        calls_lock();
+            memcpy(counts, g_calls_exited, eb_sys_call_count * sizeof(*counts));
+            for (call_counter *c = g_calls; c; c = c->next) {
+                for (size_t i = 0; i < eb_sys_call_count; i++) {
+                    counts[i] += eb_atomic_load_relaxed(&c->counts[i]);
+                }
+            }
+        calls_unlock();
+    }
+#endif
+
+void eb_sys_yield() {
+    eb_sys_call_add(eb_sys_call_yield);
+    sched_yield();
+}
+
+#pragma mark - Topology -
+int eb_sys_cpu_current() {
+    #if EB_SYS_LINUX
+        #if __x86_64__ || __i386__
+            /* Linux stores the CPU number in the low 12 bits of TSC_AUX, which RDTSCP reads without a syscall */
+            if (g_have_rdtscp) {
+                unsigned int aux = 0;
+                __builtin_ia32_rdtscp(&aux);
+                return (int)(aux & 0xfff);
+            }
+        #endif
+        
+        /* sched_getcpu() reads the CPU via the vDSO (or rseq), unlike the raw getcpu syscall */
+        int cpu = sched_getcpu();
+        return (cpu >= 0 && cpu < EB_SYS_MAX_CPUS ? cpu : -1);
+    #else
+        return -1;
+    #endif
+}
+
+size_t eb_sys_node_count() {
+    return topology_current()->nnodes;
+}
+
+int eb_sys_cpu_core(int cpu) {
+    const topology *t = topology_current();
+    return (cpu >= 0 && (size_t)cpu < t->ncpus ? t->core[cpu] : -1);
+}
+
+int eb_sys_cpu_l2(int cpu) {
+    const topology *t = topology_current();
+    return (cpu >= 0 && (size_t)cpu < t->ncpus ? t->l2[cpu] : -1);
+}
+
+int eb_sys_cpu_l3(int cpu) {
+    const topology *t = topology_current();
+    return (cpu >= 0 && (size_t)cpu < t->ncpus ? t->l3[cpu] : -1);
+}
+
+int eb_sys_cpu_node(int cpu) {
+    const topology *t = topology_current();
+    return (cpu >= 0 && (size_t)cpu < t->ncpus ? t->node[cpu] : -1);
+}
+
+int eb_sys_cpu_proximity(int a, int b) {
+    /* Load the table once, so that both CPUs are compared against the same topology */
+    const topology *t = topology_current();
+    if (a < 0 || b < 0 || (size_t)a >= t->ncpus || (size_t)b >= t->ncpus) {
+        return 0;
+    }
+    
+    if (a == b || (t->core[a] >= 0 && t->core[a] == t->core[b])) {
+        return 4;
+    } else if (t->l2[a] >= 0 && t->l2[a] == t->l2[b]) {
+        return 3;
+    } else if (t->l3[a] >= 0 && t->l3[a] == t->l3[b]) {
+        return 2;
+    } else if (t->node[a] >= 0 && t->node[a] == t->node[b]) {
+        return 1;
+    }
+    return 0;
+}
+// #######################################################
+// ## eb_config.h
+// #######################################################
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* The default eb_chan_config.spin_attempts. bench/pingpong.c compares spin-only, park-only and mixed configurations. */
+#ifndef EB_CHAN_SPIN_ATTEMPTS
+    #define EB_CHAN_SPIN_ATTEMPTS 500
+#endif
+
+/* The default eb_chan_config.port_pool_cap */
+#define EB_CONFIG_PORT_POOL_CAP 0x10
+/* The default eb_chan_config.waiter_list_cap */
+#define EB_CONFIG_WAITER_LIST_CAP 16
+
+/* ## Variables */
+/* The current configuration (see eb_chan_config_set()). It's read without synchronization, so a change is observed by
+   other threads eventually. */
+extern eb_chan_config eb_config;
+
+/* ## Functions */
+/* Applies the environment's overrides to eb_config, the first time it's called */
+void eb_config_init();
+
+/* Returns whether a thread that can't make progress until another thread does should yield the CPU, rather than retry
+   immediately */
+static inline bool eb_config_yields() {
+    eb_chan_yield_policy policy = *((volatile eb_chan_yield_policy *)&eb_config.yield_policy);
+    return (policy == eb_chan_yield_auto ? eb_sys_uniprocessor() : policy == eb_chan_yield_always);
+}
+// #######################################################
+// ## eb_config.c
+// #######################################################
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+eb_chan_config eb_config = {
+    .spin_attempts = EB_CHAN_SPIN_ATTEMPTS,
+    .port_pool_cap = EB_CONFIG_PORT_POOL_CAP,
+    .waiter_list_cap = EB_CONFIG_WAITER_LIST_CAP,
+    .yield_policy = eb_chan_yield_auto,
+};
+static pthread_once_t g_config_once = PTHREAD_ONCE_INIT;
+
+static bool config_valid(const eb_chan_config *c) {
+    return (c->port_pool_cap <= EB_CHAN_PORT_POOL_MAX &&
+            c->waiter_list_cap > 0 &&
+            (c->yield_policy == eb_chan_yield_auto || c->yield_policy == eb_chan_yield_always ||
+             c->yield_policy == eb_chan_yield_never));
+}
+
+/* Parses environment variable 'name' into 'out', if it's set to a number */
+static void env_size(const char *name, size_t *out) {
+    const char *s = getenv(name);
+    if (!s) {
+        return;
+    }
+    
+    char *end = NULL;
+    errno = 0;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (end == s || *end || errno || s[0] == '-' || v > SIZE_MAX) {
+        fprintf(stderr, "eb_chan: ignoring invalid %s=%s\n", name, s);
+        return;
+    }
+    *out = (size_t)v;
+}
+
+static void config_load_env() {
+    eb_chan_config c = eb_config;
+    env_size("EB_CHAN_SPIN_ATTEMPTS", &c.spin_attempts);
+    env_size("EB_CHAN_PORT_POOL_CAP", &c.port_pool_cap);
+    env_size("EB_CHAN_WAITER_LIST_CAP", &c.waiter_list_cap);
+    
+    const char *yield = getenv("EB_CHAN_YIELD");
+    if (yield) {
+        if (!strcmp(yield, "auto")) {
+            c.yield_policy = eb_chan_yield_auto;
+        } else if (!strcmp(yield, "always")) {
+            c.yield_policy = eb_chan_yield_always;
+        } else if (!strcmp(yield, "never")) {
+            c.yield_policy = eb_chan_yield_never;
+        } else {
+            fprintf(stderr, "eb_chan: ignoring invalid EB_CHAN_YIELD=%s (expected auto, always or never)\n", yield);
+        }
+    }
+    
+    /* Out-of-range values are ignored field by field, so that one bad variable doesn't discard the others */
+    if (c.port_pool_cap > EB_CHAN_PORT_POOL_MAX) {
+        fprintf(stderr, "eb_chan: ignoring EB_CHAN_PORT_POOL_CAP=%zu (the maximum is %d)\n", c.port_pool_cap,
+            EB_CHAN_PORT_POOL_MAX);
+        c.port_pool_cap = eb_config.port_pool_cap;
+    }
+    if (!c.waiter_list_cap) {
+        fprintf(stderr, "eb_chan: ignoring EB_CHAN_WAITER_LIST_CAP=0 (the minimum is 1)\n");
+        c.waiter_list_cap = eb_config.waiter_list_cap;
+    }
+    
+    assert(config_valid(&c));
+    eb_config = c;
+    eb_atomic_barrier();
+}
+
+void eb_config_init() {
+    pthread_once(&g_config_once, config_load_env);
+}
+
+#pragma mark - Public API -
+void eb_chan_config_get(eb_chan_config *out) {
+    assert(out);
+    eb_config_init();
+    *out = eb_config;
+}
+
+bool eb_chan_config_set(const eb_chan_config *config) {
+    assert(config);
+    /* Load the environment first, so that it doesn't override 'config' later */
+    eb_config_init();
+    if (!config_valid(config)) {
+        return false;
+    }
+    
+    eb_config = *config;
+    eb_atomic_barrier();
+    return true;
+}
+
+/* Whether contended lock acquisitions are profiled (see eb_chan_lock_stats()). Off by default; when it's off, the
+   profiled lock variants are identical to the unprofiled ones. */
+#ifndef EB_CHAN_LOCKPROF
+    #define EB_CHAN_LOCKPROF 0
+#endif
+
+/* ## Types */
+typedef int eb_spinlock;
+#define EB_SPINLOCK_INIT 0
+
+/* ## Functions */
+#define eb_spinlock_try(l) eb_atomic_compare_and_swap(l, 0, 1)
+
+#define eb_spinlock_lock(l) ({             \
+    if (!eb_config_yields()) {             \
+        while (!eb_spinlock_try(l));       \
+    } else {                               \
+        while (!eb_spinlock_try(l)) {      \
+            eb_sys_yield();                \
+        }                                  \
+    }                                      \
+})
+
+#define eb_spinlock_unlock(l) eb_atomic_compare_and_swap(l, 1, 0)
+
+/* ## Profiling */
+/* Contention counters for a lock site, updated atomically */
+typedef struct {
+    uint64_t contended;     /* Acquisitions that didn't succeed on the first attempt (including failed _try()s) */
+    uint64_t spins;         /* Failed attempts while acquiring */
+    uint64_t wait_ticks;    /* eb_time_ticks() spent waiting to acquire */
+} eb_spinlock_prof;
+
+#if EB_CHAN_LOCKPROF
+    /* Slow path of eb_spinlock_lock_prof(), after the first attempt failed */
+    static inline void eb_spinlock_lock_contended(eb_spinlock *l, eb_spinlock_prof *prof) {
+        uint64_t start = eb_time_ticks();
+        uint64_t spins = 1;
+        if (!eb_config_yields()) {
+            while (!eb_spinlock_try(l)) {
+                spins++;
+            }
+        } else {
+            while (!eb_spinlock_try(l)) {
+                spins++;
+                eb_sys_yield();
+            }
+        }
+        
+        eb_atomic_add_relaxed(&prof->contended, 1);
+        eb_atomic_add_relaxed(&prof->spins, spins);
+        eb_atomic_add_relaxed(&prof->wait_ticks, eb_time_ticks() - start);
+    }
+    
+    /* Like eb_spinlock_lock()/_try(), but charges contention to 'prof' */
+    #define eb_spinlock_lock_prof(l, prof) ({          \
+        if (!eb_spinlock_try(l)) {                     \
+            eb_spinlock_lock_contended(l, prof);       \
+        }                                              \
+    })
+    
+    #define eb_spinlock_try_prof(l, prof) ({                   \
+        bool __r = eb_spinlock_try(l);                         \
+        if (!__r) {                                            \
+            eb_atomic_add_relaxed(&(prof)->contended, 1);      \
+            eb_atomic_add_relaxed(&(prof)->spins, 1);          \
+        }                                                      \
+        __r;                                                   \
+    })
+#else
+    #define eb_spinlock_lock_prof(l, prof) eb_spinlock_lock(l)
+    #define eb_spinlock_try_prof(l, prof) eb_spinlock_try(l)
+#endif
+
+//#define eb_spinlock_try(l) __sync_lock_test_and_set(l, 1) == 0
+//#define eb_spinlock_lock(l) while (!eb_spinlock_try(l))
+//#define eb_spinlock_unlock(l) __sync_lock_release(l)
+//
+//typedef OSSpinLock eb_spinlock;
+//#define eb_spinlock_try(l) OSSpinLockTry(l)
+//#define eb_spinlock_lock(l) OSSpinLockLock(l)
+//#define eb_spinlock_unlock(l) OSSpinLockUnlock(l)
+// #######################################################
+// ## eb_thread.h
+// #######################################################
+
+#include <stdbool.h>
+#include <stdint.h>
+// #######################################################
+// ## eb_port.h
+// #######################################################
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct eb_port *eb_port;
+
+/* The park_time of a waiter that parked while no watchdog was running, so its park wasn't timed */
+#define EB_PORT_PARK_UNTIMED ((eb_nsec)1)
+
+/* Information about the thread that waits on a port, recorded before it parks. Only written by the port's owner,
+   except where noted. */
+typedef struct {
+    int cpu;                    /* The CPU that the waiter last ran on, or -1 if unknown */
+    long tid;                   /* The waiting thread */
+    eb_nsec park_time;          /* When the waiter parked, EB_PORT_PARK_UNTIMED, or 0 if it isn't parked */
+    /* When the park that the watchdog last reported started. Only accessed by the watchdog's thread. */
+    eb_nsec watchdog_reported;
+    /* The ops of the select that the port is registered for; valid while the port is in a channel's port list */
+    eb_chan_op *const *ops;
+    size_t nops;
+} eb_port_waiter;
+
+/* Usage of the pool of ports that are kept for reuse */
+typedef struct {
+    size_t len;         /* Ports in the pool */
+    size_t cap;         /* The pool's capacity */
+    size_t ports;       /* Ports that exist, including pooled ones */
+    uint64_t hits;      /* eb_port_create() calls that were satisfied by the pool */
+    uint64_t misses;    /* eb_port_create() calls that had to create a port */
+} eb_port_pool_usage;
+
+eb_port eb_port_create();
+eb_port eb_port_retain(eb_port p);
+void eb_port_release(eb_port p);
+
+/* Fills 'out' with the port pool's usage */
+void eb_port_pool_stats(eb_port_pool_usage *out);
+
+/* Prepares a port that's being reused by its owner for another wait: consumes a stale signal (one that arrived after
+   the port's last wait) so that it can't cause a spurious wakeup, and clears the waiter info */
+void eb_port_reset(eb_port p);
+
+/* Returns the port's waiter info */
+eb_port_waiter *eb_port_waiter_info(eb_port p);
+
+/* Locks the port's memory into RAM */
+bool eb_port_mlock(eb_port p);
+
+/* Returns whether the port was actually signaled, i.e. it wasn't already signaled */
+bool eb_port_signal(eb_port p);
+bool eb_port_wait(eb_port p, eb_nsec timeout);
+// #######################################################
+// ## eb_port.c
+// #######################################################
+
+#include <stdlib.h>
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#if EB_SYS_DARWIN
+    #include <mach/mach.h>
+#elif EB_SYS_LINUX
+    #include <time.h>
+    #include <semaphore.h>
+#endif
+// #######################################################
+// ## eb_probe.h
+// #######################################################
+
+
+/* USDT (user-level statically-defined tracing) probes, for attaching perf/bpftrace to a running process without
+   recompiling. Each probe compiles to a single nop until a tracer attaches, and every probe belongs to the 'eb_chan'
+   provider (see misc/bpftrace/ for example scripts). Probes are enabled when <sys/sdt.h> (systemtap-sdt-dev) is
+   available; define EB_CHAN_USDT=0 to remove them, or EB_CHAN_USDT=1 to require them. */
+#ifndef EB_CHAN_USDT
+    #if defined(__has_include)
+        #if __has_include(<sys/sdt.h>)
+            #define EB_CHAN_USDT 1
+        #endif
+    #endif
+#endif
+
+#if EB_CHAN_USDT
+    #include <sys/sdt.h>
+    #define eb_probe1(name, a) DTRACE_PROBE1(eb_chan, name, a)
+    #define eb_probe2(name, a, b) DTRACE_PROBE2(eb_chan, name, a, b)
+#else
+    #define eb_probe1(name, a)
+    #define eb_probe2(name, a, b)
+#endif
+
+static eb_spinlock g_port_pool_lock = EB_SPINLOCK_INIT;
+#if EB_CHAN_LOCKPROF
+    static eb_spinlock_prof g_port_pool_lock_prof;
+#endif
+/* Sized for the largest pool; eb_config.port_pool_cap limits how much of it is used */
+static eb_port g_port_pool[EB_CHAN_PORT_POOL_MAX];
+static size_t g_port_pool_len = 0;
+/* Pool usage (see eb_port_pool_stats()): the hits/misses are protected by g_port_pool_lock, and the number of ports
+   that exist (including pooled ones) is updated atomically */
+static uint64_t g_port_pool_hits = 0;
+static uint64_t g_port_pool_misses = 0;
+static size_t g_port_count = 0;
+
+struct eb_port {
+    unsigned int retain_count;
+    /* The allocator that allocated the port */
+    eb_chan_allocator alloc;
+    bool sem_valid;
+    bool signaled;
+    eb_port_waiter waiter;
+    #if EB_SYS_DARWIN
+        semaphore_t sem;
+    #elif EB_SYS_LINUX
+        sem_t sem;
+    #endif
+};
+
+static void eb_port_free(eb_port p) {
+    /* Allowing p==NULL so that this function can be called unconditionally on failure from eb_port_create() */
+    if (!p) {
+        return;
+    }
+    
+    bool added_to_pool = false;
+    if (p->sem_valid) {
+        /* Determine whether we should clear the reset the port because we're going to try adding the port to our pool. */
+        bool reset = false;
+        eb_spinlock_lock_prof(&g_port_pool_lock, &g_port_pool_lock_prof);
+            reset = (g_port_pool_len < eb_config.port_pool_cap);
+        eb_spinlock_unlock(&g_port_pool_lock);
+        
+        if (reset) {
+            eb_port_wait(p, eb_nsec_zero);
+        }
+        
+        /* Now that the port's reset, add it to the pool as long as it'll still fit. */
+        eb_spinlock_lock_prof(&g_port_pool_lock, &g_port_pool_lock_prof);
+            if (g_port_pool_len < eb_config.port_pool_cap) {
+                g_port_pool[g_port_pool_len] = p;
+                g_port_pool_len++;
+                added_to_pool = true;
+            }
+        eb_spinlock_unlock(&g_port_pool_lock);
+        
+        /* If we couldn't add the port to the pool, destroy the underlying semaphore. */
+        if (!added_to_pool) {
+            #if EB_SYS_DARWIN
+                kern_return_t r = semaphore_destroy(mach_task_self(), p->sem);
+                eb_assert_or_recover(r == KERN_SUCCESS, eb_no_op);
+            #elif EB_SYS_LINUX
+                int r = sem_destroy(&p->sem);
+                eb_assert_or_recover(!r, eb_no_op);
+            #endif
+            
+            p->sem_valid = false;
+        }
+    }
+    
+    if (!added_to_pool) {
+        /* Copy the allocator out of the port since we're about to free it */
+        eb_chan_allocator alloc = p->alloc;
+        eb_free(&alloc, p, sizeof(*p));
+        eb_atomic_add(&g_port_count, -1);
+        p = NULL;
+    }
+}
+
+eb_port eb_port_create() {
+    eb_port p = NULL;
+    
+    /* First try to pop a port out of the pool */
+    eb_spinlock_lock_prof(&g_port_pool_lock, &g_port_pool_lock_prof);
+        if (g_port_pool_len) {
+            g_port_pool_len--;
+            p = g_port_pool[g_port_pool_len];
+            g_port_pool_hits++;
+        } else {
+            g_port_pool_misses++;
+        }
+    eb_spinlock_unlock(&g_port_pool_lock);
+    
+    if (p) {
+        /* We successfully popped a port out of the pool */
+        eb_sanity_or_bail(!p->retain_count, "Sanity-check failed");
+    } else {
+        /* We couldn't get a port out of the pool */
+        /* Using a zeroed allocation so that bytes are zeroed */
+        eb_chan_allocator alloc = eb_alloc_global();
+        p = eb_alloc_zeroed(&alloc, sizeof(*p));
+        eb_assert_or_recover(p, goto failed);
+        p->alloc = alloc;
+        eb_atomic_add(&g_port_count, 1);
+        
+        /* Create the semaphore */
+        #if EB_SYS_DARWIN
+            kern_return_t r = semaphore_create(mach_task_self(), &p->sem, SYNC_POLICY_FIFO, 0);
+            eb_assert_or_recover(r == KERN_SUCCESS, goto failed);
+        #elif EB_SYS_LINUX
+            int r = sem_init(&p->sem, 0, 0);
+            eb_assert_or_recover(!r,  goto failed);
+        #endif
+    }
+    
+    p->sem_valid = true;
+    p->waiter = (eb_port_waiter){.cpu = -1};
+    p->retain_count = 1;
+    return p;
+    failed: {
+        eb_port_free(p);
+        return NULL;
+    }
+}
+
+eb_port eb_port_retain(eb_port p) {
+    assert(p);
+    eb_atomic_add(&p->retain_count, 1);
+    return p;
+}
+
+void eb_port_release(eb_port p) {
+    assert(p);
+    if (eb_atomic_add(&p->retain_count, -1) == 0) {
         eb_port_free(p);
     }
 }
 
-void eb_port_signal(eb_port p) {
-    assert(p);
+void eb_port_pool_stats(eb_port_pool_usage *out) {
+    assert(out);
+    
+    eb_spinlock_lock_prof(&g_port_pool_lock, &g_port_pool_lock_prof);
+        out->len = g_port_pool_len;
+        out->hits = g_port_pool_hits;
+        out->misses = g_port_pool_misses;
+    eb_spinlock_unlock(&g_port_pool_lock);
+    out->cap = eb_config.port_pool_cap;
+    out->ports = *((volatile size_t *)&g_port_count);
+}
+
+void eb_port_reset(eb_port p) {
+    assert(p);
+    
+    /* The signaler sets 'signaled' before posting the semaphore, so if it's set the post is guaranteed to come and
+       waiting for it won't block for long */
+    if (*((volatile bool *)&p->signaled)) {
+        eb_port_wait(p, eb_nsec_forever);
+    }
+    
+    /* watchdog_reported is left alone since only the watchdog's thread accesses it */
+    p->waiter.cpu = -1;
+    p->waiter.tid = 0;
+    p->waiter.park_time = 0;
+    p->waiter.ops = NULL;
+    p->waiter.nops = 0;
+}
+
+eb_port_waiter *eb_port_waiter_info(eb_port p) {
+    assert(p);
+    return &p->waiter;
+}
+
+bool eb_port_mlock(eb_port p) {
+    assert(p);
+    int r = mlock(p, sizeof(*p));
+    eb_assert_or_recover(!r, return false);
+    return true;
+}
+
+bool eb_port_signal(eb_port p) {
+    assert(p);
+    
+    if (eb_atomic_compare_and_swap(&p->signaled, false, true)) {
+        eb_sys_call_add(eb_sys_call_sem_post);
+        #if EB_SYS_DARWIN
+            kern_return_t r = semaphore_signal(p->sem);
+            eb_assert_or_recover(r == KERN_SUCCESS, eb_no_op);
+        #elif EB_SYS_LINUX
+            int r = sem_post(&p->sem);
+            eb_assert_or_recover(!r, eb_no_op);
+        #endif
+        /* port: the port that was signaled */
+        eb_probe1(signal, p);
+        return true;
+    }
+    return false;
+}
+
+bool eb_port_wait(eb_port p, eb_nsec timeout) {
+    assert(p);
+    
+    bool result = false;
+    if (timeout == eb_nsec_zero) {
+        /* ## Non-blocking */
+        eb_sys_call_add(eb_sys_call_sem_trywait);
+        #if EB_SYS_DARWIN
+            kern_return_t r = semaphore_timedwait(p->sem, (mach_timespec_t){0, 0});
+            eb_assert_or_recover(r == KERN_SUCCESS || r == KERN_OPERATION_TIMED_OUT, eb_no_op);
+            
+            result = (r == KERN_SUCCESS);
+        #elif EB_SYS_LINUX
+            int r = 0;
+            while ((r = sem_trywait(&p->sem)) == -1 && errno == EINTR);
+            eb_assert_or_recover(!r || (r == -1 && errno == EAGAIN), eb_no_op);
+            
+            result = !r;
+        #endif
+    } else if (timeout == eb_nsec_forever) {
+        /* ## Blocking */
+        eb_sys_call_add(eb_sys_call_sem_wait);
+        #if EB_SYS_DARWIN
+            kern_return_t r;
+            while ((r = semaphore_wait(p->sem)) == KERN_ABORTED);
+            eb_assert_or_recover(r == KERN_SUCCESS, eb_no_op);
+            
+            result = (r == KERN_SUCCESS);
+        #elif EB_SYS_LINUX
+            int r;
+            while ((r = sem_wait(&p->sem)) == -1 && errno == EINTR);
+            eb_assert_or_recover(!r, eb_no_op);
+            
+            result = !r;
+        #endif
+    } else {
+        /* ## Actual timeout */
+        eb_nsec start_time = eb_time_now();
+        eb_nsec remaining_timeout = timeout;
+        for (;;) {
+            eb_sys_call_add(eb_sys_call_sem_timedwait);
+            #if EB_SYS_DARWIN
+                /* This needs to be in a loop because semaphore_timedwait() can return KERN_ABORTED, e.g. if the process receives a signal. */
+                mach_timespec_t ts = {.tv_sec = (unsigned int)(remaining_timeout / eb_nsec_per_sec), .tv_nsec = (clock_res_t)(remaining_timeout % eb_nsec_per_sec)};
+                kern_return_t r = semaphore_timedwait(p->sem, ts);
+                eb_assert_or_recover(r == KERN_SUCCESS || r == KERN_OPERATION_TIMED_OUT || r == KERN_ABORTED, eb_no_op);
+                
+                if (r == KERN_SUCCESS) {
+                    result = true;
+                    break;
+                }
+            #elif EB_SYS_LINUX
+                /* Because sem_timedwait() uses the system's _REALTIME clock instead of the _MONOTONIC clock, we'll time out when
+                   the system's time changes. For that reason, we check for the timeout case ourself (instead of relying on errno
+                   after calling sem_timedwait()) condition ourself, using our own monotonic clock APIs (eb_time_now()), and
+                   restart sem_timedwait() if we determine independently that we haven't timed-out. */
+                struct timespec ts;
+                int r = clock_gettime(CLOCK_REALTIME, &ts);
+                eb_assert_or_recover(!r, break);
+                
+                ts.tv_sec += (remaining_timeout / eb_nsec_per_sec);
+                ts.tv_nsec += (remaining_timeout % eb_nsec_per_sec);
+                /* sem_timedwait() fails with EINVAL unless tv_nsec is less than a second */
+                if (ts.tv_nsec >= (long)eb_nsec_per_sec) {
+                    ts.tv_sec++;
+                    ts.tv_nsec -= eb_nsec_per_sec;
+                }
+                r = sem_timedwait(&p->sem, &ts);
+                /* The allowed return cases are: success (r==0), timed-out (r==-1, errno==ETIMEDOUT), (r==-1, errno==EINTR) */
+                eb_assert_or_recover(!r || (r == -1 && (errno == ETIMEDOUT || errno == EINTR)), break);
+                
+                /* If we acquired the semaphore, set our flag and break! */
+                if (!r) {
+                    result = true;
+                    break;
+                }
+            #endif
+                
+            /* Determine whether we timed-out, and if not, update 'remaining_timeout' with the amount of time to go. */
+            eb_nsec elapsed = eb_time_now() - start_time;
+            if (elapsed < timeout) {
+                remaining_timeout = timeout - elapsed;
+            } else {
+                break;
+            }
+        }
+    }
+    
+    if (result) {
+        assert(eb_atomic_compare_and_swap(&p->signaled, true, false));
+    }
+    
+    return result;
+}
+
+#pragma mark - Public API -
+bool eb_chan_port_pool_lock_stats(eb_chan_lock_counts *out) {
+    assert(out);
+    
+    memset(out, 0, sizeof(*out));
+    #if EB_CHAN_LOCKPROF
+        out->contended = eb_atomic_load_relaxed(&g_port_pool_lock_prof.contended);
+        out->spins = eb_atomic_load_relaxed(&g_port_pool_lock_prof.spins);
+        out->wait_cycles = eb_atomic_load_relaxed(&g_port_pool_lock_prof.wait_ticks);
+        out->wait_ns = eb_time_ticks_to_nsec(out->wait_cycles);
+        return true;
+    #else
+        return false;
+    #endif
+}
+
+/* Whether blocked-time accounting is compiled in (see eb_chan_blocked_time_enable()). Defining EB_CHAN_BLOCKED_TIME=0
+   removes it entirely. */
+#ifndef EB_CHAN_BLOCKED_TIME
+    #define EB_CHAN_BLOCKED_TIME 1
+#endif
+
+/* ## Types */
+/* The phases of a blocking select that are accounted */
+typedef enum {
+    eb_thread_phase_spin,   /* Trying ops without being parked */
+    eb_thread_phase_park,   /* Parked in eb_port_wait() */
+    eb_thread_phase_wake,   /* From the last wakeup until an op completed */
+    eb_thread_phase_count
+} eb_thread_phase;
+
+/* A thread's accumulated blocked time, in ticks, indexed by whether the select timed out and by phase. Registered
+   globally so that it can be aggregated across threads. */
+typedef struct eb_thread_acct eb_thread_acct;
+struct eb_thread_acct {
+    eb_thread_acct *next;
+    bool in_use;
+    uint64_t selects[2];
+    uint64_t ticks[2][eb_thread_phase_count];
+};
+
+/* Per-thread state. Lives in thread-local storage, so accessing it never allocates. */
+typedef struct {
+    /* The port that's reused by every blocking select on this thread (see eb_chan_thread_prepare()) */
+    eb_port port;
+    /* Whether the hot path should abort if it calls the allocator */
+    bool strict;
+    /* Whether the thread is currently within a send/recv/select */
+    bool in_hot_path;
+    /* One more than the index of the statistics shard that the thread updates, or 0 if unassigned */
+    unsigned int stats_shard;
+    /* The thread's ID (see eb_sys_thread_id()), or 0 if it hasn't been determined */
+    long tid;
+    /* The thread's blocked-time accounting, allocated when the thread first blocks after accounting is enabled */
+    eb_thread_acct *acct;
+} eb_thread;
+
+/* ## Variables */
+/* Non-zero while blocked-time accounting is enabled */
+extern int eb_thread_accounting;
+
+/* ## Functions */
+eb_thread *eb_thread_current();
+/* Returns the index of the statistics shard (less than 'nshards') that the current thread updates */
+unsigned int eb_thread_stats_shard(unsigned int nshards);
+/* Returns the current thread's ID, caching it */
+long eb_thread_id();
+/* Bails if the current thread is prepared in strict mode and is within the hot path */
+void eb_thread_check_alloc();
+/* Adds a blocking select's phase times (in ticks) to the current thread's accounting */
+void eb_thread_account(bool timed_out, const uint64_t ticks[eb_thread_phase_count]);
+// #######################################################
+// ## eb_thread.c
+// #######################################################
+
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+// #######################################################
+// ## eb_trace.h
+// #######################################################
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Whether the flight recorder is compiled in (see eb_chan_trace_start()). Recording costs a predictable branch per event
+   while tracing is stopped. Defining EB_CHAN_TRACE=0 removes it entirely. */
+#ifndef EB_CHAN_TRACE
+    #define EB_CHAN_TRACE 1
+#endif
+
+/* The number of events that each thread's ring holds; older events are overwritten */
+#define EB_TRACE_RING_CAP 2048
+
+/* ## Types */
+typedef enum {
+    eb_trace_select_begin,  /* arg: number of ops */
+    eb_trace_select_end,    /* chan: the channel of the op that was performed; arg: its index, or UINT32_MAX if none */
+    eb_trace_park,
+    eb_trace_unpark,        /* arg: whether the thread was signaled (vs. timed out) */
+    eb_trace_signal,        /* chan: the channel whose waiter was signaled */
+    eb_trace_lock_retry,    /* chan: the channel whose lock couldn't be acquired */
+    eb_trace_close,         /* chan: the channel that was closed */
+    eb_trace_unbuf_state,   /* chan: the unbuffered channel; label: the state that it transitioned to */
+} eb_trace_type;
+
+/* ## Variables */
+/* Non-zero while tracing (checked before recording every event) */
+extern int eb_trace_active;
+
+/* ## Functions */
+/* Records an event on the calling thread's ring. Only call while eb_trace_active. */
+void eb_trace_record(eb_trace_type type, const void *chan, const char *label, uint32_t arg);
+/* Gives the calling thread a ring ahead of time, so that recording never allocates */
+bool eb_trace_thread_prepare();
+// #######################################################
+// ## eb_trace.c
+// #######################################################
+
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+    uint64_t ticks;
+    const void *chan;
+    const char *label;
+    uint32_t arg;
+    uint32_t type;
+} event;
+
+/* A thread's ring of events. Only the owning thread writes to it; readers use 'head' to detect events that were
+   overwritten while they were being read. Rings are never freed: when a thread exits its ring is kept (so that its
+   events can still be dumped) until another thread adopts it. */
+typedef struct ring ring;
+struct ring {
+    ring *next;
+    bool in_use;
+    long tid;
+    /* The total number of events that have been recorded; the next event goes in events[head % EB_TRACE_RING_CAP] */
+    uint64_t head;
+    event events[EB_TRACE_RING_CAP];
+};
+
+int eb_trace_active = 0;
+static ring *g_rings = NULL;
+static eb_spinlock g_rings_lock = EB_SPINLOCK_INIT;
+static __thread ring *t_ring = NULL;
+static pthread_once_t g_ring_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_ring_key;
+
+/* Called when a thread with a ring exits, so that the ring can be adopted by another thread */
+static void ring_cleanup(void *arg) {
+    ring *r = arg;
+    eb_spinlock_lock(&g_rings_lock);
+        r->in_use = false;
+    eb_spinlock_unlock(&g_rings_lock);
+}
+
+static void ring_key_create() {
+    int r = pthread_key_create(&g_ring_key, ring_cleanup);
+    eb_assert_or_bail(!r, "pthread_key_create() failed");
+}
+
+/* Returns the calling thread's ring, adopting or allocating one if necessary */
+static ring *ring_current() {
+    if (t_ring) {
+        return t_ring;
+    }
+    
+    /* Adopt the ring of a thread that exited */
+    ring *r = NULL;
+    eb_spinlock_lock(&g_rings_lock);
+        for (ring *i = g_rings; i; i = i->next) {
+            if (!i->in_use) {
+                r = i;
+                r->in_use = true;
+                break;
+            }
+        }
+    eb_spinlock_unlock(&g_rings_lock);
+    
+    if (r) {
+        eb_atomic_store_release(&r->head, 0);
+    } else {
+        eb_chan_allocator alloc = eb_alloc_global();
+        r = eb_alloc_zeroed(&alloc, sizeof(*r));
+        eb_assert_or_recover(r, return NULL);
+        r->in_use = true;
+        
+        eb_spinlock_lock(&g_rings_lock);
+            r->next = g_rings;
+            g_rings = r;
+        eb_spinlock_unlock(&g_rings_lock);
+    }
+    
+    r->tid = eb_sys_thread_id();
+    
+    /* Register our thread-exit handler, which releases the ring */
+    pthread_once(&g_ring_key_once, ring_key_create);
+    int err = pthread_setspecific(g_ring_key, r);
+    eb_assert_or_recover(!err, eb_no_op);
+    
+    t_ring = r;
+    return r;
+}
+
+void eb_trace_record(eb_trace_type type, const void *chan, const char *label, uint32_t arg) {
+    ring *r = ring_current();
+    if (!r) {
+        return;
+    }
+    
+    uint64_t head = r->head;
+    r->events[head % EB_TRACE_RING_CAP] = (event){
+        .ticks = eb_time_ticks(),
+        .chan = chan,
+        .label = label,
+        .arg = arg,
+        .type = type,
+    };
+    /* Publish the event after it's written */
+    eb_atomic_store_release(&r->head, head + 1);
+}
+
+bool eb_trace_thread_prepare() {
+    return (ring_current() != NULL);
+}
+
+#pragma mark - Chrome trace export -
+static const char *type_name(eb_trace_type type) {
+    switch (type) {
+        case eb_trace_select_begin:
+        case eb_trace_select_end:   return "select";
+        case eb_trace_park:
+        case eb_trace_unpark:       return "park";
+        case eb_trace_signal:       return "signal";
+        case eb_trace_lock_retry:   return "lock_retry";
+        case eb_trace_close:        return "close";
+        case eb_trace_unbuf_state:  return "unbuf_state";
+    }
+    return "?";
+}
+
+static const char *type_phase(eb_trace_type type) {
+    switch (type) {
+        case eb_trace_select_begin:
+        case eb_trace_park:         return "B";
+        case eb_trace_select_end:
+        case eb_trace_unpark:       return "E";
+        default:                    return "i";
+    }
+}
+
+static void write_event(FILE *f, bool *first, int pid, long tid, uint64_t base, const event *e) {
+    double ts = (double)eb_time_ticks_to_nsec(e->ticks > base ? e->ticks - base : 0) / 1000;
+    const char *phase = type_phase(e->type);
+    fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"%s\",%s\"pid\":%d,\"tid\":%ld,\"ts\":%.3f,\"args\":{",
+        (*first ? "" : ","), type_name(e->type), phase, (phase[0] == 'i' ? "\"s\":\"t\"," : ""), pid, tid, ts);
+    *first = false;
+    
+    bool comma = false;
+    if (e->chan) {
+        fprintf(f, "\"chan\":\"%p\"", e->chan);
+        comma = true;
+    }
+    
+    switch (e->type) {
+        case eb_trace_select_begin:
+            fprintf(f, "%s\"nops\":%u", (comma ? "," : ""), e->arg);
+            break;
+        case eb_trace_select_end:
+            if (e->arg != UINT32_MAX) {
+                fprintf(f, "%s\"op\":%u,\"res\":\"%s\"", (comma ? "," : ""), e->arg, (e->label ? e->label : ""));
+            } else {
+                fprintf(f, "%s\"op\":null", (comma ? "," : ""));
+            }
+            break;
+        case eb_trace_unpark:
+            fprintf(f, "%s\"signaled\":%s", (comma ? "," : ""), (e->arg ? "true" : "false"));
+            break;
+        case eb_trace_unbuf_state:
+            fprintf(f, "%s\"state\":\"%s\"", (comma ? "," : ""), (e->label ? e->label : ""));
+            break;
+        default:
+            break;
+    }
+    
+    fprintf(f, "}}");
+}
+
+/* Copies the events that 'r' currently holds into 'out' (which must hold EB_TRACE_RING_CAP events), oldest first, and
+   returns the number of events copied. Events that were overwritten during the copy are dropped. */
+static size_t ring_snapshot(const ring *r, event *out) {
+    uint64_t head = eb_atomic_load_acquire(&r->head);
+    uint64_t start = (head > EB_TRACE_RING_CAP ? head - EB_TRACE_RING_CAP : 0);
+    for (uint64_t i = start; i < head; i++) {
+        out[i - start] = r->events[i % EB_TRACE_RING_CAP];
+    }
+    
+    /* Drop the events that the owner may have overwritten while we were copying */
+    eb_atomic_barrier();
+    uint64_t head_after = eb_atomic_load_acquire(&r->head);
+    uint64_t valid_start = (head_after > EB_TRACE_RING_CAP ? head_after - EB_TRACE_RING_CAP : 0);
+    size_t skip = (valid_start > start ? (size_t)(valid_start - start) : 0);
+    size_t count = (size_t)(head - start);
+    if (skip >= count) {
+        return 0;
+    }
+    
+    memmove(out, out + skip, (count - skip) * sizeof(*out));
+    return count - skip;
+}
+
+#pragma mark - Public API -
+bool eb_chan_trace_start() {
+    #if EB_CHAN_TRACE
+        eb_time_ticks_init();
+        eb_atomic_barrier();
+        eb_trace_active = 1;
+        return true;
+    #else
+        return false;
+    #endif
+}
+
+void eb_chan_trace_stop() {
+    eb_trace_active = 0;
+    eb_atomic_barrier();
+}
+
+bool eb_chan_trace_dump(const char *path) {
+    assert(path);
+    
+    FILE *f = fopen(path, "w");
+    eb_assert_or_recover(f, return false);
+    
+    eb_chan_allocator alloc = eb_alloc_global();
+    event *events = eb_alloc(&alloc, EB_TRACE_RING_CAP * sizeof(*events));
+    eb_assert_or_recover(events, fclose(f); return false);
+    
+    /* Use the earliest event as time zero. (Rings are only ever prepended to the list, so it's safe to walk without
+       the lock.) */
+    ring *rings = *((ring *volatile *)&g_rings);
+    uint64_t base = UINT64_MAX;
+    for (ring *r = rings; r; r = r->next) {
+        size_t count = ring_snapshot(r, events);
+        if (count && events[0].ticks < base) {
+            base = events[0].ticks;
+        }
+    }
+    
+    int pid = (int)getpid();
+    bool first = true;
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (ring *r = rings; r; r = r->next) {
+        size_t count = ring_snapshot(r, events);
+        for (size_t i = 0; i < count; i++) {
+            write_event(f, &first, pid, r->tid, base, &events[i]);
+        }
+    }
+    fprintf(f, "\n]}\n");
+    
+    eb_free(&alloc, events, EB_TRACE_RING_CAP * sizeof(*events));
+    bool ok = !ferror(f);
+    ok = !fclose(f) && ok;
+    return ok;
+}
+
+static __thread eb_thread t_thread;
+static pthread_once_t g_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_key;
+static unsigned int g_next_stats_shard = 0;
+
+int eb_thread_accounting = 0;
+/* Every thread's accounting, and the accumulated accounting of threads that exited */
+static eb_thread_acct *g_accts = NULL;
+static eb_thread_acct g_accts_exited;
+static eb_spinlock g_accts_lock = EB_SPINLOCK_INIT;
+
+/* Called when a thread exits, to release the resources that eb_chan_thread_prepare()/eb_thread_account() created */
+static void thread_cleanup(void *arg) {
+    eb_thread *t = arg;
+    if (t->port) {
+        eb_port_release(t->port);
+        t->port = NULL;
+    }
+    
+    if (t->acct) {
+        /* Fold the thread's accounting into the exited threads', and make it available to be adopted */
+        eb_spinlock_lock(&g_accts_lock);
+            for (size_t i = 0; i < 2; i++) {
+                g_accts_exited.selects[i] += t->acct->selects[i];
+                for (size_t ii = 0; ii < eb_thread_phase_count; ii++) {
+                    g_accts_exited.ticks[i][ii] += t->acct->ticks[i][ii];
+                }
+            }
+            t->acct->in_use = false;
+        eb_spinlock_unlock(&g_accts_lock);
+        t->acct = NULL;
+    }
+}
+
+static void key_create() {
+    int r = pthread_key_create(&g_key, thread_cleanup);
+    eb_assert_or_bail(!r, "pthread_key_create() failed");
+}
+
+/* Registers thread_cleanup() to be called when the current thread exits */
+static bool cleanup_register(eb_thread *t) {
+    pthread_once(&g_key_once, key_create);
+    int r = pthread_setspecific(g_key, t);
+    eb_assert_or_recover(!r, return false);
+    return true;
+}
+
+/* Gives the current thread its accounting, adopting that of an exited thread if possible */
+static bool acct_create(eb_thread *t) {
+    eb_thread_acct *a = NULL;
+    eb_spinlock_lock(&g_accts_lock);
+        for (eb_thread_acct *i = g_accts; i; i = i->next) {
+            if (!i->in_use) {
+                a = i;
+                memset(a->selects, 0, sizeof(a->selects));
+                memset(a->ticks, 0, sizeof(a->ticks));
+                a->in_use = true;
+                break;
+            }
+        }
+    eb_spinlock_unlock(&g_accts_lock);
+    
+    if (!a) {
+        eb_chan_allocator alloc = eb_alloc_global();
+        a = eb_alloc_zeroed(&alloc, sizeof(*a));
+        eb_assert_or_recover(a, return false);
+        a->in_use = true;
+        
+        eb_spinlock_lock(&g_accts_lock);
+            a->next = g_accts;
+            g_accts = a;
+        eb_spinlock_unlock(&g_accts_lock);
+    }
+    
+    t->acct = a;
+    return cleanup_register(t);
+}
+
+eb_thread *eb_thread_current() {
+    return &t_thread;
+}
+
+unsigned int eb_thread_stats_shard(unsigned int nshards) {
+    /* Assign shards round-robin as threads first use them */
+    if (!t_thread.stats_shard) {
+        t_thread.stats_shard = eb_atomic_add(&g_next_stats_shard, 1);
+    }
+    return (t_thread.stats_shard - 1) % nshards;
+}
+
+long eb_thread_id() {
+    if (!t_thread.tid) {
+        t_thread.tid = eb_sys_thread_id();
+    }
+    return t_thread.tid;
+}
+
+void eb_thread_check_alloc() {
+    eb_assert_or_bail(!(t_thread.strict && t_thread.in_hot_path), "Allocation in the hot path after eb_chan_thread_prepare()");
+}
+
+void eb_thread_account(bool timed_out, const uint64_t ticks[eb_thread_phase_count]) {
+    eb_thread *t = &t_thread;
+    if (!t->acct && !acct_create(t)) {
+        return;
+    }
+    
+    /* We're the only writer, but other threads read while aggregating */
+    eb_atomic_add_relaxed(&t->acct->selects[timed_out], 1);
+    for (size_t i = 0; i < eb_thread_phase_count; i++) {
+        eb_atomic_add_relaxed(&t->acct->ticks[timed_out][i], ticks[i]);
+    }
+}
+
+#if EB_CHAN_BLOCKED_TIME
+    static void acct_add(eb_chan_thread_times *out, const eb_thread_acct *a) {
+        eb_chan_phase_times *times[2] = {&out->completed, &out->timed_out};
+        for (size_t i = 0; i < 2; i++) {
+            times[i]->selects += eb_atomic_load_relaxed(&a->selects[i]);
+            times[i]->spin += eb_time_ticks_to_nsec(eb_atomic_load_relaxed(&a->ticks[i][eb_thread_phase_spin]));
+            times[i]->park += eb_time_ticks_to_nsec(eb_atomic_load_relaxed(&a->ticks[i][eb_thread_phase_park]));
+            times[i]->wake += eb_time_ticks_to_nsec(eb_atomic_load_relaxed(&a->ticks[i][eb_thread_phase_wake]));
+        }
+    }
+#endif
+
+#pragma mark - Public API -
+bool eb_chan_thread_prepare(unsigned int flags) {
+    /* Initialize eb_sys so that eb_sys_ncores is valid. */
+    eb_sys_init();
+    
+    eb_thread *t = &t_thread;
+    if (!t->port) {
+        t->port = eb_port_create();
+        eb_assert_or_recover(t->port, return false);
+        
+        /* Register our thread-exit handler, which releases our port */
+        bool r = cleanup_register(t);
+        eb_assert_or_recover(r, eb_port_release(t->port); t->port = NULL; return false);
+    }
+    
+    #if EB_CHAN_BLOCKED_TIME
+        /* Create the thread's accounting now, so that enabling accounting later doesn't allocate in the hot path */
+        if (!t->acct) {
+            bool r = acct_create(t);
+            eb_assert_or_recover(r, return false);
+        }
+    #endif
+    
+    #if EB_CHAN_TRACE
+        /* Give the thread its flight recorder ring now, so that recording events doesn't allocate */
+        bool traced = eb_trace_thread_prepare();
+        eb_assert_or_recover(traced, return false);
+    #endif
+    
+    if (flags & eb_chan_prepare_mlock) {
+        bool r = eb_port_mlock(t->port);
+        eb_assert_or_recover(r, return false);
+    }
+    
+    t->strict = (flags & eb_chan_prepare_strict);
+    return true;
+}
+
+bool eb_chan_blocked_time_enable() {
+    #if EB_CHAN_BLOCKED_TIME
+        eb_time_ticks_init();
+        eb_atomic_barrier();
+        eb_thread_accounting = 1;
+        return true;
+    #else
+        return false;
+    #endif
+}
+
+bool eb_chan_thread_blocked_time(eb_chan_thread_times *out) {
+    assert(out);
+    
+    memset(out, 0, sizeof(*out));
+    #if EB_CHAN_BLOCKED_TIME
+        if (t_thread.acct) {
+            acct_add(out, t_thread.acct);
+        }
+        return eb_thread_accounting;
+    #else
+        return false;
+    #endif
+}
+
+bool eb_chan_all_blocked_time(eb_chan_thread_times *out) {
+    assert(out);
+    
+    memset(out, 0, sizeof(*out));
+    #if EB_CHAN_BLOCKED_TIME
+        eb_spinlock_lock(&g_accts_lock);
+            acct_add(out, &g_accts_exited);
+            for (const eb_thread_acct *a = g_accts; a; a = a->next) {
+                if (a->in_use) {
+                    acct_add(out, a);
+                }
+            }
+        eb_spinlock_unlock(&g_accts_lock);
+        return eb_thread_accounting;
+    #else
+        return false;
+    #endif
+}
+
+static void *default_alloc(void *ctx, size_t size) {
+    return malloc(size);
+}
+
+static void *default_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size) {
+    return realloc(ptr, new_size);
+}
+
+static void default_free(void *ctx, void *ptr, size_t size) {
+    free(ptr);
+}
+
+static const eb_chan_allocator k_default_allocator = {
+    .alloc = default_alloc,
+    .realloc = default_realloc,
+    .free = default_free,
+    .ctx = NULL,
+};
+
+static eb_spinlock g_allocator_lock = EB_SPINLOCK_INIT;
+static eb_chan_allocator g_allocator = {
+    .alloc = default_alloc,
+    .realloc = default_realloc,
+    .free = default_free,
+    .ctx = NULL,
+};
+
+static uint64_t g_allocs = 0;
+static uint64_t g_reallocs = 0;
+static uint64_t g_frees = 0;
+static uint64_t g_bytes_allocated = 0;
+static uint64_t g_bytes_freed = 0;
+
+eb_chan_allocator eb_alloc_global() {
+    eb_chan_allocator r;
+    eb_spinlock_lock(&g_allocator_lock);
+        r = g_allocator;
+    eb_spinlock_unlock(&g_allocator_lock);
+    return r;
+}
+
+void *eb_alloc(const eb_chan_allocator *a, size_t size) {
+    assert(a);
+    eb_thread_check_alloc();
+    
+    void *r = a->alloc(a->ctx, size);
+    if (r) {
+        eb_atomic_add(&g_allocs, 1);
+        eb_atomic_add(&g_bytes_allocated, size);
+    }
+    return r;
+}
+
+void *eb_alloc_zeroed(const eb_chan_allocator *a, size_t size) {
+    void *r = eb_alloc(a, size);
+    if (r) {
+        memset(r, 0, size);
+    }
+    return r;
+}
+
+void *eb_realloc(const eb_chan_allocator *a, void *ptr, size_t old_size, size_t new_size) {
+    assert(a);
+    eb_thread_check_alloc();
+    
+    if (!ptr) {
+        return eb_alloc(a, new_size);
+    }
+    
+    void *r = NULL;
+    if (a->realloc) {
+        r = a->realloc(a->ctx, ptr, old_size, new_size);
+    } else {
+        /* The allocator doesn't support resizing, so emulate it */
+        r = a->alloc(a->ctx, new_size);
+        if (r) {
+            memcpy(r, ptr, (old_size < new_size ? old_size : new_size));
+            a->free(a->ctx, ptr, old_size);
+        }
+    }
+    
+    if (r) {
+        eb_atomic_add(&g_reallocs, 1);
+        eb_atomic_add(&g_bytes_allocated, new_size);
+        eb_atomic_add(&g_bytes_freed, old_size);
+    }
+    return r;
+}
+
+void eb_free(const eb_chan_allocator *a, void *ptr, size_t size) {
+    assert(a);
+    
+    /* Intentionally allowing ptr==NULL, like free() */
+    if (!ptr) {
+        return;
+    }
+    
+    /* Not checked against a strict thread's allocation policy: freeing doesn't allocate, and a strict thread can
+       release the last reference to another thread's object (e.g. a port it signaled) */
+    a->free(a->ctx, ptr, size);
+    eb_atomic_add(&g_frees, 1);
+    eb_atomic_add(&g_bytes_freed, size);
+}
+
+#pragma mark - Public API -
+void eb_chan_set_allocator(const eb_chan_allocator *a) {
+    /* A NULL allocator restores the default (malloc()/realloc()/free()) */
+    if (a) {
+        eb_assert_or_bail(a->alloc && a->free, "Allocator must supply alloc() and free()");
+    }
+    
+    eb_spinlock_lock(&g_allocator_lock);
+        g_allocator = (a ? *a : k_default_allocator);
+    eb_spinlock_unlock(&g_allocator_lock);
+}
+
+void eb_chan_alloc_stats(eb_chan_alloc_counts *out) {
+    assert(out);
+    
+    /* Adding zero is an atomic read */
+    uint64_t bytes_allocated = eb_atomic_add(&g_bytes_allocated, 0);
+    uint64_t bytes_freed = eb_atomic_add(&g_bytes_freed, 0);
+    *out = (eb_chan_alloc_counts){
+        .allocs = eb_atomic_add(&g_allocs, 0),
+        .reallocs = eb_atomic_add(&g_reallocs, 0),
+        .frees = eb_atomic_add(&g_frees, 0),
+        .bytes_allocated = bytes_allocated,
+        .bytes_in_use = (bytes_allocated > bytes_freed ? bytes_allocated - bytes_freed : 0),
+    };
+}
+// #######################################################
+// ## eb_numa.h
+// #######################################################
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* ## Functions */
+/* Returns an allocator whose allocations are placed on NUMA node 'node', or left to the default (first-touch) policy if
+   'node' is negative. Small allocations for a node share pages with others for the same node; those for a negative
+   'node' get pages of their own, so that eb_numa_move() migrates nothing else. On systems without NUMA support, this is
+   equivalent to malloc()/realloc()/free(). */
+eb_chan_allocator eb_numa_allocator(int node);
+/* Migrates the pages containing [ptr, ptr+size), which must have been allocated by a NUMA allocator, to 'node' */
+bool eb_numa_move(void *ptr, size_t size, int node);
+// #######################################################
+// ## eb_numa.c
+// #######################################################
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#if EB_SYS_LINUX
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+#endif
+
+#if EB_SYS_LINUX
+/* Values from <numaif.h>, which we don't depend on since it's part of libnuma */
+#define EB_MPOL_PREFERRED 1
+#define EB_MPOL_MF_MOVE (1 << 1)
+/* From <sys/mman.h>, which only declares mremap() and its flags with _GNU_SOURCE */
+#define EB_MREMAP_MAYMOVE 1
+
+#ifndef MAP_ANONYMOUS
+    #define MAP_ANONYMOUS MAP_ANON
+#endif
+
+static size_t page_round(size_t size) {
+    static size_t k_page_size = 0;
+    if (!k_page_size) {
+        long r = sysconf(_SC_PAGESIZE);
+        k_page_size = (r > 0 ? (size_t)r : 4096);
+    }
+    return (size + k_page_size - 1) & ~(k_page_size - 1);
+}
+
+/* Sets the memory policy of the pages containing [ptr, ptr+size) to prefer 'node'. */
+static bool numa_bind(void *ptr, size_t size, int node, unsigned int flags) {
+    if (node < 0 || node >= EB_SYS_MAX_NODES) {
+        return false;
+    }
+    
+    unsigned long mask[EB_SYS_MAX_NODES / (8 * sizeof(unsigned long))];
+    memset(mask, 0, sizeof(mask));
+    mask[node / (8 * sizeof(*mask))] |= (1UL << (node % (8 * sizeof(*mask))));
+    
+    /* mbind() requires a page-aligned address */
+    uintptr_t start = (uintptr_t)ptr & ~(page_round(1) - 1);
+    size_t len = page_round(((uintptr_t)ptr + size) - start);
+    long r = syscall(SYS_mbind, (void *)start, len, EB_MPOL_PREFERRED, mask, (unsigned long)EB_SYS_MAX_NODES + 1, flags);
+    return !r;
+}
+#endif
+
+#if EB_SYS_LINUX
+/* Allocations for a node that are no larger than EB_NUMA_SLAB_MAX are carved from EB_NUMA_CHUNK_SIZE chunks that are
+   bound to the node, in power-of-two size classes starting at EB_NUMA_SLAB_MIN (so each is aligned to its class).
+   Freed ones are kept on their class's free list for reuse, and chunks are never unmapped, so neither path makes a
+   system call once the node's chunks are warm. Larger allocations, and those without a node (which may be moved by
+   eb_numa_move(), so they need pages of their own) are mapped directly. */
+#define EB_NUMA_SLAB_MIN 16
+#define EB_NUMA_SLAB_MAX 2048
+#define EB_NUMA_SLAB_CLASSES 8
+#define EB_NUMA_CHUNK_SIZE (64 * 1024)
+
+typedef struct {
+    eb_spinlock lock;
+    void *free[EB_NUMA_SLAB_CLASSES];   /* Each freed slot stores the next one */
+    uint8_t *cur;                       /* The unused remainder of the current chunk */
+    uint8_t *end;
+} arena;
+static arena g_arenas[EB_SYS_MAX_NODES];
+
+/* Returns the arena for an allocation, or NULL if it should be mapped directly. Fills 'class' with its size class. */
+static arena *arena_for(int node, size_t size, size_t *class) {
+    if (node < 0 || node >= EB_SYS_MAX_NODES || size > EB_NUMA_SLAB_MAX) {
+        return NULL;
+    }
+    size_t c = 0;
+    for (size_t s = EB_NUMA_SLAB_MIN; s < size; s <<= 1) {
+        c++;
+    }
+    *class = c;
+    return &g_arenas[node];
+}
+
+static void *map_pages(size_t size, int node) {
+    void *r = mmap(NULL, page_round(size), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r == MAP_FAILED) {
+        return NULL;
+    }
+    
+    /* Bind before the pages are touched, so that they're faulted in on the right node. Failure isn't fatal (e.g.
+       the kernel lacks NUMA support), it just means the pages are placed by the default policy. */
+    if (node >= 0 && eb_sys_node_count() > 1) {
+        numa_bind(r, size, node, 0);
+    }
+    return r;
+}
+#endif
+
+static void *numa_allocator_alloc(void *ctx, size_t size) {
+    #if EB_SYS_LINUX
+        int node = (int)(intptr_t)ctx;
+        size_t class = 0;
+        arena *a = arena_for(node, size, &class);
+        if (!a) {
+            return map_pages(size, node);
+        }
+        
+        size_t class_size = ((size_t)EB_NUMA_SLAB_MIN << class);
+        void *r = NULL;
+        eb_spinlock_lock(&a->lock);
+            if (a->free[class]) {
+                r = a->free[class];
+                a->free[class] = *((void **)r);
+            } else {
+                if ((size_t)(a->end - a->cur) < class_size) {
+                    /* The remainder of the current chunk is abandoned, which wastes less than EB_NUMA_SLAB_MAX */
+                    uint8_t *chunk = map_pages(EB_NUMA_CHUNK_SIZE, node);
+                    if (chunk) {
+                        a->cur = chunk;
+                        a->end = chunk + EB_NUMA_CHUNK_SIZE;
+                    }
+                }
+                if ((size_t)(a->end - a->cur) >= class_size) {
+                    r = a->cur;
+                    a->cur += class_size;
+                }
+            }
+        eb_spinlock_unlock(&a->lock);
+        return r;
+    #else
+        return malloc(size);
+    #endif
+}
+
+static void numa_allocator_free(void *ctx, void *ptr, size_t size) {
+    #if EB_SYS_LINUX
+        size_t class = 0;
+        arena *a = arena_for((int)(intptr_t)ctx, size, &class);
+        if (!a) {
+            int r = munmap(ptr, page_round(size));
+            eb_assert_or_recover(!r, eb_no_op);
+            return;
+        }
+        
+        eb_spinlock_lock(&a->lock);
+            *((void **)ptr) = a->free[class];
+            a->free[class] = ptr;
+        eb_spinlock_unlock(&a->lock);
+    #else
+        free(ptr);
+    #endif
+}
+
+static void *numa_allocator_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size) {
+    #if EB_SYS_LINUX
+        int node = (int)(intptr_t)ctx;
+        size_t old_class = 0, new_class = 0;
+        arena *old_arena = arena_for(node, old_size, &old_class);
+        arena *new_arena = arena_for(node, new_size, &new_class);
+        if (old_arena && new_arena && old_class == new_class) {
+            return ptr;
+        }
+        
+        if (!old_arena && !new_arena) {
+            if (page_round(old_size) == page_round(new_size)) {
+                return ptr;
+            }
+            /* Resize the mapping in place if possible, which keeps its pages (and their memory policy) rather than
+               copying them */
+            void *r = (void *)syscall(SYS_mremap, ptr, page_round(old_size), page_round(new_size), EB_MREMAP_MAYMOVE);
+            return (r == MAP_FAILED ? NULL : r);
+        }
+        
+        /* Moving between the chunks and a mapping of its own requires a copy */
+        void *r = numa_allocator_alloc(ctx, new_size);
+        if (r) {
+            memcpy(r, ptr, (old_size < new_size ? old_size : new_size));
+            numa_allocator_free(ctx, ptr, old_size);
+        }
+        return r;
+    #else
+        return realloc(ptr, new_size);
+    #endif
+}
+
+eb_chan_allocator eb_numa_allocator(int node) {
+    return (eb_chan_allocator){.alloc = numa_allocator_alloc, .realloc = numa_allocator_realloc, .free = numa_allocator_free, .ctx = (void *)(intptr_t)node};
+}
+
+bool eb_numa_move(void *ptr, size_t size, int node) {
+    assert(ptr);
+    #if EB_SYS_LINUX
+        if (eb_sys_node_count() <= 1) {
+            return true;
+        }
+        return numa_bind(ptr, size, node, EB_MPOL_MF_MOVE);
+    #else
+        return true;
+    #endif
+}
+// #######################################################
+// ## eb_hist.h
+// #######################################################
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A log-linear (HDR-style) histogram of nanosecond values. Each power-of-two range is split into
+   2^EB_HIST_SUB_BITS linear buckets, which bounds the relative error of a reported value to 2^-EB_HIST_SUB_BITS.
+   Recording is lock-free. */
+#define EB_HIST_SUB_BITS 4
+#define EB_HIST_NBUCKETS ((64 - EB_HIST_SUB_BITS + 1) << EB_HIST_SUB_BITS)
+
+/* ## Types */
+typedef struct {
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[EB_HIST_NBUCKETS];
+} eb_hist;
+
+/* ## Functions */
+void eb_hist_record(eb_hist *h, eb_nsec val);
+/* Returns the value at percentile 'pct' (in [0, 100]) of the values recorded so far, or 0 if nothing was recorded */
+eb_nsec eb_hist_percentile(const eb_hist *h, double pct);
+// #######################################################
+// ## eb_hist.c
+// #######################################################
+
+#include <assert.h>
+
+static inline size_t bucket_idx(uint64_t val) {
+    static const uint64_t k_sub_count = (1 << EB_HIST_SUB_BITS);
+    
+    /* Small values map directly to buckets */
+    if (val < k_sub_count) {
+        return (size_t)val;
+    }
+    
+    /* Otherwise, the bucket is determined by the position of the most significant bit (the range), and the
+       EB_HIST_SUB_BITS bits below it (the linear position within the range) */
+    unsigned int msb = 63 - __builtin_clzll(val);
+    unsigned int shift = msb - EB_HIST_SUB_BITS;
+    return (size_t)(((shift + 1) << EB_HIST_SUB_BITS) + ((val >> shift) & (k_sub_count - 1)));
+}
+
+/* Returns the largest value that maps to bucket 'idx' */
+static inline uint64_t bucket_max(size_t idx) {
+    static const uint64_t k_sub_count = (1 << EB_HIST_SUB_BITS);
+    
+    if (idx < k_sub_count) {
+        return idx;
+    }
+    
+    unsigned int shift = (unsigned int)(idx >> EB_HIST_SUB_BITS) - 1;
+    uint64_t base = (k_sub_count | (idx & (k_sub_count - 1))) << shift;
+    return base + ((UINT64_C(1) << shift) - 1);
+}
+
+void eb_hist_record(eb_hist *h, eb_nsec val) {
+    assert(h);
+    
+    eb_atomic_add_relaxed(&h->buckets[bucket_idx(val)], 1);
+    eb_atomic_add_relaxed(&h->count, 1);
+    
+    /* Update the max, unless someone beat us to a larger value */
+    for (uint64_t max = eb_atomic_load_relaxed(&h->max); val > max; max = eb_atomic_load_relaxed(&h->max)) {
+        if (eb_atomic_compare_and_swap(&h->max, max, val)) {
+            break;
+        }
+    }
+}
+
+eb_nsec eb_hist_percentile(const eb_hist *h, double pct) {
+    assert(h);
+    
+    uint64_t count = eb_atomic_load_relaxed(&h->count);
+    if (!count) {
+        return 0;
+    }
+    
+    /* The rank of the value we're looking for (1-based) */
+    uint64_t rank = (uint64_t)((pct / 100.0) * count + 0.5);
+    rank = (rank < 1 ? 1 : (rank > count ? count : rank));
+    
+    uint64_t seen = 0;
+    for (size_t i = 0; i < EB_HIST_NBUCKETS; i++) {
+        seen += eb_atomic_load_relaxed(&h->buckets[i]);
+        if (seen >= rank) {
+            /* Don't report more than the largest value that was actually recorded */
+            uint64_t max = eb_atomic_load_relaxed(&h->max);
+            uint64_t r = bucket_max(i);
+            return (r < max ? r : max);
+        }
+    }
+    return eb_atomic_load_relaxed(&h->max);
+}
+// #######################################################
+// ## eb_capture.h
+// #######################################################
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* Whether traffic capture is compiled in (see eb_chan_capture_start()). Capturing costs a predictable branch per op
+   while no capture is running. Defining EB_CHAN_CAPTURE=0 removes it entirely. */
+#ifndef EB_CHAN_CAPTURE
+    #define EB_CHAN_CAPTURE 1
+#endif
+
+/* The size of each thread's record buffer, which is written to the capture file when it fills up */
+#define EB_CAPTURE_BUF_SIZE 16384
+/* Channel names longer than this are truncated in the capture file */
+#define EB_CAPTURE_NAME_MAX 255
+
+/* ## Variables */
+/* The running capture's session number (starting at 1), or 0 while not capturing (checked before every op) */
+extern uint32_t eb_capture_session;
+
+/* ## Functions */
+/* Returns a new capture-local channel id; the caller must then _define() the channel */
+uint32_t eb_capture_chan_next();
+/* Records the definition of channel 'chan' in 'session': its capacity and (possibly NULL) name */
+void eb_capture_define(uint32_t session, uint32_t chan, size_t cap, const char *name);
+/* Records an op of 'type' (an eb_chan_capture_type) on channel 'chan' in 'session', which was issued at tick 'start'
+   and completed at tick 'end', leaving 'depth' values in the channel's buffer */
+void eb_capture_record(uint32_t session, uint8_t type, uint8_t flags, uint32_t chan, size_t depth, uint64_t start,
+    uint64_t end);
+// #######################################################
+// ## eb_capture.c
+// #######################################################
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+/* A thread's buffer of encoded records. The owning thread appends to it with 'lock' held; eb_chan_capture_stop() takes
+   the lock to write out what's left. Like the flight recorder's rings, buffers are never freed: when a thread exits its
+   buffer is written out and kept, until another thread adopts it. */
+typedef struct buffer buffer;
+struct buffer {
+    buffer *next;
+    bool in_use;
+    eb_spinlock lock;
+    /* Whether a thread is writing the buffer's records to the capture file, with the lock released */
+    bool writing;
+    /* The session that the buffered records belong to */
+    uint32_t session;
+    size_t len;
+    uint8_t bytes[EB_CAPTURE_BUF_SIZE];
+};
+
+uint32_t eb_capture_session = 0;
+#if EB_CHAN_CAPTURE
+    static uint32_t g_capture_last_session = 0;
+#endif
+/* Protects g_capture_file and g_capture_file_ok, and starting/stopping */
+static eb_spinlock g_capture_file_lock = EB_SPINLOCK_INIT;
+static FILE *g_capture_file = NULL;
+static bool g_capture_file_ok = false;
+static uint64_t g_capture_start_ticks = 0;
+static uint32_t g_capture_next_chan = 0;
+static uint32_t g_capture_next_thread = 0;
+static buffer *g_capture_buffers = NULL;
+static eb_spinlock g_capture_buffers_lock = EB_SPINLOCK_INIT;
+static __thread buffer *t_capture_buffer = NULL;
+/* The calling thread's capture-local id, valid if t_capture_session is the running session */
+static __thread uint32_t t_capture_session = 0;
+static __thread uint16_t t_capture_thread = 0;
+static pthread_once_t g_capture_buffer_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_capture_buffer_key;
+
+/* Writes out the records in 'b' to 'f' (or drops them if 'f' is NULL), and empties 'b'. 'b' must be locked; the lock is
+   released during the write so that a slow file doesn't stall eb_chan_capture_stop() or other threads' buffers, and
+   'writing' keeps the buffer from being written or emptied by another thread meanwhile. eb_chan_capture_stop() waits
+   for 'writing' to clear before closing the file, so 'f' stays valid if it was obtained with 'b' locked. */
+static void buffer_write(buffer *b, FILE *f) {
+    while (b->writing) {
+        eb_spinlock_unlock(&b->lock);
+        eb_sys_yield();
+        eb_spinlock_lock(&b->lock);
+    }
+    
+    if (f && b->len) {
+        b->writing = true;
+        eb_spinlock_unlock(&b->lock);
+        bool ok = (fwrite(b->bytes, 1, b->len, f) == b->len);
+        if (!ok) {
+            eb_spinlock_lock(&g_capture_file_lock);
+                g_capture_file_ok = false;
+            eb_spinlock_unlock(&g_capture_file_lock);
+        }
+        eb_spinlock_lock(&b->lock);
+        b->writing = false;
+    }
+    b->len = 0;
+}
+
+/* Returns the capture file. After seeing that a buffer's session is running with the buffer locked, the file stays open
+   until the buffer is written out, even if the session ends meanwhile: eb_chan_capture_stop() only closes it after
+   walking every buffer, which it can't do while the buffer is locked. */
+static FILE *capture_file() {
+    eb_spinlock_lock(&g_capture_file_lock);
+        FILE *f = g_capture_file;
+    eb_spinlock_unlock(&g_capture_file_lock);
+    return f;
+}
+
+/* Called when a thread with a buffer exits, so that the buffer can be adopted by another thread */
+static void buffer_cleanup(void *arg) {
+    buffer *b = arg;
+    eb_spinlock_lock(&b->lock);
+        /* Records of a session that has ended are left for eb_chan_capture_stop() to write out (or were already) */
+        if (b->len && b->session == *((volatile uint32_t *)&eb_capture_session)) {
+            buffer_write(b, capture_file());
+        }
+    eb_spinlock_unlock(&b->lock);
+    
+    eb_spinlock_lock(&g_capture_buffers_lock);
+        b->in_use = false;
+    eb_spinlock_unlock(&g_capture_buffers_lock);
+}
+
+static void buffer_key_create() {
+    int r = pthread_key_create(&g_capture_buffer_key, buffer_cleanup);
+    eb_assert_or_bail(!r, "pthread_key_create() failed");
+}
+
+/* Returns the calling thread's buffer, adopting or allocating one if necessary */
+static buffer *buffer_current() {
+    if (t_capture_buffer) {
+        return t_capture_buffer;
+    }
+    
+    /* Adopt the buffer of a thread that exited */
+    buffer *b = NULL;
+    eb_spinlock_lock(&g_capture_buffers_lock);
+        for (buffer *i = g_capture_buffers; i; i = i->next) {
+            if (!i->in_use) {
+                b = i;
+                b->in_use = true;
+                break;
+            }
+        }
+    eb_spinlock_unlock(&g_capture_buffers_lock);
+    
+    if (!b) {
+        eb_chan_allocator alloc = eb_alloc_global();
+        b = eb_alloc_zeroed(&alloc, sizeof(*b));
+        eb_assert_or_recover(b, return NULL);
+        b->in_use = true;
+        b->lock = EB_SPINLOCK_INIT;
+        
+        eb_spinlock_lock(&g_capture_buffers_lock);
+            b->next = g_capture_buffers;
+            g_capture_buffers = b;
+        eb_spinlock_unlock(&g_capture_buffers_lock);
+    }
+    
+    /* Register our thread-exit handler, which releases the buffer */
+    pthread_once(&g_capture_buffer_key_once, buffer_key_create);
+    int err = pthread_setspecific(g_capture_buffer_key, b);
+    eb_assert_or_recover(!err, eb_no_op);
+    
+    t_capture_buffer = b;
+    return b;
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    put16(p, (uint16_t)v);
+    put16(p + 2, (uint16_t)(v >> 16));
+}
+
+static void put64(uint8_t *p, uint64_t v) {
+    put32(p, (uint32_t)v);
+    put32(p + 4, (uint32_t)(v >> 32));
+}
+
+/* Appends a record (and 'extra_len' bytes of 'extra') to the calling thread's buffer, unless 'session' has ended */
+static void append(uint32_t session, uint64_t time, uint32_t wait, uint32_t chan, uint32_t depth, uint16_t thread,
+    uint8_t type, uint8_t flags, const void *extra, size_t extra_len) {
+    buffer *b = buffer_current();
+    if (!b) {
+        return;
+    }
+    
+    eb_spinlock_lock(&b->lock);
+        /* Checking the session with the buffer locked guarantees that eb_chan_capture_stop() either sees our record,
+           or we see that the session ended */
+        if (*((volatile uint32_t *)&eb_capture_session) == session) {
+            if (b->session != session) {
+                b->session = session;
+                b->len = 0;
+            }
+            if (b->len + EB_CHAN_CAPTURE_RECORD_SIZE + extra_len > sizeof(b->bytes)) {
+                /* The session was running when we checked it, so the file is still open (see capture_file()) */
+                buffer_write(b, capture_file());
+            }
+            
+            uint8_t *p = &b->bytes[b->len];
+            put64(p, time);
+            put32(p + 8, wait);
+            put32(p + 12, chan);
+            put32(p + 16, depth);
+            put16(p + 20, thread);
+            p[22] = type;
+            p[23] = flags;
+            if (extra_len) {
+                memcpy(p + EB_CHAN_CAPTURE_RECORD_SIZE, extra, extra_len);
+            }
+            b->len += EB_CHAN_CAPTURE_RECORD_SIZE + extra_len;
+        }
+    eb_spinlock_unlock(&b->lock);
+}
+
+uint32_t eb_capture_chan_next() {
+    return eb_atomic_add(&g_capture_next_chan, 1);
+}
+
+void eb_capture_define(uint32_t session, uint32_t chan, size_t cap, const char *name) {
+    size_t name_len = (name ? strlen(name) : 0);
+    if (name_len > EB_CAPTURE_NAME_MAX) {
+        name_len = EB_CAPTURE_NAME_MAX;
+    }
+    append(session, 0, 0, chan, (uint32_t)(cap < UINT32_MAX ? cap : UINT32_MAX), (uint16_t)name_len,
+        eb_chan_capture_define, 0, name, name_len);
+}
+
+void eb_capture_record(uint32_t session, uint8_t type, uint8_t flags, uint32_t chan, size_t depth, uint64_t start,
+    uint64_t end) {
+    if (t_capture_session != session) {
+        t_capture_session = session;
+        t_capture_thread = (uint16_t)eb_atomic_add(&g_capture_next_thread, 1);
+    }
+    
+    uint64_t time = eb_time_ticks_to_nsec(start > g_capture_start_ticks ? start - g_capture_start_ticks : 0);
+    uint64_t wait = eb_time_ticks_to_nsec(end > start ? end - start : 0);
+    append(session, time, (uint32_t)(wait < UINT32_MAX ? wait : UINT32_MAX), chan,
+        (uint32_t)(depth < UINT32_MAX ? depth : UINT32_MAX), t_capture_thread, type, flags, NULL, 0);
+}
+
+#pragma mark - Public API -
+bool eb_chan_capture_start(const char *path) {
+    assert(path);
+    
+    #if EB_CHAN_CAPTURE
+        /* Don't truncate the file of a running capture (this is checked again below, with the lock held) */
+        if (*((FILE *volatile *)&g_capture_file)) {
+            return false;
+        }
+        
+        FILE *f = fopen(path, "wb");
+        eb_assert_or_recover(f, return false);
+        bool ok = (fwrite(EB_CHAN_CAPTURE_MAGIC, 1, 8, f) == 8);
+        eb_assert_or_recover(ok, fclose(f); return false);
+        
+        eb_time_ticks_init();
+        bool started = false;
+        eb_spinlock_lock(&g_capture_file_lock);
+            if (!g_capture_file) {
+                g_capture_file = f;
+                g_capture_file_ok = true;
+                g_capture_start_ticks = eb_time_ticks();
+                g_capture_next_chan = 0;
+                g_capture_next_thread = 0;
+                /* Publish the new session last, so that ops observing it see the state above */
+                eb_atomic_barrier();
+                eb_capture_session = ++g_capture_last_session;
+                started = true;
+            }
+        eb_spinlock_unlock(&g_capture_file_lock);
+        
+        if (!started) {
+            fclose(f);
+        }
+        return started;
+    #else
+        return false;
+    #endif
+}
+
+bool eb_chan_capture_stop() {
+    /* End the session, so that no more records are appended */
+    eb_spinlock_lock(&g_capture_file_lock);
+        uint32_t session = eb_capture_session;
+        eb_capture_session = 0;
+    eb_spinlock_unlock(&g_capture_file_lock);
+    if (!session) {
+        return false;
+    }
+    eb_atomic_barrier();
+    
+    /* Only we close the file, and appends of the ended session can no longer start writes, so it's stable */
+    eb_spinlock_lock(&g_capture_file_lock);
+        FILE *f = g_capture_file;
+    eb_spinlock_unlock(&g_capture_file_lock);
+    
+    /* Write out every thread's records, after any write that a thread had already started. (Buffers are only ever
+       prepended to the list, so it's safe to walk without the lock.) */
+    for (buffer *b = *((buffer *volatile *)&g_capture_buffers); b; b = b->next) {
+        eb_spinlock_lock(&b->lock);
+            buffer_write(b, (b->session == session ? f : NULL));
+        eb_spinlock_unlock(&b->lock);
+    }
+    
+    eb_spinlock_lock(&g_capture_file_lock);
+        bool ok = g_capture_file_ok;
+        g_capture_file = NULL;
+    eb_spinlock_unlock(&g_capture_file_lock);
+    ok = !fclose(f) && ok;
+    return ok;
+}
+
+/* Whether wakeups prefer waiters close to the signaling thread (see port_list_signal_first()) */
+#ifndef EB_CHAN_WAKE_LOCALITY
+    #define EB_CHAN_WAKE_LOCALITY 1
+#endif
+
+/* Whether per-channel statistics are collected (see eb_chan_stats()). Defining EB_CHAN_STATS=0 removes them entirely. */
+#ifndef EB_CHAN_STATS
+    #define EB_CHAN_STATS 1
+#endif
+
+/* The number of shards that each channel's lock-free counters are spread across, to limit contention */
+#define EB_CHAN_STATS_SHARDS 4
+/* The alignment of a channel's statistics, so that each shard has a cache line to itself */
+#define EB_CHAN_STATS_ALIGN 64
+
+/* Whether channels support latency measurement (see eb_chan_latency_enable()). Defining EB_CHAN_LATENCY=0 removes it
+   entirely. */
+#ifndef EB_CHAN_LATENCY
+    #define EB_CHAN_LATENCY 1
+#endif
+
+#pragma mark - Types -
+typedef struct {
+    eb_spinlock lock;
+    size_t cap;
+    size_t len;
+    eb_port *ports;
+    /* The first waiter that was passed over in favor of a closer one, and how many consecutive times it was passed over */
+    eb_port bypassed_port;
+    unsigned int bypassed;
+    #if EB_CHAN_LOCKPROF
+        eb_spinlock_prof lock_prof;
+    #endif
+} port_list;
+
+/* Initializes an empty list. The list's buffer isn't allocated until the first port is added, so that channels which
+   never block (and channels initialized in caller-provided storage) don't incur an allocation. */
+static inline void port_list_init(port_list *l) {
+    assert(l);
+    
+    l->lock = EB_SPINLOCK_INIT;
+    l->cap = 0;
+    l->len = 0;
+    l->ports = NULL;
+    l->bypassed_port = NULL;
+    l->bypassed = 0;
+}
+
+/* Releases every port in the list, and frees the list's buffer */
+static inline void port_list_deinit(port_list *l, const eb_chan_allocator *a) {
+    assert(l);
+    assert(a);
+    
+    /* Release each port in our list */
+    for (size_t i = 0; i < l->len; i++) {
+        eb_port_release(l->ports[i]);
+    }
+    
+    eb_free(a, l->ports, l->cap * sizeof(*(l->ports)));
+    l->ports = NULL;
+    l->cap = 0;
+    l->len = 0;
+}
+
+/* Add a port to the end of the list, expanding the buffer as necessary */
+static inline void port_list_add(port_list *l, const eb_chan_allocator *a, eb_port p) {
+    assert(l);
+    assert(a);
+    assert(p);
+    
+    /* First retain the port! */
+    eb_port_retain(p);
+    
+    eb_spinlock_lock_prof(&l->lock, &l->lock_prof);
+        /* Sanity-check that the list's length is less than its capacity */
+        eb_sanity_or_bail(l->len <= l->cap, "Sanity check failed");
+        
+        /* Expand the list's buffer if it's full (or hasn't been allocated yet) */
+        if (l->len == l->cap) {
+            size_t old_cap = l->cap;
+            l->cap = (l->cap ? l->cap * 2 : eb_config.waiter_list_cap);
+            // TODO: reimplement as a linked list, where the port nodes are just on the stacks of the _select_list() calls. that way the number of ports is unbounded, and we don't have to allocate anything on the heap!
+            l->ports = eb_realloc(a, l->ports, old_cap * sizeof(*(l->ports)), l->cap * sizeof(*(l->ports)));
+            eb_assert_or_bail(l->ports, "Allocation failed");
+        }
+        
+        l->ports[l->len] = p;
+        l->len++;
+    eb_spinlock_unlock(&l->lock);
+}
+
+/* Expand the list's buffer so that it can hold at least 'cap' ports without reallocating */
+static inline bool port_list_reserve(port_list *l, const eb_chan_allocator *a, size_t cap) {
+    assert(l);
+    assert(a);
+    
+    bool result = true;
+    eb_spinlock_lock_prof(&l->lock, &l->lock_prof);
+        if (cap > l->cap) {
+            eb_port *ports = eb_realloc(a, l->ports, l->cap * sizeof(*(l->ports)), cap * sizeof(*(l->ports)));
+            if (ports) {
+                l->ports = ports;
+                l->cap = cap;
+            } else {
+                result = false;
+            }
+        }
+    eb_spinlock_unlock(&l->lock);
+    
+    eb_assert_or_recover(result, eb_no_op);
+    return result;
+}
+
+/* Locks the list's buffer into RAM */
+static inline bool port_list_mlock(port_list *l) {
+    assert(l);
+    
+    bool result = true;
+    eb_spinlock_lock_prof(&l->lock, &l->lock_prof);
+        if (l->ports) {
+            result = !mlock(l->ports, l->cap * sizeof(*(l->ports)));
+        }
+    eb_spinlock_unlock(&l->lock);
+    
+    eb_assert_or_recover(result, eb_no_op);
+    return result;
+}
+
+/* Remove the first occurence of 'p' in the list. Returns whether a port was actually removed. */
+static inline bool port_list_rm(port_list *l, eb_port p) {
+    assert(l);
+    assert(p);
+    
+    bool result = false;
+    eb_spinlock_lock_prof(&l->lock, &l->lock_prof);
+        /* Sanity-check that the list's length is less than its capacity */
+        eb_sanity_or_bail(l->len <= l->cap, "Sanity-check failed");
+        
+        /* Search for first occurence of the given port. If we find it, release it and move the last port in the list into the hole. */
+        for (size_t i = 0; i < l->len; i++) {
+            if (l->ports[i] == p) {
+                /* Move the last element in the port list into the now-vacant spot */
+                l->ports[i] = l->ports[l->len-1];
+                /* Decrement the buffer length */
+                l->len--;
+                result = true;
+                break;
+            }
+        }
+    eb_spinlock_unlock(&l->lock);
+    
+    if (result) {
+        /* Release the port, but do so outside of the spinlock because releasing does some stuff that might not be quick. */
+        eb_port_release(p);
+    }
+    
+    return result;
+}
+
+/* Signal the first port in the list that isn't 'ignore'. Among the first few candidates, the port whose waiter last ran
+   closest to the signaling thread (sharing a core, L2, L3 or NUMA node) is preferred so that the woken thread finds the
+   channel's cache lines warm. To bound unfairness, the first candidate is woken after being passed over a few times.
+   Returns whether a port was actually signaled. */
+static inline bool port_list_signal_first(port_list *l, eb_port ignore) {
+    static const size_t k_max_candidates = 8;
+    static const unsigned int k_max_bypass = 4;
+    static const int k_max_proximity = 4;
+    
+    assert(l);
+    
+    /* Only bother determining our CPU if there's a choice to make */
+    int cpu = -1;
+    #if EB_CHAN_WAKE_LOCALITY
+        if (*((volatile size_t *)&l->len) > 1) {
+            cpu = eb_sys_cpu_current();
+        }
+    #endif
+    
+    eb_port p = NULL;
+    eb_spinlock_lock_prof(&l->lock, &l->lock_prof);
+        eb_port best = NULL;
+        int best_proximity = -1;
+        size_t ncandidates = 0;
+        for (size_t i = 0; i < l->len && ncandidates < k_max_candidates; i++) {
+            if (l->ports[i] != ignore) {
+                if (!p) {
+                    p = l->ports[i];
+                }
+                
+                if (cpu < 0) {
+                    break;
+                }
+                
+                int proximity = eb_sys_cpu_proximity(cpu, eb_port_waiter_info(l->ports[i])->cpu);
+                if (proximity > best_proximity) {
+                    best = l->ports[i];
+                    best_proximity = proximity;
+                    if (proximity == k_max_proximity) {
+                        break;
+                    }
+                }
+                
+                ncandidates++;
+            }
+        }
+        
+        /* Prefer the closest waiter, unless the first candidate has been passed over too many times. The count restarts
+           whenever the first candidate changes (e.g. because it was cancelled, or another waiter was swapped into its
+           place), so that the bound applies to each waiter rather than to the list. */
+        if (best && best != p) {
+            if (p != l->bypassed_port) {
+                l->bypassed_port = p;
+                l->bypassed = 0;
+            }
+            
+            if (l->bypassed < k_max_bypass) {
+                p = best;
+                l->bypassed++;
+            } else {
+                l->bypassed_port = NULL;
+                l->bypassed = 0;
+            }
+        }
+        
+        if (p) {
+            eb_port_retain(p);
+        }
+    eb_spinlock_unlock(&l->lock);
+    
+    bool result = false;
+    if (p) {
+        result = eb_port_signal(p);
+        eb_port_release(p);
+        p = NULL;
+    }
+    return result;
+}
+
+enum {
+    /* Buffered/unbuffered channel states */
+    chanstate_open,
+    chanstate_closed,
+    /* Unbuffered channel states */
+    chanstate_send,
+    chanstate_recv,
+    chanstate_ack,
+    chanstate_done,
+    chanstate_cancelled
+}; typedef int32_t chanstate;
+
+typedef struct {
+    eb_chan_op *const *ops;
+    size_t nops;
+    bool *cleanup_ops;
+    
+    eb_nsec timeout;
+    eb_port port;
+    /* The statistics shard that the calling thread updates */
+    unsigned int shard;
+} do_state;
+
+/* Counters that are updated outside of the channel's lock, sharded to limit contention. Sized to fill a cache line. */
+typedef struct {
+    uint64_t sends;
+    uint64_t recvs;
+    uint64_t retries;
+    uint64_t lock_failures;
+    uint64_t parks;
+    uint64_t wakeups;
+    uint64_t wasted_wakeups;
+    uint64_t closes_observed;
+} stats_shard;
+
+/* A channel's statistics. They're allocated on the channel's first op (see stats_create()) rather than embedded in the
+   channel, so that idle channels don't pay for them and the shards can be aligned to EB_CHAN_STATS_ALIGN. */
+typedef struct {
+    stats_shard shards[EB_CHAN_STATS_SHARDS];
+    /* Buffer statistics, protected by the channel's lock */
+    size_t buf_len_max;
+    uint64_t occupancy[EB_CHAN_STATS_OCCUPANCY_BUCKETS];
+} chan_stats;
+
+#if EB_CHAN_STATS
+    /* Updates are dropped until the channel's statistics are allocated */
+    #define stats_add(c, shard, field, n) do {                                      \
+        chan_stats *stats_ = *((chan_stats *volatile *)&(c)->stats);                \
+        if (stats_) {                                                               \
+            eb_atomic_add_relaxed(&stats_->shards[(shard)].field, (n));             \
+        }                                                                           \
+    } while (0)
+#else
+    #define stats_add(c, shard, field, n)
+#endif
+
+/* A channel's latency measurement state, allocated by eb_chan_latency_enable() */
+typedef struct {
+    eb_hist hist;
+    /* The tick at which the value in each buffer slot was enqueued (buffered channels only) */
+    uint64_t *ts;
+} latency;
+
+struct eb_chan {
+    unsigned int retain_count;
+    eb_spinlock lock;
+    chanstate state;
+    /* The number of times that blocking ops try the channel before parking, or EB_CHAN_SPIN_ATTEMPTS_DEFAULT to use the
+       global configuration (see eb_chan_set_spin_attempts()) */
+    size_t spin_attempts;
+    
+    /* The channel's registry shard, and its neighbors there (see eb_chan_debug_dump()) */
+    bool registered;
+    unsigned int reg_shard;
+    eb_chan reg_prev;
+    eb_chan reg_next;
+    /* The name that the channel is exported with (see eb_chan_set_name()), protected by its registry shard's lock */
+    char *name;
+    size_t name_size;
+    #if EB_CHAN_CAPTURE
+        /* The capture session (high 32 bits) that the channel was last seen in, and its capture-local id in that session
+           (see capture_chan_id()) */
+        uint64_t capture_tag;
+    #endif
+    #if EB_CHAN_LOCKPROF
+        eb_spinlock_prof lock_prof;
+    #endif
+    
+    /* Whether the channel's memory/buffer are owned by the caller (see eb_chan_init()) */
+    bool storage_external;
+    bool buf_external;
+    /* The allocator that allocated the channel's memory */
+    eb_chan_allocator alloc;
+    /* Non-zero if the channel's memory should be migrated to the node of the first receiver */
+    int numa_first_consumer;
+    
+    port_list sends;
+    port_list recvs;
+    
+    #if EB_CHAN_STATS
+        /* The channel's statistics, or NULL until they're allocated; assigned once. 'stats_mem' is the allocation that
+           contains them, before alignment. */
+        chan_stats *stats;
+        void *stats_mem;
+    #endif
+    
+    #if EB_CHAN_BLOCKED_TIME
+        /* Blocked time (in ticks) of the selects that completed on this channel, indexed by whether they received */
+        uint64_t blocked_selects[2];
+        uint64_t blocked_ticks[2][eb_thread_phase_count];
+    #endif
+    
+    #if EB_CHAN_LATENCY
+        /* Non-NULL once latency measurement is enabled; assigned once, with the lock held */
+        latency *lat;
+        /* The tick at which the value of the in-progress unbuffered send was offered */
+        uint64_t lat_unbuf_ts;
+    #endif
+    
+    /* Buffered ivars */
+    size_t buf_cap;
+    size_t buf_len;
+    size_t buf_idx;
+    const void **buf;
+    /* When the buffer last became full (or 0 if it isn't full), tracked while the watchdog is running */
+    eb_nsec buf_full_since;
+    bool buf_full_reported;
+    
+    /* Unbuffered ivars */
+    const do_state *unbuf_state;
+    eb_chan_op *unbuf_op;
+    eb_port unbuf_port;
+};
+
+static const char *chanstate_name(chanstate state) {
+    switch (state) {
+        case chanstate_open:        return "open";
+        case chanstate_closed:      return "closed";
+        case chanstate_send:        return "send";
+        case chanstate_recv:        return "recv";
+        case chanstate_ack:         return "ack";
+        case chanstate_done:        return "done";
+        case chanstate_cancelled:   return "cancelled";
+    }
+    return "?";
+}
+
+/* Records a flight recorder event (see eb_chan_trace_start()) */
+static inline void trace(eb_trace_type type, const void *chan, const char *label, uint32_t arg) {
+    #if EB_CHAN_TRACE
+        if (eb_trace_active) {
+            eb_trace_record(type, chan, label, arg);
+        }
+    #endif
+}
+
+/* Records the current state of an unbuffered channel, after a transition. Must be called with the channel's lock held. */
+static inline void trace_state(eb_chan c) {
+    #if EB_CHAN_TRACE
+        if (eb_trace_active) {
+            eb_trace_record(eb_trace_unbuf_state, c, chanstate_name(c->state), 0);
+        }
+    #endif
+}
+
+/* Signal a waiter in 'l' (one of c's port lists), counting the wakeup */
+static inline void signal_first(eb_chan c, unsigned int shard, port_list *l, eb_port ignore) {
+    if (port_list_signal_first(l, ignore)) {
+        stats_add(c, shard, wakeups, 1);
+        trace(eb_trace_signal, c, NULL, 0);
+    }
+}
+
+/* Signal a channel's unbuffered counterpart port, counting the wakeup */
+static inline void signal_port(eb_chan c, unsigned int shard, eb_port p) {
+    if (eb_port_signal(p)) {
+        stats_add(c, shard, wakeups, 1);
+        trace(eb_trace_signal, c, NULL, 0);
+    }
+}
+
+#if EB_CHAN_LATENCY
+    /* Records the latency of a value that was enqueued/offered at tick 'ts'. Must be called with the channel's lock held. */
+    static inline void latency_record(eb_chan c, uint64_t ts) {
+        uint64_t now = eb_time_ticks();
+        eb_hist_record(&c->lat->hist, eb_time_ticks_to_nsec(now > ts ? now - ts : 0));
+    }
+#endif
+
+#pragma mark - Statistics allocation -
+/* Allocates c's statistics, if they haven't been already. Returns false if the allocation failed. */
+static inline bool stats_create(eb_chan c) {
+    assert(c);
+    
+    #if EB_CHAN_STATS
+        if (*((chan_stats *volatile *)&c->stats)) {
+            return true;
+        }
+        
+        /* Over-allocate so that the statistics can be aligned */
+        size_t size = sizeof(chan_stats) + EB_CHAN_STATS_ALIGN - 1;
+        void *mem = eb_alloc_zeroed(&c->alloc, size);
+        eb_assert_or_recover(mem, return false);
+        
+        /* Another thread may be allocating them at the same time; the first one to claim 'stats_mem' wins */
+        if (!eb_atomic_compare_and_swap(&c->stats_mem, NULL, mem)) {
+            eb_free(&c->alloc, mem, size);
+            return true;
+        }
+        
+        uintptr_t align_mask = EB_CHAN_STATS_ALIGN - 1;
+        chan_stats *stats = (chan_stats *)(((uintptr_t)mem + align_mask) & ~align_mask);
+        eb_atomic_barrier();
+        *((chan_stats *volatile *)&c->stats) = stats;
+    #endif
+    return true;
+}
+
+#pragma mark - Registry -
+/* The number of shards that the registry is spread across. Channels are registered in the shard of the thread that
+   creates them, so that creating and freeing channels on different threads doesn't contend on one lock. */
+#define EB_CHAN_REGISTRY_SHARDS 16
+
+/* Every live channel, for eb_chan_debug_dump(), the watchdog and the metrics exporter. Each shard fills a cache line. */
+typedef struct {
+    eb_spinlock lock;
+    eb_chan head;
+    uint8_t pad[EB_CHAN_STATS_ALIGN - sizeof(eb_spinlock) - sizeof(eb_chan)];
+} registry_shard;
+static registry_shard g_registry[EB_CHAN_REGISTRY_SHARDS] __attribute__((aligned(EB_CHAN_STATS_ALIGN)));
+enum {
+    /* States of a background service (the watchdog or the metrics server), which start and stop claim with a CAS */
+    service_idle,
+    service_starting,
+    service_running,
+    service_stopping
+}; typedef int service_state;
+
+/* The watchdog's state; its thread exists while it's service_running or service_stopping */
+static service_state g_watchdog_state = service_idle;
+
+/* Claims a service for stopping, after waiting for a concurrent start to publish whether it succeeded. Returns false if
+   the service isn't running or another caller claimed it first. */
+static bool service_claim_stop(service_state *state) {
+    for (;;) {
+        service_state s = *((volatile service_state *)state);
+        if (s == service_starting) {
+            eb_sys_yield();
+        } else if (s != service_running) {
+            return false;
+        } else if (eb_atomic_compare_and_swap(state, service_running, service_stopping)) {
+            return true;
+        }
+    }
+}
+
+static void registry_add(eb_chan c) {
+    assert(c);
+    
+    c->reg_shard = eb_thread_stats_shard(EB_CHAN_REGISTRY_SHARDS);
+    registry_shard *shard = &g_registry[c->reg_shard];
+    eb_spinlock_lock(&shard->lock);
+        c->reg_prev = NULL;
+        c->reg_next = shard->head;
+        if (shard->head) {
+            shard->head->reg_prev = c;
+        }
+        shard->head = c;
+        c->registered = true;
+    eb_spinlock_unlock(&shard->lock);
+}
+
+static void registry_rm(eb_chan c) {
+    assert(c);
+    
+    registry_shard *shard = &g_registry[c->reg_shard];
+    eb_spinlock_lock(&shard->lock);
+        if (c->registered) {
+            if (c->reg_prev) {
+                c->reg_prev->reg_next = c->reg_next;
+            } else {
+                shard->head = c->reg_next;
+            }
+            if (c->reg_next) {
+                c->reg_next->reg_prev = c->reg_prev;
+            }
+            c->registered = false;
+        }
+    eb_spinlock_unlock(&shard->lock);
+}
+
+/* Retains a registered channel, unless it's already being freed. Must be called with the channel's registry shard
+   locked. */
+static bool registry_retain(eb_chan c) {
+    assert(c);
+    
+    for (;;) {
+        unsigned int retain_count = *((volatile unsigned int *)&c->retain_count);
+        if (!retain_count) {
+            return false;
+        }
+        if (eb_atomic_compare_and_swap(&c->retain_count, retain_count, retain_count + 1)) {
+            return true;
+        }
+    }
+}
+
+/* A buffer that state is copied into with locks held, so that it can be formatted and written after they're released.
+   It can't grow while the locks are held, so a copy that doesn't fit only tallies the space it needed; the caller then
+   releases the locks and copies again after snapshot_reset() grows the buffer. */
+typedef struct {
+    eb_chan_allocator alloc;
+    char *buf;
+    size_t cap;
+    size_t len;
+    size_t needed;
+} snapshot;
+
+static void snapshot_init(snapshot *s) {
+    assert(s);
+    
+    memset(s, 0, sizeof(*s));
+    s->alloc = eb_alloc_global();
+}
+
+static void snapshot_free(snapshot *s) {
+    assert(s);
+    
+    eb_free(&s->alloc, s->buf, s->cap);
+    s->buf = NULL;
+    s->cap = 0;
+}
+
+/* Returns the space that snapshot_push() uses for 'size' bytes, which keeps the records aligned */
+static size_t snapshot_align(size_t size) {
+    return (size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+}
+
+/* Returns room for 'size' bytes at the end of the snapshot, or NULL if they don't fit */
+static void *snapshot_push(snapshot *s, size_t size) {
+    assert(s);
+    
+    size = snapshot_align(size);
+    s->needed += size;
+    if (s->needed > s->cap) {
+        return NULL;
+    }
+    
+    void *result = s->buf + s->len;
+    s->len += size;
+    return result;
+}
+
+/* Returns whether everything that was pushed since the last reset fit */
+static bool snapshot_fits(const snapshot *s) {
+    assert(s);
+    return (s->needed <= s->cap);
+}
+
+/* Empties the snapshot, first growing it to fit what the last copy needed. Returns false if that allocation failed. */
+static bool snapshot_reset(snapshot *s) {
+    assert(s);
+    
+    if (s->needed > s->cap) {
+        size_t cap = s->needed * 2;
+        char *buf = eb_realloc(&s->alloc, s->buf, s->cap, cap);
+        eb_assert_or_recover(buf, return false);
+        s->buf = buf;
+        s->cap = cap;
+    }
+    s->len = 0;
+    s->needed = 0;
+    return true;
+}
+
+#pragma mark - Channel creation/lifecycle -
+/* Compile-time checks that the storage advertised in eb_chan.h is large enough, and aligned enough, to hold a channel.
+   If these fail, bump EB_CHAN_STORAGE_SIZE or EB_CHAN_STORAGE_ALIGN (and the union's members to match). */
+typedef char eb_chan_storage_size_check[(sizeof(struct eb_chan) <= sizeof(struct eb_chan_storage) ? 1 : -1)];
+typedef char eb_chan_storage_align_check[(__alignof__(struct eb_chan) <= EB_CHAN_STORAGE_ALIGN ? 1 : -1)];
+
+static inline void eb_chan_free(eb_chan c) {
+    /* Intentionally allowing c==NULL so that this function can be called from eb_chan_create() */
+    if (!c) {
+        return;
+    }
+    
+    eb_probe1(free, c);
+    registry_rm(c);
+    
+    if (c->buf_cap && !c->buf_external) {
+        /* ## Buffered */
+        eb_free(&c->alloc, c->buf, c->buf_cap * sizeof(*(c->buf)));
+    }
+    c->buf = NULL;
+    
+    port_list_deinit(&c->recvs, &c->alloc);
+    port_list_deinit(&c->sends, &c->alloc);
+    
+    if (c->name) {
+        eb_free(&c->alloc, c->name, c->name_size);
+        c->name = NULL;
+    }
+    
+    #if EB_CHAN_LATENCY
+        if (c->lat) {
+            eb_free(&c->alloc, c->lat->ts, c->buf_cap * sizeof(*(c->lat->ts)));
+            eb_free(&c->alloc, c->lat, sizeof(*(c->lat)));
+            c->lat = NULL;
+        }
+    #endif
+    
+    #if EB_CHAN_STATS
+        if (c->stats_mem) {
+            eb_free(&c->alloc, c->stats_mem, sizeof(chan_stats) + EB_CHAN_STATS_ALIGN - 1);
+            c->stats = NULL;
+            c->stats_mem = NULL;
+        }
+    #endif
+    
+    /* Channels initialized with eb_chan_init() live in the caller's memory, so only their resources are freed */
+    if (!c->storage_external) {
+        /* Copy the allocator out of the channel since we're about to free it */
+        eb_chan_allocator alloc = c->alloc;
+        eb_free(&alloc, c, sizeof(*c));
+    }
+    c = NULL;
+}
+
+/* Sets up a zeroed channel. If the channel's buffered and 'ring' is NULL, the buffer is allocated. */
+static inline bool eb_chan_setup(eb_chan c, void *ring, size_t buf_cap) {
+    assert(c);
+    
+    /* Apply the environment's configuration before the channel's first op */
+    eb_config_init();
+    
+    c->retain_count = 1;
+    c->lock = EB_SPINLOCK_INIT;
+    c->state = chanstate_open;
+    c->spin_attempts = EB_CHAN_SPIN_ATTEMPTS_DEFAULT;
+    
+    port_list_init(&c->sends);
+    port_list_init(&c->recvs);
+    
+    #if EB_CHAN_BUFFERED_ONLY
+        /* Unbuffered channels aren't supported in this build */
+        eb_assert_or_recover(buf_cap, return false);
+    #endif
+    
+    if (buf_cap) {
+        /* ## Buffered */
+        c->buf_cap = buf_cap;
+        c->buf_len = 0;
+        c->buf_idx = 0;
+        if (ring) {
+            c->buf = ring;
+            c->buf_external = true;
+        } else {
+            c->buf = eb_alloc(&c->alloc, c->buf_cap * sizeof(*(c->buf)));
+            eb_assert_or_recover(c->buf, return false);
+        }
+    } else {
+        /* ## Unbuffered */
+        c->unbuf_state = NULL;
+        c->unbuf_op = NULL;
+        c->unbuf_port = NULL;
+    }
+    
+    registry_add(c);
+    
+    /* Issue a memory barrier since we didn't have the lock acquired for our set up (and this channel could theoretically
+       be passed to another thread without a barrier, and that'd be bad news...) */
+    eb_atomic_barrier();
+    
+    return true;
+}
+
+eb_chan eb_chan_create(size_t buf_cap) {
+    eb_chan_allocator a = eb_alloc_global();
+    return eb_chan_create_with_allocator(buf_cap, &a);
+}
+
+eb_chan eb_chan_create_with_allocator(size_t buf_cap, const eb_chan_allocator *a) {
+    assert(a);
+    eb_assert_or_bail(a->alloc && a->free, "Allocator must supply alloc() and free()");
+    
+    /* Initialize eb_sys so that eb_sys_ncores is valid. */
+    eb_sys_init();
+    #if EB_CHAN_LOCKPROF
+        /* Lock wait times are measured in ticks */
+        eb_time_ticks_init();
+    #endif
+    
+    /* Using a zeroed allocation so that the bytes are zeroed. */
+    eb_chan c = eb_alloc_zeroed(a, sizeof(*c));
+    eb_assert_or_recover(c, goto failed);
+    c->alloc = *a;
+    
+    bool r = eb_chan_setup(c, NULL, buf_cap);
+    eb_assert_or_recover(r, goto failed);
+    
+    eb_probe2(create, c, buf_cap);
+    return c;
+    failed: {
+        eb_chan_free(c);
+        return NULL;
+    }
+}
+
+eb_chan eb_chan_create_on_node(size_t buf_cap, int node) {
+    eb_chan_allocator a = eb_numa_allocator(node >= 0 ? node : -1);
+    eb_chan c = eb_chan_create_with_allocator(buf_cap, &a);
+    eb_assert_or_recover(c, return NULL);
+    
+    if (node == eb_chan_node_first_consumer) {
+        c->numa_first_consumer = true;
+        eb_atomic_barrier();
+    }
+    
+    return c;
+}
+
+/* Migrates the channel's memory to the calling thread's node if it's the channel's first receiver */
+static void numa_claim(eb_chan c) {
+    assert(c);
+    
+    if (eb_atomic_compare_and_swap(&c->numa_first_consumer, true, false)) {
+        int node = eb_sys_cpu_node(eb_sys_cpu_current());
+        if (node >= 0) {
+            eb_numa_move(c, sizeof(*c), node);
+            if (c->buf_cap) {
+                eb_numa_move(c->buf, c->buf_cap * sizeof(*(c->buf)), node);
+            }
+        }
+    }
+}
+
+eb_chan eb_chan_init(struct eb_chan_storage *storage, void *ring, size_t buf_cap) {
+    assert(storage);
+    
+    /* Initialize eb_sys so that eb_sys_ncores is valid. */
+    eb_sys_init();
+    #if EB_CHAN_LOCKPROF
+        /* Lock wait times are measured in ticks */
+        eb_time_ticks_init();
+    #endif
+    
+    eb_chan c = (eb_chan)storage;
+    memset(c, 0, sizeof(*c));
+    c->storage_external = true;
+    c->alloc = eb_alloc_global();
+    
+    /* The ring has to be suitably aligned to hold pointers */
+    eb_assert_or_recover(!ring || !((uintptr_t)ring % sizeof(*(c->buf))), goto failed);
+    
+    bool r = eb_chan_setup(c, ring, buf_cap);
+    eb_assert_or_recover(r, goto failed);
+    
+    eb_probe2(create, c, buf_cap);
+    return c;
+    failed: {
+        eb_chan_free(c);
+        return NULL;
+    }
+}
+
+void eb_chan_deinit(eb_chan c) {
+    assert(c);
+    eb_assert_or_bail(c->storage_external, "Channel wasn't initialized with eb_chan_init()");
+    eb_chan_release(c);
+}
+
+eb_chan eb_chan_retain(eb_chan c) {
+    assert(c);
+    eb_atomic_add(&c->retain_count, 1);
+    return c;
+}
+
+void eb_chan_release(eb_chan c) {
+    assert(c);
+    if (eb_atomic_add(&c->retain_count, -1) == 0) {
+        eb_chan_free(c);
+    }
+}
+
+#pragma mark - Preallocation -
+bool eb_chan_reserve(eb_chan c, size_t max_waiters) {
+    assert(c);
+    return stats_create(c) &&
+           port_list_reserve(&c->sends, &c->alloc, max_waiters) &&
+           port_list_reserve(&c->recvs, &c->alloc, max_waiters);
+}
+
+bool eb_chan_mlock(eb_chan c) {
+    assert(c);
+    
+    int r = mlock(c, sizeof(*c));
+    eb_assert_or_recover(!r, return false);
+    
+    if (c->buf_cap) {
+        r = mlock(c->buf, c->buf_cap * sizeof(*(c->buf)));
+        eb_assert_or_recover(!r, return false);
+    }
+    
+    #if EB_CHAN_STATS
+        if (c->stats) {
+            r = mlock(c->stats, sizeof(*(c->stats)));
+            eb_assert_or_recover(!r, return false);
+        }
+    #endif
+    
+    return port_list_mlock(&c->sends) && port_list_mlock(&c->recvs);
+}
+
+#pragma mark - Configuration -
+void eb_chan_set_spin_attempts(eb_chan c, size_t attempts) {
+    assert(c);
+    *((volatile size_t *)&c->spin_attempts) = attempts;
+}
+
+#pragma mark - Statistics -
+bool eb_chan_stats(eb_chan c, eb_chan_counters *out) {
+    assert(c);
+    assert(out);
+    
+    memset(out, 0, sizeof(*out));
+    #if EB_CHAN_STATS
+        /* A channel whose statistics haven't been allocated hasn't counted anything yet */
+        chan_stats *stats = *((chan_stats *volatile *)&c->stats);
+        if (!stats) {
+            return true;
+        }
+        
+        for (size_t i = 0; i < EB_CHAN_STATS_SHARDS; i++) {
+            const stats_shard *shard = &stats->shards[i];
+            out->sends += eb_atomic_load_relaxed(&shard->sends);
+            out->recvs += eb_atomic_load_relaxed(&shard->recvs);
+            out->retries += eb_atomic_load_relaxed(&shard->retries);
+            out->lock_failures += eb_atomic_load_relaxed(&shard->lock_failures);
+            out->parks += eb_atomic_load_relaxed(&shard->parks);
+            out->wakeups += eb_atomic_load_relaxed(&shard->wakeups);
+            out->wasted_wakeups += eb_atomic_load_relaxed(&shard->wasted_wakeups);
+            out->closes_observed += eb_atomic_load_relaxed(&shard->closes_observed);
+        }
+        
+        eb_spinlock_lock_prof(&c->lock, &c->lock_prof);
+            out->buf_len_max = stats->buf_len_max;
+            memcpy(out->occupancy, stats->occupancy, sizeof(out->occupancy));
+        eb_spinlock_unlock(&c->lock);
+        return true;
+    #else
+        return false;
+    #endif
+}
+
+#pragma mark - Latency -
+bool eb_chan_latency_enable(eb_chan c) {
+    assert(c);
+    
+    #if EB_CHAN_LATENCY
+        eb_time_ticks_init();
+        
+        /* Allocate outside of the lock */
+        latency *lat = eb_alloc_zeroed(&c->alloc, sizeof(*lat));
+        eb_assert_or_recover(lat, return false);
+        if (c->buf_cap) {
+            lat->ts = eb_alloc(&c->alloc, c->buf_cap * sizeof(*(lat->ts)));
+            eb_assert_or_recover(lat->ts, goto failed);
+        }
+        
+        bool installed = false;
+        eb_spinlock_lock_prof(&c->lock, &c->lock_prof);
+            if (!c->lat) {
+                /* Treat the values that are already buffered as having been enqueued now */
+                uint64_t now = eb_time_ticks();
+                for (size_t i = 0; i < c->buf_cap; i++) {
+                    lat->ts[i] = now;
+                }
+                c->lat_unbuf_ts = now;
+                c->lat = lat;
+                installed = true;
+            }
+        eb_spinlock_unlock(&c->lock);
+        
+        /* Measurement was already enabled */
+        if (!installed) {
+            goto failed;
+        }
+        
+        return true;
+        failed: {
+            eb_free(&c->alloc, lat->ts, c->buf_cap * sizeof(*(lat->ts)));
+            eb_free(&c->alloc, lat, sizeof(*lat));
+            return (c->lat != NULL);
+        }
+    #else
+        return false;
+    #endif
+}
+
+bool eb_chan_latency_stats(eb_chan c, eb_chan_latency *out) {
+    assert(c);
+    assert(out);
+    
+    memset(out, 0, sizeof(*out));
+    #if EB_CHAN_LATENCY
+        const latency *lat = *((latency *volatile *)&c->lat);
+        if (!lat) {
+            return false;
+        }
+        
+        out->count = eb_atomic_load_relaxed(&lat->hist.count);
+        out->p50 = eb_hist_percentile(&lat->hist, 50);
+        out->p90 = eb_hist_percentile(&lat->hist, 90);
+        out->p99 = eb_hist_percentile(&lat->hist, 99);
+        out->p999 = eb_hist_percentile(&lat->hist, 99.9);
+        out->max = eb_atomic_load_relaxed(&lat->hist.max);
+        return true;
+    #else
+        return false;
+    #endif
+}
+
+eb_nsec eb_chan_latency_percentile(eb_chan c, double pct) {
+    assert(c);
     
-    if (eb_atomic_compare_and_swap(&p->signaled, false, true)) {
-        #if EB_SYS_DARWIN
-            kern_return_t r = semaphore_signal(p->sem);
-            eb_assert_or_recover(r == KERN_SUCCESS, eb_no_op);
-        #elif EB_SYS_LINUX
-            int r = sem_post(&p->sem);
-            eb_assert_or_recover(!r, eb_no_op);
-        #endif
+    #if EB_CHAN_LATENCY
+        const latency *lat = *((latency *volatile *)&c->lat);
+        return (lat ? eb_hist_percentile(&lat->hist, pct) : 0);
+    #else
+        return 0;
+    #endif
+}
+
+#pragma mark - Lock profiling -
+#if EB_CHAN_LOCKPROF
+    static void lock_counts(const eb_spinlock_prof *prof, eb_chan_lock_counts *out) {
+        out->contended = eb_atomic_load_relaxed(&prof->contended);
+        out->spins = eb_atomic_load_relaxed(&prof->spins);
+        out->wait_cycles = eb_atomic_load_relaxed(&prof->wait_ticks);
+        out->wait_ns = eb_time_ticks_to_nsec(out->wait_cycles);
     }
+#endif
+
+bool eb_chan_lock_stats(eb_chan c, eb_chan_lock_report *out) {
+    assert(c);
+    assert(out);
+    
+    memset(out, 0, sizeof(*out));
+    #if EB_CHAN_LOCKPROF
+        lock_counts(&c->lock_prof, &out->chan);
+        lock_counts(&c->sends.lock_prof, &out->sends);
+        lock_counts(&c->recvs.lock_prof, &out->recvs);
+        return true;
+    #else
+        return false;
+    #endif
 }
 
-bool eb_port_wait(eb_port p, eb_nsec timeout) {
-    assert(p);
+#pragma mark - Blocked-time accounting -
+bool eb_chan_blocked_time(eb_chan c, eb_chan_op_times *out) {
+    assert(c);
+    assert(out);
     
-    bool result = false;
-    if (timeout == eb_nsec_zero) {
-        /* ## Non-blocking */
-        #if EB_SYS_DARWIN
-            kern_return_t r = semaphore_timedwait(p->sem, (mach_timespec_t){0, 0});
-            eb_assert_or_recover(r == KERN_SUCCESS || r == KERN_OPERATION_TIMED_OUT, eb_no_op);
-            
-            result = (r == KERN_SUCCESS);
-        #elif EB_SYS_LINUX
-            int r = 0;
-            while ((r = sem_trywait(&p->sem)) == -1 && errno == EINTR);
-            eb_assert_or_recover(!r || (r == -1 && errno == EAGAIN), eb_no_op);
+    memset(out, 0, sizeof(*out));
+    #if EB_CHAN_BLOCKED_TIME
+        eb_chan_phase_times *times[2] = {&out->sends, &out->recvs};
+        for (size_t i = 0; i < 2; i++) {
+            times[i]->selects = eb_atomic_load_relaxed(&c->blocked_selects[i]);
+            times[i]->spin = eb_time_ticks_to_nsec(eb_atomic_load_relaxed(&c->blocked_ticks[i][eb_thread_phase_spin]));
+            times[i]->park = eb_time_ticks_to_nsec(eb_atomic_load_relaxed(&c->blocked_ticks[i][eb_thread_phase_park]));
+            times[i]->wake = eb_time_ticks_to_nsec(eb_atomic_load_relaxed(&c->blocked_ticks[i][eb_thread_phase_wake]));
+        }
+        return eb_thread_accounting;
+    #else
+        return false;
+    #endif
+}
+
+#pragma mark - System call accounting -
+#if EB_CHAN_SYSCALL_STATS
+    /* The counts and context switches at the last eb_chan_syscall_stats_reset() */
+    static eb_spinlock g_syscall_baseline_lock = EB_SPINLOCK_INIT;
+    static uint64_t g_syscall_baseline[eb_sys_call_count];
+    static uint64_t g_syscall_baseline_nvcsw = 0;
+    static uint64_t g_syscall_baseline_nivcsw = 0;
+    
+    /* Fills 'counts' with the system call counts, and 'nvcsw'/'nivcsw' with the process' context switches */
+    static void syscall_counts(uint64_t counts[eb_sys_call_count], uint64_t *nvcsw, uint64_t *nivcsw) {
+        eb_sys_call_counts(counts);
+        
+        struct rusage usage;
+        int r = getrusage(RUSAGE_SELF, &usage);
+        eb_assert_or_recover(!r, memset(&usage, 0, sizeof(usage)));
+        *nvcsw = usage.ru_nvcsw;
+        *nivcsw = usage.ru_nivcsw;
+    }
+#endif
+
+bool eb_chan_syscall_stats(eb_chan_syscall_counts *out) {
+    assert(out);
+    
+    memset(out, 0, sizeof(*out));
+    #if EB_CHAN_SYSCALL_STATS
+        uint64_t counts[eb_sys_call_count];
+        uint64_t nvcsw = 0;
+        uint64_t nivcsw = 0;
+        syscall_counts(counts, &nvcsw, &nivcsw);
+        
+        /* Report the counts relative to the baseline */
+        eb_spinlock_lock(&g_syscall_baseline_lock);
+            for (size_t i = 0; i < eb_sys_call_count; i++) {
+                counts[i] -= g_syscall_baseline[i];
+            }
+            nvcsw -= g_syscall_baseline_nvcsw;
+            nivcsw -= g_syscall_baseline_nivcsw;
+        eb_spinlock_unlock(&g_syscall_baseline_lock);
+        
+        out->ops = counts[eb_sys_call_op];
+        out->sem_posts = counts[eb_sys_call_sem_post];
+        out->sem_waits = counts[eb_sys_call_sem_wait];
+        out->sem_timedwaits = counts[eb_sys_call_sem_timedwait];
+        out->sem_trywaits = counts[eb_sys_call_sem_trywait];
+        out->yields = counts[eb_sys_call_yield];
+        out->syscalls = out->sem_posts + out->sem_waits + out->sem_timedwaits + out->sem_trywaits + out->yields;
+        out->voluntary_switches = nvcsw;
+        out->involuntary_switches = nivcsw;
+        if (out->ops) {
+            out->syscalls_per_op = (double)out->syscalls / out->ops;
+            out->switches_per_op = (double)(nvcsw + nivcsw) / out->ops;
+        }
+        return true;
+    #else
+        return false;
+    #endif
+}
+
+void eb_chan_syscall_stats_reset() {
+    #if EB_CHAN_SYSCALL_STATS
+        uint64_t counts[eb_sys_call_count];
+        uint64_t nvcsw = 0;
+        uint64_t nivcsw = 0;
+        syscall_counts(counts, &nvcsw, &nivcsw);
+        
+        eb_spinlock_lock(&g_syscall_baseline_lock);
+            memcpy(g_syscall_baseline, counts, sizeof(g_syscall_baseline));
+            g_syscall_baseline_nvcsw = nvcsw;
+            g_syscall_baseline_nivcsw = nivcsw;
+        eb_spinlock_unlock(&g_syscall_baseline_lock);
+    #endif
+}
+
+#pragma mark - Debugging -
+/* The records that eb_chan_debug_dump() copies out of each channel with waiters: a dump_chan, followed by each of its
+   waiters (senders first) as a dump_waiter followed by the waiter's dump_ops */
+typedef struct {
+    eb_chan chan;
+    chanstate state;
+    size_t buf_cap;
+    size_t buf_len;
+    eb_nsec buf_full_since;
+    size_t nwaiters[2];
+} dump_chan;
+
+typedef struct {
+    long tid;
+    eb_nsec park_time;
+    size_t nops;
+} dump_waiter;
+
+typedef struct {
+    bool send;
+    eb_chan chan;
+} dump_op;
+
+/* Copies the waiters in 'l' (one of a channel's port lists) into 's', and returns how many there were */
+static size_t dump_copy_waiters(snapshot *s, port_list *l) {
+    size_t count = 0;
+    eb_spinlock_lock_prof(&l->lock, &l->lock_prof);
+        for (size_t i = 0; i < l->len; i++) {
+            const eb_port_waiter *w = eb_port_waiter_info(l->ports[i]);
+            dump_waiter *dw = snapshot_push(s, sizeof(*dw));
+            if (dw) {
+                dw->tid = w->tid;
+                dw->park_time = *((volatile eb_nsec *)&w->park_time);
+                dw->nops = w->nops;
+            }
             
-            result = !r;
-        #endif
-    } else if (timeout == eb_nsec_forever) {
-        /* ## Blocking */
-        #if EB_SYS_DARWIN
-            kern_return_t r;
-            while ((r = semaphore_wait(p->sem)) == KERN_ABORTED);
-            eb_assert_or_recover(r == KERN_SUCCESS, eb_no_op);
+            for (size_t ii = 0; ii < w->nops; ii++) {
+                dump_op *op = snapshot_push(s, sizeof(*op));
+                if (op) {
+                    op->send = w->ops[ii]->send;
+                    op->chan = w->ops[ii]->chan;
+                }
+            }
+            count++;
+        }
+    eb_spinlock_unlock(&l->lock);
+    return count;
+}
+
+/* Copies every channel in 'shard' that has waiters into 's' */
+static void dump_copy_shard(snapshot *s, registry_shard *shard) {
+    eb_spinlock_lock(&shard->lock);
+        for (eb_chan c = shard->head; c; c = c->reg_next) {
+            /* Only list channels with waiters */
+            if (!*((volatile size_t *)&c->sends.len) && !*((volatile size_t *)&c->recvs.len)) {
+                continue;
+            }
             
-            result = (r == KERN_SUCCESS);
-        #elif EB_SYS_LINUX
-            int r;
-            while ((r = sem_wait(&p->sem)) == -1 && errno == EINTR);
-            eb_assert_or_recover(!r, eb_no_op);
+            dump_chan *dc = snapshot_push(s, sizeof(*dc));
+            if (dc) {
+                dc->chan = c;
+                dc->buf_cap = c->buf_cap;
+                eb_spinlock_lock_prof(&c->lock, &c->lock_prof);
+                    dc->state = c->state;
+                    dc->buf_len = c->buf_len;
+                    dc->buf_full_since = c->buf_full_since;
+                eb_spinlock_unlock(&c->lock);
+            }
             
-            result = !r;
-        #endif
-    } else {
-        /* ## Actual timeout */
-        eb_nsec start_time = eb_time_now();
-        eb_nsec remaining_timeout = timeout;
-        for (;;) {
-            #if EB_SYS_DARWIN
-                /* This needs to be in a loop because semaphore_timedwait() can return KERN_ABORTED, e.g. if the process receives a signal. */
-                mach_timespec_t ts = {.tv_sec = (unsigned int)(remaining_timeout / eb_nsec_per_sec), .tv_nsec = (clock_res_t)(remaining_timeout % eb_nsec_per_sec)};
-                kern_return_t r = semaphore_timedwait(p->sem, ts);
-                eb_assert_or_recover(r == KERN_SUCCESS || r == KERN_OPERATION_TIMED_OUT || r == KERN_ABORTED, eb_no_op);
-                
-                if (r == KERN_SUCCESS) {
-                    result = true;
-                    break;
-                }
-            #elif EB_SYS_LINUX
-                /* Because sem_timedwait() uses the system's _REALTIME clock instead of the _MONOTONIC clock, we'll time out when
-                   the system's time changes. For that reason, we check for the timeout case ourself (instead of relying on errno
-                   after calling sem_timedwait()) condition ourself, using our own monotonic clock APIs (eb_time_now()), and
-                   restart sem_timedwait() if we determine independently that we haven't timed-out. */
-                struct timespec ts;
-                int r = clock_gettime(CLOCK_REALTIME, &ts);
-                eb_assert_or_recover(!r, break);
-                
-                ts.tv_sec += (remaining_timeout / eb_nsec_per_sec);
-                ts.tv_nsec += (remaining_timeout % eb_nsec_per_sec);
-                r = sem_timedwait(&p->sem, &ts);
-                /* The allowed return cases are: success (r==0), timed-out (r==-1, errno==ETIMEDOUT), (r==-1, errno==EINTR) */
-                eb_assert_or_recover(!r || (r == -1 && (errno == ETIMEDOUT || errno == EINTR)), break);
-                
-                /* If we acquired the semaphore, set our flag and break! */
-                if (!r) {
-                    result = true;
-                    break;
-                }
-            #endif
-                
-            /* Determine whether we timed-out, and if not, update 'remaining_timeout' with the amount of time to go. */
-            eb_nsec elapsed = eb_time_now() - start_time;
-            if (elapsed < timeout) {
-                remaining_timeout = timeout - elapsed;
+            size_t nsends = dump_copy_waiters(s, &c->sends);
+            size_t nrecvs = dump_copy_waiters(s, &c->recvs);
+            if (dc) {
+                dc->nwaiters[0] = nsends;
+                dc->nwaiters[1] = nrecvs;
+            }
+        }
+    eb_spinlock_unlock(&shard->lock);
+}
+
+/* Writes the channels that dump_copy_shard() copied into 's' to 'fd', and returns how many there were */
+static size_t dump_write(int fd, const snapshot *s, eb_nsec now) {
+    size_t count = 0;
+    for (const char *p = s->buf; p < s->buf + s->len; count++) {
+        const dump_chan *dc = (const dump_chan *)p;
+        p += sizeof(*dc);
+        if (dc->buf_cap) {
+            dprintf(fd, "eb_chan %p: buffered, %zu/%zu, %s", (void *)dc->chan, dc->buf_len, dc->buf_cap,
+                chanstate_name(dc->state));
+            if (dc->buf_full_since) {
+                dprintf(fd, ", full for %.3f ms",
+                    (double)(now > dc->buf_full_since ? now - dc->buf_full_since : 0) / eb_nsec_per_msec);
+            }
+            dprintf(fd, "\n");
+        } else {
+            dprintf(fd, "eb_chan %p: unbuffered, %s\n", (void *)dc->chan, chanstate_name(dc->state));
+        }
+        
+        for (size_t i = 0; i < dc->nwaiters[0] + dc->nwaiters[1]; i++) {
+            const dump_waiter *dw = (const dump_waiter *)p;
+            p += sizeof(*dw);
+            const char *kind = (i < dc->nwaiters[0] ? "send" : "recv");
+            if (dw->park_time == EB_PORT_PARK_UNTIMED) {
+                dprintf(fd, "    %s waiter: thread %ld, parked, ops:", kind, dw->tid);
+            } else if (dw->park_time) {
+                dprintf(fd, "    %s waiter: thread %ld, parked for %.3f ms, ops:", kind, dw->tid,
+                    (double)(now > dw->park_time ? now - dw->park_time : 0) / eb_nsec_per_msec);
             } else {
-                break;
+                dprintf(fd, "    %s waiter: thread %ld, running, ops:", kind, dw->tid);
+            }
+            
+            for (size_t ii = 0; ii < dw->nops; ii++) {
+                const dump_op *op = (const dump_op *)p;
+                p += sizeof(*op);
+                dprintf(fd, "%s %s %p", (ii ? "," : ""), (op->send ? "send" : "recv"), (const void *)op->chan);
             }
+            dprintf(fd, "\n");
         }
     }
-    
-    if (result) {
-        assert(eb_atomic_compare_and_swap(&p->signaled, true, false));
+    return count;
+}
+
+size_t eb_chan_debug_dump(int fd) {
+    size_t count = 0;
+    eb_nsec now = eb_time_now();
+    snapshot s;
+    snapshot_init(&s);
+    for (size_t i = 0; i < EB_CHAN_REGISTRY_SHARDS; i++) {
+        /* Copy the shard's channels with the locks held, and write them after releasing the locks, so that a slow 'fd'
+           doesn't stall the channels' users (or deadlock, if its reader uses the channels) */
+        do {
+            if (!snapshot_reset(&s)) {
+                goto done;
+            }
+            dump_copy_shard(&s, &g_registry[i]);
+        } while (!snapshot_fits(&s));
+        count += dump_write(fd, &s, now);
     }
     
-    return result;
+    done: {
+        snapshot_free(&s);
+    }
+    return count;
 }
 
-#pragma mark - Types -
-typedef struct {
-    eb_spinlock lock;
-    size_t cap;
-    size_t len;
-    eb_port *ports;
-} *port_list;
+/* The watchdog's configuration, and the thread that runs it */
+static eb_nsec g_watchdog_park_threshold = 0;
+static eb_nsec g_watchdog_buf_full_threshold = 0;
+static eb_chan_stall_hook g_watchdog_hook = NULL;
+static void *g_watchdog_ctx = NULL;
+static pthread_t g_watchdog_thread;
+static int g_watchdog_stop = 0;
+/* When the watchdog started, which untimed parks (see EB_PORT_PARK_UNTIMED) are measured from */
+static eb_nsec g_watchdog_start_time = 0;
 
-static inline void port_list_free(port_list l);
+/* Collects the parked waiters in 'l' that have been parked longer than the threshold into 'stalls', and returns the
+   new number of stalls. Must be called with c's registry shard locked. */
+static size_t watchdog_check_waiters(eb_chan c, port_list *l, bool send, eb_nsec now, eb_chan_stall *stalls,
+    size_t nstalls, size_t max_stalls) {
+    eb_spinlock_lock_prof(&l->lock, &l->lock_prof);
+        for (size_t i = 0; i < l->len && nstalls < max_stalls; i++) {
+            eb_port_waiter *w = eb_port_waiter_info(l->ports[i]);
+            eb_nsec park_time = *((volatile eb_nsec *)&w->park_time);
+            /* Waiters that parked before the watchdog started weren't timed, so they're measured from its start */
+            if (park_time == EB_PORT_PARK_UNTIMED) {
+                park_time = g_watchdog_start_time;
+            }
+            
+            /* Only report each park once, even if the waiter is on several channels. A park is identified by when it
+               started. */
+            if (park_time && now > park_time && now - park_time >= g_watchdog_park_threshold &&
+                w->watchdog_reported != park_time && registry_retain(c)) {
+                w->watchdog_reported = park_time;
+                stalls[nstalls] = (eb_chan_stall){
+                    .type = eb_chan_stall_parked,
+                    .chan = c,
+                    .send = send,
+                    .tid = w->tid,
+                    .duration = now - park_time,
+                };
+                nstalls++;
+            }
+        }
+    eb_spinlock_unlock(&l->lock);
+    return nstalls;
+}
 
-/* Creates a new empty list */
-static inline port_list port_list_alloc(size_t cap) {
-    assert(cap > 0);
+static void *watchdog_thread(void *arg) {
+    enum { k_max_stalls = 32 };
     
-    port_list result = malloc(sizeof(*result));
-    eb_assert_or_recover(result, goto failed);
+    /* Check at a fraction of the smallest threshold */
+    eb_nsec threshold = (g_watchdog_park_threshold < g_watchdog_buf_full_threshold ?
+        g_watchdog_park_threshold : g_watchdog_buf_full_threshold);
+    eb_nsec interval = threshold / 4;
+    interval = (interval < eb_nsec_per_msec ? eb_nsec_per_msec : (interval > eb_nsec_per_sec ? eb_nsec_per_sec : interval));
     
-    result->lock = EB_SPINLOCK_INIT;
-    result->cap = cap;
-    result->len = 0;
-    result->ports = malloc(cap * sizeof(*(result->ports)));
-    eb_assert_or_recover(result->ports, goto failed);
+    while (!*((volatile int *)&g_watchdog_stop)) {
+        struct timespec ts = {.tv_sec = interval / eb_nsec_per_sec, .tv_nsec = interval % eb_nsec_per_sec};
+        nanosleep(&ts, NULL);
+        
+        /* Collect the stalls with each registry shard locked in turn, retaining their channels so that we can call the
+           hook with the registry unlocked (so that it can use the channel API) */
+        eb_chan_stall stalls[k_max_stalls];
+        size_t nstalls = 0;
+        eb_nsec now = eb_time_now();
+        for (size_t i = 0; i < EB_CHAN_REGISTRY_SHARDS && nstalls < k_max_stalls; i++) {
+            registry_shard *shard = &g_registry[i];
+            eb_spinlock_lock(&shard->lock);
+            for (eb_chan c = shard->head; c && nstalls < k_max_stalls; c = c->reg_next) {
+                if (g_watchdog_park_threshold != eb_nsec_forever) {
+                    nstalls = watchdog_check_waiters(c, &c->sends, true, now, stalls, nstalls, k_max_stalls);
+                    nstalls = watchdog_check_waiters(c, &c->recvs, false, now, stalls, nstalls, k_max_stalls);
+                }
+                
+                if (c->buf_cap && g_watchdog_buf_full_threshold != eb_nsec_forever && nstalls < k_max_stalls) {
+                    eb_spinlock_lock_prof(&c->lock, &c->lock_prof);
+                        if (c->buf_len == c->buf_cap && !c->buf_full_since) {
+                            /* The buffer was already full when the watchdog started */
+                            c->buf_full_since = now;
+                        } else if (c->buf_full_since && now > c->buf_full_since &&
+                            now - c->buf_full_since >= g_watchdog_buf_full_threshold && !c->buf_full_reported &&
+                            registry_retain(c)) {
+                            c->buf_full_reported = true;
+                            stalls[nstalls] = (eb_chan_stall){
+                                .type = eb_chan_stall_buf_full,
+                                .chan = c,
+                                .duration = now - c->buf_full_since,
+                            };
+                            nstalls++;
+                        }
+                    eb_spinlock_unlock(&c->lock);
+                }
+            }
+            eb_spinlock_unlock(&shard->lock);
+        }
+        
+        for (size_t i = 0; i < nstalls; i++) {
+            g_watchdog_hook(&stalls[i], g_watchdog_ctx);
+            eb_chan_release(stalls[i].chan);
+        }
+    }
     
-    return result;
-    failed: {
-        port_list_free(result);
-        return NULL;
+    return NULL;
+}
+
+bool eb_chan_watchdog_start(eb_nsec park_threshold, eb_nsec buf_full_threshold, eb_chan_stall_hook hook, void *ctx) {
+    assert(hook);
+    
+    /* Only one watchdog runs at a time */
+    if (!eb_atomic_compare_and_swap(&g_watchdog_state, service_idle, service_starting)) {
+        return false;
     }
+    
+    /* Initialize eb_sys so that eb_sys_ncores is valid. */
+    eb_sys_init();
+    
+    g_watchdog_park_threshold = park_threshold;
+    g_watchdog_buf_full_threshold = buf_full_threshold;
+    g_watchdog_hook = hook;
+    g_watchdog_ctx = ctx;
+    g_watchdog_stop = 0;
+    g_watchdog_start_time = eb_time_now();
+    eb_atomic_barrier();
+    
+    int r = pthread_create(&g_watchdog_thread, NULL, watchdog_thread, NULL);
+    eb_assert_or_recover(!r, *((volatile service_state *)&g_watchdog_state) = service_idle; return false);
+    /* Only mark the watchdog running once its thread exists, so that eb_chan_watchdog_stop() always has one to join */
+    eb_atomic_barrier();
+    *((volatile service_state *)&g_watchdog_state) = service_running;
+    return true;
 }
 
-/* Releases every port in the list, and frees the list itself */
-static inline void port_list_free(port_list l) {
-    /* Intentionally allowing l==NULL */
-    if (!l) {
+void eb_chan_watchdog_stop() {
+    /* Claim the watchdog, so that only one of several concurrent callers joins its thread */
+    if (!service_claim_stop(&g_watchdog_state)) {
         return;
     }
     
-    /* Release each port in our list */
-    for (size_t i = 0; i < l->len; i++) {
-        eb_port_release(l->ports[i]);
+    g_watchdog_stop = 1;
+    eb_atomic_barrier();
+    int r = pthread_join(g_watchdog_thread, NULL);
+    eb_assert_or_recover(!r, eb_no_op);
+    eb_atomic_barrier();
+    *((volatile service_state *)&g_watchdog_state) = service_idle;
+}
+
+#pragma mark - Metrics -
+bool eb_chan_set_name(eb_chan c, const char *name) {
+    assert(c);
+    
+    char *copy = NULL;
+    size_t size = 0;
+    if (name) {
+        size = strlen(name) + 1;
+        copy = eb_alloc(&c->alloc, size);
+        eb_assert_or_recover(copy, return false);
+        memcpy(copy, name, size);
     }
     
-    free(l->ports);
-    l->ports = NULL;
+    /* Swap the names with c's registry shard locked, since the exporter reads them with it locked */
+    eb_spinlock *lock = &g_registry[c->reg_shard].lock;
+    eb_spinlock_lock(lock);
+        char *old = c->name;
+        size_t old_size = c->name_size;
+        c->name = copy;
+        c->name_size = size;
+    eb_spinlock_unlock(lock);
     
-    free(l);
-    l = NULL;
+    if (old) {
+        eb_free(&c->alloc, old, old_size);
+    }
+    return true;
 }
 
-/* Add a port to the end of the list, expanding the buffer as necessary */
-static inline void port_list_add(port_list l, eb_port p) {
-    assert(l);
-    assert(p);
+/* The per-channel metric families, each of which is written as a group */
+typedef enum {
+    metric_sends,
+    metric_recvs,
+    metric_retries,
+    metric_lock_failures,
+    metric_parks,
+    metric_wakeups,
+    metric_wasted_wakeups,
+    metric_closes_observed,
+    metric_parked_waiters,
+    metric_buf_cap,
+    metric_buf_len,
+    metric_buf_len_max,
+    metric_closed,
+    metric_count,
+} metric;
+
+static const struct {
+    const char *name;
+    const char *type;
+    const char *help;
+} k_metrics[metric_count] = {
+    [metric_sends] = {"eb_chan_sends_total", "counter", "Successful sends"},
+    [metric_recvs] = {"eb_chan_recvs_total", "counter", "Successful receives"},
+    [metric_retries] = {"eb_chan_retries_total", "counter", "Ops retried because the channel was busy"},
+    [metric_lock_failures] = {"eb_chan_lock_failures_total", "counter", "Failed attempts to acquire the channel's lock"},
+    [metric_parks] = {"eb_chan_parks_total", "counter", "Times a thread parked with an op on the channel"},
+    [metric_wakeups] = {"eb_chan_wakeups_total", "counter", "Wakeups delivered to the channel's waiters"},
+    [metric_wasted_wakeups] = {"eb_chan_wasted_wakeups_total", "counter", "Wakeups after which the woken thread parked again"},
+    [metric_closes_observed] = {"eb_chan_closes_observed_total", "counter", "Ops that completed because the channel was closed"},
+    [metric_parked_waiters] = {"eb_chan_parked_waiters", "gauge", "Threads currently parked with an op on the channel"},
+    [metric_buf_cap] = {"eb_chan_buffer_capacity", "gauge", "The channel's buffer capacity"},
+    [metric_buf_len] = {"eb_chan_buffer_length", "gauge", "Values currently in the channel's buffer"},
+    [metric_buf_len_max] = {"eb_chan_buffer_length_max", "gauge", "High-water mark of the channel's buffer length"},
+    [metric_closed] = {"eb_chan_closed", "gauge", "Whether the channel is closed"},
+};
+
+/* The text that the metrics are formatted into, allocated with the global allocator. Formatting stops at the first
+   failed allocation, which is remembered in 'failed'. */
+typedef struct {
+    eb_chan_allocator alloc;
+    char *buf;
+    size_t cap;
+    size_t len;
+    bool failed;
+} metrics_text;
+
+static void metrics_text_init(metrics_text *t) {
+    assert(t);
     
-    /* First retain the port! */
-    eb_port_retain(p);
+    memset(t, 0, sizeof(*t));
+    t->alloc = eb_alloc_global();
+}
+
+static void metrics_text_free(metrics_text *t) {
+    assert(t);
     
-    eb_spinlock_lock(&l->lock);
-        /* Sanity-check that the list's length is less than its capacity */
-        eb_assert_or_bail(l->len <= l->cap, "Sanity check failed");
-        
-        /* Expand the list's buffer if it's full */
-        if (l->len == l->cap) {
-            l->cap *= 2;
-            // TODO: reimplement as a linked list, where the port nodes are just on the stacks of the _select_list() calls. that way the number of ports is unbounded, and we don't have to allocate anything on the heap!
-            l->ports = realloc(l->ports, l->cap * sizeof(*(l->ports)));
-            eb_assert_or_bail(l->ports, "Allocation failed");
+    eb_free(&t->alloc, t->buf, t->cap);
+    t->buf = NULL;
+    t->cap = 0;
+}
+
+/* Ensures that 't' has room for 'size' more bytes, plus a terminator */
+static bool metrics_text_reserve(metrics_text *t, size_t size) {
+    if (t->failed) {
+        return false;
+    }
+    
+    if (t->len + size + 1 > t->cap) {
+        size_t cap = (t->cap ? t->cap : 4096);
+        while (t->len + size + 1 > cap) {
+            cap *= 2;
+        }
+        char *buf = eb_realloc(&t->alloc, t->buf, t->cap, cap);
+        eb_assert_or_recover(buf, t->failed = true; return false);
+        t->buf = buf;
+        t->cap = cap;
+    }
+    return true;
+}
+
+static void metrics_printf(metrics_text *t, const char *format, ...) {
+    /* Format into the remaining space, and if it doesn't fit, grow the buffer and format again */
+    for (size_t size = 0;;) {
+        if (!metrics_text_reserve(t, size)) {
+            return;
         }
         
-        l->ports[l->len] = p;
-        l->len++;
-    eb_spinlock_unlock(&l->lock);
+        va_list args;
+        va_start(args, format);
+        int r = vsnprintf(t->buf + t->len, t->cap - t->len, format, args);
+        va_end(args);
+        eb_assert_or_recover(r >= 0, t->failed = true; return);
+        if ((size_t)r < t->cap - t->len) {
+            t->len += r;
+            return;
+        }
+        size = r;
+    }
 }
 
-/* Remove the first occurence of 'p' in the list. Returns whether a port was actually removed. */
-static inline bool port_list_rm(port_list l, eb_port p) {
-    assert(l);
-    assert(p);
-    
-    bool result = false;
-    eb_spinlock_lock(&l->lock);
-        /* Sanity-check that the list's length is less than its capacity */
-        eb_assert_or_bail(l->len <= l->cap, "Sanity-check failed");
+/* Writes 's' to 't' as a label value, escaping backslashes, quotes and newlines */
+static void metrics_write_escaped(metrics_text *t, const char *s) {
+    for (; *s; s++) {
+        if (!metrics_text_reserve(t, 2)) {
+            return;
+        }
         
-        /* Search for first occurence of the given port. If we find it, release it and move the last port in the list into the hole. */
+        switch (*s) {
+            case '\\':  t->buf[t->len++] = '\\'; t->buf[t->len++] = '\\'; break;
+            case '"':   t->buf[t->len++] = '\\'; t->buf[t->len++] = '"'; break;
+            case '\n':  t->buf[t->len++] = '\\'; t->buf[t->len++] = 'n'; break;
+            default:    t->buf[t->len++] = *s; break;
+        }
+    }
+}
+
+/* A channel's metrics, as copied into a snapshot by metrics_copy_shard(). The channel's name follows the record. */
+typedef struct {
+    eb_chan chan;
+    bool has_counters;
+    eb_chan_counters counters;
+    size_t parked[2];
+    size_t buf_cap;
+    size_t buf_len;
+    bool closed;
+    size_t name_size;   /* Including the terminator, or 0 if the channel is unnamed */
+} metrics_chan;
+
+/* Returns the number of waiters in 'l' (one of a channel's port lists) that are parked */
+static size_t metrics_parked_waiters(port_list *l) {
+    size_t count = 0;
+    eb_spinlock_lock_prof(&l->lock, &l->lock_prof);
         for (size_t i = 0; i < l->len; i++) {
-            if (l->ports[i] == p) {
-                /* Move the last element in the port list into the now-vacant spot */
-                l->ports[i] = l->ports[l->len-1];
-                /* Decrement the buffer length */
-                l->len--;
-                result = true;
-                break;
+            count += (*((volatile eb_nsec *)&eb_port_waiter_info(l->ports[i])->park_time) != 0);
+        }
+    eb_spinlock_unlock(&l->lock);
+    return count;
+}
+
+/* Copies the metrics of every channel in 'shard' into 's', and returns how many channels there were */
+static size_t metrics_copy_shard(snapshot *s, registry_shard *shard) {
+    size_t count = 0;
+    eb_spinlock_lock(&shard->lock);
+        for (eb_chan c = shard->head; c; c = c->reg_next) {
+            size_t name_size = c->name_size;
+            metrics_chan *mc = snapshot_push(s, sizeof(*mc));
+            char *name = snapshot_push(s, name_size);
+            count++;
+            if (!mc || !name) {
+                /* Keep tallying the space that's needed */
+                continue;
+            }
+            
+            mc->chan = c;
+            mc->has_counters = eb_chan_stats(c, &mc->counters);
+            mc->parked[0] = metrics_parked_waiters(&c->sends);
+            mc->parked[1] = metrics_parked_waiters(&c->recvs);
+            mc->buf_cap = c->buf_cap;
+            eb_spinlock_lock_prof(&c->lock, &c->lock_prof);
+                mc->closed = (c->state == chanstate_closed);
+                mc->buf_len = c->buf_len;
+            eb_spinlock_unlock(&c->lock);
+            mc->name_size = name_size;
+            if (name_size) {
+                memcpy(name, c->name, name_size);
             }
         }
-    eb_spinlock_unlock(&l->lock);
-    
-    if (result) {
-        /* Release the port, but do so outside of the spinlock because releasing does some stuff that might not be quick. */
-        eb_port_release(p);
+    eb_spinlock_unlock(&shard->lock);
+    return count;
+}
+
+/* Returns the number of samples (0-2) that 'mc' has in family 'm', storing them in 'vals' */
+static size_t metrics_values(const metrics_chan *mc, metric m, uint64_t vals[2]) {
+    const eb_chan_counters *c = &mc->counters;
+    switch (m) {
+        case metric_sends:              vals[0] = c->sends; return mc->has_counters;
+        case metric_recvs:              vals[0] = c->recvs; return mc->has_counters;
+        case metric_retries:            vals[0] = c->retries; return mc->has_counters;
+        case metric_lock_failures:      vals[0] = c->lock_failures; return mc->has_counters;
+        case metric_parks:              vals[0] = c->parks; return mc->has_counters;
+        case metric_wakeups:            vals[0] = c->wakeups; return mc->has_counters;
+        case metric_wasted_wakeups:     vals[0] = c->wasted_wakeups; return mc->has_counters;
+        case metric_closes_observed:    vals[0] = c->closes_observed; return mc->has_counters;
+        case metric_buf_len_max:        vals[0] = c->buf_len_max; return (mc->has_counters && mc->buf_cap);
+        case metric_parked_waiters:     vals[0] = mc->parked[0]; vals[1] = mc->parked[1]; return 2;
+        case metric_buf_cap:            vals[0] = mc->buf_cap; return (mc->buf_cap != 0);
+        case metric_buf_len:            vals[0] = mc->buf_len; return (mc->buf_cap != 0);
+        case metric_closed:             vals[0] = mc->closed; return 1;
+        default:                        return 0;
     }
-    
-    return result;
 }
 
-/* Signal the first port in the list that isn't 'ignore' */
-static inline void port_list_signal_first(const port_list l, eb_port ignore) {
-    assert(l);
-    
-    eb_port p = NULL;
-    eb_spinlock_lock(&l->lock);
-        for (size_t i = 0; i < l->len; i++) {
-            if (l->ports[i] != ignore) {
-                p = eb_port_retain(l->ports[i]);
-                break;
+/* Writes family 'm' for every channel in 's' to 't', if any channel has a sample in it */
+static void metrics_family(metrics_text *t, const snapshot *s, metric m) {
+    static const char *const k_ops[2] = {"send", "recv"};
+    bool wrote_header = false;
+    for (const char *p = s->buf; p < s->buf + s->len;) {
+        const metrics_chan *mc = (const metrics_chan *)p;
+        p += snapshot_align(sizeof(*mc));
+        const char *name = (mc->name_size ? p : NULL);
+        p += snapshot_align(mc->name_size);
+        
+        uint64_t vals[2];
+        size_t nvals = metrics_values(mc, m, vals);
+        if (nvals && !wrote_header) {
+            metrics_printf(t, "# HELP %s %s\n# TYPE %s %s\n", k_metrics[m].name, k_metrics[m].help, k_metrics[m].name,
+                k_metrics[m].type);
+            wrote_header = true;
+        }
+        
+        for (size_t i = 0; i < nvals; i++) {
+            metrics_printf(t, "%s{chan=\"%p\"", k_metrics[m].name, (void *)mc->chan);
+            if (name) {
+                metrics_printf(t, ",name=\"");
+                metrics_write_escaped(t, name);
+                metrics_printf(t, "\"");
             }
+            if (nvals > 1) {
+                metrics_printf(t, ",op=\"%s\"", k_ops[i]);
+            }
+            metrics_printf(t, "} %llu\n", (unsigned long long)vals[i]);
         }
-    eb_spinlock_unlock(&l->lock);
-    
-    if (p) {
-        eb_port_signal(p);
-        eb_port_release(p);
-        p = NULL;
     }
 }
 
-enum {
-    /* Buffered/unbuffered channel states */
-    chanstate_open,
-    chanstate_closed,
-    /* Unbuffered channel states */
-    chanstate_send,
-    chanstate_recv,
-    chanstate_ack,
-    chanstate_done,
-    chanstate_cancelled
-}; typedef int32_t chanstate;
+static void metrics_global(metrics_text *t, const char *name, const char *type, const char *help, uint64_t val) {
+    metrics_printf(t, "# HELP %s %s\n# TYPE %s %s\n%s %llu\n", name, help, name, type, name, (unsigned long long)val);
+}
 
-typedef struct {
-    eb_chan_op *const *ops;
-    size_t nops;
-    bool *cleanup_ops;
+/* Formats the metrics in the Prometheus text format into 't', which must be freed with metrics_text_free() either way.
+   Returns false on failure. */
+static bool metrics_format(metrics_text *t) {
+    assert(t);
     
-    eb_nsec timeout;
-    eb_port port;
-} do_state;
-
-struct eb_chan {
-    unsigned int retain_count;
-    eb_spinlock lock;
-    chanstate state;
+    metrics_text_init(t);
     
-    port_list sends;
-    port_list recvs;
+    /* Copy every channel's metrics with the registry locked a shard at a time, and format them after releasing the
+       locks so that formatting doesn't stall the channels' users. Copy again if the snapshot had to grow. */
+    snapshot s;
+    snapshot_init(&s);
+    size_t nchans = 0;
+    do {
+        if (!snapshot_reset(&s)) {
+            snapshot_free(&s);
+            return false;
+        }
+        nchans = 0;
+        for (size_t i = 0; i < EB_CHAN_REGISTRY_SHARDS; i++) {
+            nchans += metrics_copy_shard(&s, &g_registry[i]);
+        }
+    } while (!snapshot_fits(&s));
     
-    /* Buffered ivars */
-    size_t buf_cap;
-    size_t buf_len;
-    size_t buf_idx;
-    const void **buf;
+    for (metric m = 0; m < metric_count; m++) {
+        metrics_family(t, &s, m);
+    }
+    snapshot_free(&s);
     
-    /* Unbuffered ivars */
-    const do_state *unbuf_state;
-    eb_chan_op *unbuf_op;
-    eb_port unbuf_port;
-};
+    eb_chan_alloc_counts alloc;
+    eb_chan_alloc_stats(&alloc);
+    eb_port_pool_usage pool;
+    eb_port_pool_stats(&pool);
+    metrics_global(t, "eb_chan_channels", "gauge", "Live channels", nchans);
+    metrics_global(t, "eb_chan_ports", "gauge", "Ports (per-thread wait objects) that exist, including pooled ones", pool.ports);
+    metrics_global(t, "eb_chan_port_pool_length", "gauge", "Ports in the port pool", pool.len);
+    metrics_global(t, "eb_chan_port_pool_capacity", "gauge", "The port pool's capacity", pool.cap);
+    metrics_global(t, "eb_chan_port_pool_hits_total", "counter", "Port creations satisfied by the port pool", pool.hits);
+    metrics_global(t, "eb_chan_port_pool_misses_total", "counter", "Port creations that had to create a port", pool.misses);
+    metrics_global(t, "eb_chan_allocs_total", "counter", "Allocations", alloc.allocs);
+    metrics_global(t, "eb_chan_alloc_bytes_in_use", "gauge", "Bytes currently allocated", alloc.bytes_in_use);
+    return !t->failed;
+}
 
-#pragma mark - Channel creation/lifecycle -
-static inline void eb_chan_free(eb_chan c) {
-    /* Intentionally allowing c==NULL so that this function can be called from eb_chan_create() */
-    if (!c) {
-        return;
+/* Writes 'len' bytes to 'fd', retrying partial writes. Sockets are written without raising SIGPIPE. */
+static bool metrics_write_all(int fd, const char *buf, size_t len, bool sock) {
+    while (len) {
+        ssize_t r;
+        #if EB_SYS_LINUX
+            r = (sock ? send(fd, buf, len, MSG_NOSIGNAL) : write(fd, buf, len));
+        #else
+            /* Darwin sockets have SO_NOSIGPIPE set instead */
+            r = write(fd, buf, len);
+        #endif
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            return false;
+        }
+        buf += r;
+        len -= r;
     }
+    return true;
+}
+
+bool eb_chan_metrics_write(int fd) {
+    metrics_text t;
+    bool r = (metrics_format(&t) && metrics_write_all(fd, t.buf, t.len, false));
+    metrics_text_free(&t);
+    return r;
+}
+
+bool eb_chan_metrics_write_file(const char *path) {
+    assert(path);
     
-    if (c->buf_cap) {
-        /* ## Buffered */
-        free(c->buf);
-        c->buf = NULL;
-    }
+    /* Write to a temporary file that's renamed over 'path', so that readers never see a partial file. It's uniquely
+       named so that concurrent writers (e.g. two processes sharing 'path') don't write into each other's. */
+    char tmp[PATH_MAX];
+    int r = snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+    eb_assert_or_recover(r > 0 && (size_t)r < sizeof(tmp), return false);
     
-    port_list_free(c->recvs);
-    c->recvs = NULL;
+    int fd = mkstemp(tmp);
+    eb_assert_or_recover(fd >= 0, return false);
+    /* mkstemp() creates the file readable only by its owner, but the metrics are meant to be collected */
+    bool ok = !fchmod(fd, 0644);
+    ok = eb_chan_metrics_write(fd) && ok;
+    ok = !close(fd) && ok;
+    if (ok) {
+        ok = !rename(tmp, path);
+    }
+    if (!ok) {
+        unlink(tmp);
+    }
+    return ok;
+}
+
+/* The metrics server's socket, and the thread that serves it */
+static int g_metrics_fd = -1;
+static char g_metrics_path[sizeof(((struct sockaddr_un *)NULL)->sun_path)];
+static pthread_t g_metrics_thread;
+static int g_metrics_stop = 0;
+/* The metrics server's state; its socket and thread exist while it's service_running or service_stopping */
+static service_state g_metrics_state = service_idle;
+
+/* Serves the metrics to a client. Clients that send an HTTP request (e.g. `curl --unix-socket`) get an HTTP response;
+   clients that send nothing get the bare metrics. */
+static void metrics_respond(int fd) {
+    enum { k_timeout_msec = 1000 };
+    #if EB_SYS_DARWIN
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+    #endif
     
-    port_list_free(c->sends);
-    c->sends = NULL;
+    /* Read the request's header, if there is one */
+    char req[1024];
+    size_t req_len = 0;
+    while (req_len < sizeof(req) - 1) {
+        struct pollfd p = {.fd = fd, .events = POLLIN};
+        if (poll(&p, 1, k_timeout_msec) <= 0) {
+            break;
+        }
+        ssize_t r = read(fd, req + req_len, sizeof(req) - 1 - req_len);
+        if (r <= 0) {
+            break;
+        }
+        req_len += r;
+        req[req_len] = 0;
+        if (strstr(req, "\r\n\r\n")) {
+            break;
+        }
+    }
+    req[req_len] = 0;
     
-    free(c);
-    c = NULL;
+    metrics_text t;
+    bool ok = metrics_format(&t);
+    if (!req_len) {
+        if (ok) {
+            metrics_write_all(fd, t.buf, t.len, true);
+        }
+    } else if (ok) {
+        char header[128];
+        int r = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: %zu\r\n\r\n", t.len);
+        if (metrics_write_all(fd, header, r, true)) {
+            metrics_write_all(fd, t.buf, t.len, true);
+        }
+    } else {
+        static const char k_error[] = "HTTP/1.0 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n";
+        metrics_write_all(fd, k_error, sizeof(k_error) - 1, true);
+    }
+    metrics_text_free(&t);
 }
 
-eb_chan eb_chan_create(size_t buf_cap) {
-    static const size_t k_init_buf_cap = 16;
+static void *metrics_thread(void *arg) {
+    enum { k_poll_msec = 100 };
     
-    /* Initialize eb_sys so that eb_sys_ncores is valid. */
-    eb_sys_init();
+    while (!*((volatile int *)&g_metrics_stop)) {
+        /* Poll so that we notice eb_chan_metrics_stop() */
+        struct pollfd p = {.fd = g_metrics_fd, .events = POLLIN};
+        if (poll(&p, 1, k_poll_msec) <= 0) {
+            continue;
+        }
+        
+        int fd = accept(g_metrics_fd, NULL, NULL);
+        if (fd >= 0) {
+            metrics_respond(fd);
+            close(fd);
+        }
+    }
     
-    /* Using calloc so that the bytes are zeroed. */
-    eb_chan c = calloc(1, sizeof(*c));
-    eb_assert_or_recover(c, goto failed);
+    return NULL;
+}
+
+bool eb_chan_metrics_serve(const char *path) {
+    assert(path);
     
-    c->retain_count = 1;
-    c->lock = EB_SPINLOCK_INIT;
-    c->state = chanstate_open;
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    eb_assert_or_recover(strlen(path) < sizeof(addr.sun_path), return false);
+    
+    /* Only one server runs at a time */
+    if (!eb_atomic_compare_and_swap(&g_metrics_state, service_idle, service_starting)) {
+        return false;
+    }
     
-    c->sends = port_list_alloc(k_init_buf_cap);
-    eb_assert_or_recover(c->sends, goto failed);
-    c->recvs = port_list_alloc(k_init_buf_cap);
-    eb_assert_or_recover(c->recvs, goto failed);
+    strcpy(addr.sun_path, path);
+    strcpy(g_metrics_path, path);
     
-    if (buf_cap) {
-        /* ## Buffered */
-        c->buf_cap = buf_cap;
-        c->buf_len = 0;
-        c->buf_idx = 0;
-        c->buf = malloc(c->buf_cap * sizeof(*(c->buf)));
-        eb_assert_or_recover(c->buf, goto failed);
-    } else {
-        /* ## Unbuffered */
-        c->unbuf_state = NULL;
-        c->unbuf_op = NULL;
-        c->unbuf_port = NULL;
+    /* Remove a stale socket (but nothing else) left by a previous process */
+    struct stat st;
+    if (!lstat(path, &st) && S_ISSOCK(st.st_mode)) {
+        unlink(path);
     }
     
-    /* Issue a memory barrier since we didn't have the lock acquired for our set up (and this channel could theoretically
-       be passed to another thread without a barrier, and that'd be bad news...) */
-    eb_atomic_barrier();
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    eb_assert_or_recover(fd >= 0, goto failed);
+    int r = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    eb_assert_or_recover(!r, goto failed);
+    r = listen(fd, 16);
+    eb_assert_or_recover(!r, goto failed);
     
-    return c;
+    g_metrics_fd = fd;
+    g_metrics_stop = 0;
+    eb_atomic_barrier();
+    r = pthread_create(&g_metrics_thread, NULL, metrics_thread, NULL);
+    eb_assert_or_recover(!r, unlink(path); goto failed);
+    eb_atomic_barrier();
+    *((volatile service_state *)&g_metrics_state) = service_running;
+    return true;
     failed: {
-        eb_chan_free(c);
-        return NULL;
+        if (fd >= 0) {
+            close(fd);
+        }
+        g_metrics_fd = -1;
+        eb_atomic_barrier();
+        *((volatile service_state *)&g_metrics_state) = service_idle;
+        return false;
     }
 }
 
-eb_chan eb_chan_retain(eb_chan c) {
-    assert(c);
-    eb_atomic_add(&c->retain_count, 1);
-    return c;
+void eb_chan_metrics_stop() {
+    /* Claim the server, so that only one of several concurrent callers joins its thread and closes its socket */
+    if (!service_claim_stop(&g_metrics_state)) {
+        return;
+    }
+    
+    g_metrics_stop = 1;
+    eb_atomic_barrier();
+    int r = pthread_join(g_metrics_thread, NULL);
+    eb_assert_or_recover(!r, eb_no_op);
+    close(g_metrics_fd);
+    unlink(g_metrics_path);
+    g_metrics_fd = -1;
+    eb_atomic_barrier();
+    *((volatile service_state *)&g_metrics_state) = service_idle;
 }
 
-void eb_chan_release(eb_chan c) {
-    assert(c);
-    if (eb_atomic_add(&c->retain_count, -1) == 0) {
-        eb_chan_free(c);
+#pragma mark - Traffic capture -
+#if EB_CHAN_CAPTURE
+    /* Returns c's capture-local id in 'session', defining the channel in the capture the first time it's seen */
+    static uint32_t capture_chan_id(eb_chan c, uint32_t session) {
+        uint64_t tag = eb_atomic_load_relaxed(&c->capture_tag);
+        if ((uint32_t)(tag >> 32) == session) {
+            return (uint32_t)tag;
+        }
+        
+        uint64_t new_tag = ((uint64_t)session << 32) | eb_capture_chan_next();
+        if (!eb_atomic_compare_and_swap(&c->capture_tag, tag, new_tag)) {
+            /* Another thread saw the channel first, and defines it */
+            return (uint32_t)eb_atomic_load_relaxed(&c->capture_tag);
+        }
+        
+        /* Copy the name with c's registry shard locked, since eb_chan_set_name() swaps it with the shard locked */
+        char name[EB_CAPTURE_NAME_MAX + 1] = "";
+        eb_spinlock *lock = &g_registry[c->reg_shard].lock;
+        eb_spinlock_lock(lock);
+            if (c->name) {
+                strncpy(name, c->name, EB_CAPTURE_NAME_MAX);
+            }
+        eb_spinlock_unlock(lock);
+        eb_capture_define(session, (uint32_t)new_tag, c->buf_cap, name);
+        return (uint32_t)new_tag;
     }
-}
+    
+    /* Records an op of 'type' on 'c' that was issued at tick 'start' and completed at tick 'end' */
+    static void capture(eb_chan c, uint32_t session, eb_chan_capture_type type, eb_chan_capture_flags flags,
+        uint64_t start, uint64_t end) {
+        /* The depth is read without the lock, so it's approximate when other threads are operating on the channel */
+        size_t depth = (c->buf_cap ? *((volatile size_t *)&c->buf_len) : 0);
+        eb_capture_record(session, (uint8_t)type, flags, capture_chan_id(c, session), depth, start, end);
+    }
+#endif
 
 #pragma mark - Channel closing -
 eb_chan_res eb_chan_close(eb_chan c) {
     assert(c);
     
+    unsigned int shard = eb_thread_stats_shard(EB_CHAN_STATS_SHARDS);
     eb_chan_res result = eb_chan_res_stalled;
     while (result == eb_chan_res_stalled) {
-        eb_port signal_port = NULL;
-        eb_spinlock_lock(&c->lock);
+        eb_port unbuf_port = NULL;
+        eb_spinlock_lock_prof(&c->lock, &c->lock_prof);
             if (c->state == chanstate_open) {
                 c->state = chanstate_closed;
                 result = eb_chan_res_ok;
@@ -694,7 +4788,7 @@ eb_chan_res eb_chan_close(eb_chan c) {
                 result = eb_chan_res_closed;
             } else if (c->state == chanstate_send || c->state == chanstate_recv) {
                 if (c->unbuf_port) {
-                    signal_port = eb_port_retain(c->unbuf_port);
+                    unbuf_port = eb_port_retain(c->unbuf_port);
                 }
                 c->state = chanstate_closed;
                 result = eb_chan_res_ok;
@@ -702,17 +4796,26 @@ eb_chan_res eb_chan_close(eb_chan c) {
         eb_spinlock_unlock(&c->lock);
         
         /* Wake up the send/recv */
-        if (signal_port) {
-            eb_port_signal(signal_port);
-            eb_port_release(signal_port);
-            signal_port = NULL;
+        if (unbuf_port) {
+            signal_port(c, shard, unbuf_port);
+            eb_port_release(unbuf_port);
+            unbuf_port = NULL;
         }
     }
     
     if (result == eb_chan_res_ok) {
+        trace(eb_trace_close, c, NULL, 0);
+        #if EB_CHAN_CAPTURE
+            uint32_t capture_session = *((volatile uint32_t *)&eb_capture_session);
+            if (capture_session) {
+                uint64_t now = eb_time_ticks();
+                capture(c, capture_session, eb_chan_capture_close, 0, now, now);
+            }
+        #endif
+        eb_probe1(close, c);
         /* Wake up the sends/recvs so that they see the channel's now closed */
-        port_list_signal_first(c->sends, NULL);
-        port_list_signal_first(c->recvs, NULL);
+        signal_first(c, shard, &c->sends, NULL);
+        signal_first(c, shard, &c->recvs, NULL);
     }
     
     return result;
@@ -733,7 +4836,7 @@ size_t eb_chan_buf_len(eb_chan c) {
     }
     
     size_t r = 0;
-    eb_spinlock_lock(&c->lock);
+    eb_spinlock_lock_prof(&c->lock, &c->lock_prof);
         r = c->buf_len;
     eb_spinlock_unlock(&c->lock);
     return r;
@@ -755,29 +4858,32 @@ static inline void cleanup_ops(const do_state *state) {
             eb_chan c = op->chan;
             bool signal_send = false;
             bool signal_recv = false;
-            eb_spinlock_lock(&c->lock);
+            eb_spinlock_lock_prof(&c->lock, &c->lock_prof);
                 if (c->state == chanstate_send && c->unbuf_op == op) {
                     /* 'op' was in the process of an unbuffered send on the channel, but no recv had arrived
                        yet, so reset state to _open. */
                     c->state = chanstate_open;
+                    trace_state(c);
                     signal_send = true;
                 } else if (c->state == chanstate_recv && c->unbuf_op == op) {
                     /* 'op' was in the process of an unbuffered recv on the channel, but no send had arrived
                        yet, so reset state to _open. */
                     c->state = chanstate_open;
+                    trace_state(c);
                     signal_recv = true;
                 } else if (c->state == chanstate_ack && c->unbuf_op == op) {
                     /* A counterpart acknowledged 'op' but, but 'op' isn't the one that completed in our select() call, so we're cancelling. */
                     c->state = chanstate_cancelled;
+                    trace_state(c);
                 }
             eb_spinlock_unlock(&c->lock);
             
             if (signal_send) {
-                port_list_signal_first(c->sends, state->port);
+                signal_first(c, state->shard, &c->sends, state->port);
             }
             
             if (signal_recv) {
-                port_list_signal_first(c->recvs, state->port);
+                signal_first(c, state->shard, &c->recvs, state->port);
             }
             
             state->cleanup_ops[i] = false;
@@ -795,9 +4901,9 @@ static inline op_result send_buf(const do_state *state, eb_chan_op *op, size_t o
     
     if (c->buf_len < c->buf_cap || c->state == chanstate_closed) {
         /* It looks like our channel's in an acceptable state, so try to acquire the lock */
-        if (eb_spinlock_try(&c->lock)) {
+        if (eb_spinlock_try_prof(&c->lock, &c->lock_prof)) {
             /* Sanity-check the channel's state */
-            eb_assert_or_bail(c->state == chanstate_open || c->state == chanstate_closed, "Invalid channel state");
+            eb_sanity_or_bail(c->state == chanstate_open || c->state == chanstate_closed, "Invalid channel state");
             
             bool signal_recv = false;
             if (c->state == chanstate_closed) {
@@ -813,6 +4919,25 @@ static inline op_result send_buf(const do_state *state, eb_chan_op *op, size_t o
                 size_t idx = (c->buf_idx + c->buf_len) % c->buf_cap;
                 c->buf[idx] = op->val;
                 c->buf_len++;
+                #if EB_CHAN_STATS
+                    /* Track the high-water mark and the occupancy that the send left the buffer with */
+                    if (c->stats) {
+                        if (c->buf_len > c->stats->buf_len_max) {
+                            c->stats->buf_len_max = c->buf_len;
+                        }
+                        c->stats->occupancy[((c->buf_len - 1) * EB_CHAN_STATS_OCCUPANCY_BUCKETS) / c->buf_cap]++;
+                    }
+                #endif
+                #if EB_CHAN_LATENCY
+                    if (c->lat) {
+                        c->lat->ts[idx] = eb_time_ticks();
+                    }
+                #endif
+                /* Track how long the buffer stays full, for the watchdog */
+                if (c->buf_len == c->buf_cap && *((volatile service_state *)&g_watchdog_state) == service_running) {
+                    c->buf_full_since = eb_time_now();
+                    c->buf_full_reported = false;
+                }
                 /* Set our op's state and our return value */
                 op->res = eb_chan_res_ok;
                 result = op_result_complete;
@@ -821,9 +4946,12 @@ static inline op_result send_buf(const do_state *state, eb_chan_op *op, size_t o
             eb_spinlock_unlock(&c->lock);
             
             if (signal_recv) {
-                port_list_signal_first(c->recvs, state->port);
+                signal_first(c, state->shard, &c->recvs, state->port);
             }
         } else {
+            stats_add(c, state->shard, lock_failures, 1);
+            trace(eb_trace_lock_retry, c, NULL, 0);
+            eb_probe1(lock_contended, c);
             result = op_result_retry;
         }
     }
@@ -840,9 +4968,9 @@ static inline op_result recv_buf(const do_state *state, eb_chan_op *op, size_t o
     op_result result = op_result_next;
     
     if (c->buf_len || c->state == chanstate_closed) {
-        if (eb_spinlock_try(&c->lock)) {
+        if (eb_spinlock_try_prof(&c->lock, &c->lock_prof)) {
             /* Sanity-check the channel's state */
-            eb_assert_or_bail(c->state == chanstate_open || c->state == chanstate_closed, "Invalid channel state");
+            eb_sanity_or_bail(c->state == chanstate_open || c->state == chanstate_closed, "Invalid channel state");
             
             bool signal_send = false;
             if (c->buf_len) {
@@ -853,9 +4981,15 @@ static inline op_result recv_buf(const do_state *state, eb_chan_op *op, size_t o
                 op->res = eb_chan_res_ok;
                 op->val = c->buf[c->buf_idx];
                 result = op_result_complete;
+                #if EB_CHAN_LATENCY
+                    if (c->lat) {
+                        latency_record(c, c->lat->ts[c->buf_idx]);
+                    }
+                #endif
                 /* Update chan's buffer. (Updating buf_idx needs to come after we use it!) */
                 c->buf_len--;
                 c->buf_idx = (c->buf_idx + 1) % c->buf_cap;
+                c->buf_full_since = 0;
             } else if (c->state == chanstate_closed) {
                 /* ## Receiving, buffered, buffer empty, channel closed */
                 /* Set our op's state and our return value */
@@ -867,9 +5001,12 @@ static inline op_result recv_buf(const do_state *state, eb_chan_op *op, size_t o
             eb_spinlock_unlock(&c->lock);
             
             if (signal_send) {
-                port_list_signal_first(c->sends, state->port);
+                signal_first(c, state->shard, &c->sends, state->port);
             }
         } else {
+            stats_add(c, state->shard, lock_failures, 1);
+            trace(eb_trace_lock_retry, c, NULL, 0);
+            eb_probe1(lock_contended, c);
             result = op_result_retry;
         }
     }
@@ -892,16 +5029,23 @@ static inline op_result send_unbuf(const do_state *state, eb_chan_op *op, size_t
         (c->state == chanstate_ack && c->unbuf_op == op)) {
         
         /* It looks like our channel's in an acceptable state, so try to acquire the lock */
-        if (eb_spinlock_try(&c->lock)) {
+        if (eb_spinlock_try_prof(&c->lock, &c->lock_prof)) {
             /* Reset the cleanup state since we acquired the lock and are actually getting a look at the channel's state */
             state->cleanup_ops[op_idx] = false;
             
             bool signal_recv = false;
             if (c->state == chanstate_open && state->timeout != eb_nsec_zero) {
                 c->state = chanstate_send;
+                trace_state(c);
                 c->unbuf_state = state;
                 c->unbuf_op = op;
                 c->unbuf_port = state->port;
+                #if EB_CHAN_LATENCY
+                    /* The value is offered from now on */
+                    if (c->lat) {
+                        c->lat_unbuf_ts = eb_time_ticks();
+                    }
+                #endif
                 /* We need to cleanup after this since we put it in the _send state! */
                 state->cleanup_ops[op_idx] = true;
                 /* Signal a recv since one of them can continue now */
@@ -914,7 +5058,7 @@ static inline op_result send_unbuf(const do_state *state, eb_chan_op *op, size_t
                 /* We own the send op that's in progress, so assign chan's unbuf_port */
                 /* Verify that the unbuf_state matches our 'id' parameter. If this assertion fails, it means there's likely
                    one eb_chan_op being shared by multiple threads, which isn't allowed. */
-                eb_assert_or_bail(c->unbuf_state == state, "unbuf_state invalid");
+                eb_sanity_or_bail(c->unbuf_state == state, "unbuf_state invalid");
                 /* Assign the port */
                 c->unbuf_port = state->port;
                 /* We need to cleanup after this since we put it in the _send state! */
@@ -924,21 +5068,29 @@ static inline op_result send_unbuf(const do_state *state, eb_chan_op *op, size_t
                    sends/recvs from the same _do() call) */
                 
                 /* Sanity check -- make sure the op is a recv */
-                eb_assert_or_bail(!c->unbuf_op->send, "Op isn't a recv as expected");
+                eb_sanity_or_bail(!c->unbuf_op->send, "Op isn't a recv as expected");
                 
                 /* Set the recv op's value. This needs to happen before we transition out of the _recv state, otherwise the unbuf_op may no longer be valid! */
                 c->unbuf_op->val = op->val;
+                #if EB_CHAN_LATENCY
+                    /* The receiver was waiting, so the value is offered at the rendezvous; the receiver records the
+                       latency when it observes the _ack */
+                    if (c->lat) {
+                        c->lat_unbuf_ts = eb_time_ticks();
+                    }
+                #endif
                 /* Acknowledge the receive */
                 c->state = chanstate_ack;
+                trace_state(c);
                 /* Get a reference to the unbuf_port that needs to be signaled */
-                eb_port signal_port = (c->unbuf_port ? eb_port_retain(c->unbuf_port) : NULL);
+                eb_port unbuf_port = (c->unbuf_port ? eb_port_retain(c->unbuf_port) : NULL);
                 eb_spinlock_unlock(&c->lock);
                 
                 /* Wake up the recv */
-                if (signal_port) {
-                    eb_port_signal(signal_port);
-                    eb_port_release(signal_port);
-                    signal_port = NULL;
+                if (unbuf_port) {
+                    signal_port(c, state->shard, unbuf_port);
+                    eb_port_release(unbuf_port);
+                    unbuf_port = NULL;
                 }
                 
                 /* We have to cleanup all our ops here to cancel any outstanding unbuffered send/recvs, to avoid a deadlock
@@ -948,10 +5100,11 @@ static inline op_result send_unbuf(const do_state *state, eb_chan_op *op, size_t
                 
                 for (;;) {
                     if (*((volatile chanstate *)&c->state) != chanstate_ack) {
-                        eb_spinlock_lock(&c->lock);
+                        eb_spinlock_lock_prof(&c->lock, &c->lock_prof);
                             if (c->state == chanstate_done) {
                                 /* Reset the channel state back to _open */
                                 c->state = chanstate_open;
+                                trace_state(c);
                                 /* We reset our state to _open, so signal a send since it can proceed now. */
                                 signal_recv = true;
                                 /* Set our op's state and our return value */
@@ -963,6 +5116,7 @@ static inline op_result send_unbuf(const do_state *state, eb_chan_op *op, size_t
                             } else if (c->state == chanstate_cancelled) {
                                 /* Reset the channel state back to _open */
                                 c->state = chanstate_open;
+                                trace_state(c);
                                 /* As long as we're not polling, we should try the op again */
                                 if (state->timeout != eb_nsec_zero) {
                                     result = op_result_retry;
@@ -975,19 +5129,20 @@ static inline op_result send_unbuf(const do_state *state, eb_chan_op *op, size_t
                                 break;
                             }
                         eb_spinlock_unlock(&c->lock);
-                    } else if (eb_sys_ncores == 1) {
-                        /* On uniprocessor machines, yield to the scheduler because we can't continue until another
-                           thread updates the channel's state. */
-                        sched_yield();
+                    } else if (eb_config_yields()) {
+                        /* On uniprocessor machines (or as configured), yield to the scheduler because we can't
+                           continue until another thread updates the channel's state. */
+                        eb_sys_yield();
                     }
                 }
             } else if (c->state == chanstate_ack && c->unbuf_op == op) {
                 /* A recv acknowledged our send! */
                 /* Verify that the unbuf_state matches our 'id' parameter. If this assertion fails, it means there's likely
                    one eb_chan_op being shared by multiple threads, which isn't allowed. */
-                eb_assert_or_bail(c->unbuf_state == state, "unbuf_state invalid");
+                eb_sanity_or_bail(c->unbuf_state == state, "unbuf_state invalid");
                 /* A recv is polling for chan's state to change, so update it to signal that we're done sending! */
                 c->state = chanstate_done;
+                trace_state(c);
                 /* Set our op's state and our return value */
                 op->res = eb_chan_res_ok;
                 result = op_result_complete;
@@ -996,9 +5151,12 @@ static inline op_result send_unbuf(const do_state *state, eb_chan_op *op, size_t
             eb_spinlock_unlock(&c->lock);
             
             if (signal_recv) {
-                port_list_signal_first(c->recvs, state->port);
+                signal_first(c, state->shard, &c->recvs, state->port);
             }
         } else {
+            stats_add(c, state->shard, lock_failures, 1);
+            trace(eb_trace_lock_retry, c, NULL, 0);
+            eb_probe1(lock_contended, c);
             result = op_result_retry;
         }
     }
@@ -1021,13 +5179,14 @@ static inline op_result recv_unbuf(const do_state *state, eb_chan_op *op, size_t
         (c->state == chanstate_ack && c->unbuf_op == op)) {
         
         /* It looks like our channel's in an acceptable state, so try to acquire the lock */
-        if (eb_spinlock_try(&c->lock)) {
+        if (eb_spinlock_try_prof(&c->lock, &c->lock_prof)) {
             /* Reset the cleanup state since we acquired the lock and are actually getting a look at the channel's state */
             state->cleanup_ops[op_idx] = false;
             
             bool signal_send = false;
             if (c->state == chanstate_open && state->timeout != eb_nsec_zero) {
                 c->state = chanstate_recv;
+                trace_state(c);
                 c->unbuf_state = state;
                 c->unbuf_op = op;
                 c->unbuf_port = state->port;
@@ -1045,21 +5204,27 @@ static inline op_result recv_unbuf(const do_state *state, eb_chan_op *op, size_t
                    sends/recvs from the same _do() call) */
                 
                 /* Sanity check -- make sure the op is a send */
-                eb_assert_or_bail(c->unbuf_op->send, "Op isn't a send as expected");
+                eb_sanity_or_bail(c->unbuf_op->send, "Op isn't a send as expected");
                 
                 /* Get the op's value. This needs to happen before we transition out of the _send state, otherwise the unbuf_op may no longer be valid! */
                 op->val = c->unbuf_op->val;
+                #if EB_CHAN_LATENCY
+                    if (c->lat) {
+                        latency_record(c, c->lat_unbuf_ts);
+                    }
+                #endif
                 /* Acknowledge the send */
                 c->state = chanstate_ack;
+                trace_state(c);
                 /* Get a reference to the unbuf_port that needs to be signaled */
-                eb_port signal_port = (c->unbuf_port ? eb_port_retain(c->unbuf_port) : NULL);
+                eb_port unbuf_port = (c->unbuf_port ? eb_port_retain(c->unbuf_port) : NULL);
                 eb_spinlock_unlock(&c->lock);
                 
                 /* Wake up the send */
-                if (signal_port) {
-                    eb_port_signal(signal_port);
-                    eb_port_release(signal_port);
-                    signal_port = NULL;
+                if (unbuf_port) {
+                    signal_port(c, state->shard, unbuf_port);
+                    eb_port_release(unbuf_port);
+                    unbuf_port = NULL;
                 }
                 
                 /* We have to cleanup all our ops here to cancel any outstanding unbuffered send/recvs, to avoid a deadlock
@@ -1069,10 +5234,11 @@ static inline op_result recv_unbuf(const do_state *state, eb_chan_op *op, size_t
                 
                 for (;;) {
                     if (*((volatile chanstate *)&c->state) != chanstate_ack) {
-                        eb_spinlock_lock(&c->lock);
+                        eb_spinlock_lock_prof(&c->lock, &c->lock_prof);
                             if (c->state == chanstate_done) {
                                 /* Reset the channel state back to _open */
                                 c->state = chanstate_open;
+                                trace_state(c);
                                 /* We reset our state to _open, so signal a recv since it can proceed now. */
                                 signal_send = true;
                                 /* Set our op's state and our return value */
@@ -1084,6 +5250,7 @@ static inline op_result recv_unbuf(const do_state *state, eb_chan_op *op, size_t
                             } else if (c->state == chanstate_cancelled) {
                                 /* Reset the channel state back to _open */
                                 c->state = chanstate_open;
+                                trace_state(c);
                                 /* As long as we're not polling, we should try the op again */
                                 if (state->timeout != eb_nsec_zero) {
                                     result = op_result_retry;
@@ -1096,17 +5263,17 @@ static inline op_result recv_unbuf(const do_state *state, eb_chan_op *op, size_t
                                 break;
                             }
                         eb_spinlock_unlock(&c->lock);
-                    } else if (eb_sys_ncores == 1) {
-                        /* On uniprocessor machines, yield to the scheduler because we can't continue until another
-                           thread updates the channel's state. */
-                        sched_yield();
+                    } else if (eb_config_yields()) {
+                        /* On uniprocessor machines (or as configured), yield to the scheduler because we can't
+                           continue until another thread updates the channel's state. */
+                        eb_sys_yield();
                     }
                 }
             } else if (c->state == chanstate_recv && c->unbuf_op == op) {
                 /* We own the recv op that's in progress, so assign chan's unbuf_port */
                 /* Verify that the _recv_id matches our 'id' parameter. If this assertion fails, it means there's likely
                    one eb_chan_op being shared by multiple threads, which isn't allowed. */
-                eb_assert_or_bail(c->unbuf_state == state, "unbuf_state invalid");
+                eb_sanity_or_bail(c->unbuf_state == state, "unbuf_state invalid");
                 /* Assign the port */
                 c->unbuf_port = state->port;
                 /* We need to cleanup after this since we put it in the _send state! */
@@ -1115,9 +5282,15 @@ static inline op_result recv_unbuf(const do_state *state, eb_chan_op *op, size_t
                 /* A send acknowledged our recv! */
                 /* Verify that the unbuf_state matches our 'id' parameter. If this assertion fails, it means there's likely
                    one eb_chan_op being shared by multiple threads, which isn't allowed. */
-                eb_assert_or_bail(c->unbuf_state == state, "unbuf_state invalid");
+                eb_sanity_or_bail(c->unbuf_state == state, "unbuf_state invalid");
+                #if EB_CHAN_LATENCY
+                    if (c->lat) {
+                        latency_record(c, c->lat_unbuf_ts);
+                    }
+                #endif
                 /* A send is polling for chan's state to change, so update it to signal that we're done sending! */
                 c->state = chanstate_done;
+                trace_state(c);
                 /* Set our op's state and our return value */
                 op->res = eb_chan_res_ok;
                 result = op_result_complete;
@@ -1126,9 +5299,12 @@ static inline op_result recv_unbuf(const do_state *state, eb_chan_op *op, size_t
             eb_spinlock_unlock(&c->lock);
             
             if (signal_send) {
-                port_list_signal_first(c->sends, state->port);
+                signal_first(c, state->shard, &c->sends, state->port);
             }
         } else {
+            stats_add(c, state->shard, lock_failures, 1);
+            trace(eb_trace_lock_retry, c, NULL, 0);
+            eb_probe1(lock_contended, c);
             result = op_result_retry;
         }
     }
@@ -1142,33 +5318,37 @@ static inline op_result try_op(const do_state *state, eb_chan_op *op, size_t op_
     
     eb_chan c = op->chan;
     if (c) {
-        if (op->send) {
-            /* ## Send */
-            return (c->buf_cap ? send_buf(state, op, op_idx) : send_unbuf(state, op, op_idx));
-        } else {
-            /* ## Receive */
-            return (c->buf_cap ? recv_buf(state, op, op_idx) : recv_unbuf(state, op, op_idx));
-        }
+        #if EB_CHAN_BUFFERED_ONLY
+            return (op->send ? send_buf(state, op, op_idx) : recv_buf(state, op, op_idx));
+        #else
+            if (op->send) {
+                /* ## Send */
+                return (c->buf_cap ? send_buf(state, op, op_idx) : send_unbuf(state, op, op_idx));
+            } else {
+                /* ## Receive */
+                return (c->buf_cap ? recv_buf(state, op, op_idx) : recv_unbuf(state, op, op_idx));
+            }
+        #endif
     }
     return op_result_next;
 }
 
 eb_chan_res eb_chan_send(eb_chan c, const void *val) {
     eb_chan_op op = eb_chan_op_send(c, val);
-    eb_assert_or_bail(eb_chan_select(eb_nsec_forever, &op) == &op, "Invalid select() return value");
+    eb_sanity_or_bail(eb_chan_select(eb_nsec_forever, &op) == &op, "Invalid select() return value");
     return op.res;
 }
 
 eb_chan_res eb_chan_try_send(eb_chan c, const void *val) {
     eb_chan_op op = eb_chan_op_send(c, val);
     eb_chan_op *r = eb_chan_select(eb_nsec_zero, &op);
-    eb_assert_or_bail(r == NULL || r == &op, "Invalid select() return value");
+    eb_sanity_or_bail(r == NULL || r == &op, "Invalid select() return value");
     return (r ? op.res : eb_chan_res_stalled);
 }
 
 eb_chan_res eb_chan_recv(eb_chan c, const void **val) {
     eb_chan_op op = eb_chan_op_recv(c);
-    eb_assert_or_bail(eb_chan_select(eb_nsec_forever, &op) == &op, "Invalid select() return value");
+    eb_sanity_or_bail(eb_chan_select(eb_nsec_forever, &op) == &op, "Invalid select() return value");
     if (op.res == eb_chan_res_ok && val) {
         *val = op.val;
     }
@@ -1178,19 +5358,129 @@ eb_chan_res eb_chan_recv(eb_chan c, const void **val) {
 eb_chan_res eb_chan_try_recv(eb_chan c, const void **val) {
     eb_chan_op op = eb_chan_op_recv(c);
     eb_chan_op *r = eb_chan_select(eb_nsec_zero, &op);
-    eb_assert_or_bail(r == NULL || r == &op, "Invalid select() return value");
+    eb_sanity_or_bail(r == NULL || r == &op, "Invalid select() return value");
     if (r && op.res == eb_chan_res_ok && val) {
         *val = op.val;
     }
     return (r ? op.res : eb_chan_res_stalled);
 }
 
+#pragma mark - Slow-op hook -
+/* The maximum number of slow ops that are reported in a burst, and the sustained rate (per second) at which they're
+   reported after that */
+#define EB_CHAN_SLOW_OP_BURST 10
+#define EB_CHAN_SLOW_OP_RATE 10
+
+static eb_chan_slow_op_hook g_slow_op_hook = NULL;
+static eb_nsec g_slow_op_threshold = 0;
+/* The token bucket that rate-limits reports, in nanoseconds of credit: a report costs 1/EB_CHAN_SLOW_OP_RATE seconds,
+   and credit accrues in real time up to EB_CHAN_SLOW_OP_BURST reports' worth */
+static eb_spinlock g_slow_op_lock = EB_SPINLOCK_INIT;
+static eb_nsec g_slow_op_credit = 0;
+static eb_nsec g_slow_op_credit_time = 0;
+static uint64_t g_slow_op_suppressed = 0;
+
+void eb_chan_set_slow_op_hook(eb_nsec threshold, eb_chan_slow_op_hook hook) {
+    eb_time_ticks_init();
+    
+    eb_spinlock_lock(&g_slow_op_lock);
+        g_slow_op_threshold = threshold;
+        g_slow_op_credit = EB_CHAN_SLOW_OP_BURST * (eb_nsec_per_sec / EB_CHAN_SLOW_OP_RATE);
+        g_slow_op_credit_time = eb_time_now();
+        g_slow_op_suppressed = 0;
+    eb_spinlock_unlock(&g_slow_op_lock);
+    
+    /* Make sure the threshold is visible before the hook */
+    eb_atomic_barrier();
+    g_slow_op_hook = hook;
+}
+
+/* Calls the slow-op hook if the select took longer than the threshold, and the rate limit allows it */
+static void slow_op_check(eb_chan_slow_op_hook hook, eb_chan_op *const ops[], size_t nops, const eb_chan_op *result,
+    uint64_t ticks, const uint64_t phase_ticks[eb_thread_phase_count], uint64_t retries) {
+    static const eb_nsec k_report_cost = (eb_nsec_per_sec / EB_CHAN_SLOW_OP_RATE);
+    static const eb_nsec k_max_credit = EB_CHAN_SLOW_OP_BURST * (eb_nsec_per_sec / EB_CHAN_SLOW_OP_RATE);
+    
+    eb_nsec duration = eb_time_ticks_to_nsec(ticks);
+    if (duration < *((volatile eb_nsec *)&g_slow_op_threshold)) {
+        return;
+    }
+    
+    /* Take a token from the bucket */
+    bool report = false;
+    uint64_t suppressed = 0;
+    eb_nsec now = eb_time_now();
+    eb_spinlock_lock(&g_slow_op_lock);
+        eb_nsec elapsed = (now > g_slow_op_credit_time ? now - g_slow_op_credit_time : 0);
+        g_slow_op_credit = (k_max_credit - g_slow_op_credit > elapsed ? g_slow_op_credit + elapsed : k_max_credit);
+        g_slow_op_credit_time = now;
+        if (g_slow_op_credit >= k_report_cost) {
+            g_slow_op_credit -= k_report_cost;
+            suppressed = g_slow_op_suppressed;
+            g_slow_op_suppressed = 0;
+            report = true;
+        } else {
+            g_slow_op_suppressed++;
+        }
+    eb_spinlock_unlock(&g_slow_op_lock);
+    
+    if (report) {
+        eb_chan_slow_op op = {
+            .type = (nops == 1 ? (ops[0]->send ? eb_chan_slow_op_send : eb_chan_slow_op_recv) : eb_chan_slow_op_select),
+            .ops = ops,
+            .nops = nops,
+            .result = result,
+            .duration = duration,
+            .spin = eb_time_ticks_to_nsec(phase_ticks[eb_thread_phase_spin]),
+            .park = eb_time_ticks_to_nsec(phase_ticks[eb_thread_phase_park]),
+            .wake = eb_time_ticks_to_nsec(phase_ticks[eb_thread_phase_wake]),
+            .retries = retries,
+            .suppressed = suppressed,
+        };
+        hook(&op);
+    }
+}
+
 #pragma mark - Multiplexing -
 #define next_idx(nops, delta, idx) (delta == 1 && idx == nops-1 ? 0 : ((delta == -1 && idx == 0) ? nops-1 : idx+delta))
+
+/* Returns the number of times that a blocking select should try each of its ops before parking: the largest spin budget
+   among the ops' channels (see eb_chan_set_spin_attempts()). Spinning can't help on uniprocessor machines, so there it's
+   at most 1. */
+static inline size_t spin_attempts(eb_chan_op *const ops[], size_t nops) {
+    size_t global = *((volatile size_t *)&eb_config.spin_attempts);
+    size_t r = 0;
+    for (size_t i = 0; i < nops; i++) {
+        eb_chan c = ops[i]->chan;
+        if (c) {
+            size_t attempts = *((volatile size_t *)&c->spin_attempts);
+            attempts = (attempts == EB_CHAN_SPIN_ATTEMPTS_DEFAULT ? global : attempts);
+            r = (attempts > r ? attempts : r);
+        }
+    }
+    return (eb_sys_uniprocessor() && r > 1 ? 1 : r);
+}
+
 eb_chan_op *eb_chan_select_list(eb_nsec timeout, eb_chan_op *const ops[], size_t nops) {
     assert(!nops || ops);
     
-    const size_t k_attempt_multiplier = (eb_sys_ncores == 1 ? 1 : 500);
+    /* Mark that we're in the hot path, so that strict threads can catch allocations (see eb_chan_thread_prepare()) */
+    eb_thread *thread = eb_thread_current();
+    bool thread_in_hot_path = thread->in_hot_path;
+    thread->in_hot_path = true;
+    
+    #if EB_CHAN_STATS
+        /* Allocate the channels' statistics on their first op. Strict threads mustn't allocate here, so their channels'
+           statistics are allocated by eb_chan_reserve() instead. */
+        if (!thread->strict) {
+            for (size_t i = 0; i < nops; i++) {
+                if (ops[i]->chan && !*((chan_stats *volatile *)&ops[i]->chan->stats)) {
+                    stats_create(ops[i]->chan);
+                }
+            }
+        }
+    #endif
+    
     eb_nsec start_time = 0;
     size_t idx_start = 0;
     int8_t idx_delta = 0;
@@ -1204,13 +5494,40 @@ eb_chan_op *eb_chan_select_list(eb_nsec timeout, eb_chan_op *const ops[], size_t
     bool co[nops];
     memset(co, 0, sizeof(co));
     
+    trace(eb_trace_select_begin, NULL, NULL, (uint32_t)nops);
+    
+    /* Phase timing, for blocked-time accounting (see eb_chan_blocked_time_enable()), the slow-op hook (see
+       eb_chan_set_slow_op_hook()) and traffic capture (see eb_chan_capture_start()). 'phase_start' is when the current
+       spin (or post-wakeup) phase started. */
+    #if EB_CHAN_BLOCKED_TIME
+        bool acct = (timeout != eb_nsec_zero && eb_thread_accounting);
+    #else
+        bool acct = false;
+    #endif
+    eb_chan_slow_op_hook slow_op_hook = *((eb_chan_slow_op_hook volatile *)&g_slow_op_hook);
+    #if EB_CHAN_CAPTURE
+        uint32_t capture_session = *((volatile uint32_t *)&eb_capture_session);
+    #else
+        uint32_t capture_session = 0;
+    #endif
+    bool timed = (acct || slow_op_hook || capture_session);
+    bool woken_once = false;
+    uint64_t op_start = (timed ? eb_time_ticks() : 0);
+    uint64_t phase_start = op_start;
+    uint64_t phase_ticks[eb_thread_phase_count] = {0};
+    uint64_t retries = 0;
+    
     eb_chan_op *result = NULL;
     do_state state = {
         .ops = ops,
         .nops = nops,
         .cleanup_ops = co,
         .timeout = timeout,
-        .port = NULL};
+        .port = NULL,
+        #if EB_CHAN_STATS
+            .shard = eb_thread_stats_shard(EB_CHAN_STATS_SHARDS),
+        #endif
+    };
     
     if (timeout == eb_nsec_zero) {
         /* ## timeout == 0: try every op exactly once; if none of them can proceed, return NULL. */
@@ -1218,10 +5535,12 @@ eb_chan_op *eb_chan_select_list(eb_nsec timeout, eb_chan_op *const ops[], size_t
             eb_chan_op *op = ops[idx];
             op_result r;
             while ((r = try_op(&state, op, idx)) == op_result_retry) {
-                if (eb_sys_ncores == 1) {
-                    /* On uniprocessor machines, yield to the scheduler because we can't continue until another
-                       thread updates the channel's state. */
-                    sched_yield();
+                stats_add(op->chan, state.shard, retries, 1);
+                retries++;
+                if (eb_config_yields()) {
+                    /* On uniprocessor machines (or as configured), yield to the scheduler because we can't continue
+                       until another thread updates the channel's state. */
+                    eb_sys_yield();
                 }
             }
             
@@ -1237,10 +5556,18 @@ eb_chan_op *eb_chan_select_list(eb_nsec timeout, eb_chan_op *const ops[], size_t
             start_time = eb_time_now();
         }
         
+        /* The number of fast-path attempts before parking, across all ops */
+        size_t attempts = spin_attempts(ops, nops);
+        size_t nspins = (nops && attempts > SIZE_MAX / nops ? SIZE_MAX : attempts * nops);
+        
+        #if EB_CHAN_STATS
+            /* Whether we were woken since we last parked */
+            bool woken = false;
+        #endif
         for (;;) {
             /* ## Fast path: loop over our operations to see if one of them was able to send/receive. (If not,
                we'll enter the slow path where we put our thread to sleep until we're signaled.) */
-            for (size_t i = 0, idx = idx_start; i < k_attempt_multiplier*nops; i++, idx = next_idx(nops, idx_delta, idx)) {
+            for (size_t i = 0, idx = idx_start; i < nspins; i++, idx = next_idx(nops, idx_delta, idx)) {
                 eb_chan_op *op = ops[idx];
                 op_result r = try_op(&state, op, idx);
                 /* If the op completed, we need to exit! */
@@ -1248,15 +5575,32 @@ eb_chan_op *eb_chan_select_list(eb_nsec timeout, eb_chan_op *const ops[], size_t
                     result = op;
                     goto cleanup;
                 }
+                if (r == op_result_retry) {
+                    stats_add(op->chan, state.shard, retries, 1);
+                    retries++;
+                }
             }
             
             /* ## Slow path: we weren't able to find an operation that could send/receive, so we'll create a
                port to receive notifications on and put this thread to sleep until someone wakes us up. */
             if (!state.port) {
-                /* Create our port that we'll attach to channels so that we can be notified when events occur. */
-                state.port = eb_port_create();
+                /* Create our port that we'll attach to channels so that we can be notified when events occur. If
+                   the thread was prepared, reuse its port so that we don't allocate. */
+                if (thread->port) {
+                    eb_port_reset(thread->port);
+                    state.port = eb_port_retain(thread->port);
+                } else {
+                    state.port = eb_port_create();
+                }
                 eb_assert_or_recover(state.port, goto cleanup);
                 
+                /* Record our ops so that eb_chan_debug_dump() can show what we're waiting on. This needs to happen before
+                   the port is added to any channel's port list. */
+                eb_port_waiter *waiter = eb_port_waiter_info(state.port);
+                waiter->tid = eb_thread_id();
+                waiter->ops = ops;
+                waiter->nops = nops;
+                
                 /* Register our port for the appropriate notifications on every channel. */
                 /* This adds 'port' to the channel's sends/recvs (depending on the op), which we clean up at the
                    end of this function. */
@@ -1264,7 +5608,7 @@ eb_chan_op *eb_chan_select_list(eb_nsec timeout, eb_chan_op *const ops[], size_t
                     eb_chan_op *op = ops[i];
                     eb_chan c = op->chan;
                     if (c) {
-                        port_list_add((op->send ? c->sends : c->recvs), state.port);
+                        port_list_add((op->send ? &c->sends : &c->recvs), &c->alloc, state.port);
                     }
                 }
             }
@@ -1276,10 +5620,12 @@ eb_chan_op *eb_chan_select_list(eb_nsec timeout, eb_chan_op *const ops[], size_t
                 eb_chan_op *op = ops[idx];
                 op_result r;
                 while ((r = try_op(&state, op, idx)) == op_result_retry) {
-                    if (eb_sys_ncores == 1) {
-                        /* On uniprocessor machines, yield to the scheduler because we can't continue until another
-                           thread updates the channel's state. */
-                        sched_yield();
+                    stats_add(op->chan, state.shard, retries, 1);
+                    retries++;
+                    if (eb_config_yields()) {
+                        /* On uniprocessor machines (or as configured), yield to the scheduler because we can't
+                           continue until another thread updates the channel's state. */
+                        eb_sys_yield();
                     }
                 }
                 
@@ -1302,8 +5648,54 @@ eb_chan_op *eb_chan_select_list(eb_nsec timeout, eb_chan_op *const ops[], size_t
                 }
             }
             
+            /* Record the CPU that we're parking on, so that signalers can prefer waking nearby waiters, if there's
+               more than one CPU to prefer. Only record when we parked if the watchdog is running to check it. */
+            eb_port_waiter *waiter = eb_port_waiter_info(state.port);
+            waiter->cpu = -1;
+            #if EB_CHAN_WAKE_LOCALITY
+                if (!eb_sys_uniprocessor()) {
+                    waiter->cpu = eb_sys_cpu_current();
+                }
+            #endif
+            waiter->park_time = (*((volatile service_state *)&g_watchdog_state) == service_running ? eb_time_now() :
+                EB_PORT_PARK_UNTIMED);
+            
+            #if EB_CHAN_STATS
+                /* Count the park on every channel in the select, and if we were woken but have to park again without
+                   completing an op, count the wasted wakeup too */
+                for (size_t i = 0; i < nops; i++) {
+                    eb_chan c = ops[i]->chan;
+                    if (c) {
+                        stats_add(c, state.shard, parks, 1);
+                        if (woken) {
+                            stats_add(c, state.shard, wasted_wakeups, 1);
+                        }
+                    }
+                }
+            #endif
+            
             /* Put our thread to sleep until someone alerts us of an event */
-            eb_port_wait(state.port, wait_timeout);
+            trace(eb_trace_park, NULL, NULL, 0);
+            eb_probe2(park, state.port, nops);
+            /* Time since the last phase started was spent spinning, regardless of whether we were woken */
+            if (timed) {
+                uint64_t now = eb_time_ticks();
+                phase_ticks[eb_thread_phase_spin] += now - phase_start;
+                phase_start = now;
+            }
+            bool signaled = eb_port_wait(state.port, wait_timeout);
+            waiter->park_time = 0;
+            if (timed) {
+                uint64_t now = eb_time_ticks();
+                phase_ticks[eb_thread_phase_park] += now - phase_start;
+                phase_start = now;
+                woken_once = true;
+            }
+            trace(eb_trace_unpark, NULL, NULL, signaled);
+            eb_probe2(wake, state.port, signaled);
+            #if EB_CHAN_STATS
+                woken = signaled;
+            #endif
         }
     }
     
@@ -1314,9 +5706,9 @@ eb_chan_op *eb_chan_select_list(eb_nsec timeout, eb_chan_op *const ops[], size_t
                 eb_chan_op *op = ops[i];
                 eb_chan c = op->chan;
                 if (c) {
-                    port_list ports = (op->send ? c->sends : c->recvs);
+                    port_list *ports = (op->send ? &c->sends : &c->recvs);
                     port_list_rm(ports, state.port);
-                    port_list_signal_first(ports, state.port);
+                    signal_first(c, state.shard, ports, state.port);
                 }
             }
         }
@@ -1329,5 +5721,89 @@ eb_chan_op *eb_chan_select_list(eb_nsec timeout, eb_chan_op *const ops[], size_t
         }
     }
     
+    #if EB_CHAN_STATS
+        if (result && result->chan) {
+            if (result->res != eb_chan_res_ok) {
+                stats_add(result->chan, state.shard, closes_observed, 1);
+            } else if (result->send) {
+                stats_add(result->chan, state.shard, sends, 1);
+            } else {
+                stats_add(result->chan, state.shard, recvs, 1);
+            }
+        }
+    #endif
+    if (result) {
+        eb_sys_call_add(eb_sys_call_op);
+    }
+    
+    uint64_t op_end = 0;
+    if (timed) {
+        /* The time since the last wakeup was spent completing the op; if we were never parked it was all spinning */
+        op_end = eb_time_ticks();
+        phase_ticks[(woken_once ? eb_thread_phase_wake : eb_thread_phase_spin)] += op_end - phase_start;
+    }
+    
+    #if EB_CHAN_BLOCKED_TIME
+        if (acct) {
+            eb_thread_account(!result, phase_ticks);
+            if (result && result->chan) {
+                eb_chan c = result->chan;
+                size_t i = !result->send;
+                eb_atomic_add_relaxed(&c->blocked_selects[i], 1);
+                for (size_t ii = 0; ii < eb_thread_phase_count; ii++) {
+                    eb_atomic_add_relaxed(&c->blocked_ticks[i][ii], phase_ticks[ii]);
+                }
+            }
+        }
+    #endif
+    
+    #if EB_CHAN_USDT
+        if (result && result->chan) {
+            if (result->send) {
+                eb_probe2(send, result->chan, result->res);
+            } else {
+                eb_probe2(recv, result->chan, result->res);
+            }
+        }
+    #endif
+    
+    #if EB_CHAN_TRACE
+        if (eb_trace_active) {
+            /* Record which op was performed, if any */
+            uint32_t idx = UINT32_MAX;
+            for (size_t i = 0; result && i < nops; i++) {
+                if (ops[i] == result) {
+                    idx = (uint32_t)i;
+                    break;
+                }
+            }
+            eb_trace_record(eb_trace_select_end, (result ? result->chan : NULL),
+                (result ? (result->res == eb_chan_res_ok ? "ok" : "closed") : NULL), idx);
+        }
+    #endif
+    
+    /* If the channel is waiting for its first consumer to determine its NUMA placement, we're it */
+    if (result && !result->send && result->chan && result->chan->numa_first_consumer) {
+        numa_claim(result->chan);
+    }
+    
+    thread->in_hot_path = thread_in_hot_path;
+    
+    /* Report the op if it was slow. (This happens after we leave the hot path, since the hook may allocate.) */
+    if (slow_op_hook) {
+        slow_op_check(slow_op_hook, ops, nops, result, op_end - op_start, phase_ticks, retries);
+    }
+    
+    #if EB_CHAN_CAPTURE
+        /* Record the op if we're capturing. (This also happens outside the hot path, since a thread's first record
+           allocates its buffer.) */
+        if (capture_session && result && result->chan) {
+            eb_chan_capture_flags flags = ((timeout == eb_nsec_zero ? eb_chan_capture_try : 0) |
+                (result->res != eb_chan_res_ok ? eb_chan_capture_closed : 0) | (nops > 1 ? eb_chan_capture_select : 0));
+            capture(result->chan, capture_session, (result->send ? eb_chan_capture_send : eb_chan_capture_recv), flags,
+                op_start, op_end);
+        }
+    #endif
+    
     return result;
 }
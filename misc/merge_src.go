@@ -162,7 +162,24 @@ func replaceIncludes(filePath string, root bool, impl bool, history map[string]b
     return result, paths, nil
 }
 
-func mergeSrc(headerPath string, implPath string) (header string, impl string, err error) {
+/* Returns the #defines that select a variant of the library, from -DNAME[=VALUE] arguments (where VALUE defaults to 1).
+   They're emitted at the top of the merged header, ahead of the defaults that each source file supplies. */
+func variantDefines(args []string) (defines string, err error) {
+    for _, arg := range args {
+        def := strings.TrimPrefix(arg, "-D")
+        name, value := def, "1"
+        if i := strings.Index(def, "="); i >= 0 {
+            name, value = def[:i], def[i+1:]
+        }
+        if name == "" || strings.ContainsAny(name, " \t\n") || strings.Contains(value, "\n") {
+            return "", fmt.Errorf("invalid definition: %v", arg)
+        }
+        defines += "#define "+name+" "+value+"\n"
+    }
+    return defines, nil
+}
+
+func mergeSrc(headerPath string, implPath string, defines string) (header string, impl string, err error) {
     headerPath, err = normalizedPath(headerPath)
     if err != nil {
         return "", "", fmt.Errorf("normalizedPath() failed: %v", err)
@@ -219,6 +236,11 @@ func mergeSrc(headerPath string, implPath string) (header string, impl string, e
         prefix += kCommentPrefix+"  "+fileName+"\n"
     }
     prefix += kSeparator+"\n"
+    
+    /* Followed by the variant's definitions, which the implementation sees since it includes the header first */
+    if defines != "" {
+        prefix += kSeparator+kCommentPrefix+"Variant:\n"+kSeparator+defines+"\n"
+    }
     header = prefix+header
     
     return header, impl, nil
@@ -228,21 +250,42 @@ func main() {
 	usage := fmt.Sprintf(`%v %v
 
 Usage:
-  %v src.h src.c output_dir
-`, kCmdFullName, kCmdVersion, kCmdName)
+  %v [-DNAME[=VALUE]...] src.h src.c output_dir
+
+The -D options bake compile-time switches into the output, to emit a
+variant of the library, e.g.:
+  %v -DEB_CHAN_ASSUME_MULTICORE -DEB_CHAN_NO_ASSERT src.h src.c out
+`, kCmdFullName, kCmdVersion, kCmdName, kCmdName)
+    
+    /* Separate the variant's definitions from the positional args */
+    defArgs := []string{}
+    args := []string{}
+    for _, arg := range os.Args[1:] {
+        if strings.HasPrefix(arg, "-D") {
+            defArgs = append(defArgs, arg)
+        } else {
+            args = append(args, arg)
+        }
+    }
     
-    if len(os.Args) != 4 {
+    if len(args) != 3 {
 		fmt.Printf("%v", usage)
 		os.Exit(1)
     }
     
+    defines, err := variantDefines(defArgs)
+    if err != nil {
+        fmt.Printf("%v\n", err)
+        os.Exit(1)
+    }
+    
     /* Get our input args */
-    headerPath := os.Args[1]
-    implPath := os.Args[2]
-    outputDir := os.Args[3]
+    headerPath := args[0]
+    implPath := args[1]
+    outputDir := args[2]
     
     /* Find the header file */
-    headerPath, err := normalizedPath(headerPath)
+    headerPath, err = normalizedPath(headerPath)
     if err != nil {
         fmt.Printf("%v\n", err)
         os.Exit(1)
@@ -256,7 +299,7 @@ Usage:
     }
     
     /* Merge our sources! */
-    header, impl, err := mergeSrc(headerPath, implPath)
+    header, impl, err := mergeSrc(headerPath, implPath, defines)
     if err != nil {
         fmt.Printf("%v\n", err)
         os.Exit(1)
@@ -0,0 +1,139 @@
+#include "eb_alloc.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "eb_assert.h"
+#include "eb_atomic.h"
+#include "eb_spinlock.h"
+#include "eb_thread.h"
+
+static void *default_alloc(void *ctx, size_t size) {
+    return malloc(size);
+}
+
+static void *default_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size) {
+    return realloc(ptr, new_size);
+}
+
+static void default_free(void *ctx, void *ptr, size_t size) {
+    free(ptr);
+}
+
+static const eb_chan_allocator k_default_allocator = {
+    .alloc = default_alloc,
+    .realloc = default_realloc,
+    .free = default_free,
+    .ctx = NULL,
+};
+
+static eb_spinlock g_allocator_lock = EB_SPINLOCK_INIT;
+static eb_chan_allocator g_allocator = {
+    .alloc = default_alloc,
+    .realloc = default_realloc,
+    .free = default_free,
+    .ctx = NULL,
+};
+
+static uint64_t g_allocs = 0;
+static uint64_t g_reallocs = 0;
+static uint64_t g_frees = 0;
+static uint64_t g_bytes_allocated = 0;
+static uint64_t g_bytes_freed = 0;
+
+eb_chan_allocator eb_alloc_global() {
+    eb_chan_allocator r;
+    eb_spinlock_lock(&g_allocator_lock);
+        r = g_allocator;
+    eb_spinlock_unlock(&g_allocator_lock);
+    return r;
+}
+
+void *eb_alloc(const eb_chan_allocator *a, size_t size) {
+    assert(a);
+    eb_thread_check_alloc();
+    
+    void *r = a->alloc(a->ctx, size);
+    if (r) {
+        eb_atomic_add(&g_allocs, 1);
+        eb_atomic_add(&g_bytes_allocated, size);
+    }
+    return r;
+}
+
+void *eb_alloc_zeroed(const eb_chan_allocator *a, size_t size) {
+    void *r = eb_alloc(a, size);
+    if (r) {
+        memset(r, 0, size);
+    }
+    return r;
+}
+
+void *eb_realloc(const eb_chan_allocator *a, void *ptr, size_t old_size, size_t new_size) {
+    assert(a);
+    eb_thread_check_alloc();
+    
+    if (!ptr) {
+        return eb_alloc(a, new_size);
+    }
+    
+    void *r = NULL;
+    if (a->realloc) {
+        r = a->realloc(a->ctx, ptr, old_size, new_size);
+    } else {
+        /* The allocator doesn't support resizing, so emulate it */
+        r = a->alloc(a->ctx, new_size);
+        if (r) {
+            memcpy(r, ptr, (old_size < new_size ? old_size : new_size));
+            a->free(a->ctx, ptr, old_size);
+        }
+    }
+    
+    if (r) {
+        eb_atomic_add(&g_reallocs, 1);
+        eb_atomic_add(&g_bytes_allocated, new_size);
+        eb_atomic_add(&g_bytes_freed, old_size);
+    }
+    return r;
+}
+
+void eb_free(const eb_chan_allocator *a, void *ptr, size_t size) {
+    assert(a);
+    
+    /* Intentionally allowing ptr==NULL, like free() */
+    if (!ptr) {
+        return;
+    }
+    
+    /* Not checked against a strict thread's allocation policy: freeing doesn't allocate, and a strict thread can
+       release the last reference to another thread's object (e.g. a port it signaled) */
+    a->free(a->ctx, ptr, size);
+    eb_atomic_add(&g_frees, 1);
+    eb_atomic_add(&g_bytes_freed, size);
+}
+
+#pragma mark - Public API -
+void eb_chan_set_allocator(const eb_chan_allocator *a) {
+    /* A NULL allocator restores the default (malloc()/realloc()/free()) */
+    if (a) {
+        eb_assert_or_bail(a->alloc && a->free, "Allocator must supply alloc() and free()");
+    }
+    
+    eb_spinlock_lock(&g_allocator_lock);
+        g_allocator = (a ? *a : k_default_allocator);
+    eb_spinlock_unlock(&g_allocator_lock);
+}
+
+void eb_chan_alloc_stats(eb_chan_alloc_counts *out) {
+    assert(out);
+    
+    /* Adding zero is an atomic read */
+    uint64_t bytes_allocated = eb_atomic_add(&g_bytes_allocated, 0);
+    uint64_t bytes_freed = eb_atomic_add(&g_bytes_freed, 0);
+    *out = (eb_chan_alloc_counts){
+        .allocs = eb_atomic_add(&g_allocs, 0),
+        .reallocs = eb_atomic_add(&g_reallocs, 0),
+        .frees = eb_atomic_add(&g_frees, 0),
+        .bytes_allocated = bytes_allocated,
+        .bytes_in_use = (bytes_allocated > bytes_freed ? bytes_allocated - bytes_freed : 0),
+    };
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include <stddef.h>
+#include "eb_chan.h"
+
+/* ## Functions */
+/* Returns a copy of the current global allocator, so that objects can remember the allocator that allocated them. */
+eb_chan_allocator eb_alloc_global();
+
+/* Allocate/free memory via allocator 'a'. Every allocation is counted (see eb_chan_alloc_stats()). */
+void *eb_alloc(const eb_chan_allocator *a, size_t size);
+void *eb_alloc_zeroed(const eb_chan_allocator *a, size_t size);
+void *eb_realloc(const eb_chan_allocator *a, void *ptr, size_t old_size, size_t new_size);
+void eb_free(const eb_chan_allocator *a, void *ptr, size_t size);
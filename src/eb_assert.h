@@ -2,14 +2,15 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-#define eb_no_op
+/* Whether failed sanity checks go unchecked. eb_sanity_or_bail() still evaluates its condition (some have side effects,
+   like performing the op whose result is checked) but no longer aborts, so a failed sanity check leads to undefined
+   behavior. eb_assert_or_recover() still takes its recovery action without reporting, and eb_assert_or_bail() (used
+   for failed allocations, API misuse and strict mode) is unaffected. assert() follows NDEBUG. */
+#ifndef EB_CHAN_NO_ASSERT
+    #define EB_CHAN_NO_ASSERT 0
+#endif
 
-#define eb_assert_or_recover(cond, action) ({                                                                 \
-    if (!(cond)) {                                                                                            \
-        eb_assert_print("Assertion failed", #cond, __FILE__, (uintmax_t)__LINE__, __PRETTY_FUNCTION__);       \
-        action;                                                                                               \
-    }                                                                                                         \
-})
+#define eb_no_op
 
 #define eb_assert_or_bail(cond, msg) ({                                                        \
     if (!(cond)) {                                                                             \
@@ -18,4 +19,24 @@
     }                                                                                          \
 })
 
+#if EB_CHAN_NO_ASSERT
+    #define eb_assert_or_recover(cond, action) ({      \
+        if (__builtin_expect(!(cond), 0)) {            \
+            action;                                    \
+        }                                              \
+    })
+    
+    #define eb_sanity_or_bail(cond, msg) ((void)(cond))
+#else
+    #define eb_assert_or_recover(cond, action) ({                                                                 \
+        if (!(cond)) {                                                                                            \
+            eb_assert_print("Assertion failed", #cond, __FILE__, (uintmax_t)__LINE__, __PRETTY_FUNCTION__);       \
+            action;                                                                                               \
+        }                                                                                                         \
+    })
+    
+    /* Checks an internal invariant, which only fails if eb_chan (or a caller violating its contract) has a bug */
+    #define eb_sanity_or_bail(cond, msg) eb_assert_or_bail(cond, msg)
+#endif
+
 void eb_assert_print(const char *msg, const char *cond, const char *file, uintmax_t line, const char *func);
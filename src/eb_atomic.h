@@ -3,3 +3,8 @@
 #define eb_atomic_add(ptr, delta) __sync_add_and_fetch(ptr, delta) /* Returns the new value */
 #define eb_atomic_compare_and_swap(ptr, old, new) __sync_bool_compare_and_swap(ptr, old, new)
 #define eb_atomic_barrier() __sync_synchronize()
+#define eb_atomic_add_relaxed(ptr, delta) __atomic_add_fetch(ptr, delta, __ATOMIC_RELAXED) /* Returns the new value; imposes no ordering */
+#define eb_atomic_load_relaxed(ptr) __atomic_load_n(ptr, __ATOMIC_RELAXED)
+#define eb_atomic_store_relaxed(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELAXED)
+#define eb_atomic_load_acquire(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define eb_atomic_store_release(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
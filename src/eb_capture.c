@@ -0,0 +1,293 @@
+#include "eb_capture.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include "eb_chan.h"
+#include "eb_alloc.h"
+#include "eb_assert.h"
+#include "eb_atomic.h"
+#include "eb_spinlock.h"
+#include "eb_time.h"
+
+/* A thread's buffer of encoded records. The owning thread appends to it with 'lock' held; eb_chan_capture_stop() takes
+   the lock to write out what's left. Like the flight recorder's rings, buffers are never freed: when a thread exits its
+   buffer is written out and kept, until another thread adopts it. */
+typedef struct buffer buffer;
+struct buffer {
+    buffer *next;
+    bool in_use;
+    eb_spinlock lock;
+    /* Whether a thread is writing the buffer's records to the capture file, with the lock released */
+    bool writing;
+    /* The session that the buffered records belong to */
+    uint32_t session;
+    size_t len;
+    uint8_t bytes[EB_CAPTURE_BUF_SIZE];
+};
+
+uint32_t eb_capture_session = 0;
+#if EB_CHAN_CAPTURE
+    static uint32_t g_capture_last_session = 0;
+#endif
+/* Protects g_capture_file and g_capture_file_ok, and starting/stopping */
+static eb_spinlock g_capture_file_lock = EB_SPINLOCK_INIT;
+static FILE *g_capture_file = NULL;
+static bool g_capture_file_ok = false;
+static uint64_t g_capture_start_ticks = 0;
+static uint32_t g_capture_next_chan = 0;
+static uint32_t g_capture_next_thread = 0;
+static buffer *g_capture_buffers = NULL;
+static eb_spinlock g_capture_buffers_lock = EB_SPINLOCK_INIT;
+static __thread buffer *t_capture_buffer = NULL;
+/* The calling thread's capture-local id, valid if t_capture_session is the running session */
+static __thread uint32_t t_capture_session = 0;
+static __thread uint16_t t_capture_thread = 0;
+static pthread_once_t g_capture_buffer_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_capture_buffer_key;
+
+/* Writes out the records in 'b' to 'f' (or drops them if 'f' is NULL), and empties 'b'. 'b' must be locked; the lock is
+   released during the write so that a slow file doesn't stall eb_chan_capture_stop() or other threads' buffers, and
+   'writing' keeps the buffer from being written or emptied by another thread meanwhile. eb_chan_capture_stop() waits
+   for 'writing' to clear before closing the file, so 'f' stays valid if it was obtained with 'b' locked. */
+static void buffer_write(buffer *b, FILE *f) {
+    while (b->writing) {
+        eb_spinlock_unlock(&b->lock);
+        eb_sys_yield();
+        eb_spinlock_lock(&b->lock);
+    }
+    
+    if (f && b->len) {
+        b->writing = true;
+        eb_spinlock_unlock(&b->lock);
+        bool ok = (fwrite(b->bytes, 1, b->len, f) == b->len);
+        if (!ok) {
+            eb_spinlock_lock(&g_capture_file_lock);
+                g_capture_file_ok = false;
+            eb_spinlock_unlock(&g_capture_file_lock);
+        }
+        eb_spinlock_lock(&b->lock);
+        b->writing = false;
+    }
+    b->len = 0;
+}
+
+/* Returns the capture file. After seeing that a buffer's session is running with the buffer locked, the file stays open
+   until the buffer is written out, even if the session ends meanwhile: eb_chan_capture_stop() only closes it after
+   walking every buffer, which it can't do while the buffer is locked. */
+static FILE *capture_file() {
+    eb_spinlock_lock(&g_capture_file_lock);
+        FILE *f = g_capture_file;
+    eb_spinlock_unlock(&g_capture_file_lock);
+    return f;
+}
+
+/* Called when a thread with a buffer exits, so that the buffer can be adopted by another thread */
+static void buffer_cleanup(void *arg) {
+    buffer *b = arg;
+    eb_spinlock_lock(&b->lock);
+        /* Records of a session that has ended are left for eb_chan_capture_stop() to write out (or were already) */
+        if (b->len && b->session == *((volatile uint32_t *)&eb_capture_session)) {
+            buffer_write(b, capture_file());
+        }
+    eb_spinlock_unlock(&b->lock);
+    
+    eb_spinlock_lock(&g_capture_buffers_lock);
+        b->in_use = false;
+    eb_spinlock_unlock(&g_capture_buffers_lock);
+}
+
+static void buffer_key_create() {
+    int r = pthread_key_create(&g_capture_buffer_key, buffer_cleanup);
+    eb_assert_or_bail(!r, "pthread_key_create() failed");
+}
+
+/* Returns the calling thread's buffer, adopting or allocating one if necessary */
+static buffer *buffer_current() {
+    if (t_capture_buffer) {
+        return t_capture_buffer;
+    }
+    
+    /* Adopt the buffer of a thread that exited */
+    buffer *b = NULL;
+    eb_spinlock_lock(&g_capture_buffers_lock);
+        for (buffer *i = g_capture_buffers; i; i = i->next) {
+            if (!i->in_use) {
+                b = i;
+                b->in_use = true;
+                break;
+            }
+        }
+    eb_spinlock_unlock(&g_capture_buffers_lock);
+    
+    if (!b) {
+        eb_chan_allocator alloc = eb_alloc_global();
+        b = eb_alloc_zeroed(&alloc, sizeof(*b));
+        eb_assert_or_recover(b, return NULL);
+        b->in_use = true;
+        b->lock = EB_SPINLOCK_INIT;
+        
+        eb_spinlock_lock(&g_capture_buffers_lock);
+            b->next = g_capture_buffers;
+            g_capture_buffers = b;
+        eb_spinlock_unlock(&g_capture_buffers_lock);
+    }
+    
+    /* Register our thread-exit handler, which releases the buffer */
+    pthread_once(&g_capture_buffer_key_once, buffer_key_create);
+    int err = pthread_setspecific(g_capture_buffer_key, b);
+    eb_assert_or_recover(!err, eb_no_op);
+    
+    t_capture_buffer = b;
+    return b;
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    put16(p, (uint16_t)v);
+    put16(p + 2, (uint16_t)(v >> 16));
+}
+
+static void put64(uint8_t *p, uint64_t v) {
+    put32(p, (uint32_t)v);
+    put32(p + 4, (uint32_t)(v >> 32));
+}
+
+/* Appends a record (and 'extra_len' bytes of 'extra') to the calling thread's buffer, unless 'session' has ended */
+static void append(uint32_t session, uint64_t time, uint32_t wait, uint32_t chan, uint32_t depth, uint16_t thread,
+    uint8_t type, uint8_t flags, const void *extra, size_t extra_len) {
+    buffer *b = buffer_current();
+    if (!b) {
+        return;
+    }
+    
+    eb_spinlock_lock(&b->lock);
+        /* Checking the session with the buffer locked guarantees that eb_chan_capture_stop() either sees our record,
+           or we see that the session ended */
+        if (*((volatile uint32_t *)&eb_capture_session) == session) {
+            if (b->session != session) {
+                b->session = session;
+                b->len = 0;
+            }
+            if (b->len + EB_CHAN_CAPTURE_RECORD_SIZE + extra_len > sizeof(b->bytes)) {
+                /* The session was running when we checked it, so the file is still open (see capture_file()) */
+                buffer_write(b, capture_file());
+            }
+            
+            uint8_t *p = &b->bytes[b->len];
+            put64(p, time);
+            put32(p + 8, wait);
+            put32(p + 12, chan);
+            put32(p + 16, depth);
+            put16(p + 20, thread);
+            p[22] = type;
+            p[23] = flags;
+            if (extra_len) {
+                memcpy(p + EB_CHAN_CAPTURE_RECORD_SIZE, extra, extra_len);
+            }
+            b->len += EB_CHAN_CAPTURE_RECORD_SIZE + extra_len;
+        }
+    eb_spinlock_unlock(&b->lock);
+}
+
+uint32_t eb_capture_chan_next() {
+    return eb_atomic_add(&g_capture_next_chan, 1);
+}
+
+void eb_capture_define(uint32_t session, uint32_t chan, size_t cap, const char *name) {
+    size_t name_len = (name ? strlen(name) : 0);
+    if (name_len > EB_CAPTURE_NAME_MAX) {
+        name_len = EB_CAPTURE_NAME_MAX;
+    }
+    append(session, 0, 0, chan, (uint32_t)(cap < UINT32_MAX ? cap : UINT32_MAX), (uint16_t)name_len,
+        eb_chan_capture_define, 0, name, name_len);
+}
+
+void eb_capture_record(uint32_t session, uint8_t type, uint8_t flags, uint32_t chan, size_t depth, uint64_t start,
+    uint64_t end) {
+    if (t_capture_session != session) {
+        t_capture_session = session;
+        t_capture_thread = (uint16_t)eb_atomic_add(&g_capture_next_thread, 1);
+    }
+    
+    uint64_t time = eb_time_ticks_to_nsec(start > g_capture_start_ticks ? start - g_capture_start_ticks : 0);
+    uint64_t wait = eb_time_ticks_to_nsec(end > start ? end - start : 0);
+    append(session, time, (uint32_t)(wait < UINT32_MAX ? wait : UINT32_MAX), chan,
+        (uint32_t)(depth < UINT32_MAX ? depth : UINT32_MAX), t_capture_thread, type, flags, NULL, 0);
+}
+
+#pragma mark - Public API -
+bool eb_chan_capture_start(const char *path) {
+    assert(path);
+    
+    #if EB_CHAN_CAPTURE
+        /* Don't truncate the file of a running capture (this is checked again below, with the lock held) */
+        if (*((FILE *volatile *)&g_capture_file)) {
+            return false;
+        }
+        
+        FILE *f = fopen(path, "wb");
+        eb_assert_or_recover(f, return false);
+        bool ok = (fwrite(EB_CHAN_CAPTURE_MAGIC, 1, 8, f) == 8);
+        eb_assert_or_recover(ok, fclose(f); return false);
+        
+        eb_time_ticks_init();
+        bool started = false;
+        eb_spinlock_lock(&g_capture_file_lock);
+            if (!g_capture_file) {
+                g_capture_file = f;
+                g_capture_file_ok = true;
+                g_capture_start_ticks = eb_time_ticks();
+                g_capture_next_chan = 0;
+                g_capture_next_thread = 0;
+                /* Publish the new session last, so that ops observing it see the state above */
+                eb_atomic_barrier();
+                eb_capture_session = ++g_capture_last_session;
+                started = true;
+            }
+        eb_spinlock_unlock(&g_capture_file_lock);
+        
+        if (!started) {
+            fclose(f);
+        }
+        return started;
+    #else
+        return false;
+    #endif
+}
+
+bool eb_chan_capture_stop() {
+    /* End the session, so that no more records are appended */
+    eb_spinlock_lock(&g_capture_file_lock);
+        uint32_t session = eb_capture_session;
+        eb_capture_session = 0;
+    eb_spinlock_unlock(&g_capture_file_lock);
+    if (!session) {
+        return false;
+    }
+    eb_atomic_barrier();
+    
+    /* Only we close the file, and appends of the ended session can no longer start writes, so it's stable */
+    eb_spinlock_lock(&g_capture_file_lock);
+        FILE *f = g_capture_file;
+    eb_spinlock_unlock(&g_capture_file_lock);
+    
+    /* Write out every thread's records, after any write that a thread had already started. (Buffers are only ever
+       prepended to the list, so it's safe to walk without the lock.) */
+    for (buffer *b = *((buffer *volatile *)&g_capture_buffers); b; b = b->next) {
+        eb_spinlock_lock(&b->lock);
+            buffer_write(b, (b->session == session ? f : NULL));
+        eb_spinlock_unlock(&b->lock);
+    }
+    
+    eb_spinlock_lock(&g_capture_file_lock);
+        bool ok = g_capture_file_ok;
+        g_capture_file = NULL;
+    eb_spinlock_unlock(&g_capture_file_lock);
+    ok = !fclose(f) && ok;
+    return ok;
+}
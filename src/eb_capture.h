@@ -0,0 +1,29 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* Whether traffic capture is compiled in (see eb_chan_capture_start()). Capturing costs a predictable branch per op
+   while no capture is running. Defining EB_CHAN_CAPTURE=0 removes it entirely. */
+#ifndef EB_CHAN_CAPTURE
+    #define EB_CHAN_CAPTURE 1
+#endif
+
+/* The size of each thread's record buffer, which is written to the capture file when it fills up */
+#define EB_CAPTURE_BUF_SIZE 16384
+/* Channel names longer than this are truncated in the capture file */
+#define EB_CAPTURE_NAME_MAX 255
+
+/* ## Variables */
+/* The running capture's session number (starting at 1), or 0 while not capturing (checked before every op) */
+extern uint32_t eb_capture_session;
+
+/* ## Functions */
+/* Returns a new capture-local channel id; the caller must then _define() the channel */
+uint32_t eb_capture_chan_next();
+/* Records the definition of channel 'chan' in 'session': its capacity and (possibly NULL) name */
+void eb_capture_define(uint32_t session, uint32_t chan, size_t cap, const char *name);
+/* Records an op of 'type' (an eb_chan_capture_type) on channel 'chan' in 'session', which was issued at tick 'start'
+   and completed at tick 'end', leaving 'depth' values in the channel's buffer */
+void eb_capture_record(uint32_t session, uint8_t type, uint8_t flags, uint32_t chan, size_t depth, uint64_t start,
+    uint64_t end);
@@ -3,12 +3,54 @@
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdarg.h>
 #include <sched.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <pthread.h>
 #include "eb_assert.h"
+#include "eb_alloc.h"
+#include "eb_numa.h"
+#include "eb_sys.h"
+#include "eb_config.h"
 #include "eb_port.h"
 #include "eb_atomic.h"
 #include "eb_spinlock.h"
 #include "eb_time.h"
+#include "eb_thread.h"
+#include "eb_hist.h"
+#include "eb_trace.h"
+#include "eb_capture.h"
+#include "eb_probe.h"
+
+/* Whether wakeups prefer waiters close to the signaling thread (see port_list_signal_first()) */
+#ifndef EB_CHAN_WAKE_LOCALITY
+    #define EB_CHAN_WAKE_LOCALITY 1
+#endif
+
+/* Whether per-channel statistics are collected (see eb_chan_stats()). Defining EB_CHAN_STATS=0 removes them entirely. */
+#ifndef EB_CHAN_STATS
+    #define EB_CHAN_STATS 1
+#endif
+
+/* The number of shards that each channel's lock-free counters are spread across, to limit contention */
+#define EB_CHAN_STATS_SHARDS 4
+/* The alignment of a channel's statistics, so that each shard has a cache line to itself */
+#define EB_CHAN_STATS_ALIGN 64
+
+/* Whether channels support latency measurement (see eb_chan_latency_enable()). Defining EB_CHAN_LATENCY=0 removes it
+   entirely. */
+#ifndef EB_CHAN_LATENCY
+    #define EB_CHAN_LATENCY 1
+#endif
 
 #pragma mark - Types -
 typedef struct {
@@ -16,255 +58,1894 @@ typedef struct {
     size_t cap;
     size_t len;
     eb_port *ports;
-} *port_list;
+    /* The first waiter that was passed over in favor of a closer one, and how many consecutive times it was passed over */
+    eb_port bypassed_port;
+    unsigned int bypassed;
+    #if EB_CHAN_LOCKPROF
+        eb_spinlock_prof lock_prof;
+    #endif
+} port_list;
+
+/* Initializes an empty list. The list's buffer isn't allocated until the first port is added, so that channels which
+   never block (and channels initialized in caller-provided storage) don't incur an allocation. */
+static inline void port_list_init(port_list *l) {
+    assert(l);
+    
+    l->lock = EB_SPINLOCK_INIT;
+    l->cap = 0;
+    l->len = 0;
+    l->ports = NULL;
+    l->bypassed_port = NULL;
+    l->bypassed = 0;
+}
+
+/* Releases every port in the list, and frees the list's buffer */
+static inline void port_list_deinit(port_list *l, const eb_chan_allocator *a) {
+    assert(l);
+    assert(a);
+    
+    /* Release each port in our list */
+    for (size_t i = 0; i < l->len; i++) {
+        eb_port_release(l->ports[i]);
+    }
+    
+    eb_free(a, l->ports, l->cap * sizeof(*(l->ports)));
+    l->ports = NULL;
+    l->cap = 0;
+    l->len = 0;
+}
 
-static inline void port_list_free(port_list l);
+/* Add a port to the end of the list, expanding the buffer as necessary */
+static inline void port_list_add(port_list *l, const eb_chan_allocator *a, eb_port p) {
+    assert(l);
+    assert(a);
+    assert(p);
+    
+    /* First retain the port! */
+    eb_port_retain(p);
+    
+    eb_spinlock_lock_prof(&l->lock, &l->lock_prof);
+        /* Sanity-check that the list's length is less than its capacity */
+        eb_sanity_or_bail(l->len <= l->cap, "Sanity check failed");
+        
+        /* Expand the list's buffer if it's full (or hasn't been allocated yet) */
+        if (l->len == l->cap) {
+            size_t old_cap = l->cap;
+            l->cap = (l->cap ? l->cap * 2 : eb_config.waiter_list_cap);
+            // TODO: reimplement as a linked list, where the port nodes are just on the stacks of the _select_list() calls. that way the number of ports is unbounded, and we don't have to allocate anything on the heap!
+            l->ports = eb_realloc(a, l->ports, old_cap * sizeof(*(l->ports)), l->cap * sizeof(*(l->ports)));
+            eb_assert_or_bail(l->ports, "Allocation failed");
+        }
+        
+        l->ports[l->len] = p;
+        l->len++;
+    eb_spinlock_unlock(&l->lock);
+}
 
-/* Creates a new empty list */
-static inline port_list port_list_alloc(size_t cap) {
-    assert(cap > 0);
+/* Expand the list's buffer so that it can hold at least 'cap' ports without reallocating */
+static inline bool port_list_reserve(port_list *l, const eb_chan_allocator *a, size_t cap) {
+    assert(l);
+    assert(a);
+    
+    bool result = true;
+    eb_spinlock_lock_prof(&l->lock, &l->lock_prof);
+        if (cap > l->cap) {
+            eb_port *ports = eb_realloc(a, l->ports, l->cap * sizeof(*(l->ports)), cap * sizeof(*(l->ports)));
+            if (ports) {
+                l->ports = ports;
+                l->cap = cap;
+            } else {
+                result = false;
+            }
+        }
+    eb_spinlock_unlock(&l->lock);
     
-    port_list result = malloc(sizeof(*result));
-    eb_assert_or_recover(result, goto failed);
+    eb_assert_or_recover(result, eb_no_op);
+    return result;
+}
+
+/* Locks the list's buffer into RAM */
+static inline bool port_list_mlock(port_list *l) {
+    assert(l);
     
-    result->lock = EB_SPINLOCK_INIT;
-    result->cap = cap;
-    result->len = 0;
-    result->ports = malloc(cap * sizeof(*(result->ports)));
-    eb_assert_or_recover(result->ports, goto failed);
+    bool result = true;
+    eb_spinlock_lock_prof(&l->lock, &l->lock_prof);
+        if (l->ports) {
+            result = !mlock(l->ports, l->cap * sizeof(*(l->ports)));
+        }
+    eb_spinlock_unlock(&l->lock);
     
+    eb_assert_or_recover(result, eb_no_op);
     return result;
-    failed: {
-        port_list_free(result);
+}
+
+/* Remove the first occurence of 'p' in the list. Returns whether a port was actually removed. */
+static inline bool port_list_rm(port_list *l, eb_port p) {
+    assert(l);
+    assert(p);
+    
+    bool result = false;
+    eb_spinlock_lock_prof(&l->lock, &l->lock_prof);
+        /* Sanity-check that the list's length is less than its capacity */
+        eb_sanity_or_bail(l->len <= l->cap, "Sanity-check failed");
+        
+        /* Search for first occurence of the given port. If we find it, release it and move the last port in the list into the hole. */
+        for (size_t i = 0; i < l->len; i++) {
+            if (l->ports[i] == p) {
+                /* Move the last element in the port list into the now-vacant spot */
+                l->ports[i] = l->ports[l->len-1];
+                /* Decrement the buffer length */
+                l->len--;
+                result = true;
+                break;
+            }
+        }
+    eb_spinlock_unlock(&l->lock);
+    
+    if (result) {
+        /* Release the port, but do so outside of the spinlock because releasing does some stuff that might not be quick. */
+        eb_port_release(p);
+    }
+    
+    return result;
+}
+
+/* Signal the first port in the list that isn't 'ignore'. Among the first few candidates, the port whose waiter last ran
+   closest to the signaling thread (sharing a core, L2, L3 or NUMA node) is preferred so that the woken thread finds the
+   channel's cache lines warm. To bound unfairness, the first candidate is woken after being passed over a few times.
+   Returns whether a port was actually signaled. */
+static inline bool port_list_signal_first(port_list *l, eb_port ignore) {
+    static const size_t k_max_candidates = 8;
+    static const unsigned int k_max_bypass = 4;
+    static const int k_max_proximity = 4;
+    
+    assert(l);
+    
+    /* Only bother determining our CPU if there's a choice to make */
+    int cpu = -1;
+    #if EB_CHAN_WAKE_LOCALITY
+        if (*((volatile size_t *)&l->len) > 1) {
+            cpu = eb_sys_cpu_current();
+        }
+    #endif
+    
+    eb_port p = NULL;
+    eb_spinlock_lock_prof(&l->lock, &l->lock_prof);
+        eb_port best = NULL;
+        int best_proximity = -1;
+        size_t ncandidates = 0;
+        for (size_t i = 0; i < l->len && ncandidates < k_max_candidates; i++) {
+            if (l->ports[i] != ignore) {
+                if (!p) {
+                    p = l->ports[i];
+                }
+                
+                if (cpu < 0) {
+                    break;
+                }
+                
+                int proximity = eb_sys_cpu_proximity(cpu, eb_port_waiter_info(l->ports[i])->cpu);
+                if (proximity > best_proximity) {
+                    best = l->ports[i];
+                    best_proximity = proximity;
+                    if (proximity == k_max_proximity) {
+                        break;
+                    }
+                }
+                
+                ncandidates++;
+            }
+        }
+        
+        /* Prefer the closest waiter, unless the first candidate has been passed over too many times. The count restarts
+           whenever the first candidate changes (e.g. because it was cancelled, or another waiter was swapped into its
+           place), so that the bound applies to each waiter rather than to the list. */
+        if (best && best != p) {
+            if (p != l->bypassed_port) {
+                l->bypassed_port = p;
+                l->bypassed = 0;
+            }
+            
+            if (l->bypassed < k_max_bypass) {
+                p = best;
+                l->bypassed++;
+            } else {
+                l->bypassed_port = NULL;
+                l->bypassed = 0;
+            }
+        }
+        
+        if (p) {
+            eb_port_retain(p);
+        }
+    eb_spinlock_unlock(&l->lock);
+    
+    bool result = false;
+    if (p) {
+        result = eb_port_signal(p);
+        eb_port_release(p);
+        p = NULL;
+    }
+    return result;
+}
+
+enum {
+    /* Buffered/unbuffered channel states */
+    chanstate_open,
+    chanstate_closed,
+    /* Unbuffered channel states */
+    chanstate_send,
+    chanstate_recv,
+    chanstate_ack,
+    chanstate_done,
+    chanstate_cancelled
+}; typedef int32_t chanstate;
+
+typedef struct {
+    eb_chan_op *const *ops;
+    size_t nops;
+    bool *cleanup_ops;
+    
+    eb_nsec timeout;
+    eb_port port;
+    /* The statistics shard that the calling thread updates */
+    unsigned int shard;
+} do_state;
+
+/* Counters that are updated outside of the channel's lock, sharded to limit contention. Sized to fill a cache line. */
+typedef struct {
+    uint64_t sends;
+    uint64_t recvs;
+    uint64_t retries;
+    uint64_t lock_failures;
+    uint64_t parks;
+    uint64_t wakeups;
+    uint64_t wasted_wakeups;
+    uint64_t closes_observed;
+} stats_shard;
+
+/* A channel's statistics. They're allocated on the channel's first op (see stats_create()) rather than embedded in the
+   channel, so that idle channels don't pay for them and the shards can be aligned to EB_CHAN_STATS_ALIGN. */
+typedef struct {
+    stats_shard shards[EB_CHAN_STATS_SHARDS];
+    /* Buffer statistics, protected by the channel's lock */
+    size_t buf_len_max;
+    uint64_t occupancy[EB_CHAN_STATS_OCCUPANCY_BUCKETS];
+} chan_stats;
+
+#if EB_CHAN_STATS
+    /* Updates are dropped until the channel's statistics are allocated */
+    #define stats_add(c, shard, field, n) do {                                      \
+        chan_stats *stats_ = *((chan_stats *volatile *)&(c)->stats);                \
+        if (stats_) {                                                               \
+            eb_atomic_add_relaxed(&stats_->shards[(shard)].field, (n));             \
+        }                                                                           \
+    } while (0)
+#else
+    #define stats_add(c, shard, field, n)
+#endif
+
+/* A channel's latency measurement state, allocated by eb_chan_latency_enable() */
+typedef struct {
+    eb_hist hist;
+    /* The tick at which the value in each buffer slot was enqueued (buffered channels only) */
+    uint64_t *ts;
+} latency;
+
+struct eb_chan {
+    unsigned int retain_count;
+    eb_spinlock lock;
+    chanstate state;
+    /* The number of times that blocking ops try the channel before parking, or EB_CHAN_SPIN_ATTEMPTS_DEFAULT to use the
+       global configuration (see eb_chan_set_spin_attempts()) */
+    size_t spin_attempts;
+    
+    /* The channel's registry shard, and its neighbors there (see eb_chan_debug_dump()) */
+    bool registered;
+    unsigned int reg_shard;
+    eb_chan reg_prev;
+    eb_chan reg_next;
+    /* The name that the channel is exported with (see eb_chan_set_name()), protected by its registry shard's lock */
+    char *name;
+    size_t name_size;
+    #if EB_CHAN_CAPTURE
+        /* The capture session (high 32 bits) that the channel was last seen in, and its capture-local id in that session
+           (see capture_chan_id()) */
+        uint64_t capture_tag;
+    #endif
+    #if EB_CHAN_LOCKPROF
+        eb_spinlock_prof lock_prof;
+    #endif
+    
+    /* Whether the channel's memory/buffer are owned by the caller (see eb_chan_init()) */
+    bool storage_external;
+    bool buf_external;
+    /* The allocator that allocated the channel's memory */
+    eb_chan_allocator alloc;
+    /* Non-zero if the channel's memory should be migrated to the node of the first receiver */
+    int numa_first_consumer;
+    
+    port_list sends;
+    port_list recvs;
+    
+    #if EB_CHAN_STATS
+        /* The channel's statistics, or NULL until they're allocated; assigned once. 'stats_mem' is the allocation that
+           contains them, before alignment. */
+        chan_stats *stats;
+        void *stats_mem;
+    #endif
+    
+    #if EB_CHAN_BLOCKED_TIME
+        /* Blocked time (in ticks) of the selects that completed on this channel, indexed by whether they received */
+        uint64_t blocked_selects[2];
+        uint64_t blocked_ticks[2][eb_thread_phase_count];
+    #endif
+    
+    #if EB_CHAN_LATENCY
+        /* Non-NULL once latency measurement is enabled; assigned once, with the lock held */
+        latency *lat;
+        /* The tick at which the value of the in-progress unbuffered send was offered */
+        uint64_t lat_unbuf_ts;
+    #endif
+    
+    /* Buffered ivars */
+    size_t buf_cap;
+    size_t buf_len;
+    size_t buf_idx;
+    const void **buf;
+    /* When the buffer last became full (or 0 if it isn't full), tracked while the watchdog is running */
+    eb_nsec buf_full_since;
+    bool buf_full_reported;
+    
+    /* Unbuffered ivars */
+    const do_state *unbuf_state;
+    eb_chan_op *unbuf_op;
+    eb_port unbuf_port;
+};
+
+static const char *chanstate_name(chanstate state) {
+    switch (state) {
+        case chanstate_open:        return "open";
+        case chanstate_closed:      return "closed";
+        case chanstate_send:        return "send";
+        case chanstate_recv:        return "recv";
+        case chanstate_ack:         return "ack";
+        case chanstate_done:        return "done";
+        case chanstate_cancelled:   return "cancelled";
+    }
+    return "?";
+}
+
+/* Records a flight recorder event (see eb_chan_trace_start()) */
+static inline void trace(eb_trace_type type, const void *chan, const char *label, uint32_t arg) {
+    #if EB_CHAN_TRACE
+        if (eb_trace_active) {
+            eb_trace_record(type, chan, label, arg);
+        }
+    #endif
+}
+
+/* Records the current state of an unbuffered channel, after a transition. Must be called with the channel's lock held. */
+static inline void trace_state(eb_chan c) {
+    #if EB_CHAN_TRACE
+        if (eb_trace_active) {
+            eb_trace_record(eb_trace_unbuf_state, c, chanstate_name(c->state), 0);
+        }
+    #endif
+}
+
+/* Signal a waiter in 'l' (one of c's port lists), counting the wakeup */
+static inline void signal_first(eb_chan c, unsigned int shard, port_list *l, eb_port ignore) {
+    if (port_list_signal_first(l, ignore)) {
+        stats_add(c, shard, wakeups, 1);
+        trace(eb_trace_signal, c, NULL, 0);
+    }
+}
+
+/* Signal a channel's unbuffered counterpart port, counting the wakeup */
+static inline void signal_port(eb_chan c, unsigned int shard, eb_port p) {
+    if (eb_port_signal(p)) {
+        stats_add(c, shard, wakeups, 1);
+        trace(eb_trace_signal, c, NULL, 0);
+    }
+}
+
+#if EB_CHAN_LATENCY
+    /* Records the latency of a value that was enqueued/offered at tick 'ts'. Must be called with the channel's lock held. */
+    static inline void latency_record(eb_chan c, uint64_t ts) {
+        uint64_t now = eb_time_ticks();
+        eb_hist_record(&c->lat->hist, eb_time_ticks_to_nsec(now > ts ? now - ts : 0));
+    }
+#endif
+
+#pragma mark - Statistics allocation -
+/* Allocates c's statistics, if they haven't been already. Returns false if the allocation failed. */
+static inline bool stats_create(eb_chan c) {
+    assert(c);
+    
+    #if EB_CHAN_STATS
+        if (*((chan_stats *volatile *)&c->stats)) {
+            return true;
+        }
+        
+        /* Over-allocate so that the statistics can be aligned */
+        size_t size = sizeof(chan_stats) + EB_CHAN_STATS_ALIGN - 1;
+        void *mem = eb_alloc_zeroed(&c->alloc, size);
+        eb_assert_or_recover(mem, return false);
+        
+        /* Another thread may be allocating them at the same time; the first one to claim 'stats_mem' wins */
+        if (!eb_atomic_compare_and_swap(&c->stats_mem, NULL, mem)) {
+            eb_free(&c->alloc, mem, size);
+            return true;
+        }
+        
+        uintptr_t align_mask = EB_CHAN_STATS_ALIGN - 1;
+        chan_stats *stats = (chan_stats *)(((uintptr_t)mem + align_mask) & ~align_mask);
+        eb_atomic_barrier();
+        *((chan_stats *volatile *)&c->stats) = stats;
+    #endif
+    return true;
+}
+
+#pragma mark - Registry -
+/* The number of shards that the registry is spread across. Channels are registered in the shard of the thread that
+   creates them, so that creating and freeing channels on different threads doesn't contend on one lock. */
+#define EB_CHAN_REGISTRY_SHARDS 16
+
+/* Every live channel, for eb_chan_debug_dump(), the watchdog and the metrics exporter. Each shard fills a cache line. */
+typedef struct {
+    eb_spinlock lock;
+    eb_chan head;
+    uint8_t pad[EB_CHAN_STATS_ALIGN - sizeof(eb_spinlock) - sizeof(eb_chan)];
+} registry_shard;
+static registry_shard g_registry[EB_CHAN_REGISTRY_SHARDS] __attribute__((aligned(EB_CHAN_STATS_ALIGN)));
+enum {
+    /* States of a background service (the watchdog or the metrics server), which start and stop claim with a CAS */
+    service_idle,
+    service_starting,
+    service_running,
+    service_stopping
+}; typedef int service_state;
+
+/* The watchdog's state; its thread exists while it's service_running or service_stopping */
+static service_state g_watchdog_state = service_idle;
+
+/* Claims a service for stopping, after waiting for a concurrent start to publish whether it succeeded. Returns false if
+   the service isn't running or another caller claimed it first. */
+static bool service_claim_stop(service_state *state) {
+    for (;;) {
+        service_state s = *((volatile service_state *)state);
+        if (s == service_starting) {
+            eb_sys_yield();
+        } else if (s != service_running) {
+            return false;
+        } else if (eb_atomic_compare_and_swap(state, service_running, service_stopping)) {
+            return true;
+        }
+    }
+}
+
+static void registry_add(eb_chan c) {
+    assert(c);
+    
+    c->reg_shard = eb_thread_stats_shard(EB_CHAN_REGISTRY_SHARDS);
+    registry_shard *shard = &g_registry[c->reg_shard];
+    eb_spinlock_lock(&shard->lock);
+        c->reg_prev = NULL;
+        c->reg_next = shard->head;
+        if (shard->head) {
+            shard->head->reg_prev = c;
+        }
+        shard->head = c;
+        c->registered = true;
+    eb_spinlock_unlock(&shard->lock);
+}
+
+static void registry_rm(eb_chan c) {
+    assert(c);
+    
+    registry_shard *shard = &g_registry[c->reg_shard];
+    eb_spinlock_lock(&shard->lock);
+        if (c->registered) {
+            if (c->reg_prev) {
+                c->reg_prev->reg_next = c->reg_next;
+            } else {
+                shard->head = c->reg_next;
+            }
+            if (c->reg_next) {
+                c->reg_next->reg_prev = c->reg_prev;
+            }
+            c->registered = false;
+        }
+    eb_spinlock_unlock(&shard->lock);
+}
+
+/* Retains a registered channel, unless it's already being freed. Must be called with the channel's registry shard
+   locked. */
+static bool registry_retain(eb_chan c) {
+    assert(c);
+    
+    for (;;) {
+        unsigned int retain_count = *((volatile unsigned int *)&c->retain_count);
+        if (!retain_count) {
+            return false;
+        }
+        if (eb_atomic_compare_and_swap(&c->retain_count, retain_count, retain_count + 1)) {
+            return true;
+        }
+    }
+}
+
+/* A buffer that state is copied into with locks held, so that it can be formatted and written after they're released.
+   It can't grow while the locks are held, so a copy that doesn't fit only tallies the space it needed; the caller then
+   releases the locks and copies again after snapshot_reset() grows the buffer. */
+typedef struct {
+    eb_chan_allocator alloc;
+    char *buf;
+    size_t cap;
+    size_t len;
+    size_t needed;
+} snapshot;
+
+static void snapshot_init(snapshot *s) {
+    assert(s);
+    
+    memset(s, 0, sizeof(*s));
+    s->alloc = eb_alloc_global();
+}
+
+static void snapshot_free(snapshot *s) {
+    assert(s);
+    
+    eb_free(&s->alloc, s->buf, s->cap);
+    s->buf = NULL;
+    s->cap = 0;
+}
+
+/* Returns the space that snapshot_push() uses for 'size' bytes, which keeps the records aligned */
+static size_t snapshot_align(size_t size) {
+    return (size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+}
+
+/* Returns room for 'size' bytes at the end of the snapshot, or NULL if they don't fit */
+static void *snapshot_push(snapshot *s, size_t size) {
+    assert(s);
+    
+    size = snapshot_align(size);
+    s->needed += size;
+    if (s->needed > s->cap) {
         return NULL;
     }
+    
+    void *result = s->buf + s->len;
+    s->len += size;
+    return result;
+}
+
+/* Returns whether everything that was pushed since the last reset fit */
+static bool snapshot_fits(const snapshot *s) {
+    assert(s);
+    return (s->needed <= s->cap);
+}
+
+/* Empties the snapshot, first growing it to fit what the last copy needed. Returns false if that allocation failed. */
+static bool snapshot_reset(snapshot *s) {
+    assert(s);
+    
+    if (s->needed > s->cap) {
+        size_t cap = s->needed * 2;
+        char *buf = eb_realloc(&s->alloc, s->buf, s->cap, cap);
+        eb_assert_or_recover(buf, return false);
+        s->buf = buf;
+        s->cap = cap;
+    }
+    s->len = 0;
+    s->needed = 0;
+    return true;
 }
 
-/* Releases every port in the list, and frees the list itself */
-static inline void port_list_free(port_list l) {
-    /* Intentionally allowing l==NULL */
-    if (!l) {
+#pragma mark - Channel creation/lifecycle -
+/* Compile-time checks that the storage advertised in eb_chan.h is large enough, and aligned enough, to hold a channel.
+   If these fail, bump EB_CHAN_STORAGE_SIZE or EB_CHAN_STORAGE_ALIGN (and the union's members to match). */
+typedef char eb_chan_storage_size_check[(sizeof(struct eb_chan) <= sizeof(struct eb_chan_storage) ? 1 : -1)];
+typedef char eb_chan_storage_align_check[(__alignof__(struct eb_chan) <= EB_CHAN_STORAGE_ALIGN ? 1 : -1)];
+
+static inline void eb_chan_free(eb_chan c) {
+    /* Intentionally allowing c==NULL so that this function can be called from eb_chan_create() */
+    if (!c) {
         return;
     }
     
-    /* Release each port in our list */
-    for (size_t i = 0; i < l->len; i++) {
-        eb_port_release(l->ports[i]);
+    eb_probe1(free, c);
+    registry_rm(c);
+    
+    if (c->buf_cap && !c->buf_external) {
+        /* ## Buffered */
+        eb_free(&c->alloc, c->buf, c->buf_cap * sizeof(*(c->buf)));
+    }
+    c->buf = NULL;
+    
+    port_list_deinit(&c->recvs, &c->alloc);
+    port_list_deinit(&c->sends, &c->alloc);
+    
+    if (c->name) {
+        eb_free(&c->alloc, c->name, c->name_size);
+        c->name = NULL;
+    }
+    
+    #if EB_CHAN_LATENCY
+        if (c->lat) {
+            eb_free(&c->alloc, c->lat->ts, c->buf_cap * sizeof(*(c->lat->ts)));
+            eb_free(&c->alloc, c->lat, sizeof(*(c->lat)));
+            c->lat = NULL;
+        }
+    #endif
+    
+    #if EB_CHAN_STATS
+        if (c->stats_mem) {
+            eb_free(&c->alloc, c->stats_mem, sizeof(chan_stats) + EB_CHAN_STATS_ALIGN - 1);
+            c->stats = NULL;
+            c->stats_mem = NULL;
+        }
+    #endif
+    
+    /* Channels initialized with eb_chan_init() live in the caller's memory, so only their resources are freed */
+    if (!c->storage_external) {
+        /* Copy the allocator out of the channel since we're about to free it */
+        eb_chan_allocator alloc = c->alloc;
+        eb_free(&alloc, c, sizeof(*c));
+    }
+    c = NULL;
+}
+
+/* Sets up a zeroed channel. If the channel's buffered and 'ring' is NULL, the buffer is allocated. */
+static inline bool eb_chan_setup(eb_chan c, void *ring, size_t buf_cap) {
+    assert(c);
+    
+    /* Apply the environment's configuration before the channel's first op */
+    eb_config_init();
+    
+    c->retain_count = 1;
+    c->lock = EB_SPINLOCK_INIT;
+    c->state = chanstate_open;
+    c->spin_attempts = EB_CHAN_SPIN_ATTEMPTS_DEFAULT;
+    
+    port_list_init(&c->sends);
+    port_list_init(&c->recvs);
+    
+    #if EB_CHAN_BUFFERED_ONLY
+        /* Unbuffered channels aren't supported in this build */
+        eb_assert_or_recover(buf_cap, return false);
+    #endif
+    
+    if (buf_cap) {
+        /* ## Buffered */
+        c->buf_cap = buf_cap;
+        c->buf_len = 0;
+        c->buf_idx = 0;
+        if (ring) {
+            c->buf = ring;
+            c->buf_external = true;
+        } else {
+            c->buf = eb_alloc(&c->alloc, c->buf_cap * sizeof(*(c->buf)));
+            eb_assert_or_recover(c->buf, return false);
+        }
+    } else {
+        /* ## Unbuffered */
+        c->unbuf_state = NULL;
+        c->unbuf_op = NULL;
+        c->unbuf_port = NULL;
+    }
+    
+    registry_add(c);
+    
+    /* Issue a memory barrier since we didn't have the lock acquired for our set up (and this channel could theoretically
+       be passed to another thread without a barrier, and that'd be bad news...) */
+    eb_atomic_barrier();
+    
+    return true;
+}
+
+eb_chan eb_chan_create(size_t buf_cap) {
+    eb_chan_allocator a = eb_alloc_global();
+    return eb_chan_create_with_allocator(buf_cap, &a);
+}
+
+eb_chan eb_chan_create_with_allocator(size_t buf_cap, const eb_chan_allocator *a) {
+    assert(a);
+    eb_assert_or_bail(a->alloc && a->free, "Allocator must supply alloc() and free()");
+    
+    /* Initialize eb_sys so that eb_sys_ncores is valid. */
+    eb_sys_init();
+    #if EB_CHAN_LOCKPROF
+        /* Lock wait times are measured in ticks */
+        eb_time_ticks_init();
+    #endif
+    
+    /* Using a zeroed allocation so that the bytes are zeroed. */
+    eb_chan c = eb_alloc_zeroed(a, sizeof(*c));
+    eb_assert_or_recover(c, goto failed);
+    c->alloc = *a;
+    
+    bool r = eb_chan_setup(c, NULL, buf_cap);
+    eb_assert_or_recover(r, goto failed);
+    
+    eb_probe2(create, c, buf_cap);
+    return c;
+    failed: {
+        eb_chan_free(c);
+        return NULL;
+    }
+}
+
+eb_chan eb_chan_create_on_node(size_t buf_cap, int node) {
+    eb_chan_allocator a = eb_numa_allocator(node >= 0 ? node : -1);
+    eb_chan c = eb_chan_create_with_allocator(buf_cap, &a);
+    eb_assert_or_recover(c, return NULL);
+    
+    if (node == eb_chan_node_first_consumer) {
+        c->numa_first_consumer = true;
+        eb_atomic_barrier();
+    }
+    
+    return c;
+}
+
+/* Migrates the channel's memory to the calling thread's node if it's the channel's first receiver */
+static void numa_claim(eb_chan c) {
+    assert(c);
+    
+    if (eb_atomic_compare_and_swap(&c->numa_first_consumer, true, false)) {
+        int node = eb_sys_cpu_node(eb_sys_cpu_current());
+        if (node >= 0) {
+            eb_numa_move(c, sizeof(*c), node);
+            if (c->buf_cap) {
+                eb_numa_move(c->buf, c->buf_cap * sizeof(*(c->buf)), node);
+            }
+        }
+    }
+}
+
+eb_chan eb_chan_init(struct eb_chan_storage *storage, void *ring, size_t buf_cap) {
+    assert(storage);
+    
+    /* Initialize eb_sys so that eb_sys_ncores is valid. */
+    eb_sys_init();
+    #if EB_CHAN_LOCKPROF
+        /* Lock wait times are measured in ticks */
+        eb_time_ticks_init();
+    #endif
+    
+    eb_chan c = (eb_chan)storage;
+    memset(c, 0, sizeof(*c));
+    c->storage_external = true;
+    c->alloc = eb_alloc_global();
+    
+    /* The ring has to be suitably aligned to hold pointers */
+    eb_assert_or_recover(!ring || !((uintptr_t)ring % sizeof(*(c->buf))), goto failed);
+    
+    bool r = eb_chan_setup(c, ring, buf_cap);
+    eb_assert_or_recover(r, goto failed);
+    
+    eb_probe2(create, c, buf_cap);
+    return c;
+    failed: {
+        eb_chan_free(c);
+        return NULL;
+    }
+}
+
+void eb_chan_deinit(eb_chan c) {
+    assert(c);
+    eb_assert_or_bail(c->storage_external, "Channel wasn't initialized with eb_chan_init()");
+    eb_chan_release(c);
+}
+
+eb_chan eb_chan_retain(eb_chan c) {
+    assert(c);
+    eb_atomic_add(&c->retain_count, 1);
+    return c;
+}
+
+void eb_chan_release(eb_chan c) {
+    assert(c);
+    if (eb_atomic_add(&c->retain_count, -1) == 0) {
+        eb_chan_free(c);
+    }
+}
+
+#pragma mark - Preallocation -
+bool eb_chan_reserve(eb_chan c, size_t max_waiters) {
+    assert(c);
+    return stats_create(c) &&
+           port_list_reserve(&c->sends, &c->alloc, max_waiters) &&
+           port_list_reserve(&c->recvs, &c->alloc, max_waiters);
+}
+
+bool eb_chan_mlock(eb_chan c) {
+    assert(c);
+    
+    int r = mlock(c, sizeof(*c));
+    eb_assert_or_recover(!r, return false);
+    
+    if (c->buf_cap) {
+        r = mlock(c->buf, c->buf_cap * sizeof(*(c->buf)));
+        eb_assert_or_recover(!r, return false);
+    }
+    
+    #if EB_CHAN_STATS
+        if (c->stats) {
+            r = mlock(c->stats, sizeof(*(c->stats)));
+            eb_assert_or_recover(!r, return false);
+        }
+    #endif
+    
+    return port_list_mlock(&c->sends) && port_list_mlock(&c->recvs);
+}
+
+#pragma mark - Configuration -
+void eb_chan_set_spin_attempts(eb_chan c, size_t attempts) {
+    assert(c);
+    *((volatile size_t *)&c->spin_attempts) = attempts;
+}
+
+#pragma mark - Statistics -
+bool eb_chan_stats(eb_chan c, eb_chan_counters *out) {
+    assert(c);
+    assert(out);
+    
+    memset(out, 0, sizeof(*out));
+    #if EB_CHAN_STATS
+        /* A channel whose statistics haven't been allocated hasn't counted anything yet */
+        chan_stats *stats = *((chan_stats *volatile *)&c->stats);
+        if (!stats) {
+            return true;
+        }
+        
+        for (size_t i = 0; i < EB_CHAN_STATS_SHARDS; i++) {
+            const stats_shard *shard = &stats->shards[i];
+            out->sends += eb_atomic_load_relaxed(&shard->sends);
+            out->recvs += eb_atomic_load_relaxed(&shard->recvs);
+            out->retries += eb_atomic_load_relaxed(&shard->retries);
+            out->lock_failures += eb_atomic_load_relaxed(&shard->lock_failures);
+            out->parks += eb_atomic_load_relaxed(&shard->parks);
+            out->wakeups += eb_atomic_load_relaxed(&shard->wakeups);
+            out->wasted_wakeups += eb_atomic_load_relaxed(&shard->wasted_wakeups);
+            out->closes_observed += eb_atomic_load_relaxed(&shard->closes_observed);
+        }
+        
+        eb_spinlock_lock_prof(&c->lock, &c->lock_prof);
+            out->buf_len_max = stats->buf_len_max;
+            memcpy(out->occupancy, stats->occupancy, sizeof(out->occupancy));
+        eb_spinlock_unlock(&c->lock);
+        return true;
+    #else
+        return false;
+    #endif
+}
+
+#pragma mark - Latency -
+bool eb_chan_latency_enable(eb_chan c) {
+    assert(c);
+    
+    #if EB_CHAN_LATENCY
+        eb_time_ticks_init();
+        
+        /* Allocate outside of the lock */
+        latency *lat = eb_alloc_zeroed(&c->alloc, sizeof(*lat));
+        eb_assert_or_recover(lat, return false);
+        if (c->buf_cap) {
+            lat->ts = eb_alloc(&c->alloc, c->buf_cap * sizeof(*(lat->ts)));
+            eb_assert_or_recover(lat->ts, goto failed);
+        }
+        
+        bool installed = false;
+        eb_spinlock_lock_prof(&c->lock, &c->lock_prof);
+            if (!c->lat) {
+                /* Treat the values that are already buffered as having been enqueued now */
+                uint64_t now = eb_time_ticks();
+                for (size_t i = 0; i < c->buf_cap; i++) {
+                    lat->ts[i] = now;
+                }
+                c->lat_unbuf_ts = now;
+                c->lat = lat;
+                installed = true;
+            }
+        eb_spinlock_unlock(&c->lock);
+        
+        /* Measurement was already enabled */
+        if (!installed) {
+            goto failed;
+        }
+        
+        return true;
+        failed: {
+            eb_free(&c->alloc, lat->ts, c->buf_cap * sizeof(*(lat->ts)));
+            eb_free(&c->alloc, lat, sizeof(*lat));
+            return (c->lat != NULL);
+        }
+    #else
+        return false;
+    #endif
+}
+
+bool eb_chan_latency_stats(eb_chan c, eb_chan_latency *out) {
+    assert(c);
+    assert(out);
+    
+    memset(out, 0, sizeof(*out));
+    #if EB_CHAN_LATENCY
+        const latency *lat = *((latency *volatile *)&c->lat);
+        if (!lat) {
+            return false;
+        }
+        
+        out->count = eb_atomic_load_relaxed(&lat->hist.count);
+        out->p50 = eb_hist_percentile(&lat->hist, 50);
+        out->p90 = eb_hist_percentile(&lat->hist, 90);
+        out->p99 = eb_hist_percentile(&lat->hist, 99);
+        out->p999 = eb_hist_percentile(&lat->hist, 99.9);
+        out->max = eb_atomic_load_relaxed(&lat->hist.max);
+        return true;
+    #else
+        return false;
+    #endif
+}
+
+eb_nsec eb_chan_latency_percentile(eb_chan c, double pct) {
+    assert(c);
+    
+    #if EB_CHAN_LATENCY
+        const latency *lat = *((latency *volatile *)&c->lat);
+        return (lat ? eb_hist_percentile(&lat->hist, pct) : 0);
+    #else
+        return 0;
+    #endif
+}
+
+#pragma mark - Lock profiling -
+#if EB_CHAN_LOCKPROF
+    static void lock_counts(const eb_spinlock_prof *prof, eb_chan_lock_counts *out) {
+        out->contended = eb_atomic_load_relaxed(&prof->contended);
+        out->spins = eb_atomic_load_relaxed(&prof->spins);
+        out->wait_cycles = eb_atomic_load_relaxed(&prof->wait_ticks);
+        out->wait_ns = eb_time_ticks_to_nsec(out->wait_cycles);
+    }
+#endif
+
+bool eb_chan_lock_stats(eb_chan c, eb_chan_lock_report *out) {
+    assert(c);
+    assert(out);
+    
+    memset(out, 0, sizeof(*out));
+    #if EB_CHAN_LOCKPROF
+        lock_counts(&c->lock_prof, &out->chan);
+        lock_counts(&c->sends.lock_prof, &out->sends);
+        lock_counts(&c->recvs.lock_prof, &out->recvs);
+        return true;
+    #else
+        return false;
+    #endif
+}
+
+#pragma mark - Blocked-time accounting -
+bool eb_chan_blocked_time(eb_chan c, eb_chan_op_times *out) {
+    assert(c);
+    assert(out);
+    
+    memset(out, 0, sizeof(*out));
+    #if EB_CHAN_BLOCKED_TIME
+        eb_chan_phase_times *times[2] = {&out->sends, &out->recvs};
+        for (size_t i = 0; i < 2; i++) {
+            times[i]->selects = eb_atomic_load_relaxed(&c->blocked_selects[i]);
+            times[i]->spin = eb_time_ticks_to_nsec(eb_atomic_load_relaxed(&c->blocked_ticks[i][eb_thread_phase_spin]));
+            times[i]->park = eb_time_ticks_to_nsec(eb_atomic_load_relaxed(&c->blocked_ticks[i][eb_thread_phase_park]));
+            times[i]->wake = eb_time_ticks_to_nsec(eb_atomic_load_relaxed(&c->blocked_ticks[i][eb_thread_phase_wake]));
+        }
+        return eb_thread_accounting;
+    #else
+        return false;
+    #endif
+}
+
+#pragma mark - System call accounting -
+#if EB_CHAN_SYSCALL_STATS
+    /* The counts and context switches at the last eb_chan_syscall_stats_reset() */
+    static eb_spinlock g_syscall_baseline_lock = EB_SPINLOCK_INIT;
+    static uint64_t g_syscall_baseline[eb_sys_call_count];
+    static uint64_t g_syscall_baseline_nvcsw = 0;
+    static uint64_t g_syscall_baseline_nivcsw = 0;
+    
+    /* Fills 'counts' with the system call counts, and 'nvcsw'/'nivcsw' with the process' context switches */
+    static void syscall_counts(uint64_t counts[eb_sys_call_count], uint64_t *nvcsw, uint64_t *nivcsw) {
+        eb_sys_call_counts(counts);
+        
+        struct rusage usage;
+        int r = getrusage(RUSAGE_SELF, &usage);
+        eb_assert_or_recover(!r, memset(&usage, 0, sizeof(usage)));
+        *nvcsw = usage.ru_nvcsw;
+        *nivcsw = usage.ru_nivcsw;
+    }
+#endif
+
+bool eb_chan_syscall_stats(eb_chan_syscall_counts *out) {
+    assert(out);
+    
+    memset(out, 0, sizeof(*out));
+    #if EB_CHAN_SYSCALL_STATS
+        uint64_t counts[eb_sys_call_count];
+        uint64_t nvcsw = 0;
+        uint64_t nivcsw = 0;
+        syscall_counts(counts, &nvcsw, &nivcsw);
+        
+        /* Report the counts relative to the baseline */
+        eb_spinlock_lock(&g_syscall_baseline_lock);
+            for (size_t i = 0; i < eb_sys_call_count; i++) {
+                counts[i] -= g_syscall_baseline[i];
+            }
+            nvcsw -= g_syscall_baseline_nvcsw;
+            nivcsw -= g_syscall_baseline_nivcsw;
+        eb_spinlock_unlock(&g_syscall_baseline_lock);
+        
+        out->ops = counts[eb_sys_call_op];
+        out->sem_posts = counts[eb_sys_call_sem_post];
+        out->sem_waits = counts[eb_sys_call_sem_wait];
+        out->sem_timedwaits = counts[eb_sys_call_sem_timedwait];
+        out->sem_trywaits = counts[eb_sys_call_sem_trywait];
+        out->yields = counts[eb_sys_call_yield];
+        out->syscalls = out->sem_posts + out->sem_waits + out->sem_timedwaits + out->sem_trywaits + out->yields;
+        out->voluntary_switches = nvcsw;
+        out->involuntary_switches = nivcsw;
+        if (out->ops) {
+            out->syscalls_per_op = (double)out->syscalls / out->ops;
+            out->switches_per_op = (double)(nvcsw + nivcsw) / out->ops;
+        }
+        return true;
+    #else
+        return false;
+    #endif
+}
+
+void eb_chan_syscall_stats_reset() {
+    #if EB_CHAN_SYSCALL_STATS
+        uint64_t counts[eb_sys_call_count];
+        uint64_t nvcsw = 0;
+        uint64_t nivcsw = 0;
+        syscall_counts(counts, &nvcsw, &nivcsw);
+        
+        eb_spinlock_lock(&g_syscall_baseline_lock);
+            memcpy(g_syscall_baseline, counts, sizeof(g_syscall_baseline));
+            g_syscall_baseline_nvcsw = nvcsw;
+            g_syscall_baseline_nivcsw = nivcsw;
+        eb_spinlock_unlock(&g_syscall_baseline_lock);
+    #endif
+}
+
+#pragma mark - Debugging -
+/* The records that eb_chan_debug_dump() copies out of each channel with waiters: a dump_chan, followed by each of its
+   waiters (senders first) as a dump_waiter followed by the waiter's dump_ops */
+typedef struct {
+    eb_chan chan;
+    chanstate state;
+    size_t buf_cap;
+    size_t buf_len;
+    eb_nsec buf_full_since;
+    size_t nwaiters[2];
+} dump_chan;
+
+typedef struct {
+    long tid;
+    eb_nsec park_time;
+    size_t nops;
+} dump_waiter;
+
+typedef struct {
+    bool send;
+    eb_chan chan;
+} dump_op;
+
+/* Copies the waiters in 'l' (one of a channel's port lists) into 's', and returns how many there were */
+static size_t dump_copy_waiters(snapshot *s, port_list *l) {
+    size_t count = 0;
+    eb_spinlock_lock_prof(&l->lock, &l->lock_prof);
+        for (size_t i = 0; i < l->len; i++) {
+            const eb_port_waiter *w = eb_port_waiter_info(l->ports[i]);
+            dump_waiter *dw = snapshot_push(s, sizeof(*dw));
+            if (dw) {
+                dw->tid = w->tid;
+                dw->park_time = *((volatile eb_nsec *)&w->park_time);
+                dw->nops = w->nops;
+            }
+            
+            for (size_t ii = 0; ii < w->nops; ii++) {
+                dump_op *op = snapshot_push(s, sizeof(*op));
+                if (op) {
+                    op->send = w->ops[ii]->send;
+                    op->chan = w->ops[ii]->chan;
+                }
+            }
+            count++;
+        }
+    eb_spinlock_unlock(&l->lock);
+    return count;
+}
+
+/* Copies every channel in 'shard' that has waiters into 's' */
+static void dump_copy_shard(snapshot *s, registry_shard *shard) {
+    eb_spinlock_lock(&shard->lock);
+        for (eb_chan c = shard->head; c; c = c->reg_next) {
+            /* Only list channels with waiters */
+            if (!*((volatile size_t *)&c->sends.len) && !*((volatile size_t *)&c->recvs.len)) {
+                continue;
+            }
+            
+            dump_chan *dc = snapshot_push(s, sizeof(*dc));
+            if (dc) {
+                dc->chan = c;
+                dc->buf_cap = c->buf_cap;
+                eb_spinlock_lock_prof(&c->lock, &c->lock_prof);
+                    dc->state = c->state;
+                    dc->buf_len = c->buf_len;
+                    dc->buf_full_since = c->buf_full_since;
+                eb_spinlock_unlock(&c->lock);
+            }
+            
+            size_t nsends = dump_copy_waiters(s, &c->sends);
+            size_t nrecvs = dump_copy_waiters(s, &c->recvs);
+            if (dc) {
+                dc->nwaiters[0] = nsends;
+                dc->nwaiters[1] = nrecvs;
+            }
+        }
+    eb_spinlock_unlock(&shard->lock);
+}
+
+/* Writes the channels that dump_copy_shard() copied into 's' to 'fd', and returns how many there were */
+static size_t dump_write(int fd, const snapshot *s, eb_nsec now) {
+    size_t count = 0;
+    for (const char *p = s->buf; p < s->buf + s->len; count++) {
+        const dump_chan *dc = (const dump_chan *)p;
+        p += sizeof(*dc);
+        if (dc->buf_cap) {
+            dprintf(fd, "eb_chan %p: buffered, %zu/%zu, %s", (void *)dc->chan, dc->buf_len, dc->buf_cap,
+                chanstate_name(dc->state));
+            if (dc->buf_full_since) {
+                dprintf(fd, ", full for %.3f ms",
+                    (double)(now > dc->buf_full_since ? now - dc->buf_full_since : 0) / eb_nsec_per_msec);
+            }
+            dprintf(fd, "\n");
+        } else {
+            dprintf(fd, "eb_chan %p: unbuffered, %s\n", (void *)dc->chan, chanstate_name(dc->state));
+        }
+        
+        for (size_t i = 0; i < dc->nwaiters[0] + dc->nwaiters[1]; i++) {
+            const dump_waiter *dw = (const dump_waiter *)p;
+            p += sizeof(*dw);
+            const char *kind = (i < dc->nwaiters[0] ? "send" : "recv");
+            if (dw->park_time == EB_PORT_PARK_UNTIMED) {
+                dprintf(fd, "    %s waiter: thread %ld, parked, ops:", kind, dw->tid);
+            } else if (dw->park_time) {
+                dprintf(fd, "    %s waiter: thread %ld, parked for %.3f ms, ops:", kind, dw->tid,
+                    (double)(now > dw->park_time ? now - dw->park_time : 0) / eb_nsec_per_msec);
+            } else {
+                dprintf(fd, "    %s waiter: thread %ld, running, ops:", kind, dw->tid);
+            }
+            
+            for (size_t ii = 0; ii < dw->nops; ii++) {
+                const dump_op *op = (const dump_op *)p;
+                p += sizeof(*op);
+                dprintf(fd, "%s %s %p", (ii ? "," : ""), (op->send ? "send" : "recv"), (const void *)op->chan);
+            }
+            dprintf(fd, "\n");
+        }
+    }
+    return count;
+}
+
+size_t eb_chan_debug_dump(int fd) {
+    size_t count = 0;
+    eb_nsec now = eb_time_now();
+    snapshot s;
+    snapshot_init(&s);
+    for (size_t i = 0; i < EB_CHAN_REGISTRY_SHARDS; i++) {
+        /* Copy the shard's channels with the locks held, and write them after releasing the locks, so that a slow 'fd'
+           doesn't stall the channels' users (or deadlock, if its reader uses the channels) */
+        do {
+            if (!snapshot_reset(&s)) {
+                goto done;
+            }
+            dump_copy_shard(&s, &g_registry[i]);
+        } while (!snapshot_fits(&s));
+        count += dump_write(fd, &s, now);
+    }
+    
+    done: {
+        snapshot_free(&s);
+    }
+    return count;
+}
+
+/* The watchdog's configuration, and the thread that runs it */
+static eb_nsec g_watchdog_park_threshold = 0;
+static eb_nsec g_watchdog_buf_full_threshold = 0;
+static eb_chan_stall_hook g_watchdog_hook = NULL;
+static void *g_watchdog_ctx = NULL;
+static pthread_t g_watchdog_thread;
+static int g_watchdog_stop = 0;
+/* When the watchdog started, which untimed parks (see EB_PORT_PARK_UNTIMED) are measured from */
+static eb_nsec g_watchdog_start_time = 0;
+
+/* Collects the parked waiters in 'l' that have been parked longer than the threshold into 'stalls', and returns the
+   new number of stalls. Must be called with c's registry shard locked. */
+static size_t watchdog_check_waiters(eb_chan c, port_list *l, bool send, eb_nsec now, eb_chan_stall *stalls,
+    size_t nstalls, size_t max_stalls) {
+    eb_spinlock_lock_prof(&l->lock, &l->lock_prof);
+        for (size_t i = 0; i < l->len && nstalls < max_stalls; i++) {
+            eb_port_waiter *w = eb_port_waiter_info(l->ports[i]);
+            eb_nsec park_time = *((volatile eb_nsec *)&w->park_time);
+            /* Waiters that parked before the watchdog started weren't timed, so they're measured from its start */
+            if (park_time == EB_PORT_PARK_UNTIMED) {
+                park_time = g_watchdog_start_time;
+            }
+            
+            /* Only report each park once, even if the waiter is on several channels. A park is identified by when it
+               started. */
+            if (park_time && now > park_time && now - park_time >= g_watchdog_park_threshold &&
+                w->watchdog_reported != park_time && registry_retain(c)) {
+                w->watchdog_reported = park_time;
+                stalls[nstalls] = (eb_chan_stall){
+                    .type = eb_chan_stall_parked,
+                    .chan = c,
+                    .send = send,
+                    .tid = w->tid,
+                    .duration = now - park_time,
+                };
+                nstalls++;
+            }
+        }
+    eb_spinlock_unlock(&l->lock);
+    return nstalls;
+}
+
+static void *watchdog_thread(void *arg) {
+    enum { k_max_stalls = 32 };
+    
+    /* Check at a fraction of the smallest threshold */
+    eb_nsec threshold = (g_watchdog_park_threshold < g_watchdog_buf_full_threshold ?
+        g_watchdog_park_threshold : g_watchdog_buf_full_threshold);
+    eb_nsec interval = threshold / 4;
+    interval = (interval < eb_nsec_per_msec ? eb_nsec_per_msec : (interval > eb_nsec_per_sec ? eb_nsec_per_sec : interval));
+    
+    while (!*((volatile int *)&g_watchdog_stop)) {
+        struct timespec ts = {.tv_sec = interval / eb_nsec_per_sec, .tv_nsec = interval % eb_nsec_per_sec};
+        nanosleep(&ts, NULL);
+        
+        /* Collect the stalls with each registry shard locked in turn, retaining their channels so that we can call the
+           hook with the registry unlocked (so that it can use the channel API) */
+        eb_chan_stall stalls[k_max_stalls];
+        size_t nstalls = 0;
+        eb_nsec now = eb_time_now();
+        for (size_t i = 0; i < EB_CHAN_REGISTRY_SHARDS && nstalls < k_max_stalls; i++) {
+            registry_shard *shard = &g_registry[i];
+            eb_spinlock_lock(&shard->lock);
+            for (eb_chan c = shard->head; c && nstalls < k_max_stalls; c = c->reg_next) {
+                if (g_watchdog_park_threshold != eb_nsec_forever) {
+                    nstalls = watchdog_check_waiters(c, &c->sends, true, now, stalls, nstalls, k_max_stalls);
+                    nstalls = watchdog_check_waiters(c, &c->recvs, false, now, stalls, nstalls, k_max_stalls);
+                }
+                
+                if (c->buf_cap && g_watchdog_buf_full_threshold != eb_nsec_forever && nstalls < k_max_stalls) {
+                    eb_spinlock_lock_prof(&c->lock, &c->lock_prof);
+                        if (c->buf_len == c->buf_cap && !c->buf_full_since) {
+                            /* The buffer was already full when the watchdog started */
+                            c->buf_full_since = now;
+                        } else if (c->buf_full_since && now > c->buf_full_since &&
+                            now - c->buf_full_since >= g_watchdog_buf_full_threshold && !c->buf_full_reported &&
+                            registry_retain(c)) {
+                            c->buf_full_reported = true;
+                            stalls[nstalls] = (eb_chan_stall){
+                                .type = eb_chan_stall_buf_full,
+                                .chan = c,
+                                .duration = now - c->buf_full_since,
+                            };
+                            nstalls++;
+                        }
+                    eb_spinlock_unlock(&c->lock);
+                }
+            }
+            eb_spinlock_unlock(&shard->lock);
+        }
+        
+        for (size_t i = 0; i < nstalls; i++) {
+            g_watchdog_hook(&stalls[i], g_watchdog_ctx);
+            eb_chan_release(stalls[i].chan);
+        }
+    }
+    
+    return NULL;
+}
+
+bool eb_chan_watchdog_start(eb_nsec park_threshold, eb_nsec buf_full_threshold, eb_chan_stall_hook hook, void *ctx) {
+    assert(hook);
+    
+    /* Only one watchdog runs at a time */
+    if (!eb_atomic_compare_and_swap(&g_watchdog_state, service_idle, service_starting)) {
+        return false;
+    }
+    
+    /* Initialize eb_sys so that eb_sys_ncores is valid. */
+    eb_sys_init();
+    
+    g_watchdog_park_threshold = park_threshold;
+    g_watchdog_buf_full_threshold = buf_full_threshold;
+    g_watchdog_hook = hook;
+    g_watchdog_ctx = ctx;
+    g_watchdog_stop = 0;
+    g_watchdog_start_time = eb_time_now();
+    eb_atomic_barrier();
+    
+    int r = pthread_create(&g_watchdog_thread, NULL, watchdog_thread, NULL);
+    eb_assert_or_recover(!r, *((volatile service_state *)&g_watchdog_state) = service_idle; return false);
+    /* Only mark the watchdog running once its thread exists, so that eb_chan_watchdog_stop() always has one to join */
+    eb_atomic_barrier();
+    *((volatile service_state *)&g_watchdog_state) = service_running;
+    return true;
+}
+
+void eb_chan_watchdog_stop() {
+    /* Claim the watchdog, so that only one of several concurrent callers joins its thread */
+    if (!service_claim_stop(&g_watchdog_state)) {
+        return;
+    }
+    
+    g_watchdog_stop = 1;
+    eb_atomic_barrier();
+    int r = pthread_join(g_watchdog_thread, NULL);
+    eb_assert_or_recover(!r, eb_no_op);
+    eb_atomic_barrier();
+    *((volatile service_state *)&g_watchdog_state) = service_idle;
+}
+
+#pragma mark - Metrics -
+bool eb_chan_set_name(eb_chan c, const char *name) {
+    assert(c);
+    
+    char *copy = NULL;
+    size_t size = 0;
+    if (name) {
+        size = strlen(name) + 1;
+        copy = eb_alloc(&c->alloc, size);
+        eb_assert_or_recover(copy, return false);
+        memcpy(copy, name, size);
+    }
+    
+    /* Swap the names with c's registry shard locked, since the exporter reads them with it locked */
+    eb_spinlock *lock = &g_registry[c->reg_shard].lock;
+    eb_spinlock_lock(lock);
+        char *old = c->name;
+        size_t old_size = c->name_size;
+        c->name = copy;
+        c->name_size = size;
+    eb_spinlock_unlock(lock);
+    
+    if (old) {
+        eb_free(&c->alloc, old, old_size);
+    }
+    return true;
+}
+
+/* The per-channel metric families, each of which is written as a group */
+typedef enum {
+    metric_sends,
+    metric_recvs,
+    metric_retries,
+    metric_lock_failures,
+    metric_parks,
+    metric_wakeups,
+    metric_wasted_wakeups,
+    metric_closes_observed,
+    metric_parked_waiters,
+    metric_buf_cap,
+    metric_buf_len,
+    metric_buf_len_max,
+    metric_closed,
+    metric_count,
+} metric;
+
+static const struct {
+    const char *name;
+    const char *type;
+    const char *help;
+} k_metrics[metric_count] = {
+    [metric_sends] = {"eb_chan_sends_total", "counter", "Successful sends"},
+    [metric_recvs] = {"eb_chan_recvs_total", "counter", "Successful receives"},
+    [metric_retries] = {"eb_chan_retries_total", "counter", "Ops retried because the channel was busy"},
+    [metric_lock_failures] = {"eb_chan_lock_failures_total", "counter", "Failed attempts to acquire the channel's lock"},
+    [metric_parks] = {"eb_chan_parks_total", "counter", "Times a thread parked with an op on the channel"},
+    [metric_wakeups] = {"eb_chan_wakeups_total", "counter", "Wakeups delivered to the channel's waiters"},
+    [metric_wasted_wakeups] = {"eb_chan_wasted_wakeups_total", "counter", "Wakeups after which the woken thread parked again"},
+    [metric_closes_observed] = {"eb_chan_closes_observed_total", "counter", "Ops that completed because the channel was closed"},
+    [metric_parked_waiters] = {"eb_chan_parked_waiters", "gauge", "Threads currently parked with an op on the channel"},
+    [metric_buf_cap] = {"eb_chan_buffer_capacity", "gauge", "The channel's buffer capacity"},
+    [metric_buf_len] = {"eb_chan_buffer_length", "gauge", "Values currently in the channel's buffer"},
+    [metric_buf_len_max] = {"eb_chan_buffer_length_max", "gauge", "High-water mark of the channel's buffer length"},
+    [metric_closed] = {"eb_chan_closed", "gauge", "Whether the channel is closed"},
+};
+
+/* The text that the metrics are formatted into, allocated with the global allocator. Formatting stops at the first
+   failed allocation, which is remembered in 'failed'. */
+typedef struct {
+    eb_chan_allocator alloc;
+    char *buf;
+    size_t cap;
+    size_t len;
+    bool failed;
+} metrics_text;
+
+static void metrics_text_init(metrics_text *t) {
+    assert(t);
+    
+    memset(t, 0, sizeof(*t));
+    t->alloc = eb_alloc_global();
+}
+
+static void metrics_text_free(metrics_text *t) {
+    assert(t);
+    
+    eb_free(&t->alloc, t->buf, t->cap);
+    t->buf = NULL;
+    t->cap = 0;
+}
+
+/* Ensures that 't' has room for 'size' more bytes, plus a terminator */
+static bool metrics_text_reserve(metrics_text *t, size_t size) {
+    if (t->failed) {
+        return false;
+    }
+    
+    if (t->len + size + 1 > t->cap) {
+        size_t cap = (t->cap ? t->cap : 4096);
+        while (t->len + size + 1 > cap) {
+            cap *= 2;
+        }
+        char *buf = eb_realloc(&t->alloc, t->buf, t->cap, cap);
+        eb_assert_or_recover(buf, t->failed = true; return false);
+        t->buf = buf;
+        t->cap = cap;
+    }
+    return true;
+}
+
+static void metrics_printf(metrics_text *t, const char *format, ...) {
+    /* Format into the remaining space, and if it doesn't fit, grow the buffer and format again */
+    for (size_t size = 0;;) {
+        if (!metrics_text_reserve(t, size)) {
+            return;
+        }
+        
+        va_list args;
+        va_start(args, format);
+        int r = vsnprintf(t->buf + t->len, t->cap - t->len, format, args);
+        va_end(args);
+        eb_assert_or_recover(r >= 0, t->failed = true; return);
+        if ((size_t)r < t->cap - t->len) {
+            t->len += r;
+            return;
+        }
+        size = r;
+    }
+}
+
+/* Writes 's' to 't' as a label value, escaping backslashes, quotes and newlines */
+static void metrics_write_escaped(metrics_text *t, const char *s) {
+    for (; *s; s++) {
+        if (!metrics_text_reserve(t, 2)) {
+            return;
+        }
+        
+        switch (*s) {
+            case '\\':  t->buf[t->len++] = '\\'; t->buf[t->len++] = '\\'; break;
+            case '"':   t->buf[t->len++] = '\\'; t->buf[t->len++] = '"'; break;
+            case '\n':  t->buf[t->len++] = '\\'; t->buf[t->len++] = 'n'; break;
+            default:    t->buf[t->len++] = *s; break;
+        }
+    }
+}
+
+/* A channel's metrics, as copied into a snapshot by metrics_copy_shard(). The channel's name follows the record. */
+typedef struct {
+    eb_chan chan;
+    bool has_counters;
+    eb_chan_counters counters;
+    size_t parked[2];
+    size_t buf_cap;
+    size_t buf_len;
+    bool closed;
+    size_t name_size;   /* Including the terminator, or 0 if the channel is unnamed */
+} metrics_chan;
+
+/* Returns the number of waiters in 'l' (one of a channel's port lists) that are parked */
+static size_t metrics_parked_waiters(port_list *l) {
+    size_t count = 0;
+    eb_spinlock_lock_prof(&l->lock, &l->lock_prof);
+        for (size_t i = 0; i < l->len; i++) {
+            count += (*((volatile eb_nsec *)&eb_port_waiter_info(l->ports[i])->park_time) != 0);
+        }
+    eb_spinlock_unlock(&l->lock);
+    return count;
+}
+
+/* Copies the metrics of every channel in 'shard' into 's', and returns how many channels there were */
+static size_t metrics_copy_shard(snapshot *s, registry_shard *shard) {
+    size_t count = 0;
+    eb_spinlock_lock(&shard->lock);
+        for (eb_chan c = shard->head; c; c = c->reg_next) {
+            size_t name_size = c->name_size;
+            metrics_chan *mc = snapshot_push(s, sizeof(*mc));
+            char *name = snapshot_push(s, name_size);
+            count++;
+            if (!mc || !name) {
+                /* Keep tallying the space that's needed */
+                continue;
+            }
+            
+            mc->chan = c;
+            mc->has_counters = eb_chan_stats(c, &mc->counters);
+            mc->parked[0] = metrics_parked_waiters(&c->sends);
+            mc->parked[1] = metrics_parked_waiters(&c->recvs);
+            mc->buf_cap = c->buf_cap;
+            eb_spinlock_lock_prof(&c->lock, &c->lock_prof);
+                mc->closed = (c->state == chanstate_closed);
+                mc->buf_len = c->buf_len;
+            eb_spinlock_unlock(&c->lock);
+            mc->name_size = name_size;
+            if (name_size) {
+                memcpy(name, c->name, name_size);
+            }
+        }
+    eb_spinlock_unlock(&shard->lock);
+    return count;
+}
+
+/* Returns the number of samples (0-2) that 'mc' has in family 'm', storing them in 'vals' */
+static size_t metrics_values(const metrics_chan *mc, metric m, uint64_t vals[2]) {
+    const eb_chan_counters *c = &mc->counters;
+    switch (m) {
+        case metric_sends:              vals[0] = c->sends; return mc->has_counters;
+        case metric_recvs:              vals[0] = c->recvs; return mc->has_counters;
+        case metric_retries:            vals[0] = c->retries; return mc->has_counters;
+        case metric_lock_failures:      vals[0] = c->lock_failures; return mc->has_counters;
+        case metric_parks:              vals[0] = c->parks; return mc->has_counters;
+        case metric_wakeups:            vals[0] = c->wakeups; return mc->has_counters;
+        case metric_wasted_wakeups:     vals[0] = c->wasted_wakeups; return mc->has_counters;
+        case metric_closes_observed:    vals[0] = c->closes_observed; return mc->has_counters;
+        case metric_buf_len_max:        vals[0] = c->buf_len_max; return (mc->has_counters && mc->buf_cap);
+        case metric_parked_waiters:     vals[0] = mc->parked[0]; vals[1] = mc->parked[1]; return 2;
+        case metric_buf_cap:            vals[0] = mc->buf_cap; return (mc->buf_cap != 0);
+        case metric_buf_len:            vals[0] = mc->buf_len; return (mc->buf_cap != 0);
+        case metric_closed:             vals[0] = mc->closed; return 1;
+        default:                        return 0;
     }
-    
-    free(l->ports);
-    l->ports = NULL;
-    
-    free(l);
-    l = NULL;
 }
 
-/* Add a port to the end of the list, expanding the buffer as necessary */
-static inline void port_list_add(port_list l, eb_port p) {
-    assert(l);
-    assert(p);
-    
-    /* First retain the port! */
-    eb_port_retain(p);
-    
-    eb_spinlock_lock(&l->lock);
-        /* Sanity-check that the list's length is less than its capacity */
-        eb_assert_or_bail(l->len <= l->cap, "Sanity check failed");
+/* Writes family 'm' for every channel in 's' to 't', if any channel has a sample in it */
+static void metrics_family(metrics_text *t, const snapshot *s, metric m) {
+    static const char *const k_ops[2] = {"send", "recv"};
+    bool wrote_header = false;
+    for (const char *p = s->buf; p < s->buf + s->len;) {
+        const metrics_chan *mc = (const metrics_chan *)p;
+        p += snapshot_align(sizeof(*mc));
+        const char *name = (mc->name_size ? p : NULL);
+        p += snapshot_align(mc->name_size);
         
-        /* Expand the list's buffer if it's full */
-        if (l->len == l->cap) {
-            l->cap *= 2;
-            // TODO: reimplement as a linked list, where the port nodes are just on the stacks of the _select_list() calls. that way the number of ports is unbounded, and we don't have to allocate anything on the heap!
-            l->ports = realloc(l->ports, l->cap * sizeof(*(l->ports)));
-            eb_assert_or_bail(l->ports, "Allocation failed");
+        uint64_t vals[2];
+        size_t nvals = metrics_values(mc, m, vals);
+        if (nvals && !wrote_header) {
+            metrics_printf(t, "# HELP %s %s\n# TYPE %s %s\n", k_metrics[m].name, k_metrics[m].help, k_metrics[m].name,
+                k_metrics[m].type);
+            wrote_header = true;
         }
         
-        l->ports[l->len] = p;
-        l->len++;
-    eb_spinlock_unlock(&l->lock);
+        for (size_t i = 0; i < nvals; i++) {
+            metrics_printf(t, "%s{chan=\"%p\"", k_metrics[m].name, (void *)mc->chan);
+            if (name) {
+                metrics_printf(t, ",name=\"");
+                metrics_write_escaped(t, name);
+                metrics_printf(t, "\"");
+            }
+            if (nvals > 1) {
+                metrics_printf(t, ",op=\"%s\"", k_ops[i]);
+            }
+            metrics_printf(t, "} %llu\n", (unsigned long long)vals[i]);
+        }
+    }
 }
 
-/* Remove the first occurence of 'p' in the list. Returns whether a port was actually removed. */
-static inline bool port_list_rm(port_list l, eb_port p) {
-    assert(l);
-    assert(p);
+static void metrics_global(metrics_text *t, const char *name, const char *type, const char *help, uint64_t val) {
+    metrics_printf(t, "# HELP %s %s\n# TYPE %s %s\n%s %llu\n", name, help, name, type, name, (unsigned long long)val);
+}
+
+/* Formats the metrics in the Prometheus text format into 't', which must be freed with metrics_text_free() either way.
+   Returns false on failure. */
+static bool metrics_format(metrics_text *t) {
+    assert(t);
     
-    bool result = false;
-    eb_spinlock_lock(&l->lock);
-        /* Sanity-check that the list's length is less than its capacity */
-        eb_assert_or_bail(l->len <= l->cap, "Sanity-check failed");
-        
-        /* Search for first occurence of the given port. If we find it, release it and move the last port in the list into the hole. */
-        for (size_t i = 0; i < l->len; i++) {
-            if (l->ports[i] == p) {
-                /* Move the last element in the port list into the now-vacant spot */
-                l->ports[i] = l->ports[l->len-1];
-                /* Decrement the buffer length */
-                l->len--;
-                result = true;
-                break;
-            }
+    metrics_text_init(t);
+    
+    /* Copy every channel's metrics with the registry locked a shard at a time, and format them after releasing the
+       locks so that formatting doesn't stall the channels' users. Copy again if the snapshot had to grow. */
+    snapshot s;
+    snapshot_init(&s);
+    size_t nchans = 0;
+    do {
+        if (!snapshot_reset(&s)) {
+            snapshot_free(&s);
+            return false;
         }
-    eb_spinlock_unlock(&l->lock);
+        nchans = 0;
+        for (size_t i = 0; i < EB_CHAN_REGISTRY_SHARDS; i++) {
+            nchans += metrics_copy_shard(&s, &g_registry[i]);
+        }
+    } while (!snapshot_fits(&s));
     
-    if (result) {
-        /* Release the port, but do so outside of the spinlock because releasing does some stuff that might not be quick. */
-        eb_port_release(p);
+    for (metric m = 0; m < metric_count; m++) {
+        metrics_family(t, &s, m);
     }
+    snapshot_free(&s);
     
-    return result;
+    eb_chan_alloc_counts alloc;
+    eb_chan_alloc_stats(&alloc);
+    eb_port_pool_usage pool;
+    eb_port_pool_stats(&pool);
+    metrics_global(t, "eb_chan_channels", "gauge", "Live channels", nchans);
+    metrics_global(t, "eb_chan_ports", "gauge", "Ports (per-thread wait objects) that exist, including pooled ones", pool.ports);
+    metrics_global(t, "eb_chan_port_pool_length", "gauge", "Ports in the port pool", pool.len);
+    metrics_global(t, "eb_chan_port_pool_capacity", "gauge", "The port pool's capacity", pool.cap);
+    metrics_global(t, "eb_chan_port_pool_hits_total", "counter", "Port creations satisfied by the port pool", pool.hits);
+    metrics_global(t, "eb_chan_port_pool_misses_total", "counter", "Port creations that had to create a port", pool.misses);
+    metrics_global(t, "eb_chan_allocs_total", "counter", "Allocations", alloc.allocs);
+    metrics_global(t, "eb_chan_alloc_bytes_in_use", "gauge", "Bytes currently allocated", alloc.bytes_in_use);
+    return !t->failed;
 }
 
-/* Signal the first port in the list that isn't 'ignore' */
-static inline void port_list_signal_first(const port_list l, eb_port ignore) {
-    assert(l);
-    
-    eb_port p = NULL;
-    eb_spinlock_lock(&l->lock);
-        for (size_t i = 0; i < l->len; i++) {
-            if (l->ports[i] != ignore) {
-                p = eb_port_retain(l->ports[i]);
-                break;
-            }
+/* Writes 'len' bytes to 'fd', retrying partial writes. Sockets are written without raising SIGPIPE. */
+static bool metrics_write_all(int fd, const char *buf, size_t len, bool sock) {
+    while (len) {
+        ssize_t r;
+        #if EB_SYS_LINUX
+            r = (sock ? send(fd, buf, len, MSG_NOSIGNAL) : write(fd, buf, len));
+        #else
+            /* Darwin sockets have SO_NOSIGPIPE set instead */
+            r = write(fd, buf, len);
+        #endif
+        if (r < 0 && errno == EINTR) {
+            continue;
         }
-    eb_spinlock_unlock(&l->lock);
-    
-    if (p) {
-        eb_port_signal(p);
-        eb_port_release(p);
-        p = NULL;
+        if (r <= 0) {
+            return false;
+        }
+        buf += r;
+        len -= r;
     }
+    return true;
 }
 
-enum {
-    /* Buffered/unbuffered channel states */
-    chanstate_open,
-    chanstate_closed,
-    /* Unbuffered channel states */
-    chanstate_send,
-    chanstate_recv,
-    chanstate_ack,
-    chanstate_done,
-    chanstate_cancelled
-}; typedef int32_t chanstate;
-
-typedef struct {
-    eb_chan_op *const *ops;
-    size_t nops;
-    bool *cleanup_ops;
-    
-    eb_nsec timeout;
-    eb_port port;
-} do_state;
+bool eb_chan_metrics_write(int fd) {
+    metrics_text t;
+    bool r = (metrics_format(&t) && metrics_write_all(fd, t.buf, t.len, false));
+    metrics_text_free(&t);
+    return r;
+}
 
-struct eb_chan {
-    unsigned int retain_count;
-    eb_spinlock lock;
-    chanstate state;
-    
-    port_list sends;
-    port_list recvs;
+bool eb_chan_metrics_write_file(const char *path) {
+    assert(path);
     
-    /* Buffered ivars */
-    size_t buf_cap;
-    size_t buf_len;
-    size_t buf_idx;
-    const void **buf;
+    /* Write to a temporary file that's renamed over 'path', so that readers never see a partial file. It's uniquely
+       named so that concurrent writers (e.g. two processes sharing 'path') don't write into each other's. */
+    char tmp[PATH_MAX];
+    int r = snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+    eb_assert_or_recover(r > 0 && (size_t)r < sizeof(tmp), return false);
     
-    /* Unbuffered ivars */
-    const do_state *unbuf_state;
-    eb_chan_op *unbuf_op;
-    eb_port unbuf_port;
-};
-
-#pragma mark - Channel creation/lifecycle -
-static inline void eb_chan_free(eb_chan c) {
-    /* Intentionally allowing c==NULL so that this function can be called from eb_chan_create() */
-    if (!c) {
-        return;
+    int fd = mkstemp(tmp);
+    eb_assert_or_recover(fd >= 0, return false);
+    /* mkstemp() creates the file readable only by its owner, but the metrics are meant to be collected */
+    bool ok = !fchmod(fd, 0644);
+    ok = eb_chan_metrics_write(fd) && ok;
+    ok = !close(fd) && ok;
+    if (ok) {
+        ok = !rename(tmp, path);
+    }
+    if (!ok) {
+        unlink(tmp);
     }
+    return ok;
+}
+
+/* The metrics server's socket, and the thread that serves it */
+static int g_metrics_fd = -1;
+static char g_metrics_path[sizeof(((struct sockaddr_un *)NULL)->sun_path)];
+static pthread_t g_metrics_thread;
+static int g_metrics_stop = 0;
+/* The metrics server's state; its socket and thread exist while it's service_running or service_stopping */
+static service_state g_metrics_state = service_idle;
+
+/* Serves the metrics to a client. Clients that send an HTTP request (e.g. `curl --unix-socket`) get an HTTP response;
+   clients that send nothing get the bare metrics. */
+static void metrics_respond(int fd) {
+    enum { k_timeout_msec = 1000 };
+    #if EB_SYS_DARWIN
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+    #endif
     
-    if (c->buf_cap) {
-        /* ## Buffered */
-        free(c->buf);
-        c->buf = NULL;
+    /* Read the request's header, if there is one */
+    char req[1024];
+    size_t req_len = 0;
+    while (req_len < sizeof(req) - 1) {
+        struct pollfd p = {.fd = fd, .events = POLLIN};
+        if (poll(&p, 1, k_timeout_msec) <= 0) {
+            break;
+        }
+        ssize_t r = read(fd, req + req_len, sizeof(req) - 1 - req_len);
+        if (r <= 0) {
+            break;
+        }
+        req_len += r;
+        req[req_len] = 0;
+        if (strstr(req, "\r\n\r\n")) {
+            break;
+        }
     }
+    req[req_len] = 0;
     
-    port_list_free(c->recvs);
-    c->recvs = NULL;
+    metrics_text t;
+    bool ok = metrics_format(&t);
+    if (!req_len) {
+        if (ok) {
+            metrics_write_all(fd, t.buf, t.len, true);
+        }
+    } else if (ok) {
+        char header[128];
+        int r = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: %zu\r\n\r\n", t.len);
+        if (metrics_write_all(fd, header, r, true)) {
+            metrics_write_all(fd, t.buf, t.len, true);
+        }
+    } else {
+        static const char k_error[] = "HTTP/1.0 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n";
+        metrics_write_all(fd, k_error, sizeof(k_error) - 1, true);
+    }
+    metrics_text_free(&t);
+}
+
+static void *metrics_thread(void *arg) {
+    enum { k_poll_msec = 100 };
     
-    port_list_free(c->sends);
-    c->sends = NULL;
+    while (!*((volatile int *)&g_metrics_stop)) {
+        /* Poll so that we notice eb_chan_metrics_stop() */
+        struct pollfd p = {.fd = g_metrics_fd, .events = POLLIN};
+        if (poll(&p, 1, k_poll_msec) <= 0) {
+            continue;
+        }
+        
+        int fd = accept(g_metrics_fd, NULL, NULL);
+        if (fd >= 0) {
+            metrics_respond(fd);
+            close(fd);
+        }
+    }
     
-    free(c);
-    c = NULL;
+    return NULL;
 }
 
-eb_chan eb_chan_create(size_t buf_cap) {
-    static const size_t k_init_buf_cap = 16;
-    
-    /* Initialize eb_sys so that eb_sys_ncores is valid. */
-    eb_sys_init();
+bool eb_chan_metrics_serve(const char *path) {
+    assert(path);
     
-    /* Using calloc so that the bytes are zeroed. */
-    eb_chan c = calloc(1, sizeof(*c));
-    eb_assert_or_recover(c, goto failed);
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    eb_assert_or_recover(strlen(path) < sizeof(addr.sun_path), return false);
     
-    c->retain_count = 1;
-    c->lock = EB_SPINLOCK_INIT;
-    c->state = chanstate_open;
+    /* Only one server runs at a time */
+    if (!eb_atomic_compare_and_swap(&g_metrics_state, service_idle, service_starting)) {
+        return false;
+    }
     
-    c->sends = port_list_alloc(k_init_buf_cap);
-    eb_assert_or_recover(c->sends, goto failed);
-    c->recvs = port_list_alloc(k_init_buf_cap);
-    eb_assert_or_recover(c->recvs, goto failed);
+    strcpy(addr.sun_path, path);
+    strcpy(g_metrics_path, path);
     
-    if (buf_cap) {
-        /* ## Buffered */
-        c->buf_cap = buf_cap;
-        c->buf_len = 0;
-        c->buf_idx = 0;
-        c->buf = malloc(c->buf_cap * sizeof(*(c->buf)));
-        eb_assert_or_recover(c->buf, goto failed);
-    } else {
-        /* ## Unbuffered */
-        c->unbuf_state = NULL;
-        c->unbuf_op = NULL;
-        c->unbuf_port = NULL;
+    /* Remove a stale socket (but nothing else) left by a previous process */
+    struct stat st;
+    if (!lstat(path, &st) && S_ISSOCK(st.st_mode)) {
+        unlink(path);
     }
     
-    /* Issue a memory barrier since we didn't have the lock acquired for our set up (and this channel could theoretically
-       be passed to another thread without a barrier, and that'd be bad news...) */
-    eb_atomic_barrier();
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    eb_assert_or_recover(fd >= 0, goto failed);
+    int r = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    eb_assert_or_recover(!r, goto failed);
+    r = listen(fd, 16);
+    eb_assert_or_recover(!r, goto failed);
     
-    return c;
+    g_metrics_fd = fd;
+    g_metrics_stop = 0;
+    eb_atomic_barrier();
+    r = pthread_create(&g_metrics_thread, NULL, metrics_thread, NULL);
+    eb_assert_or_recover(!r, unlink(path); goto failed);
+    eb_atomic_barrier();
+    *((volatile service_state *)&g_metrics_state) = service_running;
+    return true;
     failed: {
-        eb_chan_free(c);
-        return NULL;
+        if (fd >= 0) {
+            close(fd);
+        }
+        g_metrics_fd = -1;
+        eb_atomic_barrier();
+        *((volatile service_state *)&g_metrics_state) = service_idle;
+        return false;
     }
 }
 
-eb_chan eb_chan_retain(eb_chan c) {
-    assert(c);
-    eb_atomic_add(&c->retain_count, 1);
-    return c;
+void eb_chan_metrics_stop() {
+    /* Claim the server, so that only one of several concurrent callers joins its thread and closes its socket */
+    if (!service_claim_stop(&g_metrics_state)) {
+        return;
+    }
+    
+    g_metrics_stop = 1;
+    eb_atomic_barrier();
+    int r = pthread_join(g_metrics_thread, NULL);
+    eb_assert_or_recover(!r, eb_no_op);
+    close(g_metrics_fd);
+    unlink(g_metrics_path);
+    g_metrics_fd = -1;
+    eb_atomic_barrier();
+    *((volatile service_state *)&g_metrics_state) = service_idle;
 }
 
-void eb_chan_release(eb_chan c) {
-    assert(c);
-    if (eb_atomic_add(&c->retain_count, -1) == 0) {
-        eb_chan_free(c);
+#pragma mark - Traffic capture -
+#if EB_CHAN_CAPTURE
+    /* Returns c's capture-local id in 'session', defining the channel in the capture the first time it's seen */
+    static uint32_t capture_chan_id(eb_chan c, uint32_t session) {
+        uint64_t tag = eb_atomic_load_relaxed(&c->capture_tag);
+        if ((uint32_t)(tag >> 32) == session) {
+            return (uint32_t)tag;
+        }
+        
+        uint64_t new_tag = ((uint64_t)session << 32) | eb_capture_chan_next();
+        if (!eb_atomic_compare_and_swap(&c->capture_tag, tag, new_tag)) {
+            /* Another thread saw the channel first, and defines it */
+            return (uint32_t)eb_atomic_load_relaxed(&c->capture_tag);
+        }
+        
+        /* Copy the name with c's registry shard locked, since eb_chan_set_name() swaps it with the shard locked */
+        char name[EB_CAPTURE_NAME_MAX + 1] = "";
+        eb_spinlock *lock = &g_registry[c->reg_shard].lock;
+        eb_spinlock_lock(lock);
+            if (c->name) {
+                strncpy(name, c->name, EB_CAPTURE_NAME_MAX);
+            }
+        eb_spinlock_unlock(lock);
+        eb_capture_define(session, (uint32_t)new_tag, c->buf_cap, name);
+        return (uint32_t)new_tag;
     }
-}
+    
+    /* Records an op of 'type' on 'c' that was issued at tick 'start' and completed at tick 'end' */
+    static void capture(eb_chan c, uint32_t session, eb_chan_capture_type type, eb_chan_capture_flags flags,
+        uint64_t start, uint64_t end) {
+        /* The depth is read without the lock, so it's approximate when other threads are operating on the channel */
+        size_t depth = (c->buf_cap ? *((volatile size_t *)&c->buf_len) : 0);
+        eb_capture_record(session, (uint8_t)type, flags, capture_chan_id(c, session), depth, start, end);
+    }
+#endif
 
 #pragma mark - Channel closing -
 eb_chan_res eb_chan_close(eb_chan c) {
     assert(c);
     
+    unsigned int shard = eb_thread_stats_shard(EB_CHAN_STATS_SHARDS);
     eb_chan_res result = eb_chan_res_stalled;
     while (result == eb_chan_res_stalled) {
-        eb_port signal_port = NULL;
-        eb_spinlock_lock(&c->lock);
+        eb_port unbuf_port = NULL;
+        eb_spinlock_lock_prof(&c->lock, &c->lock_prof);
             if (c->state == chanstate_open) {
                 c->state = chanstate_closed;
                 result = eb_chan_res_ok;
@@ -272,7 +1953,7 @@ eb_chan_res eb_chan_close(eb_chan c) {
                 result = eb_chan_res_closed;
             } else if (c->state == chanstate_send || c->state == chanstate_recv) {
                 if (c->unbuf_port) {
-                    signal_port = eb_port_retain(c->unbuf_port);
+                    unbuf_port = eb_port_retain(c->unbuf_port);
                 }
                 c->state = chanstate_closed;
                 result = eb_chan_res_ok;
@@ -280,17 +1961,26 @@ eb_chan_res eb_chan_close(eb_chan c) {
         eb_spinlock_unlock(&c->lock);
         
         /* Wake up the send/recv */
-        if (signal_port) {
-            eb_port_signal(signal_port);
-            eb_port_release(signal_port);
-            signal_port = NULL;
+        if (unbuf_port) {
+            signal_port(c, shard, unbuf_port);
+            eb_port_release(unbuf_port);
+            unbuf_port = NULL;
         }
     }
     
     if (result == eb_chan_res_ok) {
+        trace(eb_trace_close, c, NULL, 0);
+        #if EB_CHAN_CAPTURE
+            uint32_t capture_session = *((volatile uint32_t *)&eb_capture_session);
+            if (capture_session) {
+                uint64_t now = eb_time_ticks();
+                capture(c, capture_session, eb_chan_capture_close, 0, now, now);
+            }
+        #endif
+        eb_probe1(close, c);
         /* Wake up the sends/recvs so that they see the channel's now closed */
-        port_list_signal_first(c->sends, NULL);
-        port_list_signal_first(c->recvs, NULL);
+        signal_first(c, shard, &c->sends, NULL);
+        signal_first(c, shard, &c->recvs, NULL);
     }
     
     return result;
@@ -311,7 +2001,7 @@ size_t eb_chan_buf_len(eb_chan c) {
     }
     
     size_t r = 0;
-    eb_spinlock_lock(&c->lock);
+    eb_spinlock_lock_prof(&c->lock, &c->lock_prof);
         r = c->buf_len;
     eb_spinlock_unlock(&c->lock);
     return r;
@@ -333,29 +2023,32 @@ static inline void cleanup_ops(const do_state *state) {
             eb_chan c = op->chan;
             bool signal_send = false;
             bool signal_recv = false;
-            eb_spinlock_lock(&c->lock);
+            eb_spinlock_lock_prof(&c->lock, &c->lock_prof);
                 if (c->state == chanstate_send && c->unbuf_op == op) {
                     /* 'op' was in the process of an unbuffered send on the channel, but no recv had arrived
                        yet, so reset state to _open. */
                     c->state = chanstate_open;
+                    trace_state(c);
                     signal_send = true;
                 } else if (c->state == chanstate_recv && c->unbuf_op == op) {
                     /* 'op' was in the process of an unbuffered recv on the channel, but no send had arrived
                        yet, so reset state to _open. */
                     c->state = chanstate_open;
+                    trace_state(c);
                     signal_recv = true;
                 } else if (c->state == chanstate_ack && c->unbuf_op == op) {
                     /* A counterpart acknowledged 'op' but, but 'op' isn't the one that completed in our select() call, so we're cancelling. */
                     c->state = chanstate_cancelled;
+                    trace_state(c);
                 }
             eb_spinlock_unlock(&c->lock);
             
             if (signal_send) {
-                port_list_signal_first(c->sends, state->port);
+                signal_first(c, state->shard, &c->sends, state->port);
             }
             
             if (signal_recv) {
-                port_list_signal_first(c->recvs, state->port);
+                signal_first(c, state->shard, &c->recvs, state->port);
             }
             
             state->cleanup_ops[i] = false;
@@ -373,9 +2066,9 @@ static inline op_result send_buf(const do_state *state, eb_chan_op *op, size_t o
     
     if (c->buf_len < c->buf_cap || c->state == chanstate_closed) {
         /* It looks like our channel's in an acceptable state, so try to acquire the lock */
-        if (eb_spinlock_try(&c->lock)) {
+        if (eb_spinlock_try_prof(&c->lock, &c->lock_prof)) {
             /* Sanity-check the channel's state */
-            eb_assert_or_bail(c->state == chanstate_open || c->state == chanstate_closed, "Invalid channel state");
+            eb_sanity_or_bail(c->state == chanstate_open || c->state == chanstate_closed, "Invalid channel state");
             
             bool signal_recv = false;
             if (c->state == chanstate_closed) {
@@ -391,6 +2084,25 @@ static inline op_result send_buf(const do_state *state, eb_chan_op *op, size_t o
                 size_t idx = (c->buf_idx + c->buf_len) % c->buf_cap;
                 c->buf[idx] = op->val;
                 c->buf_len++;
+                #if EB_CHAN_STATS
+                    /* Track the high-water mark and the occupancy that the send left the buffer with */
+                    if (c->stats) {
+                        if (c->buf_len > c->stats->buf_len_max) {
+                            c->stats->buf_len_max = c->buf_len;
+                        }
+                        c->stats->occupancy[((c->buf_len - 1) * EB_CHAN_STATS_OCCUPANCY_BUCKETS) / c->buf_cap]++;
+                    }
+                #endif
+                #if EB_CHAN_LATENCY
+                    if (c->lat) {
+                        c->lat->ts[idx] = eb_time_ticks();
+                    }
+                #endif
+                /* Track how long the buffer stays full, for the watchdog */
+                if (c->buf_len == c->buf_cap && *((volatile service_state *)&g_watchdog_state) == service_running) {
+                    c->buf_full_since = eb_time_now();
+                    c->buf_full_reported = false;
+                }
                 /* Set our op's state and our return value */
                 op->res = eb_chan_res_ok;
                 result = op_result_complete;
@@ -399,9 +2111,12 @@ static inline op_result send_buf(const do_state *state, eb_chan_op *op, size_t o
             eb_spinlock_unlock(&c->lock);
             
             if (signal_recv) {
-                port_list_signal_first(c->recvs, state->port);
+                signal_first(c, state->shard, &c->recvs, state->port);
             }
         } else {
+            stats_add(c, state->shard, lock_failures, 1);
+            trace(eb_trace_lock_retry, c, NULL, 0);
+            eb_probe1(lock_contended, c);
             result = op_result_retry;
         }
     }
@@ -418,9 +2133,9 @@ static inline op_result recv_buf(const do_state *state, eb_chan_op *op, size_t o
     op_result result = op_result_next;
     
     if (c->buf_len || c->state == chanstate_closed) {
-        if (eb_spinlock_try(&c->lock)) {
+        if (eb_spinlock_try_prof(&c->lock, &c->lock_prof)) {
             /* Sanity-check the channel's state */
-            eb_assert_or_bail(c->state == chanstate_open || c->state == chanstate_closed, "Invalid channel state");
+            eb_sanity_or_bail(c->state == chanstate_open || c->state == chanstate_closed, "Invalid channel state");
             
             bool signal_send = false;
             if (c->buf_len) {
@@ -431,9 +2146,15 @@ static inline op_result recv_buf(const do_state *state, eb_chan_op *op, size_t o
                 op->res = eb_chan_res_ok;
                 op->val = c->buf[c->buf_idx];
                 result = op_result_complete;
+                #if EB_CHAN_LATENCY
+                    if (c->lat) {
+                        latency_record(c, c->lat->ts[c->buf_idx]);
+                    }
+                #endif
                 /* Update chan's buffer. (Updating buf_idx needs to come after we use it!) */
                 c->buf_len--;
                 c->buf_idx = (c->buf_idx + 1) % c->buf_cap;
+                c->buf_full_since = 0;
             } else if (c->state == chanstate_closed) {
                 /* ## Receiving, buffered, buffer empty, channel closed */
                 /* Set our op's state and our return value */
@@ -445,9 +2166,12 @@ static inline op_result recv_buf(const do_state *state, eb_chan_op *op, size_t o
             eb_spinlock_unlock(&c->lock);
             
             if (signal_send) {
-                port_list_signal_first(c->sends, state->port);
+                signal_first(c, state->shard, &c->sends, state->port);
             }
         } else {
+            stats_add(c, state->shard, lock_failures, 1);
+            trace(eb_trace_lock_retry, c, NULL, 0);
+            eb_probe1(lock_contended, c);
             result = op_result_retry;
         }
     }
@@ -470,16 +2194,23 @@ static inline op_result send_unbuf(const do_state *state, eb_chan_op *op, size_t
         (c->state == chanstate_ack && c->unbuf_op == op)) {
         
         /* It looks like our channel's in an acceptable state, so try to acquire the lock */
-        if (eb_spinlock_try(&c->lock)) {
+        if (eb_spinlock_try_prof(&c->lock, &c->lock_prof)) {
             /* Reset the cleanup state since we acquired the lock and are actually getting a look at the channel's state */
             state->cleanup_ops[op_idx] = false;
             
             bool signal_recv = false;
             if (c->state == chanstate_open && state->timeout != eb_nsec_zero) {
                 c->state = chanstate_send;
+                trace_state(c);
                 c->unbuf_state = state;
                 c->unbuf_op = op;
                 c->unbuf_port = state->port;
+                #if EB_CHAN_LATENCY
+                    /* The value is offered from now on */
+                    if (c->lat) {
+                        c->lat_unbuf_ts = eb_time_ticks();
+                    }
+                #endif
                 /* We need to cleanup after this since we put it in the _send state! */
                 state->cleanup_ops[op_idx] = true;
                 /* Signal a recv since one of them can continue now */
@@ -492,7 +2223,7 @@ static inline op_result send_unbuf(const do_state *state, eb_chan_op *op, size_t
                 /* We own the send op that's in progress, so assign chan's unbuf_port */
                 /* Verify that the unbuf_state matches our 'id' parameter. If this assertion fails, it means there's likely
                    one eb_chan_op being shared by multiple threads, which isn't allowed. */
-                eb_assert_or_bail(c->unbuf_state == state, "unbuf_state invalid");
+                eb_sanity_or_bail(c->unbuf_state == state, "unbuf_state invalid");
                 /* Assign the port */
                 c->unbuf_port = state->port;
                 /* We need to cleanup after this since we put it in the _send state! */
@@ -502,21 +2233,29 @@ static inline op_result send_unbuf(const do_state *state, eb_chan_op *op, size_t
                    sends/recvs from the same _do() call) */
                 
                 /* Sanity check -- make sure the op is a recv */
-                eb_assert_or_bail(!c->unbuf_op->send, "Op isn't a recv as expected");
+                eb_sanity_or_bail(!c->unbuf_op->send, "Op isn't a recv as expected");
                 
                 /* Set the recv op's value. This needs to happen before we transition out of the _recv state, otherwise the unbuf_op may no longer be valid! */
                 c->unbuf_op->val = op->val;
+                #if EB_CHAN_LATENCY
+                    /* The receiver was waiting, so the value is offered at the rendezvous; the receiver records the
+                       latency when it observes the _ack */
+                    if (c->lat) {
+                        c->lat_unbuf_ts = eb_time_ticks();
+                    }
+                #endif
                 /* Acknowledge the receive */
                 c->state = chanstate_ack;
+                trace_state(c);
                 /* Get a reference to the unbuf_port that needs to be signaled */
-                eb_port signal_port = (c->unbuf_port ? eb_port_retain(c->unbuf_port) : NULL);
+                eb_port unbuf_port = (c->unbuf_port ? eb_port_retain(c->unbuf_port) : NULL);
                 eb_spinlock_unlock(&c->lock);
                 
                 /* Wake up the recv */
-                if (signal_port) {
-                    eb_port_signal(signal_port);
-                    eb_port_release(signal_port);
-                    signal_port = NULL;
+                if (unbuf_port) {
+                    signal_port(c, state->shard, unbuf_port);
+                    eb_port_release(unbuf_port);
+                    unbuf_port = NULL;
                 }
                 
                 /* We have to cleanup all our ops here to cancel any outstanding unbuffered send/recvs, to avoid a deadlock
@@ -526,10 +2265,11 @@ static inline op_result send_unbuf(const do_state *state, eb_chan_op *op, size_t
                 
                 for (;;) {
                     if (*((volatile chanstate *)&c->state) != chanstate_ack) {
-                        eb_spinlock_lock(&c->lock);
+                        eb_spinlock_lock_prof(&c->lock, &c->lock_prof);
                             if (c->state == chanstate_done) {
                                 /* Reset the channel state back to _open */
                                 c->state = chanstate_open;
+                                trace_state(c);
                                 /* We reset our state to _open, so signal a send since it can proceed now. */
                                 signal_recv = true;
                                 /* Set our op's state and our return value */
@@ -541,6 +2281,7 @@ static inline op_result send_unbuf(const do_state *state, eb_chan_op *op, size_t
                             } else if (c->state == chanstate_cancelled) {
                                 /* Reset the channel state back to _open */
                                 c->state = chanstate_open;
+                                trace_state(c);
                                 /* As long as we're not polling, we should try the op again */
                                 if (state->timeout != eb_nsec_zero) {
                                     result = op_result_retry;
@@ -553,19 +2294,20 @@ static inline op_result send_unbuf(const do_state *state, eb_chan_op *op, size_t
                                 break;
                             }
                         eb_spinlock_unlock(&c->lock);
-                    } else if (eb_sys_ncores == 1) {
-                        /* On uniprocessor machines, yield to the scheduler because we can't continue until another
-                           thread updates the channel's state. */
-                        sched_yield();
+                    } else if (eb_config_yields()) {
+                        /* On uniprocessor machines (or as configured), yield to the scheduler because we can't
+                           continue until another thread updates the channel's state. */
+                        eb_sys_yield();
                     }
                 }
             } else if (c->state == chanstate_ack && c->unbuf_op == op) {
                 /* A recv acknowledged our send! */
                 /* Verify that the unbuf_state matches our 'id' parameter. If this assertion fails, it means there's likely
                    one eb_chan_op being shared by multiple threads, which isn't allowed. */
-                eb_assert_or_bail(c->unbuf_state == state, "unbuf_state invalid");
+                eb_sanity_or_bail(c->unbuf_state == state, "unbuf_state invalid");
                 /* A recv is polling for chan's state to change, so update it to signal that we're done sending! */
                 c->state = chanstate_done;
+                trace_state(c);
                 /* Set our op's state and our return value */
                 op->res = eb_chan_res_ok;
                 result = op_result_complete;
@@ -574,9 +2316,12 @@ static inline op_result send_unbuf(const do_state *state, eb_chan_op *op, size_t
             eb_spinlock_unlock(&c->lock);
             
             if (signal_recv) {
-                port_list_signal_first(c->recvs, state->port);
+                signal_first(c, state->shard, &c->recvs, state->port);
             }
         } else {
+            stats_add(c, state->shard, lock_failures, 1);
+            trace(eb_trace_lock_retry, c, NULL, 0);
+            eb_probe1(lock_contended, c);
             result = op_result_retry;
         }
     }
@@ -599,13 +2344,14 @@ static inline op_result recv_unbuf(const do_state *state, eb_chan_op *op, size_t
         (c->state == chanstate_ack && c->unbuf_op == op)) {
         
         /* It looks like our channel's in an acceptable state, so try to acquire the lock */
-        if (eb_spinlock_try(&c->lock)) {
+        if (eb_spinlock_try_prof(&c->lock, &c->lock_prof)) {
             /* Reset the cleanup state since we acquired the lock and are actually getting a look at the channel's state */
             state->cleanup_ops[op_idx] = false;
             
             bool signal_send = false;
             if (c->state == chanstate_open && state->timeout != eb_nsec_zero) {
                 c->state = chanstate_recv;
+                trace_state(c);
                 c->unbuf_state = state;
                 c->unbuf_op = op;
                 c->unbuf_port = state->port;
@@ -623,21 +2369,27 @@ static inline op_result recv_unbuf(const do_state *state, eb_chan_op *op, size_t
                    sends/recvs from the same _do() call) */
                 
                 /* Sanity check -- make sure the op is a send */
-                eb_assert_or_bail(c->unbuf_op->send, "Op isn't a send as expected");
+                eb_sanity_or_bail(c->unbuf_op->send, "Op isn't a send as expected");
                 
                 /* Get the op's value. This needs to happen before we transition out of the _send state, otherwise the unbuf_op may no longer be valid! */
                 op->val = c->unbuf_op->val;
+                #if EB_CHAN_LATENCY
+                    if (c->lat) {
+                        latency_record(c, c->lat_unbuf_ts);
+                    }
+                #endif
                 /* Acknowledge the send */
                 c->state = chanstate_ack;
+                trace_state(c);
                 /* Get a reference to the unbuf_port that needs to be signaled */
-                eb_port signal_port = (c->unbuf_port ? eb_port_retain(c->unbuf_port) : NULL);
+                eb_port unbuf_port = (c->unbuf_port ? eb_port_retain(c->unbuf_port) : NULL);
                 eb_spinlock_unlock(&c->lock);
                 
                 /* Wake up the send */
-                if (signal_port) {
-                    eb_port_signal(signal_port);
-                    eb_port_release(signal_port);
-                    signal_port = NULL;
+                if (unbuf_port) {
+                    signal_port(c, state->shard, unbuf_port);
+                    eb_port_release(unbuf_port);
+                    unbuf_port = NULL;
                 }
                 
                 /* We have to cleanup all our ops here to cancel any outstanding unbuffered send/recvs, to avoid a deadlock
@@ -647,10 +2399,11 @@ static inline op_result recv_unbuf(const do_state *state, eb_chan_op *op, size_t
                 
                 for (;;) {
                     if (*((volatile chanstate *)&c->state) != chanstate_ack) {
-                        eb_spinlock_lock(&c->lock);
+                        eb_spinlock_lock_prof(&c->lock, &c->lock_prof);
                             if (c->state == chanstate_done) {
                                 /* Reset the channel state back to _open */
                                 c->state = chanstate_open;
+                                trace_state(c);
                                 /* We reset our state to _open, so signal a recv since it can proceed now. */
                                 signal_send = true;
                                 /* Set our op's state and our return value */
@@ -662,6 +2415,7 @@ static inline op_result recv_unbuf(const do_state *state, eb_chan_op *op, size_t
                             } else if (c->state == chanstate_cancelled) {
                                 /* Reset the channel state back to _open */
                                 c->state = chanstate_open;
+                                trace_state(c);
                                 /* As long as we're not polling, we should try the op again */
                                 if (state->timeout != eb_nsec_zero) {
                                     result = op_result_retry;
@@ -674,17 +2428,17 @@ static inline op_result recv_unbuf(const do_state *state, eb_chan_op *op, size_t
                                 break;
                             }
                         eb_spinlock_unlock(&c->lock);
-                    } else if (eb_sys_ncores == 1) {
-                        /* On uniprocessor machines, yield to the scheduler because we can't continue until another
-                           thread updates the channel's state. */
-                        sched_yield();
+                    } else if (eb_config_yields()) {
+                        /* On uniprocessor machines (or as configured), yield to the scheduler because we can't
+                           continue until another thread updates the channel's state. */
+                        eb_sys_yield();
                     }
                 }
             } else if (c->state == chanstate_recv && c->unbuf_op == op) {
                 /* We own the recv op that's in progress, so assign chan's unbuf_port */
                 /* Verify that the _recv_id matches our 'id' parameter. If this assertion fails, it means there's likely
                    one eb_chan_op being shared by multiple threads, which isn't allowed. */
-                eb_assert_or_bail(c->unbuf_state == state, "unbuf_state invalid");
+                eb_sanity_or_bail(c->unbuf_state == state, "unbuf_state invalid");
                 /* Assign the port */
                 c->unbuf_port = state->port;
                 /* We need to cleanup after this since we put it in the _send state! */
@@ -693,9 +2447,15 @@ static inline op_result recv_unbuf(const do_state *state, eb_chan_op *op, size_t
                 /* A send acknowledged our recv! */
                 /* Verify that the unbuf_state matches our 'id' parameter. If this assertion fails, it means there's likely
                    one eb_chan_op being shared by multiple threads, which isn't allowed. */
-                eb_assert_or_bail(c->unbuf_state == state, "unbuf_state invalid");
+                eb_sanity_or_bail(c->unbuf_state == state, "unbuf_state invalid");
+                #if EB_CHAN_LATENCY
+                    if (c->lat) {
+                        latency_record(c, c->lat_unbuf_ts);
+                    }
+                #endif
                 /* A send is polling for chan's state to change, so update it to signal that we're done sending! */
                 c->state = chanstate_done;
+                trace_state(c);
                 /* Set our op's state and our return value */
                 op->res = eb_chan_res_ok;
                 result = op_result_complete;
@@ -704,9 +2464,12 @@ static inline op_result recv_unbuf(const do_state *state, eb_chan_op *op, size_t
             eb_spinlock_unlock(&c->lock);
             
             if (signal_send) {
-                port_list_signal_first(c->sends, state->port);
+                signal_first(c, state->shard, &c->sends, state->port);
             }
         } else {
+            stats_add(c, state->shard, lock_failures, 1);
+            trace(eb_trace_lock_retry, c, NULL, 0);
+            eb_probe1(lock_contended, c);
             result = op_result_retry;
         }
     }
@@ -720,33 +2483,37 @@ static inline op_result try_op(const do_state *state, eb_chan_op *op, size_t op_
     
     eb_chan c = op->chan;
     if (c) {
-        if (op->send) {
-            /* ## Send */
-            return (c->buf_cap ? send_buf(state, op, op_idx) : send_unbuf(state, op, op_idx));
-        } else {
-            /* ## Receive */
-            return (c->buf_cap ? recv_buf(state, op, op_idx) : recv_unbuf(state, op, op_idx));
-        }
+        #if EB_CHAN_BUFFERED_ONLY
+            return (op->send ? send_buf(state, op, op_idx) : recv_buf(state, op, op_idx));
+        #else
+            if (op->send) {
+                /* ## Send */
+                return (c->buf_cap ? send_buf(state, op, op_idx) : send_unbuf(state, op, op_idx));
+            } else {
+                /* ## Receive */
+                return (c->buf_cap ? recv_buf(state, op, op_idx) : recv_unbuf(state, op, op_idx));
+            }
+        #endif
     }
     return op_result_next;
 }
 
 eb_chan_res eb_chan_send(eb_chan c, const void *val) {
     eb_chan_op op = eb_chan_op_send(c, val);
-    eb_assert_or_bail(eb_chan_select(eb_nsec_forever, &op) == &op, "Invalid select() return value");
+    eb_sanity_or_bail(eb_chan_select(eb_nsec_forever, &op) == &op, "Invalid select() return value");
     return op.res;
 }
 
 eb_chan_res eb_chan_try_send(eb_chan c, const void *val) {
     eb_chan_op op = eb_chan_op_send(c, val);
     eb_chan_op *r = eb_chan_select(eb_nsec_zero, &op);
-    eb_assert_or_bail(r == NULL || r == &op, "Invalid select() return value");
+    eb_sanity_or_bail(r == NULL || r == &op, "Invalid select() return value");
     return (r ? op.res : eb_chan_res_stalled);
 }
 
 eb_chan_res eb_chan_recv(eb_chan c, const void **val) {
     eb_chan_op op = eb_chan_op_recv(c);
-    eb_assert_or_bail(eb_chan_select(eb_nsec_forever, &op) == &op, "Invalid select() return value");
+    eb_sanity_or_bail(eb_chan_select(eb_nsec_forever, &op) == &op, "Invalid select() return value");
     if (op.res == eb_chan_res_ok && val) {
         *val = op.val;
     }
@@ -756,19 +2523,129 @@ eb_chan_res eb_chan_recv(eb_chan c, const void **val) {
 eb_chan_res eb_chan_try_recv(eb_chan c, const void **val) {
     eb_chan_op op = eb_chan_op_recv(c);
     eb_chan_op *r = eb_chan_select(eb_nsec_zero, &op);
-    eb_assert_or_bail(r == NULL || r == &op, "Invalid select() return value");
+    eb_sanity_or_bail(r == NULL || r == &op, "Invalid select() return value");
     if (r && op.res == eb_chan_res_ok && val) {
         *val = op.val;
     }
     return (r ? op.res : eb_chan_res_stalled);
 }
 
+#pragma mark - Slow-op hook -
+/* The maximum number of slow ops that are reported in a burst, and the sustained rate (per second) at which they're
+   reported after that */
+#define EB_CHAN_SLOW_OP_BURST 10
+#define EB_CHAN_SLOW_OP_RATE 10
+
+static eb_chan_slow_op_hook g_slow_op_hook = NULL;
+static eb_nsec g_slow_op_threshold = 0;
+/* The token bucket that rate-limits reports, in nanoseconds of credit: a report costs 1/EB_CHAN_SLOW_OP_RATE seconds,
+   and credit accrues in real time up to EB_CHAN_SLOW_OP_BURST reports' worth */
+static eb_spinlock g_slow_op_lock = EB_SPINLOCK_INIT;
+static eb_nsec g_slow_op_credit = 0;
+static eb_nsec g_slow_op_credit_time = 0;
+static uint64_t g_slow_op_suppressed = 0;
+
+void eb_chan_set_slow_op_hook(eb_nsec threshold, eb_chan_slow_op_hook hook) {
+    eb_time_ticks_init();
+    
+    eb_spinlock_lock(&g_slow_op_lock);
+        g_slow_op_threshold = threshold;
+        g_slow_op_credit = EB_CHAN_SLOW_OP_BURST * (eb_nsec_per_sec / EB_CHAN_SLOW_OP_RATE);
+        g_slow_op_credit_time = eb_time_now();
+        g_slow_op_suppressed = 0;
+    eb_spinlock_unlock(&g_slow_op_lock);
+    
+    /* Make sure the threshold is visible before the hook */
+    eb_atomic_barrier();
+    g_slow_op_hook = hook;
+}
+
+/* Calls the slow-op hook if the select took longer than the threshold, and the rate limit allows it */
+static void slow_op_check(eb_chan_slow_op_hook hook, eb_chan_op *const ops[], size_t nops, const eb_chan_op *result,
+    uint64_t ticks, const uint64_t phase_ticks[eb_thread_phase_count], uint64_t retries) {
+    static const eb_nsec k_report_cost = (eb_nsec_per_sec / EB_CHAN_SLOW_OP_RATE);
+    static const eb_nsec k_max_credit = EB_CHAN_SLOW_OP_BURST * (eb_nsec_per_sec / EB_CHAN_SLOW_OP_RATE);
+    
+    eb_nsec duration = eb_time_ticks_to_nsec(ticks);
+    if (duration < *((volatile eb_nsec *)&g_slow_op_threshold)) {
+        return;
+    }
+    
+    /* Take a token from the bucket */
+    bool report = false;
+    uint64_t suppressed = 0;
+    eb_nsec now = eb_time_now();
+    eb_spinlock_lock(&g_slow_op_lock);
+        eb_nsec elapsed = (now > g_slow_op_credit_time ? now - g_slow_op_credit_time : 0);
+        g_slow_op_credit = (k_max_credit - g_slow_op_credit > elapsed ? g_slow_op_credit + elapsed : k_max_credit);
+        g_slow_op_credit_time = now;
+        if (g_slow_op_credit >= k_report_cost) {
+            g_slow_op_credit -= k_report_cost;
+            suppressed = g_slow_op_suppressed;
+            g_slow_op_suppressed = 0;
+            report = true;
+        } else {
+            g_slow_op_suppressed++;
+        }
+    eb_spinlock_unlock(&g_slow_op_lock);
+    
+    if (report) {
+        eb_chan_slow_op op = {
+            .type = (nops == 1 ? (ops[0]->send ? eb_chan_slow_op_send : eb_chan_slow_op_recv) : eb_chan_slow_op_select),
+            .ops = ops,
+            .nops = nops,
+            .result = result,
+            .duration = duration,
+            .spin = eb_time_ticks_to_nsec(phase_ticks[eb_thread_phase_spin]),
+            .park = eb_time_ticks_to_nsec(phase_ticks[eb_thread_phase_park]),
+            .wake = eb_time_ticks_to_nsec(phase_ticks[eb_thread_phase_wake]),
+            .retries = retries,
+            .suppressed = suppressed,
+        };
+        hook(&op);
+    }
+}
+
 #pragma mark - Multiplexing -
 #define next_idx(nops, delta, idx) (delta == 1 && idx == nops-1 ? 0 : ((delta == -1 && idx == 0) ? nops-1 : idx+delta))
+
+/* Returns the number of times that a blocking select should try each of its ops before parking: the largest spin budget
+   among the ops' channels (see eb_chan_set_spin_attempts()). Spinning can't help on uniprocessor machines, so there it's
+   at most 1. */
+static inline size_t spin_attempts(eb_chan_op *const ops[], size_t nops) {
+    size_t global = *((volatile size_t *)&eb_config.spin_attempts);
+    size_t r = 0;
+    for (size_t i = 0; i < nops; i++) {
+        eb_chan c = ops[i]->chan;
+        if (c) {
+            size_t attempts = *((volatile size_t *)&c->spin_attempts);
+            attempts = (attempts == EB_CHAN_SPIN_ATTEMPTS_DEFAULT ? global : attempts);
+            r = (attempts > r ? attempts : r);
+        }
+    }
+    return (eb_sys_uniprocessor() && r > 1 ? 1 : r);
+}
+
 eb_chan_op *eb_chan_select_list(eb_nsec timeout, eb_chan_op *const ops[], size_t nops) {
     assert(!nops || ops);
     
-    const size_t k_attempt_multiplier = (eb_sys_ncores == 1 ? 1 : 500);
+    /* Mark that we're in the hot path, so that strict threads can catch allocations (see eb_chan_thread_prepare()) */
+    eb_thread *thread = eb_thread_current();
+    bool thread_in_hot_path = thread->in_hot_path;
+    thread->in_hot_path = true;
+    
+    #if EB_CHAN_STATS
+        /* Allocate the channels' statistics on their first op. Strict threads mustn't allocate here, so their channels'
+           statistics are allocated by eb_chan_reserve() instead. */
+        if (!thread->strict) {
+            for (size_t i = 0; i < nops; i++) {
+                if (ops[i]->chan && !*((chan_stats *volatile *)&ops[i]->chan->stats)) {
+                    stats_create(ops[i]->chan);
+                }
+            }
+        }
+    #endif
+    
     eb_nsec start_time = 0;
     size_t idx_start = 0;
     int8_t idx_delta = 0;
@@ -782,13 +2659,40 @@ eb_chan_op *eb_chan_select_list(eb_nsec timeout, eb_chan_op *const ops[], size_t
     bool co[nops];
     memset(co, 0, sizeof(co));
     
+    trace(eb_trace_select_begin, NULL, NULL, (uint32_t)nops);
+    
+    /* Phase timing, for blocked-time accounting (see eb_chan_blocked_time_enable()), the slow-op hook (see
+       eb_chan_set_slow_op_hook()) and traffic capture (see eb_chan_capture_start()). 'phase_start' is when the current
+       spin (or post-wakeup) phase started. */
+    #if EB_CHAN_BLOCKED_TIME
+        bool acct = (timeout != eb_nsec_zero && eb_thread_accounting);
+    #else
+        bool acct = false;
+    #endif
+    eb_chan_slow_op_hook slow_op_hook = *((eb_chan_slow_op_hook volatile *)&g_slow_op_hook);
+    #if EB_CHAN_CAPTURE
+        uint32_t capture_session = *((volatile uint32_t *)&eb_capture_session);
+    #else
+        uint32_t capture_session = 0;
+    #endif
+    bool timed = (acct || slow_op_hook || capture_session);
+    bool woken_once = false;
+    uint64_t op_start = (timed ? eb_time_ticks() : 0);
+    uint64_t phase_start = op_start;
+    uint64_t phase_ticks[eb_thread_phase_count] = {0};
+    uint64_t retries = 0;
+    
     eb_chan_op *result = NULL;
     do_state state = {
         .ops = ops,
         .nops = nops,
         .cleanup_ops = co,
         .timeout = timeout,
-        .port = NULL};
+        .port = NULL,
+        #if EB_CHAN_STATS
+            .shard = eb_thread_stats_shard(EB_CHAN_STATS_SHARDS),
+        #endif
+    };
     
     if (timeout == eb_nsec_zero) {
         /* ## timeout == 0: try every op exactly once; if none of them can proceed, return NULL. */
@@ -796,10 +2700,12 @@ eb_chan_op *eb_chan_select_list(eb_nsec timeout, eb_chan_op *const ops[], size_t
             eb_chan_op *op = ops[idx];
             op_result r;
             while ((r = try_op(&state, op, idx)) == op_result_retry) {
-                if (eb_sys_ncores == 1) {
-                    /* On uniprocessor machines, yield to the scheduler because we can't continue until another
-                       thread updates the channel's state. */
-                    sched_yield();
+                stats_add(op->chan, state.shard, retries, 1);
+                retries++;
+                if (eb_config_yields()) {
+                    /* On uniprocessor machines (or as configured), yield to the scheduler because we can't continue
+                       until another thread updates the channel's state. */
+                    eb_sys_yield();
                 }
             }
             
@@ -815,10 +2721,18 @@ eb_chan_op *eb_chan_select_list(eb_nsec timeout, eb_chan_op *const ops[], size_t
             start_time = eb_time_now();
         }
         
+        /* The number of fast-path attempts before parking, across all ops */
+        size_t attempts = spin_attempts(ops, nops);
+        size_t nspins = (nops && attempts > SIZE_MAX / nops ? SIZE_MAX : attempts * nops);
+        
+        #if EB_CHAN_STATS
+            /* Whether we were woken since we last parked */
+            bool woken = false;
+        #endif
         for (;;) {
             /* ## Fast path: loop over our operations to see if one of them was able to send/receive. (If not,
                we'll enter the slow path where we put our thread to sleep until we're signaled.) */
-            for (size_t i = 0, idx = idx_start; i < k_attempt_multiplier*nops; i++, idx = next_idx(nops, idx_delta, idx)) {
+            for (size_t i = 0, idx = idx_start; i < nspins; i++, idx = next_idx(nops, idx_delta, idx)) {
                 eb_chan_op *op = ops[idx];
                 op_result r = try_op(&state, op, idx);
                 /* If the op completed, we need to exit! */
@@ -826,15 +2740,32 @@ eb_chan_op *eb_chan_select_list(eb_nsec timeout, eb_chan_op *const ops[], size_t
                     result = op;
                     goto cleanup;
                 }
+                if (r == op_result_retry) {
+                    stats_add(op->chan, state.shard, retries, 1);
+                    retries++;
+                }
             }
             
             /* ## Slow path: we weren't able to find an operation that could send/receive, so we'll create a
                port to receive notifications on and put this thread to sleep until someone wakes us up. */
             if (!state.port) {
-                /* Create our port that we'll attach to channels so that we can be notified when events occur. */
-                state.port = eb_port_create();
+                /* Create our port that we'll attach to channels so that we can be notified when events occur. If
+                   the thread was prepared, reuse its port so that we don't allocate. */
+                if (thread->port) {
+                    eb_port_reset(thread->port);
+                    state.port = eb_port_retain(thread->port);
+                } else {
+                    state.port = eb_port_create();
+                }
                 eb_assert_or_recover(state.port, goto cleanup);
                 
+                /* Record our ops so that eb_chan_debug_dump() can show what we're waiting on. This needs to happen before
+                   the port is added to any channel's port list. */
+                eb_port_waiter *waiter = eb_port_waiter_info(state.port);
+                waiter->tid = eb_thread_id();
+                waiter->ops = ops;
+                waiter->nops = nops;
+                
                 /* Register our port for the appropriate notifications on every channel. */
                 /* This adds 'port' to the channel's sends/recvs (depending on the op), which we clean up at the
                    end of this function. */
@@ -842,7 +2773,7 @@ eb_chan_op *eb_chan_select_list(eb_nsec timeout, eb_chan_op *const ops[], size_t
                     eb_chan_op *op = ops[i];
                     eb_chan c = op->chan;
                     if (c) {
-                        port_list_add((op->send ? c->sends : c->recvs), state.port);
+                        port_list_add((op->send ? &c->sends : &c->recvs), &c->alloc, state.port);
                     }
                 }
             }
@@ -854,10 +2785,12 @@ eb_chan_op *eb_chan_select_list(eb_nsec timeout, eb_chan_op *const ops[], size_t
                 eb_chan_op *op = ops[idx];
                 op_result r;
                 while ((r = try_op(&state, op, idx)) == op_result_retry) {
-                    if (eb_sys_ncores == 1) {
-                        /* On uniprocessor machines, yield to the scheduler because we can't continue until another
-                           thread updates the channel's state. */
-                        sched_yield();
+                    stats_add(op->chan, state.shard, retries, 1);
+                    retries++;
+                    if (eb_config_yields()) {
+                        /* On uniprocessor machines (or as configured), yield to the scheduler because we can't
+                           continue until another thread updates the channel's state. */
+                        eb_sys_yield();
                     }
                 }
                 
@@ -880,8 +2813,54 @@ eb_chan_op *eb_chan_select_list(eb_nsec timeout, eb_chan_op *const ops[], size_t
                 }
             }
             
+            /* Record the CPU that we're parking on, so that signalers can prefer waking nearby waiters, if there's
+               more than one CPU to prefer. Only record when we parked if the watchdog is running to check it. */
+            eb_port_waiter *waiter = eb_port_waiter_info(state.port);
+            waiter->cpu = -1;
+            #if EB_CHAN_WAKE_LOCALITY
+                if (!eb_sys_uniprocessor()) {
+                    waiter->cpu = eb_sys_cpu_current();
+                }
+            #endif
+            waiter->park_time = (*((volatile service_state *)&g_watchdog_state) == service_running ? eb_time_now() :
+                EB_PORT_PARK_UNTIMED);
+            
+            #if EB_CHAN_STATS
+                /* Count the park on every channel in the select, and if we were woken but have to park again without
+                   completing an op, count the wasted wakeup too */
+                for (size_t i = 0; i < nops; i++) {
+                    eb_chan c = ops[i]->chan;
+                    if (c) {
+                        stats_add(c, state.shard, parks, 1);
+                        if (woken) {
+                            stats_add(c, state.shard, wasted_wakeups, 1);
+                        }
+                    }
+                }
+            #endif
+            
             /* Put our thread to sleep until someone alerts us of an event */
-            eb_port_wait(state.port, wait_timeout);
+            trace(eb_trace_park, NULL, NULL, 0);
+            eb_probe2(park, state.port, nops);
+            /* Time since the last phase started was spent spinning, regardless of whether we were woken */
+            if (timed) {
+                uint64_t now = eb_time_ticks();
+                phase_ticks[eb_thread_phase_spin] += now - phase_start;
+                phase_start = now;
+            }
+            bool signaled = eb_port_wait(state.port, wait_timeout);
+            waiter->park_time = 0;
+            if (timed) {
+                uint64_t now = eb_time_ticks();
+                phase_ticks[eb_thread_phase_park] += now - phase_start;
+                phase_start = now;
+                woken_once = true;
+            }
+            trace(eb_trace_unpark, NULL, NULL, signaled);
+            eb_probe2(wake, state.port, signaled);
+            #if EB_CHAN_STATS
+                woken = signaled;
+            #endif
         }
     }
     
@@ -892,9 +2871,9 @@ eb_chan_op *eb_chan_select_list(eb_nsec timeout, eb_chan_op *const ops[], size_t
                 eb_chan_op *op = ops[i];
                 eb_chan c = op->chan;
                 if (c) {
-                    port_list ports = (op->send ? c->sends : c->recvs);
+                    port_list *ports = (op->send ? &c->sends : &c->recvs);
                     port_list_rm(ports, state.port);
-                    port_list_signal_first(ports, state.port);
+                    signal_first(c, state.shard, ports, state.port);
                 }
             }
         }
@@ -907,5 +2886,89 @@ eb_chan_op *eb_chan_select_list(eb_nsec timeout, eb_chan_op *const ops[], size_t
         }
     }
     
+    #if EB_CHAN_STATS
+        if (result && result->chan) {
+            if (result->res != eb_chan_res_ok) {
+                stats_add(result->chan, state.shard, closes_observed, 1);
+            } else if (result->send) {
+                stats_add(result->chan, state.shard, sends, 1);
+            } else {
+                stats_add(result->chan, state.shard, recvs, 1);
+            }
+        }
+    #endif
+    if (result) {
+        eb_sys_call_add(eb_sys_call_op);
+    }
+    
+    uint64_t op_end = 0;
+    if (timed) {
+        /* The time since the last wakeup was spent completing the op; if we were never parked it was all spinning */
+        op_end = eb_time_ticks();
+        phase_ticks[(woken_once ? eb_thread_phase_wake : eb_thread_phase_spin)] += op_end - phase_start;
+    }
+    
+    #if EB_CHAN_BLOCKED_TIME
+        if (acct) {
+            eb_thread_account(!result, phase_ticks);
+            if (result && result->chan) {
+                eb_chan c = result->chan;
+                size_t i = !result->send;
+                eb_atomic_add_relaxed(&c->blocked_selects[i], 1);
+                for (size_t ii = 0; ii < eb_thread_phase_count; ii++) {
+                    eb_atomic_add_relaxed(&c->blocked_ticks[i][ii], phase_ticks[ii]);
+                }
+            }
+        }
+    #endif
+    
+    #if EB_CHAN_USDT
+        if (result && result->chan) {
+            if (result->send) {
+                eb_probe2(send, result->chan, result->res);
+            } else {
+                eb_probe2(recv, result->chan, result->res);
+            }
+        }
+    #endif
+    
+    #if EB_CHAN_TRACE
+        if (eb_trace_active) {
+            /* Record which op was performed, if any */
+            uint32_t idx = UINT32_MAX;
+            for (size_t i = 0; result && i < nops; i++) {
+                if (ops[i] == result) {
+                    idx = (uint32_t)i;
+                    break;
+                }
+            }
+            eb_trace_record(eb_trace_select_end, (result ? result->chan : NULL),
+                (result ? (result->res == eb_chan_res_ok ? "ok" : "closed") : NULL), idx);
+        }
+    #endif
+    
+    /* If the channel is waiting for its first consumer to determine its NUMA placement, we're it */
+    if (result && !result->send && result->chan && result->chan->numa_first_consumer) {
+        numa_claim(result->chan);
+    }
+    
+    thread->in_hot_path = thread_in_hot_path;
+    
+    /* Report the op if it was slow. (This happens after we leave the hot path, since the hook may allocate.) */
+    if (slow_op_hook) {
+        slow_op_check(slow_op_hook, ops, nops, result, op_end - op_start, phase_ticks, retries);
+    }
+    
+    #if EB_CHAN_CAPTURE
+        /* Record the op if we're capturing. (This also happens outside the hot path, since a thread's first record
+           allocates its buffer.) */
+        if (capture_session && result && result->chan) {
+            eb_chan_capture_flags flags = ((timeout == eb_nsec_zero ? eb_chan_capture_try : 0) |
+                (result->res != eb_chan_res_ok ? eb_chan_capture_closed : 0) | (nops > 1 ? eb_chan_capture_select : 0));
+            capture(result->chan, capture_session, (result->send ? eb_chan_capture_send : eb_chan_capture_recv), flags,
+                op_start, op_end);
+        }
+    #endif
+    
     return result;
 }
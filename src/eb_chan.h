@@ -3,8 +3,15 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "eb_nsec.h"
 
+/* Whether only buffered channels are supported, which resolves the buffered-vs-unbuffered branch of every op at compile
+   time. In such builds, creating a channel with a capacity of 0 fails. */
+#ifndef EB_CHAN_BUFFERED_ONLY
+    #define EB_CHAN_BUFFERED_ONLY 0
+#endif
+
 /* ## Types */
 typedef enum {
     eb_chan_res_ok,         /* Success */
@@ -20,11 +27,372 @@ typedef struct {
     const void *val;    /* The value to be sent/the value that was received */
 } eb_chan_op;
 
+/* A memory allocator. Sizes are supplied to realloc()/free() to support sized/arena allocators. realloc() may be NULL,
+   in which case it's emulated via alloc()/free(). */
+typedef struct {
+    void *(*alloc)(void *ctx, size_t size);
+    void *(*realloc)(void *ctx, void *ptr, size_t old_size, size_t new_size);
+    void (*free)(void *ctx, void *ptr, size_t size);
+    void *ctx;
+} eb_chan_allocator;
+
+/* Cumulative allocation counts across every allocator, since the process started */
+typedef struct {
+    uint64_t allocs;
+    uint64_t reallocs;
+    uint64_t frees;
+    uint64_t bytes_allocated;
+    uint64_t bytes_in_use;
+} eb_chan_alloc_counts;
+
+/* Opaque storage for a channel that lives in caller-provided memory (see eb_chan_init()). The storage has a size of
+   EB_CHAN_STORAGE_SIZE bytes, and the alignment of EB_CHAN_STORAGE_ALIGN bytes is guaranteed by the union. */
+#define EB_CHAN_STORAGE_SIZE 512
+#define EB_CHAN_STORAGE_ALIGN 8
+struct eb_chan_storage {
+    union {
+        unsigned char bytes[EB_CHAN_STORAGE_SIZE];
+        void *align_ptr;
+        uint64_t align_u64;
+        double align_double;
+    } opaque;
+};
+
+/* The size in bytes of the ring that backs a buffered channel with a capacity of 'buf_cap' */
+#define EB_CHAN_RING_SIZE(buf_cap) ((buf_cap) * sizeof(const void *))
+
 /* ## Channel creation/lifecycle */
 eb_chan eb_chan_create(size_t buf_cap);
 eb_chan eb_chan_retain(eb_chan c);
 void eb_chan_release(eb_chan c);
 
+/* _init() initializes a channel within caller-provided storage (e.g. embedded in a struct, or in static storage), and
+   returns the handle to use with every other eb_chan function. For buffered channels, 'ring' may point to caller memory
+   of at least EB_CHAN_RING_SIZE(buf_cap) bytes (suitably aligned for pointers), or may be NULL to have the ring allocated.
+   _deinit() releases the reference that _init() returned; the storage and ring must remain valid until every reference
+   to the channel has been released. */
+eb_chan eb_chan_init(struct eb_chan_storage *storage, void *ring, size_t buf_cap);
+void eb_chan_deinit(eb_chan c);
+
+/* ## Allocation */
+/* _set_allocator() sets the global allocator used for every subsequent allocation (channels, ports, port lists), where
+   NULL restores the default (malloc()/realloc()/free()). Each object remembers the allocator that allocated it, so
+   the global allocator can be changed at any time.
+   _create_with_allocator() creates a channel whose memory (the channel itself, its ring and its port lists) comes from
+   'a' instead of the global allocator. 'a' is copied. */
+void eb_chan_set_allocator(const eb_chan_allocator *a);
+eb_chan eb_chan_create_with_allocator(size_t buf_cap, const eb_chan_allocator *a);
+/* Reports the allocation counts, e.g. to verify that a steady-state workload doesn't allocate */
+void eb_chan_alloc_stats(eb_chan_alloc_counts *out);
+
+/* ## NUMA placement */
+enum {
+    eb_chan_node_first_consumer = -1,   /* Place the channel on the NUMA node of the first thread to receive from it */
+};
+
+/* _create_on_node() creates a channel whose memory (the channel and its ring) is placed on NUMA node 'node', or on the
+   node of its first receiver if 'node' is eb_chan_node_first_consumer. On systems without NUMA, this is equivalent to
+   eb_chan_create(). Independently of placement, blocked waiters on the signaling thread's node are woken first. */
+eb_chan eb_chan_create_on_node(size_t buf_cap, int node);
+
+/* ## Preallocation */
+/* Flags for _thread_prepare() */
+enum {
+    eb_chan_prepare_strict = 1 << 0,    /* Abort if a send/recv/select on the calling thread calls the allocator */
+    eb_chan_prepare_mlock = 1 << 1,     /* Lock the thread's preallocated memory into RAM via mlock() */
+};
+
+/* _thread_prepare() preallocates everything the calling thread needs to block (its port and semaphore), so that after
+   warm-up no send/recv/select on the thread allocates or creates a semaphore. The preallocated resources are released
+   when the thread exits. Returns false on failure.
+   _reserve() preallocates room for 'max_waiters' blocked senders and 'max_waiters' blocked receivers on 'c', so that
+   blocking on the channel doesn't allocate as long as the number of waiters stays within the reservation. It also
+   allocates the channel's statistics (see eb_chan_stats()).
+   _mlock() locks the channel's memory (the channel, its ring, its statistics and its reserved waiter lists) into RAM. */
+bool eb_chan_thread_prepare(unsigned int flags);
+bool eb_chan_reserve(eb_chan c, size_t max_waiters);
+bool eb_chan_mlock(eb_chan c);
+
+/* ## Configuration */
+/* How a thread waits when it can't make progress until another thread does, e.g. while a spinlock is held or while an
+   unbuffered send/recv is half-way done */
+typedef enum {
+    eb_chan_yield_auto,     /* Yield the CPU if the process can only use one core, otherwise retry immediately (the default) */
+    eb_chan_yield_always,   /* Always yield the CPU, e.g. when the machine is oversubscribed */
+    eb_chan_yield_never,    /* Never yield the CPU, e.g. when every thread has a dedicated core */
+} eb_chan_yield_policy;
+
+/* Runtime tunables, which apply to every channel */
+typedef struct {
+    size_t spin_attempts;               /* The number of times a blocking op tries each of its ops (on multicore machines) before parking the thread. 0 parks immediately; a huge value effectively never parks. */
+    size_t port_pool_cap;               /* The number of idle ports (and their semaphores) that are kept for reuse, at most EB_CHAN_PORT_POOL_MAX */
+    size_t waiter_list_cap;             /* The initial capacity of a channel's lists of blocked senders/receivers, which double as needed */
+    eb_chan_yield_policy yield_policy;
+} eb_chan_config;
+
+/* The largest supported eb_chan_config.port_pool_cap */
+#define EB_CHAN_PORT_POOL_MAX 4096
+/* The per-channel spin attempts that defer to eb_chan_config.spin_attempts (see eb_chan_set_spin_attempts()) */
+#define EB_CHAN_SPIN_ATTEMPTS_DEFAULT SIZE_MAX
+
+/* _config_get() fills 'out' with the current configuration. It starts out as the compile-time defaults (500 spin
+   attempts, 16 pooled ports, 16 waiters per list, _yield_auto), overridden by these environment variables when the
+   first channel is created: EB_CHAN_SPIN_ATTEMPTS, EB_CHAN_PORT_POOL_CAP, EB_CHAN_WAITER_LIST_CAP and EB_CHAN_YIELD
+   (auto, always or never). Invalid values are reported on stderr and ignored.
+   _config_set() replaces the configuration, returning false (and changing nothing) if it's invalid. Modifying the result
+   of _config_get() keeps the environment's overrides of the other fields. It's meant to be called at startup: it's safe
+   to call while channels are in use, but other threads may observe the change late. If port_pool_cap shrinks, the
+   surplus pooled ports are destroyed as they're reused.
+   _set_spin_attempts() overrides spin_attempts for ops on 'c', e.g. to spin longer on a latency-critical channel than on
+   the rest, or to park immediately on a channel whose peers are slow. A select spins for the largest budget among its
+   channels. EB_CHAN_SPIN_ATTEMPTS_DEFAULT restores the global value. */
+void eb_chan_config_get(eb_chan_config *out);
+bool eb_chan_config_set(const eb_chan_config *config);
+void eb_chan_set_spin_attempts(eb_chan c, size_t attempts);
+
+/* ## Statistics */
+/* The number of buckets in eb_chan_counters' occupancy histogram */
+#define EB_CHAN_STATS_OCCUPANCY_BUCKETS 8
+
+typedef struct {
+    uint64_t sends;             /* Successful sends */
+    uint64_t recvs;             /* Successful receives */
+    uint64_t retries;           /* Times an op was retried because the channel was busy */
+    uint64_t lock_failures;     /* Failed attempts to acquire the channel's lock */
+    uint64_t parks;             /* Times a thread parked with an op on the channel (counted on every channel in a select) */
+    uint64_t wakeups;           /* Wakeups delivered to the channel's waiters */
+    uint64_t wasted_wakeups;    /* Wakeups after which the woken thread had to park again (counted like parks) */
+    uint64_t closes_observed;   /* Ops that completed because the channel was closed */
+    size_t buf_len_max;         /* High-water mark of the channel's buffer length */
+    /* Histogram of the buffer's occupancy after each buffered send, where bucket i counts occupancies in
+       (i/EB_CHAN_STATS_OCCUPANCY_BUCKETS, (i+1)/EB_CHAN_STATS_OCCUPANCY_BUCKETS] of the buffer's capacity */
+    uint64_t occupancy[EB_CHAN_STATS_OCCUPANCY_BUCKETS];
+} eb_chan_counters;
+
+/* Fills 'out' with the channel's counters. Counters are cheap to maintain (the ones updated outside of the channel's
+   lock are sharded across threads) and can be compiled out by defining EB_CHAN_STATS=0, in which case this returns
+   false and zeroes 'out'. The counters are allocated by the channel's first op (or by eb_chan_reserve(), for channels
+   that are only used by strict threads), and they stay at zero until then. */
+bool eb_chan_stats(eb_chan c, eb_chan_counters *out);
+
+/* ## Latency */
+/* Percentiles of the time that values spent in a channel: from when a value was enqueued in a buffered channel's
+   buffer until it was dequeued, or from when a value was offered to an unbuffered channel until a receiver took it */
+typedef struct {
+    uint64_t count;     /* Number of values measured */
+    eb_nsec p50;
+    eb_nsec p90;
+    eb_nsec p99;
+    eb_nsec p999;
+    eb_nsec max;
+} eb_chan_latency;
+
+/* Enables latency measurement on the channel. Measurement is off by default since it costs a timestamp per value and
+   a few KB per channel; it can be compiled out by defining EB_CHAN_LATENCY=0, in which case this returns false.
+   Values already in the channel's buffer are treated as having been enqueued at the time of the call. */
+bool eb_chan_latency_enable(eb_chan c);
+/* Fills 'out' with the channel's latency percentiles, which have a relative error of at most 1/16. Returns false if
+   latency measurement isn't enabled on the channel. */
+bool eb_chan_latency_stats(eb_chan c, eb_chan_latency *out);
+/* Returns the channel's latency at percentile 'pct' (in [0, 100]), or 0 if latency measurement isn't enabled */
+eb_nsec eb_chan_latency_percentile(eb_chan c, double pct);
+
+/* ## Tracing */
+/* A flight recorder: while tracing, every thread records its channel activity (select entry/exit and the op that was
+   performed, parks/unparks, signals, lock contention, closes, and unbuffered channel state transitions) into its own
+   ring of its last 2048 events. A typical use is to trace continuously, and on a latency spike call
+   _stop() (which freezes the rings) and _dump(), which writes Chrome trace-event JSON to 'path' for viewing in
+   chrome://tracing or Perfetto. _start() returns false if the recorder was compiled out by defining EB_CHAN_TRACE=0.
+   Rings are allocated when a thread first records an event, or by eb_chan_thread_prepare(). */
+bool eb_chan_trace_start();
+void eb_chan_trace_stop();
+bool eb_chan_trace_dump(const char *path);
+
+/* ## Traffic capture */
+/* While capturing, every completed send/recv (including those of selects and _try_ ops) and every close is recorded
+   with its timing, its thread and the channel's buffer depth to the binary file at 'path', for bench/replay.c to
+   replay offline. Channels are identified by their capacity and name (see eb_chan_set_name()). Each thread buffers its
+   records and writes them in batches. _start() returns false if a capture is already running, if 'path' can't be
+   created, or if capture was compiled out by defining EB_CHAN_CAPTURE=0. _stop() writes the remaining records and
+   returns false if writing the file failed. */
+bool eb_chan_capture_start(const char *path);
+bool eb_chan_capture_stop();
+
+/* The capture file starts with the 8 bytes of EB_CHAN_CAPTURE_MAGIC, followed by records of EB_CHAN_CAPTURE_RECORD_SIZE
+   bytes, whose fields are little-endian:
+     offset 0   uint64  time: when the op was issued, in nanoseconds since the capture started
+            8   uint32  wait: how long the op took to complete, in nanoseconds (saturating)
+            12  uint32  chan: the channel's capture-local id
+            16  uint32  depth: the number of values in the channel's buffer after the op; the capacity for _define
+            20  uint16  thread: the capture-local id of the thread; the length of the name that follows for _define
+            22  uint8   type: an eb_chan_capture_type
+            23  uint8   flags: eb_chan_capture_flags
+   _define records are followed by the channel's name (not NUL-terminated), and appear before the channel's other
+   records from the same thread, but not necessarily before those of other threads. Each thread's records are in
+   order, while records of different threads are interleaved in batches. */
+#define EB_CHAN_CAPTURE_MAGIC "EBCAP\0\0\1"
+#define EB_CHAN_CAPTURE_RECORD_SIZE 24
+
+typedef enum {
+    eb_chan_capture_define,
+    eb_chan_capture_send,
+    eb_chan_capture_recv,
+    eb_chan_capture_close,
+} eb_chan_capture_type;
+
+enum {
+    eb_chan_capture_try = 1 << 0,       /* The op was a _try_ op (or a select with a zero timeout) */
+    eb_chan_capture_closed = 1 << 1,    /* The op completed because the channel was closed */
+    eb_chan_capture_select = 1 << 2,    /* The op was one of several in a select */
+}; typedef uint8_t eb_chan_capture_flags;
+
+/* ## Lock profiling */
+/* Contention counters for one of eb_chan's spinlocks */
+typedef struct {
+    uint64_t contended;     /* Acquisitions that didn't succeed on the first attempt */
+    uint64_t spins;         /* Failed attempts to acquire the lock */
+    uint64_t wait_cycles;   /* Time spent waiting to acquire the lock, in TSC cycles on x86 (nanoseconds elsewhere) */
+    eb_nsec wait_ns;        /* wait_cycles, in nanoseconds */
+} eb_chan_lock_counts;
+
+typedef struct {
+    eb_chan_lock_counts chan;   /* The channel's lock */
+    eb_chan_lock_counts sends;  /* The lock of the channel's list of waiting senders */
+    eb_chan_lock_counts recvs;  /* The lock of the channel's list of waiting receivers */
+} eb_chan_lock_report;
+
+/* Fill 'out' with the lock contention that was observed on a channel's locks, or on the global pool of ports. The
+   profiler is compiled out by default; define EB_CHAN_LOCKPROF=1 to enable it. Otherwise these return false and zero
+   'out'. */
+bool eb_chan_lock_stats(eb_chan c, eb_chan_lock_report *out);
+bool eb_chan_port_pool_lock_stats(eb_chan_lock_counts *out);
+
+/* ## Blocked-time accounting */
+/* Time spent in the phases of blocking selects (those with a non-zero timeout) */
+typedef struct {
+    uint64_t selects;   /* Number of selects accounted */
+    eb_nsec spin;       /* Trying ops without being parked (including after wakeups that didn't lead to an op) */
+    eb_nsec park;       /* Parked, waiting to be signaled */
+    eb_nsec wake;       /* From the last wakeup until an op completed */
+} eb_chan_phase_times;
+
+typedef struct {
+    eb_chan_phase_times completed;  /* Selects that completed an op */
+    eb_chan_phase_times timed_out;  /* Selects that timed out */
+} eb_chan_thread_times;
+
+typedef struct {
+    eb_chan_phase_times sends;      /* Selects that completed by sending on the channel */
+    eb_chan_phase_times recvs;      /* Selects that completed by receiving from the channel (i.e. idle consumers) */
+} eb_chan_op_times;
+
+/* Enables accounting of where threads' time goes while they're blocked in a select, which costs a few timestamps per
+   blocking select. Each select's time is attributed to its thread, and to the channel whose op completed (or to the
+   timeout). Returns false if accounting was compiled out by defining EB_CHAN_BLOCKED_TIME=0. */
+bool eb_chan_blocked_time_enable();
+/* Fill 'out' with the current thread's/every thread's (including ones that have exited) accounting. Return false if
+   accounting isn't enabled. */
+bool eb_chan_thread_blocked_time(eb_chan_thread_times *out);
+bool eb_chan_all_blocked_time(eb_chan_thread_times *out);
+/* Fills 'out' with the time that was attributed to a channel. Returns false if accounting isn't enabled. */
+bool eb_chan_blocked_time(eb_chan c, eb_chan_op_times *out);
+
+/* ## System call accounting */
+typedef struct {
+    uint64_t ops;                   /* Completed sends/receives (including ones that completed because a channel closed) */
+    uint64_t sem_posts;             /* Wakeups (sem_post()/semaphore_signal()) */
+    uint64_t sem_waits;             /* Untimed parks (sem_wait()/semaphore_wait()) */
+    uint64_t sem_timedwaits;        /* Timed parks (sem_timedwait()/semaphore_timedwait()) */
+    uint64_t sem_trywaits;          /* Non-blocking semaphore checks, e.g. when resetting a pooled port */
+    uint64_t yields;                /* sched_yield() calls, from spinlocks and selects on single-core machines */
+    uint64_t syscalls;              /* The sum of the above calls */
+    uint64_t voluntary_switches;    /* The process' context switches, from getrusage() */
+    uint64_t involuntary_switches;
+    double syscalls_per_op;
+    double switches_per_op;         /* Voluntary and involuntary switches per op */
+} eb_chan_syscall_counts;
+
+/* Fills 'out' with the system calls that eb_chan made (on every thread) and the process' context switches since the
+   last _reset() (or since the process started), along with their rate per completed op. Counting costs an uncontended
+   increment of a thread-local counter per op and per system call; _stats() sums every thread's counters. Returns false
+   and zeroes 'out' if counting was compiled out by defining EB_CHAN_SYSCALL_STATS=0. */
+bool eb_chan_syscall_stats(eb_chan_syscall_counts *out);
+void eb_chan_syscall_stats_reset();
+
+/* ## Debugging */
+/* Writes every channel that has waiters to 'fd', with the channel's state and its waiting senders and receivers: the
+   waiting thread, how long it's been parked (only known while the watchdog is running), and the ops of its select.
+   Returns the number of channels written. Intended for incident debugging; it copies each channel's state with the
+   channel briefly locked, and writes to 'fd' after unlocking everything. */
+size_t eb_chan_debug_dump(int fd);
+
+typedef enum {
+    eb_chan_stall_parked,       /* A waiter has been parked longer than the park threshold */
+    eb_chan_stall_buf_full,     /* A channel's buffer has been full longer than the buffer threshold */
+} eb_chan_stall_type;
+
+typedef struct {
+    eb_chan_stall_type type;
+    eb_chan chan;           /* The stalled channel (for _parked, one of the channels that the waiter is waiting on) */
+    bool send;              /* _parked: whether the waiter is waiting to send on 'chan' */
+    long tid;               /* _parked: the waiting thread */
+    eb_nsec duration;       /* How long the waiter has been parked/the buffer has been full */
+} eb_chan_stall;
+
+typedef void (*eb_chan_stall_hook)(const eb_chan_stall *stall, void *ctx);
+
+/* Starts a watchdog thread that calls 'hook' (on the watchdog thread, once per stall) when a waiter has been parked
+   longer than 'park_threshold', or a channel's buffer has been full longer than 'buf_full_threshold'. Either threshold
+   can be eb_nsec_forever to disable that check. The hook may use the channel API, including eb_chan_debug_dump().
+   Parks are only timestamped while the watchdog is running, so waiters that parked before it started are timed from
+   its start. Returns false if it's already running. */
+bool eb_chan_watchdog_start(eb_nsec park_threshold, eb_nsec buf_full_threshold, eb_chan_stall_hook hook, void *ctx);
+void eb_chan_watchdog_stop();
+
+/* ## Metrics */
+/* Sets the name that the channel is exported with (as the 'name' label), typically right after creating it. 'name' is
+   copied, and may be NULL to remove the name. Returns false on allocation failure. */
+bool eb_chan_set_name(eb_chan c, const char *name);
+/* Write every channel's statistics, buffer occupancy and parked waiters, and the global port pool and allocation
+   usage, in the Prometheus text exposition format. Counters are cumulative, so send/receive rates are computed by the
+   scraper (e.g. rate(eb_chan_sends_total[1m])). _write() writes to 'fd'; _write_file() replaces the file at 'path'
+   atomically (e.g. for node_exporter's textfile collector). The channels are copied with their locks briefly held, and
+   formatted (into memory from the global allocator) after the locks are released. Return false on failure. */
+bool eb_chan_metrics_write(int fd);
+bool eb_chan_metrics_write_file(const char *path);
+/* Starts a thread that serves the metrics on a Unix domain socket at 'path', e.g. for
+   `curl --unix-socket <path> http://localhost/metrics`. A stale socket at 'path' is replaced. Returns false if the
+   socket couldn't be created, or a server is already running. */
+bool eb_chan_metrics_serve(const char *path);
+void eb_chan_metrics_stop();
+
+/* ## Slow-op hook */
+typedef enum {
+    eb_chan_slow_op_send,       /* A single-op send (including eb_chan_send()/_try_send()) */
+    eb_chan_slow_op_recv,       /* A single-op receive (including eb_chan_recv()/_try_recv()) */
+    eb_chan_slow_op_select,     /* A select over several ops */
+} eb_chan_slow_op_type;
+
+typedef struct {
+    eb_chan_slow_op_type type;
+    eb_chan_op *const *ops;     /* The select's ops, and thereby its channels */
+    size_t nops;
+    const eb_chan_op *result;   /* The op that was performed, or NULL if the select timed out */
+    eb_nsec duration;           /* End-to-end duration */
+    eb_nsec spin;               /* Time spent trying ops without being parked */
+    eb_nsec park;               /* Time spent parked */
+    eb_nsec wake;               /* Time from the last wakeup until the op completed */
+    uint64_t retries;           /* Number of times that an op was retried because its channel was busy */
+    uint64_t suppressed;        /* Slow ops that weren't reported since the last report, due to rate limiting */
+} eb_chan_slow_op;
+
+typedef void (*eb_chan_slow_op_hook)(const eb_chan_slow_op *op);
+
+/* Sets a hook that's called (on the calling thread, after the op completes) when a send, receive or select takes
+   longer than 'threshold' end to end. Reports are rate-limited to bursts of 10, and 10 per second after that. While a
+   hook is set, each op costs two extra clock reads. A NULL hook disables reporting. */
+void eb_chan_set_slow_op_hook(eb_nsec threshold, eb_chan_slow_op_hook hook);
+
 /* ## Channel closing */
 /* Returns _ok on success, or _closed if the channel was already closed. */
 eb_chan_res eb_chan_close(eb_chan c);
@@ -0,0 +1,99 @@
+#include "eb_config.h"
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "eb_atomic.h"
+
+eb_chan_config eb_config = {
+    .spin_attempts = EB_CHAN_SPIN_ATTEMPTS,
+    .port_pool_cap = EB_CONFIG_PORT_POOL_CAP,
+    .waiter_list_cap = EB_CONFIG_WAITER_LIST_CAP,
+    .yield_policy = eb_chan_yield_auto,
+};
+static pthread_once_t g_config_once = PTHREAD_ONCE_INIT;
+
+static bool config_valid(const eb_chan_config *c) {
+    return (c->port_pool_cap <= EB_CHAN_PORT_POOL_MAX &&
+            c->waiter_list_cap > 0 &&
+            (c->yield_policy == eb_chan_yield_auto || c->yield_policy == eb_chan_yield_always ||
+             c->yield_policy == eb_chan_yield_never));
+}
+
+/* Parses environment variable 'name' into 'out', if it's set to a number */
+static void env_size(const char *name, size_t *out) {
+    const char *s = getenv(name);
+    if (!s) {
+        return;
+    }
+    
+    char *end = NULL;
+    errno = 0;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (end == s || *end || errno || s[0] == '-' || v > SIZE_MAX) {
+        fprintf(stderr, "eb_chan: ignoring invalid %s=%s\n", name, s);
+        return;
+    }
+    *out = (size_t)v;
+}
+
+static void config_load_env() {
+    eb_chan_config c = eb_config;
+    env_size("EB_CHAN_SPIN_ATTEMPTS", &c.spin_attempts);
+    env_size("EB_CHAN_PORT_POOL_CAP", &c.port_pool_cap);
+    env_size("EB_CHAN_WAITER_LIST_CAP", &c.waiter_list_cap);
+    
+    const char *yield = getenv("EB_CHAN_YIELD");
+    if (yield) {
+        if (!strcmp(yield, "auto")) {
+            c.yield_policy = eb_chan_yield_auto;
+        } else if (!strcmp(yield, "always")) {
+            c.yield_policy = eb_chan_yield_always;
+        } else if (!strcmp(yield, "never")) {
+            c.yield_policy = eb_chan_yield_never;
+        } else {
+            fprintf(stderr, "eb_chan: ignoring invalid EB_CHAN_YIELD=%s (expected auto, always or never)\n", yield);
+        }
+    }
+    
+    /* Out-of-range values are ignored field by field, so that one bad variable doesn't discard the others */
+    if (c.port_pool_cap > EB_CHAN_PORT_POOL_MAX) {
+        fprintf(stderr, "eb_chan: ignoring EB_CHAN_PORT_POOL_CAP=%zu (the maximum is %d)\n", c.port_pool_cap,
+            EB_CHAN_PORT_POOL_MAX);
+        c.port_pool_cap = eb_config.port_pool_cap;
+    }
+    if (!c.waiter_list_cap) {
+        fprintf(stderr, "eb_chan: ignoring EB_CHAN_WAITER_LIST_CAP=0 (the minimum is 1)\n");
+        c.waiter_list_cap = eb_config.waiter_list_cap;
+    }
+    
+    assert(config_valid(&c));
+    eb_config = c;
+    eb_atomic_barrier();
+}
+
+void eb_config_init() {
+    pthread_once(&g_config_once, config_load_env);
+}
+
+#pragma mark - Public API -
+void eb_chan_config_get(eb_chan_config *out) {
+    assert(out);
+    eb_config_init();
+    *out = eb_config;
+}
+
+bool eb_chan_config_set(const eb_chan_config *config) {
+    assert(config);
+    /* Load the environment first, so that it doesn't override 'config' later */
+    eb_config_init();
+    if (!config_valid(config)) {
+        return false;
+    }
+    
+    eb_config = *config;
+    eb_atomic_barrier();
+    return true;
+}
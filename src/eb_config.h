@@ -0,0 +1,31 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include "eb_chan.h"
+#include "eb_sys.h"
+
+/* The default eb_chan_config.spin_attempts. bench/pingpong.c compares spin-only, park-only and mixed configurations. */
+#ifndef EB_CHAN_SPIN_ATTEMPTS
+    #define EB_CHAN_SPIN_ATTEMPTS 500
+#endif
+
+/* The default eb_chan_config.port_pool_cap */
+#define EB_CONFIG_PORT_POOL_CAP 0x10
+/* The default eb_chan_config.waiter_list_cap */
+#define EB_CONFIG_WAITER_LIST_CAP 16
+
+/* ## Variables */
+/* The current configuration (see eb_chan_config_set()). It's read without synchronization, so a change is observed by
+   other threads eventually. */
+extern eb_chan_config eb_config;
+
+/* ## Functions */
+/* Applies the environment's overrides to eb_config, the first time it's called */
+void eb_config_init();
+
+/* Returns whether a thread that can't make progress until another thread does should yield the CPU, rather than retry
+   immediately */
+static inline bool eb_config_yields() {
+    eb_chan_yield_policy policy = *((volatile eb_chan_yield_policy *)&eb_config.yield_policy);
+    return (policy == eb_chan_yield_auto ? eb_sys_uniprocessor() : policy == eb_chan_yield_always);
+}
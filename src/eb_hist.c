@@ -0,0 +1,70 @@
+#include "eb_hist.h"
+#include <assert.h>
+#include "eb_atomic.h"
+
+static inline size_t bucket_idx(uint64_t val) {
+    static const uint64_t k_sub_count = (1 << EB_HIST_SUB_BITS);
+    
+    /* Small values map directly to buckets */
+    if (val < k_sub_count) {
+        return (size_t)val;
+    }
+    
+    /* Otherwise, the bucket is determined by the position of the most significant bit (the range), and the
+       EB_HIST_SUB_BITS bits below it (the linear position within the range) */
+    unsigned int msb = 63 - __builtin_clzll(val);
+    unsigned int shift = msb - EB_HIST_SUB_BITS;
+    return (size_t)(((shift + 1) << EB_HIST_SUB_BITS) + ((val >> shift) & (k_sub_count - 1)));
+}
+
+/* Returns the largest value that maps to bucket 'idx' */
+static inline uint64_t bucket_max(size_t idx) {
+    static const uint64_t k_sub_count = (1 << EB_HIST_SUB_BITS);
+    
+    if (idx < k_sub_count) {
+        return idx;
+    }
+    
+    unsigned int shift = (unsigned int)(idx >> EB_HIST_SUB_BITS) - 1;
+    uint64_t base = (k_sub_count | (idx & (k_sub_count - 1))) << shift;
+    return base + ((UINT64_C(1) << shift) - 1);
+}
+
+void eb_hist_record(eb_hist *h, eb_nsec val) {
+    assert(h);
+    
+    eb_atomic_add_relaxed(&h->buckets[bucket_idx(val)], 1);
+    eb_atomic_add_relaxed(&h->count, 1);
+    
+    /* Update the max, unless someone beat us to a larger value */
+    for (uint64_t max = eb_atomic_load_relaxed(&h->max); val > max; max = eb_atomic_load_relaxed(&h->max)) {
+        if (eb_atomic_compare_and_swap(&h->max, max, val)) {
+            break;
+        }
+    }
+}
+
+eb_nsec eb_hist_percentile(const eb_hist *h, double pct) {
+    assert(h);
+    
+    uint64_t count = eb_atomic_load_relaxed(&h->count);
+    if (!count) {
+        return 0;
+    }
+    
+    /* The rank of the value we're looking for (1-based) */
+    uint64_t rank = (uint64_t)((pct / 100.0) * count + 0.5);
+    rank = (rank < 1 ? 1 : (rank > count ? count : rank));
+    
+    uint64_t seen = 0;
+    for (size_t i = 0; i < EB_HIST_NBUCKETS; i++) {
+        seen += eb_atomic_load_relaxed(&h->buckets[i]);
+        if (seen >= rank) {
+            /* Don't report more than the largest value that was actually recorded */
+            uint64_t max = eb_atomic_load_relaxed(&h->max);
+            uint64_t r = bucket_max(i);
+            return (r < max ? r : max);
+        }
+    }
+    return eb_atomic_load_relaxed(&h->max);
+}
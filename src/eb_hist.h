@@ -0,0 +1,22 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "eb_nsec.h"
+
+/* A log-linear (HDR-style) histogram of nanosecond values. Each power-of-two range is split into
+   2^EB_HIST_SUB_BITS linear buckets, which bounds the relative error of a reported value to 2^-EB_HIST_SUB_BITS.
+   Recording is lock-free. */
+#define EB_HIST_SUB_BITS 4
+#define EB_HIST_NBUCKETS ((64 - EB_HIST_SUB_BITS + 1) << EB_HIST_SUB_BITS)
+
+/* ## Types */
+typedef struct {
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[EB_HIST_NBUCKETS];
+} eb_hist;
+
+/* ## Functions */
+void eb_hist_record(eb_hist *h, eb_nsec val);
+/* Returns the value at percentile 'pct' (in [0, 100]) of the values recorded so far, or 0 if nothing was recorded */
+eb_nsec eb_hist_percentile(const eb_hist *h, double pct);
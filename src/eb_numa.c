@@ -0,0 +1,201 @@
+#include "eb_numa.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "eb_sys.h"
+#if EB_SYS_LINUX
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+#endif
+#include "eb_assert.h"
+#include "eb_spinlock.h"
+
+#if EB_SYS_LINUX
+/* Values from <numaif.h>, which we don't depend on since it's part of libnuma */
+#define EB_MPOL_PREFERRED 1
+#define EB_MPOL_MF_MOVE (1 << 1)
+/* From <sys/mman.h>, which only declares mremap() and its flags with _GNU_SOURCE */
+#define EB_MREMAP_MAYMOVE 1
+
+#ifndef MAP_ANONYMOUS
+    #define MAP_ANONYMOUS MAP_ANON
+#endif
+
+static size_t page_round(size_t size) {
+    static size_t k_page_size = 0;
+    if (!k_page_size) {
+        long r = sysconf(_SC_PAGESIZE);
+        k_page_size = (r > 0 ? (size_t)r : 4096);
+    }
+    return (size + k_page_size - 1) & ~(k_page_size - 1);
+}
+
+/* Sets the memory policy of the pages containing [ptr, ptr+size) to prefer 'node'. */
+static bool numa_bind(void *ptr, size_t size, int node, unsigned int flags) {
+    if (node < 0 || node >= EB_SYS_MAX_NODES) {
+        return false;
+    }
+    
+    unsigned long mask[EB_SYS_MAX_NODES / (8 * sizeof(unsigned long))];
+    memset(mask, 0, sizeof(mask));
+    mask[node / (8 * sizeof(*mask))] |= (1UL << (node % (8 * sizeof(*mask))));
+    
+    /* mbind() requires a page-aligned address */
+    uintptr_t start = (uintptr_t)ptr & ~(page_round(1) - 1);
+    size_t len = page_round(((uintptr_t)ptr + size) - start);
+    long r = syscall(SYS_mbind, (void *)start, len, EB_MPOL_PREFERRED, mask, (unsigned long)EB_SYS_MAX_NODES + 1, flags);
+    return !r;
+}
+#endif
+
+#if EB_SYS_LINUX
+/* Allocations for a node that are no larger than EB_NUMA_SLAB_MAX are carved from EB_NUMA_CHUNK_SIZE chunks that are
+   bound to the node, in power-of-two size classes starting at EB_NUMA_SLAB_MIN (so each is aligned to its class).
+   Freed ones are kept on their class's free list for reuse, and chunks are never unmapped, so neither path makes a
+   system call once the node's chunks are warm. Larger allocations, and those without a node (which may be moved by
+   eb_numa_move(), so they need pages of their own) are mapped directly. */
+#define EB_NUMA_SLAB_MIN 16
+#define EB_NUMA_SLAB_MAX 2048
+#define EB_NUMA_SLAB_CLASSES 8
+#define EB_NUMA_CHUNK_SIZE (64 * 1024)
+
+typedef struct {
+    eb_spinlock lock;
+    void *free[EB_NUMA_SLAB_CLASSES];   /* Each freed slot stores the next one */
+    uint8_t *cur;                       /* The unused remainder of the current chunk */
+    uint8_t *end;
+} arena;
+static arena g_arenas[EB_SYS_MAX_NODES];
+
+/* Returns the arena for an allocation, or NULL if it should be mapped directly. Fills 'class' with its size class. */
+static arena *arena_for(int node, size_t size, size_t *class) {
+    if (node < 0 || node >= EB_SYS_MAX_NODES || size > EB_NUMA_SLAB_MAX) {
+        return NULL;
+    }
+    size_t c = 0;
+    for (size_t s = EB_NUMA_SLAB_MIN; s < size; s <<= 1) {
+        c++;
+    }
+    *class = c;
+    return &g_arenas[node];
+}
+
+static void *map_pages(size_t size, int node) {
+    void *r = mmap(NULL, page_round(size), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r == MAP_FAILED) {
+        return NULL;
+    }
+    
+    /* Bind before the pages are touched, so that they're faulted in on the right node. Failure isn't fatal (e.g.
+       the kernel lacks NUMA support), it just means the pages are placed by the default policy. */
+    if (node >= 0 && eb_sys_node_count() > 1) {
+        numa_bind(r, size, node, 0);
+    }
+    return r;
+}
+#endif
+
+static void *numa_allocator_alloc(void *ctx, size_t size) {
+    #if EB_SYS_LINUX
+        int node = (int)(intptr_t)ctx;
+        size_t class = 0;
+        arena *a = arena_for(node, size, &class);
+        if (!a) {
+            return map_pages(size, node);
+        }
+        
+        size_t class_size = ((size_t)EB_NUMA_SLAB_MIN << class);
+        void *r = NULL;
+        eb_spinlock_lock(&a->lock);
+            if (a->free[class]) {
+                r = a->free[class];
+                a->free[class] = *((void **)r);
+            } else {
+                if ((size_t)(a->end - a->cur) < class_size) {
+                    /* The remainder of the current chunk is abandoned, which wastes less than EB_NUMA_SLAB_MAX */
+                    uint8_t *chunk = map_pages(EB_NUMA_CHUNK_SIZE, node);
+                    if (chunk) {
+                        a->cur = chunk;
+                        a->end = chunk + EB_NUMA_CHUNK_SIZE;
+                    }
+                }
+                if ((size_t)(a->end - a->cur) >= class_size) {
+                    r = a->cur;
+                    a->cur += class_size;
+                }
+            }
+        eb_spinlock_unlock(&a->lock);
+        return r;
+    #else
+        return malloc(size);
+    #endif
+}
+
+static void numa_allocator_free(void *ctx, void *ptr, size_t size) {
+    #if EB_SYS_LINUX
+        size_t class = 0;
+        arena *a = arena_for((int)(intptr_t)ctx, size, &class);
+        if (!a) {
+            int r = munmap(ptr, page_round(size));
+            eb_assert_or_recover(!r, eb_no_op);
+            return;
+        }
+        
+        eb_spinlock_lock(&a->lock);
+            *((void **)ptr) = a->free[class];
+            a->free[class] = ptr;
+        eb_spinlock_unlock(&a->lock);
+    #else
+        free(ptr);
+    #endif
+}
+
+static void *numa_allocator_realloc(void *ctx, void *ptr, size_t old_size, size_t new_size) {
+    #if EB_SYS_LINUX
+        int node = (int)(intptr_t)ctx;
+        size_t old_class = 0, new_class = 0;
+        arena *old_arena = arena_for(node, old_size, &old_class);
+        arena *new_arena = arena_for(node, new_size, &new_class);
+        if (old_arena && new_arena && old_class == new_class) {
+            return ptr;
+        }
+        
+        if (!old_arena && !new_arena) {
+            if (page_round(old_size) == page_round(new_size)) {
+                return ptr;
+            }
+            /* Resize the mapping in place if possible, which keeps its pages (and their memory policy) rather than
+               copying them */
+            void *r = (void *)syscall(SYS_mremap, ptr, page_round(old_size), page_round(new_size), EB_MREMAP_MAYMOVE);
+            return (r == MAP_FAILED ? NULL : r);
+        }
+        
+        /* Moving between the chunks and a mapping of its own requires a copy */
+        void *r = numa_allocator_alloc(ctx, new_size);
+        if (r) {
+            memcpy(r, ptr, (old_size < new_size ? old_size : new_size));
+            numa_allocator_free(ctx, ptr, old_size);
+        }
+        return r;
+    #else
+        return realloc(ptr, new_size);
+    #endif
+}
+
+eb_chan_allocator eb_numa_allocator(int node) {
+    return (eb_chan_allocator){.alloc = numa_allocator_alloc, .realloc = numa_allocator_realloc, .free = numa_allocator_free, .ctx = (void *)(intptr_t)node};
+}
+
+bool eb_numa_move(void *ptr, size_t size, int node) {
+    assert(ptr);
+    #if EB_SYS_LINUX
+        if (eb_sys_node_count() <= 1) {
+            return true;
+        }
+        return numa_bind(ptr, size, node, EB_MPOL_MF_MOVE);
+    #else
+        return true;
+    #endif
+}
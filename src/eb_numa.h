@@ -0,0 +1,13 @@
+#pragma once
+#include <stddef.h>
+#include <stdbool.h>
+#include "eb_chan.h"
+
+/* ## Functions */
+/* Returns an allocator whose allocations are placed on NUMA node 'node', or left to the default (first-touch) policy if
+   'node' is negative. Small allocations for a node share pages with others for the same node; those for a negative
+   'node' get pages of their own, so that eb_numa_move() migrates nothing else. On systems without NUMA support, this is
+   equivalent to malloc()/realloc()/free(). */
+eb_chan_allocator eb_numa_allocator(int node);
+/* Migrates the pages containing [ptr, ptr+size), which must have been allocated by a NUMA allocator, to 'node' */
+bool eb_numa_move(void *ptr, size_t size, int node);
@@ -3,6 +3,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <string.h>
+#include <sys/mman.h>
 #include "eb_sys.h"
 #if EB_SYS_DARWIN
     #include <mach/mach.h>
@@ -11,19 +12,33 @@
     #include <semaphore.h>
 #endif
 #include "eb_assert.h"
+#include "eb_alloc.h"
 #include "eb_atomic.h"
 #include "eb_spinlock.h"
+#include "eb_config.h"
 #include "eb_time.h"
+#include "eb_probe.h"
 
-#define PORT_POOL_CAP 0x10
 static eb_spinlock g_port_pool_lock = EB_SPINLOCK_INIT;
-static eb_port g_port_pool[PORT_POOL_CAP];
+#if EB_CHAN_LOCKPROF
+    static eb_spinlock_prof g_port_pool_lock_prof;
+#endif
+/* Sized for the largest pool; eb_config.port_pool_cap limits how much of it is used */
+static eb_port g_port_pool[EB_CHAN_PORT_POOL_MAX];
 static size_t g_port_pool_len = 0;
+/* Pool usage (see eb_port_pool_stats()): the hits/misses are protected by g_port_pool_lock, and the number of ports
+   that exist (including pooled ones) is updated atomically */
+static uint64_t g_port_pool_hits = 0;
+static uint64_t g_port_pool_misses = 0;
+static size_t g_port_count = 0;
 
 struct eb_port {
     unsigned int retain_count;
+    /* The allocator that allocated the port */
+    eb_chan_allocator alloc;
     bool sem_valid;
     bool signaled;
+    eb_port_waiter waiter;
     #if EB_SYS_DARWIN
         semaphore_t sem;
     #elif EB_SYS_LINUX
@@ -41,8 +56,8 @@ static void eb_port_free(eb_port p) {
     if (p->sem_valid) {
         /* Determine whether we should clear the reset the port because we're going to try adding the port to our pool. */
         bool reset = false;
-        eb_spinlock_lock(&g_port_pool_lock);
-            reset = (g_port_pool_len < PORT_POOL_CAP);
+        eb_spinlock_lock_prof(&g_port_pool_lock, &g_port_pool_lock_prof);
+            reset = (g_port_pool_len < eb_config.port_pool_cap);
         eb_spinlock_unlock(&g_port_pool_lock);
         
         if (reset) {
@@ -50,8 +65,8 @@ static void eb_port_free(eb_port p) {
         }
         
         /* Now that the port's reset, add it to the pool as long as it'll still fit. */
-        eb_spinlock_lock(&g_port_pool_lock);
-            if (g_port_pool_len < PORT_POOL_CAP) {
+        eb_spinlock_lock_prof(&g_port_pool_lock, &g_port_pool_lock_prof);
+            if (g_port_pool_len < eb_config.port_pool_cap) {
                 g_port_pool[g_port_pool_len] = p;
                 g_port_pool_len++;
                 added_to_pool = true;
@@ -73,7 +88,10 @@ static void eb_port_free(eb_port p) {
     }
     
     if (!added_to_pool) {
-        free(p);
+        /* Copy the allocator out of the port since we're about to free it */
+        eb_chan_allocator alloc = p->alloc;
+        eb_free(&alloc, p, sizeof(*p));
+        eb_atomic_add(&g_port_count, -1);
         p = NULL;
     }
 }
@@ -82,21 +100,27 @@ eb_port eb_port_create() {
     eb_port p = NULL;
     
     /* First try to pop a port out of the pool */
-    eb_spinlock_lock(&g_port_pool_lock);
+    eb_spinlock_lock_prof(&g_port_pool_lock, &g_port_pool_lock_prof);
         if (g_port_pool_len) {
             g_port_pool_len--;
             p = g_port_pool[g_port_pool_len];
+            g_port_pool_hits++;
+        } else {
+            g_port_pool_misses++;
         }
     eb_spinlock_unlock(&g_port_pool_lock);
     
     if (p) {
         /* We successfully popped a port out of the pool */
-        eb_assert_or_bail(!p->retain_count, "Sanity-check failed");
+        eb_sanity_or_bail(!p->retain_count, "Sanity-check failed");
     } else {
         /* We couldn't get a port out of the pool */
-        /* Using calloc so that bytes are zeroed */
-        p = calloc(1, sizeof(*p));
+        /* Using a zeroed allocation so that bytes are zeroed */
+        eb_chan_allocator alloc = eb_alloc_global();
+        p = eb_alloc_zeroed(&alloc, sizeof(*p));
         eb_assert_or_recover(p, goto failed);
+        p->alloc = alloc;
+        eb_atomic_add(&g_port_count, 1);
         
         /* Create the semaphore */
         #if EB_SYS_DARWIN
@@ -109,6 +133,7 @@ eb_port eb_port_create() {
     }
     
     p->sem_valid = true;
+    p->waiter = (eb_port_waiter){.cpu = -1};
     p->retain_count = 1;
     return p;
     failed: {
@@ -130,10 +155,52 @@ void eb_port_release(eb_port p) {
     }
 }
 
-void eb_port_signal(eb_port p) {
+void eb_port_pool_stats(eb_port_pool_usage *out) {
+    assert(out);
+    
+    eb_spinlock_lock_prof(&g_port_pool_lock, &g_port_pool_lock_prof);
+        out->len = g_port_pool_len;
+        out->hits = g_port_pool_hits;
+        out->misses = g_port_pool_misses;
+    eb_spinlock_unlock(&g_port_pool_lock);
+    out->cap = eb_config.port_pool_cap;
+    out->ports = *((volatile size_t *)&g_port_count);
+}
+
+void eb_port_reset(eb_port p) {
+    assert(p);
+    
+    /* The signaler sets 'signaled' before posting the semaphore, so if it's set the post is guaranteed to come and
+       waiting for it won't block for long */
+    if (*((volatile bool *)&p->signaled)) {
+        eb_port_wait(p, eb_nsec_forever);
+    }
+    
+    /* watchdog_reported is left alone since only the watchdog's thread accesses it */
+    p->waiter.cpu = -1;
+    p->waiter.tid = 0;
+    p->waiter.park_time = 0;
+    p->waiter.ops = NULL;
+    p->waiter.nops = 0;
+}
+
+eb_port_waiter *eb_port_waiter_info(eb_port p) {
+    assert(p);
+    return &p->waiter;
+}
+
+bool eb_port_mlock(eb_port p) {
+    assert(p);
+    int r = mlock(p, sizeof(*p));
+    eb_assert_or_recover(!r, return false);
+    return true;
+}
+
+bool eb_port_signal(eb_port p) {
     assert(p);
     
     if (eb_atomic_compare_and_swap(&p->signaled, false, true)) {
+        eb_sys_call_add(eb_sys_call_sem_post);
         #if EB_SYS_DARWIN
             kern_return_t r = semaphore_signal(p->sem);
             eb_assert_or_recover(r == KERN_SUCCESS, eb_no_op);
@@ -141,7 +208,11 @@ void eb_port_signal(eb_port p) {
             int r = sem_post(&p->sem);
             eb_assert_or_recover(!r, eb_no_op);
         #endif
+        /* port: the port that was signaled */
+        eb_probe1(signal, p);
+        return true;
     }
+    return false;
 }
 
 bool eb_port_wait(eb_port p, eb_nsec timeout) {
@@ -150,6 +221,7 @@ bool eb_port_wait(eb_port p, eb_nsec timeout) {
     bool result = false;
     if (timeout == eb_nsec_zero) {
         /* ## Non-blocking */
+        eb_sys_call_add(eb_sys_call_sem_trywait);
         #if EB_SYS_DARWIN
             kern_return_t r = semaphore_timedwait(p->sem, (mach_timespec_t){0, 0});
             eb_assert_or_recover(r == KERN_SUCCESS || r == KERN_OPERATION_TIMED_OUT, eb_no_op);
@@ -164,6 +236,7 @@ bool eb_port_wait(eb_port p, eb_nsec timeout) {
         #endif
     } else if (timeout == eb_nsec_forever) {
         /* ## Blocking */
+        eb_sys_call_add(eb_sys_call_sem_wait);
         #if EB_SYS_DARWIN
             kern_return_t r;
             while ((r = semaphore_wait(p->sem)) == KERN_ABORTED);
@@ -182,6 +255,7 @@ bool eb_port_wait(eb_port p, eb_nsec timeout) {
         eb_nsec start_time = eb_time_now();
         eb_nsec remaining_timeout = timeout;
         for (;;) {
+            eb_sys_call_add(eb_sys_call_sem_timedwait);
             #if EB_SYS_DARWIN
                 /* This needs to be in a loop because semaphore_timedwait() can return KERN_ABORTED, e.g. if the process receives a signal. */
                 mach_timespec_t ts = {.tv_sec = (unsigned int)(remaining_timeout / eb_nsec_per_sec), .tv_nsec = (clock_res_t)(remaining_timeout % eb_nsec_per_sec)};
@@ -203,6 +277,11 @@ bool eb_port_wait(eb_port p, eb_nsec timeout) {
                 
                 ts.tv_sec += (remaining_timeout / eb_nsec_per_sec);
                 ts.tv_nsec += (remaining_timeout % eb_nsec_per_sec);
+                /* sem_timedwait() fails with EINVAL unless tv_nsec is less than a second */
+                if (ts.tv_nsec >= (long)eb_nsec_per_sec) {
+                    ts.tv_sec++;
+                    ts.tv_nsec -= eb_nsec_per_sec;
+                }
                 r = sem_timedwait(&p->sem, &ts);
                 /* The allowed return cases are: success (r==0), timed-out (r==-1, errno==ETIMEDOUT), (r==-1, errno==EINTR) */
                 eb_assert_or_recover(!r || (r == -1 && (errno == ETIMEDOUT || errno == EINTR)), break);
@@ -230,3 +309,19 @@ bool eb_port_wait(eb_port p, eb_nsec timeout) {
     
     return result;
 }
+
+#pragma mark - Public API -
+bool eb_chan_port_pool_lock_stats(eb_chan_lock_counts *out) {
+    assert(out);
+    
+    memset(out, 0, sizeof(*out));
+    #if EB_CHAN_LOCKPROF
+        out->contended = eb_atomic_load_relaxed(&g_port_pool_lock_prof.contended);
+        out->spins = eb_atomic_load_relaxed(&g_port_pool_lock_prof.spins);
+        out->wait_cycles = eb_atomic_load_relaxed(&g_port_pool_lock_prof.wait_ticks);
+        out->wait_ns = eb_time_ticks_to_nsec(out->wait_cycles);
+        return true;
+    #else
+        return false;
+    #endif
+}
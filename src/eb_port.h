@@ -1,13 +1,54 @@
 #pragma once
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "eb_nsec.h"
+#include "eb_chan.h"
 
 typedef struct eb_port *eb_port;
 
+/* The park_time of a waiter that parked while no watchdog was running, so its park wasn't timed */
+#define EB_PORT_PARK_UNTIMED ((eb_nsec)1)
+
+/* Information about the thread that waits on a port, recorded before it parks. Only written by the port's owner,
+   except where noted. */
+typedef struct {
+    int cpu;                    /* The CPU that the waiter last ran on, or -1 if unknown */
+    long tid;                   /* The waiting thread */
+    eb_nsec park_time;          /* When the waiter parked, EB_PORT_PARK_UNTIMED, or 0 if it isn't parked */
+    /* When the park that the watchdog last reported started. Only accessed by the watchdog's thread. */
+    eb_nsec watchdog_reported;
+    /* The ops of the select that the port is registered for; valid while the port is in a channel's port list */
+    eb_chan_op *const *ops;
+    size_t nops;
+} eb_port_waiter;
+
+/* Usage of the pool of ports that are kept for reuse */
+typedef struct {
+    size_t len;         /* Ports in the pool */
+    size_t cap;         /* The pool's capacity */
+    size_t ports;       /* Ports that exist, including pooled ones */
+    uint64_t hits;      /* eb_port_create() calls that were satisfied by the pool */
+    uint64_t misses;    /* eb_port_create() calls that had to create a port */
+} eb_port_pool_usage;
+
 eb_port eb_port_create();
 eb_port eb_port_retain(eb_port p);
 void eb_port_release(eb_port p);
 
-void eb_port_signal(eb_port p);
+/* Fills 'out' with the port pool's usage */
+void eb_port_pool_stats(eb_port_pool_usage *out);
+
+/* Prepares a port that's being reused by its owner for another wait: consumes a stale signal (one that arrived after
+   the port's last wait) so that it can't cause a spurious wakeup, and clears the waiter info */
+void eb_port_reset(eb_port p);
+
+/* Returns the port's waiter info */
+eb_port_waiter *eb_port_waiter_info(eb_port p);
+
+/* Locks the port's memory into RAM */
+bool eb_port_mlock(eb_port p);
+
+/* Returns whether the port was actually signaled, i.e. it wasn't already signaled */
+bool eb_port_signal(eb_port p);
 bool eb_port_wait(eb_port p, eb_nsec timeout);
@@ -0,0 +1,22 @@
+#pragma once
+
+/* USDT (user-level statically-defined tracing) probes, for attaching perf/bpftrace to a running process without
+   recompiling. Each probe compiles to a single nop until a tracer attaches, and every probe belongs to the 'eb_chan'
+   provider (see misc/bpftrace/ for example scripts). Probes are enabled when <sys/sdt.h> (systemtap-sdt-dev) is
+   available; define EB_CHAN_USDT=0 to remove them, or EB_CHAN_USDT=1 to require them. */
+#ifndef EB_CHAN_USDT
+    #if defined(__has_include)
+        #if __has_include(<sys/sdt.h>)
+            #define EB_CHAN_USDT 1
+        #endif
+    #endif
+#endif
+
+#if EB_CHAN_USDT
+    #include <sys/sdt.h>
+    #define eb_probe1(name, a) DTRACE_PROBE1(eb_chan, name, a)
+    #define eb_probe2(name, a, b) DTRACE_PROBE2(eb_chan, name, a, b)
+#else
+    #define eb_probe1(name, a)
+    #define eb_probe2(name, a, b)
+#endif
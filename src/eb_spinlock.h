@@ -1,7 +1,16 @@
 #pragma once
 #include <stdbool.h>
-#include <sched.h>
+#include <stdint.h>
 #include "eb_sys.h"
+#include "eb_config.h"
+#include "eb_atomic.h"
+#include "eb_time.h"
+
+/* Whether contended lock acquisitions are profiled (see eb_chan_lock_stats()). Off by default; when it's off, the
+   profiled lock variants are identical to the unprofiled ones. */
+#ifndef EB_CHAN_LOCKPROF
+    #define EB_CHAN_LOCKPROF 0
+#endif
 
 /* ## Types */
 typedef int eb_spinlock;
@@ -11,17 +20,66 @@ typedef int eb_spinlock;
 #define eb_spinlock_try(l) eb_atomic_compare_and_swap(l, 0, 1)
 
 #define eb_spinlock_lock(l) ({             \
-    if (eb_sys_ncores > 1) {               \
+    if (!eb_config_yields()) {             \
         while (!eb_spinlock_try(l));       \
     } else {                               \
         while (!eb_spinlock_try(l)) {      \
-            sched_yield();                 \
+            eb_sys_yield();                \
         }                                  \
     }                                      \
 })
 
 #define eb_spinlock_unlock(l) eb_atomic_compare_and_swap(l, 1, 0)
 
+/* ## Profiling */
+/* Contention counters for a lock site, updated atomically */
+typedef struct {
+    uint64_t contended;     /* Acquisitions that didn't succeed on the first attempt (including failed _try()s) */
+    uint64_t spins;         /* Failed attempts while acquiring */
+    uint64_t wait_ticks;    /* eb_time_ticks() spent waiting to acquire */
+} eb_spinlock_prof;
+
+#if EB_CHAN_LOCKPROF
+    /* Slow path of eb_spinlock_lock_prof(), after the first attempt failed */
+    static inline void eb_spinlock_lock_contended(eb_spinlock *l, eb_spinlock_prof *prof) {
+        uint64_t start = eb_time_ticks();
+        uint64_t spins = 1;
+        if (!eb_config_yields()) {
+            while (!eb_spinlock_try(l)) {
+                spins++;
+            }
+        } else {
+            while (!eb_spinlock_try(l)) {
+                spins++;
+                eb_sys_yield();
+            }
+        }
+        
+        eb_atomic_add_relaxed(&prof->contended, 1);
+        eb_atomic_add_relaxed(&prof->spins, spins);
+        eb_atomic_add_relaxed(&prof->wait_ticks, eb_time_ticks() - start);
+    }
+    
+    /* Like eb_spinlock_lock()/_try(), but charges contention to 'prof' */
+    #define eb_spinlock_lock_prof(l, prof) ({          \
+        if (!eb_spinlock_try(l)) {                     \
+            eb_spinlock_lock_contended(l, prof);       \
+        }                                              \
+    })
+    
+    #define eb_spinlock_try_prof(l, prof) ({                   \
+        bool __r = eb_spinlock_try(l);                         \
+        if (!__r) {                                            \
+            eb_atomic_add_relaxed(&(prof)->contended, 1);      \
+            eb_atomic_add_relaxed(&(prof)->spins, 1);          \
+        }                                                      \
+        __r;                                                   \
+    })
+#else
+    #define eb_spinlock_lock_prof(l, prof) eb_spinlock_lock(l)
+    #define eb_spinlock_try_prof(l, prof) eb_spinlock_try(l)
+#endif
+
 //#define eb_spinlock_try(l) __sync_lock_test_and_set(l, 1) == 0
 //#define eb_spinlock_lock(l) while (!eb_spinlock_try(l))
 //#define eb_spinlock_unlock(l) __sync_lock_release(l)
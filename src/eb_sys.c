@@ -1,13 +1,54 @@
 #include "eb_sys.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
 #include "eb_assert.h"
 #include "eb_atomic.h"
+#include "eb_time.h"
 
 #if EB_SYS_DARWIN
     #include <mach/mach.h>
 #elif EB_SYS_LINUX
     #include <unistd.h>
+    #include <fcntl.h>
+    #include <sys/syscall.h>
+    #if __x86_64__ || __i386__
+        #include <cpuid.h>
+    #endif
+    /* Declared here since <sched.h> only declares it with _GNU_SOURCE, which can't be defined this late in the
+       amalgamation. Every Linux libc provides it. */
+    int sched_getcpu(void);
 #endif
 
+/* Topology tables, indexed by CPU. Entries are -1 if unknown. */
+typedef struct {
+    size_t ncpus;
+    size_t nnodes;
+    int core[EB_SYS_MAX_CPUS];
+    int l2[EB_SYS_MAX_CPUS];
+    int l3[EB_SYS_MAX_CPUS];
+    int node[EB_SYS_MAX_CPUS];
+} topology;
+
+/* The topology tables, of which g_topology is the current one. Readers use it without synchronization, so a CPU hotplug
+   fills the other table and publishes it in the current one's place. The retired table is only refilled by the next
+   hotplug, at least EB_SYS_REFRESH_INTERVAL later, which is the grace period for readers that were still using it. (A
+   reader that overstays it can only get a stale proximity hint, since every lookup is bounded by the tables' size.) */
+static topology g_topologies[2] = {{.ncpus = 0, .nnodes = 1}, {.ncpus = 0, .nnodes = 1}};
+static topology *g_topology = &g_topologies[0];
+static bool g_topology_published = false;
+static size_t g_ncpus_online = 0;
+/* Whether the CPU supports RDTSCP, which Linux uses to expose the current CPU cheaply */
+static bool g_have_rdtscp = false;
+
+static int g_refreshing = 0;
+static pthread_t g_refresh_thread;
+
 size_t ncores() {
     #if EB_SYS_DARWIN
         host_basic_info_data_t info;
@@ -26,8 +67,526 @@ size_t ncores() {
     #endif
 }
 
+#if EB_SYS_LINUX
+/* Reads a small file into 'buf' as a NUL-terminated string. Uses open()/read() instead of stdio so that we don't
+   allocate, since this can be called from the select slow path. */
+static bool read_file(const char *path, char *buf, size_t cap) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    
+    ssize_t len = read(fd, buf, cap - 1);
+    close(fd);
+    if (len <= 0) {
+        return false;
+    }
+    
+    buf[len] = 0;
+    return true;
+}
+
+/* Reads a file containing a single integer */
+static bool read_long(const char *path, long *out) {
+    char buf[64];
+    if (!read_file(path, buf, sizeof(buf))) {
+        return false;
+    }
+    
+    char *end = NULL;
+    *out = strtol(buf, &end, 10);
+    return (end != buf);
+}
+
+/* Parses the next range from a CPU list (e.g. "0-3,8,10-11"), advancing 's'. Returns false at the end of the list. */
+static bool cpulist_next(const char **s, long *lo, long *hi) {
+    char *end = NULL;
+    *lo = strtol(*s, &end, 10);
+    if (end == *s) {
+        return false;
+    }
+    
+    *hi = *lo;
+    if (*end == '-') {
+        const char *hi_str = end + 1;
+        *hi = strtol(hi_str, &end, 10);
+        if (end == hi_str) {
+            return false;
+        }
+    }
+    
+    *s = (*end == ',' ? end + 1 : end);
+    return true;
+}
+
+/* Returns the first CPU in the CPU list file at 'path', or -1 */
+static int cpulist_first(const char *path) {
+    char buf[1024];
+    if (!read_file(path, buf, sizeof(buf))) {
+        return -1;
+    }
+    
+    const char *s = buf;
+    long lo, hi;
+    return (cpulist_next(&s, &lo, &hi) && lo >= 0 && lo < EB_SYS_MAX_CPUS ? (int)lo : -1);
+}
+
+/* Returns the number of CPUs in the process' affinity mask, or 0 if unknown */
+static size_t affinity_ncores() {
+    unsigned long mask[EB_SYS_MAX_CPUS / (8 * sizeof(unsigned long))];
+    memset(mask, 0, sizeof(mask));
+    /* Using the raw syscall since sched_getaffinity() requires _GNU_SOURCE. It returns the size of the mask that was
+       written. */
+    long r = syscall(SYS_sched_getaffinity, 0, sizeof(mask), mask);
+    if (r <= 0) {
+        return 0;
+    }
+    
+    size_t result = 0;
+    for (size_t i = 0; i < (size_t)r / sizeof(*mask); i++) {
+        result += __builtin_popcountl(mask[i]);
+    }
+    return result;
+}
+
+/* Finds the path of the process' cgroup for 'controller' (or the v2 unified hierarchy if 'controller' is NULL) */
+static bool cgroup_path(const char *controller, char *out, size_t cap) {
+    char buf[4096];
+    if (!read_file("/proc/self/cgroup", buf, sizeof(buf))) {
+        return false;
+    }
+    
+    /* Each line has the form "hierarchy-ID:controller-list:cgroup-path" */
+    for (char *line = buf; line && *line;) {
+        char *next = strchr(line, '\n');
+        if (next) {
+            *next = 0;
+            next++;
+        }
+        
+        char *controllers = strchr(line, ':');
+        char *path = (controllers ? strchr(controllers + 1, ':') : NULL);
+        if (path) {
+            controllers++;
+            *path = 0;
+            path++;
+            
+            bool match = false;
+            if (!controller) {
+                match = !strcmp(line, "0:") || !*controllers;
+            } else {
+                /* Look for 'controller' in the comma-separated controller list */
+                size_t len = strlen(controller);
+                for (const char *c = controllers; c && *c; c = strchr(c, ',') ? strchr(c, ',') + 1 : NULL) {
+                    if (!strncmp(c, controller, len) && (c[len] == ',' || !c[len])) {
+                        match = true;
+                        break;
+                    }
+                }
+            }
+            
+            if (match && strlen(path) < cap) {
+                strcpy(out, path);
+                return true;
+            }
+        }
+        
+        line = next;
+    }
+    
+    return false;
+}
+
+/* Returns the number of cores permitted by the process' cgroup CPU quota (v1 or v2), or 0 if there's no quota */
+static size_t quota_ncores() {
+    char cg[1024];
+    char path[2048];
+    long quota = -1;
+    long period = 0;
+    
+    /* ## cgroup v2: cpu.max contains "$MAX $PERIOD", where $MAX is "max" if there's no limit */
+    const char *v2_roots[] = {"/sys/fs/cgroup", "/sys/fs/cgroup/unified"};
+    if (!cgroup_path(NULL, cg, sizeof(cg))) {
+        strcpy(cg, "/");
+    }
+    for (size_t i = 0; i < sizeof(v2_roots) / sizeof(*v2_roots) && quota < 0; i++) {
+        /* Try the process' own cgroup, and then the root (which is the process' cgroup within a cgroup namespace) */
+        const char *dirs[] = {cg, ""};
+        for (size_t j = 0; j < sizeof(dirs) / sizeof(*dirs) && quota < 0; j++) {
+            char buf[128];
+            snprintf(path, sizeof(path), "%s%s/cpu.max", v2_roots[i], dirs[j]);
+            if (read_file(path, buf, sizeof(buf))) {
+                if (!strncmp(buf, "max", 3)) {
+                    return 0;
+                }
+                char *end = NULL;
+                quota = strtol(buf, &end, 10);
+                period = strtol(end, NULL, 10);
+            }
+        }
+    }
+    
+    /* ## cgroup v1: cpu.cfs_quota_us is -1 if there's no limit */
+    if (quota < 0) {
+        const char *v1_roots[] = {"/sys/fs/cgroup/cpu", "/sys/fs/cgroup/cpu,cpuacct"};
+        if (!cgroup_path("cpu", cg, sizeof(cg))) {
+            strcpy(cg, "/");
+        }
+        for (size_t i = 0; i < sizeof(v1_roots) / sizeof(*v1_roots) && quota < 0; i++) {
+            const char *dirs[] = {cg, ""};
+            for (size_t j = 0; j < sizeof(dirs) / sizeof(*dirs); j++) {
+                snprintf(path, sizeof(path), "%s%s/cpu.cfs_quota_us", v1_roots[i], dirs[j]);
+                if (read_long(path, &quota)) {
+                    snprintf(path, sizeof(path), "%s%s/cpu.cfs_period_us", v1_roots[i], dirs[j]);
+                    if (!read_long(path, &period)) {
+                        quota = -1;
+                    }
+                    break;
+                }
+            }
+        }
+    }
+    
+    if (quota <= 0 || period <= 0) {
+        return 0;
+    }
+    
+    /* Round down (but to at least 1), since spinning with a fractional core just burns the quota */
+    size_t result = (size_t)(quota / period);
+    return (result ? result : 1);
+}
+
+/* Returns the identifier of the cache at 'level' that's shared by 'cpu', or -1 */
+static int cache_id(int cpu, long level) {
+    char path[256];
+    for (int i = 0;; i++) {
+        long l = 0;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, i);
+        if (!read_long(path, &l)) {
+            return -1;
+        }
+        
+        if (l == level) {
+            /* Skip instruction caches */
+            char type[32];
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/type", cpu, i);
+            if (read_file(path, type, sizeof(type)) && !strncmp(type, "Instruction", 11)) {
+                continue;
+            }
+            
+            /* Identify the cache by the first CPU that shares it */
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", cpu, i);
+            return cpulist_first(path);
+        }
+    }
+}
+#endif
+
+/* Determines the number of cores that we can effectively use in parallel */
+static size_t effective_ncores() {
+    size_t result = ncores();
+    #if EB_SYS_LINUX
+        size_t affinity = affinity_ncores();
+        if (affinity && affinity < result) {
+            result = affinity;
+        }
+        
+        size_t quota = quota_ncores();
+        if (quota && quota < result) {
+            result = quota;
+        }
+    #endif
+    /* Assume a uniprocessor if we couldn't determine anything */
+    return (result ? result : 1);
+}
+
+/* Reads the topology into the table that isn't current, and publishes it */
+static void topology_update() {
+    /* The first table is filled in place, since nothing has read its entries yet (they're guarded by ncpus = 0) */
+    topology *t = &g_topologies[0];
+    if (g_topology_published) {
+        t = (g_topology == &g_topologies[0] ? &g_topologies[1] : &g_topologies[0]);
+    }
+    size_t ncpus = 0;
+    t->ncpus = 0;
+    t->nnodes = 1;
+    
+    #if EB_SYS_LINUX
+        long conf = sysconf(_SC_NPROCESSORS_CONF);
+        ncpus = (conf > 0 ? (conf < EB_SYS_MAX_CPUS ? (size_t)conf : EB_SYS_MAX_CPUS) : 0);
+        
+        char path[256];
+        for (size_t cpu = 0; cpu < ncpus; cpu++) {
+            /* Identify the physical core by the first of its hyperthreads */
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%zu/topology/thread_siblings_list", cpu);
+            t->core[cpu] = cpulist_first(path);
+            t->l2[cpu] = cache_id((int)cpu, 2);
+            t->l3[cpu] = cache_id((int)cpu, 3);
+            t->node[cpu] = -1;
+        }
+        
+        /* Assign each CPU its NUMA node from the nodes' CPU lists */
+        char nodes[256];
+        if (read_file("/sys/devices/system/node/online", nodes, sizeof(nodes))) {
+            const char *s = nodes;
+            long node_lo, node_hi;
+            while (cpulist_next(&s, &node_lo, &node_hi)) {
+                if (node_hi >= (long)t->nnodes) {
+                    t->nnodes = (node_hi < EB_SYS_MAX_NODES ? (size_t)node_hi + 1 : EB_SYS_MAX_NODES);
+                }
+                for (long node = node_lo; node <= node_hi; node++) {
+                    char cpus[1024];
+                    snprintf(path, sizeof(path), "/sys/devices/system/node/node%ld/cpulist", node);
+                    if (!read_file(path, cpus, sizeof(cpus))) {
+                        continue;
+                    }
+                    
+                    const char *cs = cpus;
+                    long lo, hi;
+                    while (cpulist_next(&cs, &lo, &hi)) {
+                        for (long cpu = lo; cpu <= hi && cpu < (long)ncpus; cpu++) {
+                            t->node[cpu] = (int)node;
+                        }
+                    }
+                }
+            }
+        } else {
+            /* No NUMA support, so everything's on node 0 */
+            for (size_t cpu = 0; cpu < ncpus; cpu++) {
+                t->node[cpu] = 0;
+            }
+        }
+    #endif
+    
+    /* Make the entries visible before ncpus (which guards them), and ncpus before the table itself */
+    eb_atomic_barrier();
+    t->ncpus = ncpus;
+    eb_atomic_barrier();
+    *((topology *volatile *)&g_topology) = t;
+    g_topology_published = true;
+}
+
+/* Returns the current topology, which remains unchanged for at least EB_SYS_REFRESH_INTERVAL */
+static inline const topology *topology_current() {
+    return *((topology *volatile *)&g_topology);
+}
+
+/* Periodically re-evaluates eb_sys_ncores and the topology, which reads files (e.g. the cgroup's CPU quota), so that
+   no thread using channels pays for it */
+static void *refresh_thread(void *arg) {
+    for (;;) {
+        struct timespec ts = {.tv_sec = EB_SYS_REFRESH_INTERVAL / eb_nsec_per_sec,
+            .tv_nsec = EB_SYS_REFRESH_INTERVAL % eb_nsec_per_sec};
+        nanosleep(&ts, NULL);
+        
+        /* The topology only changes when CPUs are hotplugged, so only re-evaluate it then since it's comparatively
+           expensive */
+        size_t online = ncores();
+        if (online != g_ncpus_online) {
+            topology_update();
+            g_ncpus_online = online;
+        }
+        *((volatile size_t *)&eb_sys_ncores) = effective_ncores();
+    }
+    return NULL;
+}
+
 void eb_sys_init() {
     if (!eb_sys_ncores) {
-        eb_atomic_compare_and_swap(&eb_sys_ncores, 0, ncores());
+        /* Only one thread performs the initial evaluation; the others wait for it so that eb_sys_ncores is valid
+           when we return. */
+        if (eb_atomic_compare_and_swap(&g_refreshing, 0, 1)) {
+            if (!eb_sys_ncores) {
+                g_ncpus_online = ncores();
+                #if EB_SYS_LINUX && (__x86_64__ || __i386__)
+                    unsigned int eax, ebx, ecx, edx;
+                    g_have_rdtscp = (__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) && (edx & (1 << 27)));
+                #endif
+                topology_update();
+                eb_atomic_barrier();
+                eb_atomic_compare_and_swap(&eb_sys_ncores, 0, effective_ncores());
+                
+                /* If the thread can't be created, the initial evaluation stands */
+                int r = pthread_create(&g_refresh_thread, NULL, refresh_thread, NULL);
+                eb_assert_or_recover(!r, eb_no_op);
+                if (!r) {
+                    pthread_detach(g_refresh_thread);
+                }
+            }
+            eb_atomic_compare_and_swap(&g_refreshing, 1, 0);
+        } else {
+            while (!*((volatile size_t *)&eb_sys_ncores));
+        }
+    }
+}
+
+long eb_sys_thread_id() {
+    #if EB_SYS_DARWIN
+        uint64_t tid = 0;
+        pthread_threadid_np(NULL, &tid);
+        return (long)tid;
+    #elif EB_SYS_LINUX
+        /* Using the raw syscall since gettid() requires _GNU_SOURCE */
+        return syscall(SYS_gettid);
+    #endif
+}
+
+#pragma mark - System call accounting -
+#if EB_CHAN_SYSCALL_STATS
+    /* Each thread counts its calls in thread-local storage, which only it writes, so counting needs no atomic
+       read-modify-writes. The threads' counters are listed so that they can be summed when they're read, and a thread's
+       counts are folded into g_calls_exited when it exits. */
+    typedef struct call_counter call_counter;
+    struct call_counter {
+        call_counter *prev;
+        call_counter *next;
+        bool registered;
+        uint64_t counts[eb_sys_call_count];
+    };
+    static __thread call_counter t_calls;
+    static call_counter *g_calls = NULL;
+    static uint64_t g_calls_exited[eb_sys_call_count];
+    static int g_calls_lock = 0;
+    static pthread_once_t g_calls_key_once = PTHREAD_ONCE_INIT;
+    static pthread_key_t g_calls_key;
+    
+    /* Guards the list of counters. eb_spinlock can't be used here since it counts its yields. */
+    static void calls_lock() {
+        while (!eb_atomic_compare_and_swap(&g_calls_lock, 0, 1)) {
+            sched_yield();
+        }
+    }
+    
+    static void calls_unlock() {
+        eb_atomic_compare_and_swap(&g_calls_lock, 1, 0);
+    }
+    
+    /* Called when a thread exits, to fold its counts into g_calls_exited before its thread-local storage goes away */
+    static void calls_cleanup(void *arg) {
+        call_counter *c = arg;
+        calls_lock();
+            if (c->prev) {
+                c->prev->next = c->next;
+            } else {
+                g_calls = c->next;
+            }
+            if (c->next) {
+                c->next->prev = c->prev;
+            }
+            for (size_t i = 0; i < eb_sys_call_count; i++) {
+                g_calls_exited[i] += c->counts[i];
+                c->counts[i] = 0;
+            }
+            c->registered = false;
+        calls_unlock();
+    }
+    
+    static void calls_key_create() {
+        int r = pthread_key_create(&g_calls_key, calls_cleanup);
+        eb_assert_or_bail(!r, "pthread_key_create() failed");
+    }
+    
+    /* Lists the current thread's counter, the first time it counts a call */
+    static void calls_register() {
+        call_counter *c = &t_calls;
+        c->registered = true;
+        pthread_once(&g_calls_key_once, calls_key_create);
+        int r = pthread_setspecific(g_calls_key, c);
+        eb_assert_or_recover(!r, return);
+        
+        calls_lock();
+            c->prev = NULL;
+            c->next = g_calls;
+            if (g_calls) {
+                g_calls->prev = c;
+            }
+            g_calls = c;
+        calls_unlock();
+    }
+    
+    void eb_sys_call_add(eb_sys_call call) {
+        if (!t_calls.registered) {
+            calls_register();
+        }
+        eb_atomic_store_relaxed(&t_calls.counts[call], t_calls.counts[call] + 1);
+    }
+    
+    void eb_sys_call_counts(uint64_t counts[eb_sys_call_count]) {
+        calls_lock();
+            memcpy(counts, g_calls_exited, eb_sys_call_count * sizeof(*counts));
+            for (call_counter *c = g_calls; c; c = c->next) {
+                for (size_t i = 0; i < eb_sys_call_count; i++) {
+                    counts[i] += eb_atomic_load_relaxed(&c->counts[i]);
+                }
+            }
+        calls_unlock();
+    }
+#endif
+
+void eb_sys_yield() {
+    eb_sys_call_add(eb_sys_call_yield);
+    sched_yield();
+}
+
+#pragma mark - Topology -
+int eb_sys_cpu_current() {
+    #if EB_SYS_LINUX
+        #if __x86_64__ || __i386__
+            /* Linux stores the CPU number in the low 12 bits of TSC_AUX, which RDTSCP reads without a syscall */
+            if (g_have_rdtscp) {
+                unsigned int aux = 0;
+                __builtin_ia32_rdtscp(&aux);
+                return (int)(aux & 0xfff);
+            }
+        #endif
+        
+        /* sched_getcpu() reads the CPU via the vDSO (or rseq), unlike the raw getcpu syscall */
+        int cpu = sched_getcpu();
+        return (cpu >= 0 && cpu < EB_SYS_MAX_CPUS ? cpu : -1);
+    #else
+        return -1;
+    #endif
+}
+
+size_t eb_sys_node_count() {
+    return topology_current()->nnodes;
+}
+
+int eb_sys_cpu_core(int cpu) {
+    const topology *t = topology_current();
+    return (cpu >= 0 && (size_t)cpu < t->ncpus ? t->core[cpu] : -1);
+}
+
+int eb_sys_cpu_l2(int cpu) {
+    const topology *t = topology_current();
+    return (cpu >= 0 && (size_t)cpu < t->ncpus ? t->l2[cpu] : -1);
+}
+
+int eb_sys_cpu_l3(int cpu) {
+    const topology *t = topology_current();
+    return (cpu >= 0 && (size_t)cpu < t->ncpus ? t->l3[cpu] : -1);
+}
+
+int eb_sys_cpu_node(int cpu) {
+    const topology *t = topology_current();
+    return (cpu >= 0 && (size_t)cpu < t->ncpus ? t->node[cpu] : -1);
+}
+
+int eb_sys_cpu_proximity(int a, int b) {
+    /* Load the table once, so that both CPUs are compared against the same topology */
+    const topology *t = topology_current();
+    if (a < 0 || b < 0 || (size_t)a >= t->ncpus || (size_t)b >= t->ncpus) {
+        return 0;
+    }
+    
+    if (a == b || (t->core[a] >= 0 && t->core[a] == t->core[b])) {
+        return 4;
+    } else if (t->l2[a] >= 0 && t->l2[a] == t->l2[b]) {
+        return 3;
+    } else if (t->l3[a] >= 0 && t->l3[a] == t->l3[b]) {
+        return 2;
+    } else if (t->node[a] >= 0 && t->node[a] == t->node[b]) {
+        return 1;
     }
+    return 0;
 }
@@ -1,5 +1,8 @@
 #pragma once
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include "eb_nsec.h"
 
 #if __MACH__
     #define EB_SYS_DARWIN 1
@@ -9,9 +12,78 @@
     #error Unsupported system
 #endif
 
+/* The maximum number of CPUs whose topology is tracked */
+#define EB_SYS_MAX_CPUS 1024
+/* The maximum number of NUMA nodes that are tracked */
+#define EB_SYS_MAX_NODES 64
+/* The interval at which the machine's state is re-evaluated (see eb_sys_ncores) */
+#define EB_SYS_REFRESH_INTERVAL (eb_nsec_per_sec)
+
+/* Whether the system calls that eb_chan makes are counted (see eb_chan_syscall_stats()). Defining
+   EB_CHAN_SYSCALL_STATS=0 removes the counting entirely. */
+#ifndef EB_CHAN_SYSCALL_STATS
+    #define EB_CHAN_SYSCALL_STATS 1
+#endif
+
+/* Whether the process is assumed to be able to use more than one core, which resolves the single-core checks on the hot
+   paths at compile time (see eb_sys_uniprocessor()). A build with EB_CHAN_ASSUME_MULTICORE=1 keeps working on a single
+   core, but it spins where it would otherwise yield, unless eb_chan_config.yield_policy says to yield. */
+#ifndef EB_CHAN_ASSUME_MULTICORE
+    #define EB_CHAN_ASSUME_MULTICORE 0
+#endif
+
+/* ## Types */
+/* The system calls that are counted */
+typedef enum {
+    eb_sys_call_sem_post,       /* sem_post()/semaphore_signal() */
+    eb_sys_call_sem_wait,       /* sem_wait()/semaphore_wait() */
+    eb_sys_call_sem_timedwait,  /* sem_timedwait()/semaphore_timedwait(), with a non-zero timeout */
+    eb_sys_call_sem_trywait,    /* sem_trywait()/semaphore_timedwait(), with a zero timeout */
+    eb_sys_call_yield,          /* sched_yield() */
+    eb_sys_call_op,             /* Not a system call: completed ops, which the system calls are reported relative to */
+    eb_sys_call_count
+} eb_sys_call;
+
 /* ## Variables */
-/* Returns the number of logical cores on the machine. _init must be called for this to be valid! */
+/* Returns the number of cores that the process can effectively use in parallel: the number of logical cores on the
+   machine, limited by the process' CPU affinity and its cgroup CPU quota. This drives the spin-vs-yield decisions, and
+   is re-evaluated periodically by a thread that _init starts. _init must be called for this to be valid! */
 size_t eb_sys_ncores;
 
 /* ## Functions */
+/* Returns whether the process can only use one core, in which case spinning is pointless */
+#if EB_CHAN_ASSUME_MULTICORE
+    #define eb_sys_uniprocessor() false
+#else
+    #define eb_sys_uniprocessor() (eb_sys_ncores == 1)
+#endif
+
 void eb_sys_init();
+
+/* Counts a call to 'call'. _counts() fills 'counts' with the totals, indexed by eb_sys_call. */
+#if EB_CHAN_SYSCALL_STATS
+    void eb_sys_call_add(eb_sys_call call);
+    void eb_sys_call_counts(uint64_t counts[eb_sys_call_count]);
+#else
+    #define eb_sys_call_add(call) ((void)0)
+#endif
+/* Yields the CPU via sched_yield(), counting the call */
+void eb_sys_yield();
+
+/* Returns an identifier for the calling thread that matches what the OS reports (the TID on Linux) */
+long eb_sys_thread_id();
+
+/* ## Topology */
+/* Returns the CPU that the calling thread is running on, or -1 if unknown */
+int eb_sys_cpu_current();
+/* Returns the number of NUMA nodes (1 if the machine isn't NUMA) */
+size_t eb_sys_node_count();
+/* Return an identifier for the physical core/L2 cache/L3 cache/NUMA node of 'cpu', such that CPUs sharing the
+   resource have equal identifiers. Returns -1 if 'cpu' is invalid or the topology is unknown. */
+int eb_sys_cpu_core(int cpu);
+int eb_sys_cpu_l2(int cpu);
+int eb_sys_cpu_l3(int cpu);
+int eb_sys_cpu_node(int cpu);
+/* Returns how closely CPUs 'a' and 'b' share resources: 4 if they share a physical core, 3 if they share an L2 cache,
+   2 if they share an L3 cache, 1 if they share a NUMA node, and 0 otherwise (or if either is unknown) */
+int eb_sys_cpu_proximity(int a, int b);
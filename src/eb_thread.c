@@ -0,0 +1,220 @@
+#include "eb_thread.h"
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+#include "eb_chan.h"
+#include "eb_alloc.h"
+#include "eb_assert.h"
+#include "eb_atomic.h"
+#include "eb_spinlock.h"
+#include "eb_sys.h"
+#include "eb_time.h"
+#include "eb_trace.h"
+
+static __thread eb_thread t_thread;
+static pthread_once_t g_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_key;
+static unsigned int g_next_stats_shard = 0;
+
+int eb_thread_accounting = 0;
+/* Every thread's accounting, and the accumulated accounting of threads that exited */
+static eb_thread_acct *g_accts = NULL;
+static eb_thread_acct g_accts_exited;
+static eb_spinlock g_accts_lock = EB_SPINLOCK_INIT;
+
+/* Called when a thread exits, to release the resources that eb_chan_thread_prepare()/eb_thread_account() created */
+static void thread_cleanup(void *arg) {
+    eb_thread *t = arg;
+    if (t->port) {
+        eb_port_release(t->port);
+        t->port = NULL;
+    }
+    
+    if (t->acct) {
+        /* Fold the thread's accounting into the exited threads', and make it available to be adopted */
+        eb_spinlock_lock(&g_accts_lock);
+            for (size_t i = 0; i < 2; i++) {
+                g_accts_exited.selects[i] += t->acct->selects[i];
+                for (size_t ii = 0; ii < eb_thread_phase_count; ii++) {
+                    g_accts_exited.ticks[i][ii] += t->acct->ticks[i][ii];
+                }
+            }
+            t->acct->in_use = false;
+        eb_spinlock_unlock(&g_accts_lock);
+        t->acct = NULL;
+    }
+}
+
+static void key_create() {
+    int r = pthread_key_create(&g_key, thread_cleanup);
+    eb_assert_or_bail(!r, "pthread_key_create() failed");
+}
+
+/* Registers thread_cleanup() to be called when the current thread exits */
+static bool cleanup_register(eb_thread *t) {
+    pthread_once(&g_key_once, key_create);
+    int r = pthread_setspecific(g_key, t);
+    eb_assert_or_recover(!r, return false);
+    return true;
+}
+
+/* Gives the current thread its accounting, adopting that of an exited thread if possible */
+static bool acct_create(eb_thread *t) {
+    eb_thread_acct *a = NULL;
+    eb_spinlock_lock(&g_accts_lock);
+        for (eb_thread_acct *i = g_accts; i; i = i->next) {
+            if (!i->in_use) {
+                a = i;
+                memset(a->selects, 0, sizeof(a->selects));
+                memset(a->ticks, 0, sizeof(a->ticks));
+                a->in_use = true;
+                break;
+            }
+        }
+    eb_spinlock_unlock(&g_accts_lock);
+    
+    if (!a) {
+        eb_chan_allocator alloc = eb_alloc_global();
+        a = eb_alloc_zeroed(&alloc, sizeof(*a));
+        eb_assert_or_recover(a, return false);
+        a->in_use = true;
+        
+        eb_spinlock_lock(&g_accts_lock);
+            a->next = g_accts;
+            g_accts = a;
+        eb_spinlock_unlock(&g_accts_lock);
+    }
+    
+    t->acct = a;
+    return cleanup_register(t);
+}
+
+eb_thread *eb_thread_current() {
+    return &t_thread;
+}
+
+unsigned int eb_thread_stats_shard(unsigned int nshards) {
+    /* Assign shards round-robin as threads first use them */
+    if (!t_thread.stats_shard) {
+        t_thread.stats_shard = eb_atomic_add(&g_next_stats_shard, 1);
+    }
+    return (t_thread.stats_shard - 1) % nshards;
+}
+
+long eb_thread_id() {
+    if (!t_thread.tid) {
+        t_thread.tid = eb_sys_thread_id();
+    }
+    return t_thread.tid;
+}
+
+void eb_thread_check_alloc() {
+    eb_assert_or_bail(!(t_thread.strict && t_thread.in_hot_path), "Allocation in the hot path after eb_chan_thread_prepare()");
+}
+
+void eb_thread_account(bool timed_out, const uint64_t ticks[eb_thread_phase_count]) {
+    eb_thread *t = &t_thread;
+    if (!t->acct && !acct_create(t)) {
+        return;
+    }
+    
+    /* We're the only writer, but other threads read while aggregating */
+    eb_atomic_add_relaxed(&t->acct->selects[timed_out], 1);
+    for (size_t i = 0; i < eb_thread_phase_count; i++) {
+        eb_atomic_add_relaxed(&t->acct->ticks[timed_out][i], ticks[i]);
+    }
+}
+
+#if EB_CHAN_BLOCKED_TIME
+    static void acct_add(eb_chan_thread_times *out, const eb_thread_acct *a) {
+        eb_chan_phase_times *times[2] = {&out->completed, &out->timed_out};
+        for (size_t i = 0; i < 2; i++) {
+            times[i]->selects += eb_atomic_load_relaxed(&a->selects[i]);
+            times[i]->spin += eb_time_ticks_to_nsec(eb_atomic_load_relaxed(&a->ticks[i][eb_thread_phase_spin]));
+            times[i]->park += eb_time_ticks_to_nsec(eb_atomic_load_relaxed(&a->ticks[i][eb_thread_phase_park]));
+            times[i]->wake += eb_time_ticks_to_nsec(eb_atomic_load_relaxed(&a->ticks[i][eb_thread_phase_wake]));
+        }
+    }
+#endif
+
+#pragma mark - Public API -
+bool eb_chan_thread_prepare(unsigned int flags) {
+    /* Initialize eb_sys so that eb_sys_ncores is valid. */
+    eb_sys_init();
+    
+    eb_thread *t = &t_thread;
+    if (!t->port) {
+        t->port = eb_port_create();
+        eb_assert_or_recover(t->port, return false);
+        
+        /* Register our thread-exit handler, which releases our port */
+        bool r = cleanup_register(t);
+        eb_assert_or_recover(r, eb_port_release(t->port); t->port = NULL; return false);
+    }
+    
+    #if EB_CHAN_BLOCKED_TIME
+        /* Create the thread's accounting now, so that enabling accounting later doesn't allocate in the hot path */
+        if (!t->acct) {
+            bool r = acct_create(t);
+            eb_assert_or_recover(r, return false);
+        }
+    #endif
+    
+    #if EB_CHAN_TRACE
+        /* Give the thread its flight recorder ring now, so that recording events doesn't allocate */
+        bool traced = eb_trace_thread_prepare();
+        eb_assert_or_recover(traced, return false);
+    #endif
+    
+    if (flags & eb_chan_prepare_mlock) {
+        bool r = eb_port_mlock(t->port);
+        eb_assert_or_recover(r, return false);
+    }
+    
+    t->strict = (flags & eb_chan_prepare_strict);
+    return true;
+}
+
+bool eb_chan_blocked_time_enable() {
+    #if EB_CHAN_BLOCKED_TIME
+        eb_time_ticks_init();
+        eb_atomic_barrier();
+        eb_thread_accounting = 1;
+        return true;
+    #else
+        return false;
+    #endif
+}
+
+bool eb_chan_thread_blocked_time(eb_chan_thread_times *out) {
+    assert(out);
+    
+    memset(out, 0, sizeof(*out));
+    #if EB_CHAN_BLOCKED_TIME
+        if (t_thread.acct) {
+            acct_add(out, t_thread.acct);
+        }
+        return eb_thread_accounting;
+    #else
+        return false;
+    #endif
+}
+
+bool eb_chan_all_blocked_time(eb_chan_thread_times *out) {
+    assert(out);
+    
+    memset(out, 0, sizeof(*out));
+    #if EB_CHAN_BLOCKED_TIME
+        eb_spinlock_lock(&g_accts_lock);
+            acct_add(out, &g_accts_exited);
+            for (const eb_thread_acct *a = g_accts; a; a = a->next) {
+                if (a->in_use) {
+                    acct_add(out, a);
+                }
+            }
+        eb_spinlock_unlock(&g_accts_lock);
+        return eb_thread_accounting;
+    #else
+        return false;
+    #endif
+}
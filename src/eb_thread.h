@@ -0,0 +1,60 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "eb_port.h"
+
+/* Whether blocked-time accounting is compiled in (see eb_chan_blocked_time_enable()). Defining EB_CHAN_BLOCKED_TIME=0
+   removes it entirely. */
+#ifndef EB_CHAN_BLOCKED_TIME
+    #define EB_CHAN_BLOCKED_TIME 1
+#endif
+
+/* ## Types */
+/* The phases of a blocking select that are accounted */
+typedef enum {
+    eb_thread_phase_spin,   /* Trying ops without being parked */
+    eb_thread_phase_park,   /* Parked in eb_port_wait() */
+    eb_thread_phase_wake,   /* From the last wakeup until an op completed */
+    eb_thread_phase_count
+} eb_thread_phase;
+
+/* A thread's accumulated blocked time, in ticks, indexed by whether the select timed out and by phase. Registered
+   globally so that it can be aggregated across threads. */
+typedef struct eb_thread_acct eb_thread_acct;
+struct eb_thread_acct {
+    eb_thread_acct *next;
+    bool in_use;
+    uint64_t selects[2];
+    uint64_t ticks[2][eb_thread_phase_count];
+};
+
+/* Per-thread state. Lives in thread-local storage, so accessing it never allocates. */
+typedef struct {
+    /* The port that's reused by every blocking select on this thread (see eb_chan_thread_prepare()) */
+    eb_port port;
+    /* Whether the hot path should abort if it calls the allocator */
+    bool strict;
+    /* Whether the thread is currently within a send/recv/select */
+    bool in_hot_path;
+    /* One more than the index of the statistics shard that the thread updates, or 0 if unassigned */
+    unsigned int stats_shard;
+    /* The thread's ID (see eb_sys_thread_id()), or 0 if it hasn't been determined */
+    long tid;
+    /* The thread's blocked-time accounting, allocated when the thread first blocks after accounting is enabled */
+    eb_thread_acct *acct;
+} eb_thread;
+
+/* ## Variables */
+/* Non-zero while blocked-time accounting is enabled */
+extern int eb_thread_accounting;
+
+/* ## Functions */
+eb_thread *eb_thread_current();
+/* Returns the index of the statistics shard (less than 'nshards') that the current thread updates */
+unsigned int eb_thread_stats_shard(unsigned int nshards);
+/* Returns the current thread's ID, caching it */
+long eb_thread_id();
+/* Bails if the current thread is prepared in strict mode and is within the hot path */
+void eb_thread_check_alloc();
+/* Adds a blocking select's phase times (in ticks) to the current thread's accounting */
+void eb_thread_account(bool timed_out, const uint64_t ticks[eb_thread_phase_count]);
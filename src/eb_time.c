@@ -7,7 +7,12 @@
 #elif EB_SYS_LINUX
     #include <time.h>
 #endif
+#if __x86_64__ || __i386__
+    #include <cpuid.h>
+    #define EB_TIME_TSC 1
+#endif
 #include "eb_assert.h"
+#include "eb_alloc.h"
 #include "eb_atomic.h"
 
 eb_nsec eb_time_now() {
@@ -15,7 +20,9 @@ eb_nsec eb_time_now() {
     /* Initialize k_timebase_info, thread-safely */
     static mach_timebase_info_t k_timebase_info = NULL;
     if (!k_timebase_info) {
-        mach_timebase_info_t timebase_info = malloc(sizeof(*timebase_info));
+        eb_chan_allocator alloc = eb_alloc_global();
+        mach_timebase_info_t timebase_info = eb_alloc(&alloc, sizeof(*timebase_info));
+        eb_assert_or_recover(timebase_info, return 0);
         kern_return_t r = mach_timebase_info(timebase_info);
         eb_assert_or_recover(r == KERN_SUCCESS, return 0);
         
@@ -23,7 +30,7 @@ eb_nsec eb_time_now() {
         eb_atomic_barrier();
         
         if (!eb_atomic_compare_and_swap(&k_timebase_info, NULL, timebase_info)) {
-            free(timebase_info);
+            eb_free(&alloc, timebase_info, sizeof(*timebase_info));
             timebase_info = NULL;
         }
     }
@@ -37,3 +44,55 @@ eb_nsec eb_time_now() {
     return ((uint64_t)ts.tv_sec * eb_nsec_per_sec) + ts.tv_nsec;
 #endif
 }
+
+enum {
+    ticks_uninitialized,
+    ticks_initializing,
+    ticks_tsc,
+    ticks_clock,
+};
+static int g_ticks_state = ticks_uninitialized;
+static double g_nsec_per_tick = 1;
+
+void eb_time_ticks_init() {
+    if (eb_atomic_compare_and_swap(&g_ticks_state, ticks_uninitialized, ticks_initializing)) {
+        int state = ticks_clock;
+        #if EB_TIME_TSC
+            /* Only use the TSC if it's invariant (it ticks at a constant rate regardless of frequency scaling and sleep
+               states), which is reported by CPUID leaf 0x80000007 */
+            unsigned int eax, ebx, ecx, edx;
+            if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1 << 8))) {
+                /* Calibrate the TSC against our monotonic clock */
+                static const eb_nsec k_calibration_time = 2000000;
+                eb_nsec start = eb_time_now();
+                uint64_t start_ticks = __builtin_ia32_rdtsc();
+                eb_nsec elapsed;
+                while ((elapsed = eb_time_now() - start) < k_calibration_time);
+                uint64_t elapsed_ticks = __builtin_ia32_rdtsc() - start_ticks;
+                if (elapsed_ticks) {
+                    g_nsec_per_tick = (double)elapsed / elapsed_ticks;
+                    state = ticks_tsc;
+                }
+            }
+        #endif
+        
+        eb_atomic_barrier();
+        g_ticks_state = state;
+    } else {
+        /* Wait for the thread that's calibrating */
+        while (*((volatile int *)&g_ticks_state) == ticks_initializing);
+    }
+}
+
+uint64_t eb_time_ticks() {
+    #if EB_TIME_TSC
+        if (g_ticks_state == ticks_tsc) {
+            return __builtin_ia32_rdtsc();
+        }
+    #endif
+    return eb_time_now();
+}
+
+eb_nsec eb_time_ticks_to_nsec(uint64_t ticks) {
+    return (g_ticks_state == ticks_tsc ? (eb_nsec)(ticks * g_nsec_per_tick) : ticks);
+}
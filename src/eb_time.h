@@ -1,5 +1,13 @@
 #pragma once
+#include <stdint.h>
 #include "eb_nsec.h"
 
 /* Returns the number of nanoseconds since an arbitrary point in time (usually the machine's boot time) */
 eb_nsec eb_time_now();
+
+/* _ticks() returns a cheap monotonic timestamp in arbitrary units (the invariant TSC on x86, where available), for
+   measuring short intervals. _ticks_init() must be called before _ticks() is used; it's idempotent, but the first call
+   calibrates the tick rate, which takes a few milliseconds. _ticks_to_nsec() converts a difference of ticks. */
+void eb_time_ticks_init();
+uint64_t eb_time_ticks();
+eb_nsec eb_time_ticks_to_nsec(uint64_t ticks);
@@ -0,0 +1,258 @@
+#include "eb_trace.h"
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include "eb_chan.h"
+#include "eb_alloc.h"
+#include "eb_assert.h"
+#include "eb_atomic.h"
+#include "eb_spinlock.h"
+#include "eb_sys.h"
+#include "eb_time.h"
+
+typedef struct {
+    uint64_t ticks;
+    const void *chan;
+    const char *label;
+    uint32_t arg;
+    uint32_t type;
+} event;
+
+/* A thread's ring of events. Only the owning thread writes to it; readers use 'head' to detect events that were
+   overwritten while they were being read. Rings are never freed: when a thread exits its ring is kept (so that its
+   events can still be dumped) until another thread adopts it. */
+typedef struct ring ring;
+struct ring {
+    ring *next;
+    bool in_use;
+    long tid;
+    /* The total number of events that have been recorded; the next event goes in events[head % EB_TRACE_RING_CAP] */
+    uint64_t head;
+    event events[EB_TRACE_RING_CAP];
+};
+
+int eb_trace_active = 0;
+static ring *g_rings = NULL;
+static eb_spinlock g_rings_lock = EB_SPINLOCK_INIT;
+static __thread ring *t_ring = NULL;
+static pthread_once_t g_ring_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_ring_key;
+
+/* Called when a thread with a ring exits, so that the ring can be adopted by another thread */
+static void ring_cleanup(void *arg) {
+    ring *r = arg;
+    eb_spinlock_lock(&g_rings_lock);
+        r->in_use = false;
+    eb_spinlock_unlock(&g_rings_lock);
+}
+
+static void ring_key_create() {
+    int r = pthread_key_create(&g_ring_key, ring_cleanup);
+    eb_assert_or_bail(!r, "pthread_key_create() failed");
+}
+
+/* Returns the calling thread's ring, adopting or allocating one if necessary */
+static ring *ring_current() {
+    if (t_ring) {
+        return t_ring;
+    }
+    
+    /* Adopt the ring of a thread that exited */
+    ring *r = NULL;
+    eb_spinlock_lock(&g_rings_lock);
+        for (ring *i = g_rings; i; i = i->next) {
+            if (!i->in_use) {
+                r = i;
+                r->in_use = true;
+                break;
+            }
+        }
+    eb_spinlock_unlock(&g_rings_lock);
+    
+    if (r) {
+        eb_atomic_store_release(&r->head, 0);
+    } else {
+        eb_chan_allocator alloc = eb_alloc_global();
+        r = eb_alloc_zeroed(&alloc, sizeof(*r));
+        eb_assert_or_recover(r, return NULL);
+        r->in_use = true;
+        
+        eb_spinlock_lock(&g_rings_lock);
+            r->next = g_rings;
+            g_rings = r;
+        eb_spinlock_unlock(&g_rings_lock);
+    }
+    
+    r->tid = eb_sys_thread_id();
+    
+    /* Register our thread-exit handler, which releases the ring */
+    pthread_once(&g_ring_key_once, ring_key_create);
+    int err = pthread_setspecific(g_ring_key, r);
+    eb_assert_or_recover(!err, eb_no_op);
+    
+    t_ring = r;
+    return r;
+}
+
+void eb_trace_record(eb_trace_type type, const void *chan, const char *label, uint32_t arg) {
+    ring *r = ring_current();
+    if (!r) {
+        return;
+    }
+    
+    uint64_t head = r->head;
+    r->events[head % EB_TRACE_RING_CAP] = (event){
+        .ticks = eb_time_ticks(),
+        .chan = chan,
+        .label = label,
+        .arg = arg,
+        .type = type,
+    };
+    /* Publish the event after it's written */
+    eb_atomic_store_release(&r->head, head + 1);
+}
+
+bool eb_trace_thread_prepare() {
+    return (ring_current() != NULL);
+}
+
+#pragma mark - Chrome trace export -
+static const char *type_name(eb_trace_type type) {
+    switch (type) {
+        case eb_trace_select_begin:
+        case eb_trace_select_end:   return "select";
+        case eb_trace_park:
+        case eb_trace_unpark:       return "park";
+        case eb_trace_signal:       return "signal";
+        case eb_trace_lock_retry:   return "lock_retry";
+        case eb_trace_close:        return "close";
+        case eb_trace_unbuf_state:  return "unbuf_state";
+    }
+    return "?";
+}
+
+static const char *type_phase(eb_trace_type type) {
+    switch (type) {
+        case eb_trace_select_begin:
+        case eb_trace_park:         return "B";
+        case eb_trace_select_end:
+        case eb_trace_unpark:       return "E";
+        default:                    return "i";
+    }
+}
+
+static void write_event(FILE *f, bool *first, int pid, long tid, uint64_t base, const event *e) {
+    double ts = (double)eb_time_ticks_to_nsec(e->ticks > base ? e->ticks - base : 0) / 1000;
+    const char *phase = type_phase(e->type);
+    fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"%s\",%s\"pid\":%d,\"tid\":%ld,\"ts\":%.3f,\"args\":{",
+        (*first ? "" : ","), type_name(e->type), phase, (phase[0] == 'i' ? "\"s\":\"t\"," : ""), pid, tid, ts);
+    *first = false;
+    
+    bool comma = false;
+    if (e->chan) {
+        fprintf(f, "\"chan\":\"%p\"", e->chan);
+        comma = true;
+    }
+    
+    switch (e->type) {
+        case eb_trace_select_begin:
+            fprintf(f, "%s\"nops\":%u", (comma ? "," : ""), e->arg);
+            break;
+        case eb_trace_select_end:
+            if (e->arg != UINT32_MAX) {
+                fprintf(f, "%s\"op\":%u,\"res\":\"%s\"", (comma ? "," : ""), e->arg, (e->label ? e->label : ""));
+            } else {
+                fprintf(f, "%s\"op\":null", (comma ? "," : ""));
+            }
+            break;
+        case eb_trace_unpark:
+            fprintf(f, "%s\"signaled\":%s", (comma ? "," : ""), (e->arg ? "true" : "false"));
+            break;
+        case eb_trace_unbuf_state:
+            fprintf(f, "%s\"state\":\"%s\"", (comma ? "," : ""), (e->label ? e->label : ""));
+            break;
+        default:
+            break;
+    }
+    
+    fprintf(f, "}}");
+}
+
+/* Copies the events that 'r' currently holds into 'out' (which must hold EB_TRACE_RING_CAP events), oldest first, and
+   returns the number of events copied. Events that were overwritten during the copy are dropped. */
+static size_t ring_snapshot(const ring *r, event *out) {
+    uint64_t head = eb_atomic_load_acquire(&r->head);
+    uint64_t start = (head > EB_TRACE_RING_CAP ? head - EB_TRACE_RING_CAP : 0);
+    for (uint64_t i = start; i < head; i++) {
+        out[i - start] = r->events[i % EB_TRACE_RING_CAP];
+    }
+    
+    /* Drop the events that the owner may have overwritten while we were copying */
+    eb_atomic_barrier();
+    uint64_t head_after = eb_atomic_load_acquire(&r->head);
+    uint64_t valid_start = (head_after > EB_TRACE_RING_CAP ? head_after - EB_TRACE_RING_CAP : 0);
+    size_t skip = (valid_start > start ? (size_t)(valid_start - start) : 0);
+    size_t count = (size_t)(head - start);
+    if (skip >= count) {
+        return 0;
+    }
+    
+    memmove(out, out + skip, (count - skip) * sizeof(*out));
+    return count - skip;
+}
+
+#pragma mark - Public API -
+bool eb_chan_trace_start() {
+    #if EB_CHAN_TRACE
+        eb_time_ticks_init();
+        eb_atomic_barrier();
+        eb_trace_active = 1;
+        return true;
+    #else
+        return false;
+    #endif
+}
+
+void eb_chan_trace_stop() {
+    eb_trace_active = 0;
+    eb_atomic_barrier();
+}
+
+bool eb_chan_trace_dump(const char *path) {
+    assert(path);
+    
+    FILE *f = fopen(path, "w");
+    eb_assert_or_recover(f, return false);
+    
+    eb_chan_allocator alloc = eb_alloc_global();
+    event *events = eb_alloc(&alloc, EB_TRACE_RING_CAP * sizeof(*events));
+    eb_assert_or_recover(events, fclose(f); return false);
+    
+    /* Use the earliest event as time zero. (Rings are only ever prepended to the list, so it's safe to walk without
+       the lock.) */
+    ring *rings = *((ring *volatile *)&g_rings);
+    uint64_t base = UINT64_MAX;
+    for (ring *r = rings; r; r = r->next) {
+        size_t count = ring_snapshot(r, events);
+        if (count && events[0].ticks < base) {
+            base = events[0].ticks;
+        }
+    }
+    
+    int pid = (int)getpid();
+    bool first = true;
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (ring *r = rings; r; r = r->next) {
+        size_t count = ring_snapshot(r, events);
+        for (size_t i = 0; i < count; i++) {
+            write_event(f, &first, pid, r->tid, base, &events[i]);
+        }
+    }
+    fprintf(f, "\n]}\n");
+    
+    eb_free(&alloc, events, EB_TRACE_RING_CAP * sizeof(*events));
+    bool ok = !ferror(f);
+    ok = !fclose(f) && ok;
+    return ok;
+}
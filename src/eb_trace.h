@@ -0,0 +1,35 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Whether the flight recorder is compiled in (see eb_chan_trace_start()). Recording costs a predictable branch per event
+   while tracing is stopped. Defining EB_CHAN_TRACE=0 removes it entirely. */
+#ifndef EB_CHAN_TRACE
+    #define EB_CHAN_TRACE 1
+#endif
+
+/* The number of events that each thread's ring holds; older events are overwritten */
+#define EB_TRACE_RING_CAP 2048
+
+/* ## Types */
+typedef enum {
+    eb_trace_select_begin,  /* arg: number of ops */
+    eb_trace_select_end,    /* chan: the channel of the op that was performed; arg: its index, or UINT32_MAX if none */
+    eb_trace_park,
+    eb_trace_unpark,        /* arg: whether the thread was signaled (vs. timed out) */
+    eb_trace_signal,        /* chan: the channel whose waiter was signaled */
+    eb_trace_lock_retry,    /* chan: the channel whose lock couldn't be acquired */
+    eb_trace_close,         /* chan: the channel that was closed */
+    eb_trace_unbuf_state,   /* chan: the unbuffered channel; label: the state that it transitioned to */
+} eb_trace_type;
+
+/* ## Variables */
+/* Non-zero while tracing (checked before recording every event) */
+extern int eb_trace_active;
+
+/* ## Functions */
+/* Records an event on the calling thread's ring. Only call while eb_trace_active. */
+void eb_trace_record(eb_trace_type type, const void *chan, const char *label, uint32_t arg);
+/* Gives the calling thread a ring ahead of time, so that recording never allocates */
+bool eb_trace_thread_prepare();
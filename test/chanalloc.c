@@ -0,0 +1,73 @@
+// Test that allocations are routed through the global and per-channel allocators.
+
+#include "testglue.h"
+
+#define N 1000
+
+typedef struct {
+    int allocs;
+    int frees;
+} counting_ctx;
+
+static void *counting_alloc(void *ctx, size_t size) {
+    tg_atomic_add(&((counting_ctx *)ctx)->allocs, 1);
+    return malloc(size);
+}
+
+static void counting_free(void *ctx, void *ptr, size_t size) {
+    tg_atomic_add(&((counting_ctx *)ctx)->frees, 1);
+    free(ptr);
+}
+
+void Sender(eb_chan c) {
+    for (intptr_t i = 0; i < N; i++) {
+        assert(eb_chan_send(c, (const void *)i) == eb_chan_res_ok);
+    }
+}
+
+int main() {
+    // Per-channel allocator (without realloc(), which is emulated)
+    counting_ctx chan_ctx = {0};
+    eb_chan_allocator chan_alloc = {.alloc = counting_alloc, .realloc = NULL, .free = counting_free, .ctx = &chan_ctx};
+    eb_chan c = eb_chan_create_with_allocator(8, &chan_alloc);
+    assert(c);
+    assert(chan_ctx.allocs == 2); // The channel and its ring
+    
+    go( Sender(c) );
+    for (intptr_t i = 0; i < N; i++) {
+        const void *val;
+        assert(eb_chan_recv(c, &val) == eb_chan_res_ok);
+        assert((intptr_t)val == i);
+    }
+    
+    eb_chan_release(c);
+    assert(chan_ctx.allocs == chan_ctx.frees);
+    
+    // Global allocator
+    counting_ctx global_ctx = {0};
+    eb_chan_allocator global_alloc = {.alloc = counting_alloc, .realloc = NULL, .free = counting_free, .ctx = &global_ctx};
+    eb_chan_set_allocator(&global_alloc);
+    c = eb_chan_create(0);
+    assert(c);
+    assert(global_ctx.allocs == 1);
+    
+    // A steady-state workload doesn't allocate once the channel's statistics (allocated by its first op) and port lists
+    // have been allocated
+    eb_chan_op warmup = eb_chan_op_recv(c);
+    assert(eb_chan_select(eb_nsec_zero, &warmup) == NULL);
+    eb_chan_alloc_counts before, after;
+    eb_chan_alloc_stats(&before);
+    for (int i = 0; i < 10; i++) {
+        eb_chan_op op = eb_chan_op_recv(c);
+        assert(eb_chan_select(eb_nsec_zero, &op) == NULL);
+    }
+    eb_chan_alloc_stats(&after);
+    assert(after.allocs == before.allocs && after.reallocs == before.reallocs);
+    
+    // Restoring the default allocator doesn't affect channels created with the previous one
+    eb_chan_set_allocator(NULL);
+    eb_chan_release(c);
+    assert(global_ctx.allocs == global_ctx.frees);
+    
+    return 0;
+}
@@ -0,0 +1,62 @@
+// Test per-thread blocked-time accounting.
+
+#include "testglue.h"
+#include <unistd.h>
+
+void Sender(eb_chan c) {
+    // Leave the receiver parked for a while
+    usleep(20000);
+    assert(eb_chan_send(c, NULL) == eb_chan_res_ok);
+}
+
+int main() {
+    eb_chan_thread_times t, all;
+    eb_chan_op_times o;
+    
+    if (!eb_chan_blocked_time_enable()) {
+        // Accounting is compiled out
+        assert(!eb_chan_thread_blocked_time(&t));
+        return 0;
+    }
+    
+    assert(eb_chan_thread_blocked_time(&t));
+    assert(!t.completed.selects && !t.timed_out.selects);
+    
+    // A receive that parks until the sender arrives is attributed to the channel
+    eb_chan c = eb_chan_create(0);
+    go( Sender(c) );
+    assert(eb_chan_recv(c, NULL) == eb_chan_res_ok);
+    
+    assert(eb_chan_thread_blocked_time(&t));
+    assert(t.completed.selects == 1);
+    assert(t.completed.park >= 10000000);
+    assert(!t.timed_out.selects);
+    
+    assert(eb_chan_blocked_time(c, &o));
+    assert(o.recvs.selects == 1);
+    assert(o.recvs.park == t.completed.park);
+    
+    // A select that times out is attributed to the timeout
+    eb_chan c2 = eb_chan_create(0);
+    eb_chan_op op = eb_chan_op_recv(c2);
+    assert(eb_chan_select(5000000, &op) == NULL);
+    
+    assert(eb_chan_thread_blocked_time(&t));
+    assert(t.timed_out.selects == 1);
+    assert(t.timed_out.spin + t.timed_out.park >= 4000000);
+    assert(eb_chan_blocked_time(c2, &o));
+    assert(!o.recvs.selects && !o.sends.selects);
+    
+    // Non-blocking ops aren't accounted
+    assert(eb_chan_try_recv(c2, NULL) == eb_chan_res_stalled);
+    assert(eb_chan_thread_blocked_time(&t));
+    assert(t.completed.selects == 1 && t.timed_out.selects == 1);
+    
+    // The aggregate includes every thread, including the sender
+    assert(eb_chan_all_blocked_time(&all));
+    assert(all.completed.selects >= t.completed.selects);
+    assert(all.timed_out.selects >= t.timed_out.selects);
+    assert(all.completed.park >= t.completed.park);
+    
+    return 0;
+}
@@ -0,0 +1,167 @@
+// Test traffic capture.
+
+#include "testglue.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char *const kPath = "/tmp/eb_chan_capture_test.bin";
+
+static uint64_t Get(const uint8_t *p, size_t n) {
+    uint64_t v = 0;
+    for (size_t i = n; i > 0; i--) {
+        v = (v << 8) | p[i - 1];
+    }
+    return v;
+}
+
+typedef struct {
+    uint64_t time;
+    uint32_t wait, chan, depth;
+    uint16_t thread;
+    uint8_t type, flags;
+    char name[256];
+} Record;
+
+// Reads the capture file into 'records', returning the number of records
+static size_t Read(Record *records, size_t cap) {
+    FILE *f = fopen(kPath, "rb");
+    assert(f);
+    char magic[8];
+    assert(fread(magic, 1, 8, f) == 8);
+    assert(!memcmp(magic, EB_CHAN_CAPTURE_MAGIC, 8));
+
+    size_t n = 0;
+    uint8_t b[EB_CHAN_CAPTURE_RECORD_SIZE];
+    while (fread(b, 1, sizeof(b), f) == sizeof(b)) {
+        assert(n < cap);
+        Record *r = &records[n++];
+        *r = (Record){
+            .time = Get(b, 8), .wait = (uint32_t)Get(b + 8, 4), .chan = (uint32_t)Get(b + 12, 4),
+            .depth = (uint32_t)Get(b + 16, 4), .thread = (uint16_t)Get(b + 20, 2), .type = b[22], .flags = b[23],
+        };
+        if (r->type == eb_chan_capture_define) {
+            assert(fread(r->name, 1, r->thread, f) == r->thread);
+            r->name[r->thread] = 0;
+        }
+    }
+    assert(feof(f));
+    fclose(f);
+    return n;
+}
+
+static volatile bool g_sent = false;
+
+void Sender(eb_chan c) {
+    // Leave the receiver parked for a while
+    usleep(20000);
+    assert(eb_chan_send(c, (void*)42) == eb_chan_res_ok);
+    // The send was recorded before it returned
+    g_sent = true;
+}
+
+int main() {
+    eb_chan jobs = eb_chan_create(2);
+    eb_chan unbuf = eb_chan_create(0);
+    assert(eb_chan_set_name(jobs, "jobs"));
+
+    // Nothing is recorded before the capture starts
+    assert(eb_chan_send(jobs, NULL) == eb_chan_res_ok);
+    assert(eb_chan_recv(jobs, NULL) == eb_chan_res_ok);
+    assert(!eb_chan_capture_stop());
+
+    assert(eb_chan_capture_start(kPath));
+    assert(!eb_chan_capture_start(kPath));
+    assert(eb_chan_send(jobs, NULL) == eb_chan_res_ok);
+    assert(eb_chan_try_send(jobs, NULL) == eb_chan_res_ok);
+    assert(eb_chan_try_send(jobs, NULL) == eb_chan_res_stalled);
+    assert(eb_chan_recv(jobs, NULL) == eb_chan_res_ok);
+    go( Sender(unbuf) );
+    const void *val;
+    assert(eb_chan_recv(unbuf, &val) == eb_chan_res_ok && val == (void*)42);
+    eb_chan_close(jobs);
+    eb_chan_op r = eb_chan_op_recv(jobs), r2 = eb_chan_op_recv(unbuf);
+    assert(eb_chan_select(eb_nsec_forever, &r, &r2) == &r && r.res == eb_chan_res_ok);
+    assert(eb_chan_select(eb_nsec_forever, &r, &r2) == &r && r.res == eb_chan_res_closed);
+    while (!g_sent) {
+        usleep(1000);
+    }
+    assert(eb_chan_capture_stop());
+
+    // Nothing is recorded after it stops
+    assert(eb_chan_recv(jobs, NULL) == eb_chan_res_closed);
+
+    Record records[32];
+    size_t n = Read(records, 32);
+    // 2 definitions, 7 ops on this thread (the failed _try_send() isn't recorded) and the sender's op
+    assert(n == 10);
+
+    uint32_t jobs_id = UINT32_MAX, unbuf_id = UINT32_MAX;
+    for (size_t i = 0; i < n; i++) {
+        if (records[i].type == eb_chan_capture_define) {
+            if (!strcmp(records[i].name, "jobs")) {
+                assert(records[i].depth == 2);
+                jobs_id = records[i].chan;
+            } else {
+                assert(!records[i].name[0] && !records[i].depth);
+                unbuf_id = records[i].chan;
+            }
+        }
+    }
+    assert(jobs_id != UINT32_MAX && unbuf_id != UINT32_MAX && jobs_id != unbuf_id);
+
+    // This thread's ops, in order
+    static const struct {
+        uint8_t type;
+        uint8_t flags;
+        bool jobs;
+        uint32_t depth;
+    } kExpected[] = {
+        {eb_chan_capture_send, 0, true, 1},
+        {eb_chan_capture_send, eb_chan_capture_try, true, 2},
+        {eb_chan_capture_recv, 0, true, 1},
+        {eb_chan_capture_recv, 0, false, 0},
+        {eb_chan_capture_close, 0, true, 1},
+        {eb_chan_capture_recv, eb_chan_capture_select, true, 0},
+        {eb_chan_capture_recv, eb_chan_capture_select | eb_chan_capture_closed, true, 0},
+    };
+    size_t expected = 0;
+    uint16_t thread = UINT16_MAX;
+    uint64_t last_time = 0;
+    for (size_t i = 0; i < n; i++) {
+        Record *x = &records[i];
+        if (x->type == eb_chan_capture_define) {
+            continue;
+        }
+        if (x->type == eb_chan_capture_send && x->chan == unbuf_id) {
+            // The sender's op, on another thread
+            assert(x->depth == 0 && !x->flags);
+            continue;
+        }
+        if (thread == UINT16_MAX) {
+            thread = x->thread;
+        }
+        assert(x->thread == thread);
+        assert(expected < sizeof(kExpected) / sizeof(*kExpected));
+        assert(x->type == kExpected[expected].type);
+        assert(x->flags == kExpected[expected].flags);
+        assert(x->chan == (kExpected[expected].jobs ? jobs_id : unbuf_id));
+        assert(x->depth == kExpected[expected].depth);
+        assert(x->time >= last_time);
+        last_time = x->time;
+        // The receive from the unbuffered channel waited for the sender
+        if (x->chan == unbuf_id) {
+            assert(x->wait >= 10000000);
+        }
+        expected++;
+    }
+    assert(expected == sizeof(kExpected) / sizeof(*kExpected));
+
+    // A new capture starts over
+    assert(eb_chan_capture_start(kPath));
+    assert(eb_chan_capture_stop());
+    assert(Read(records, 32) == 0);
+
+    unlink(kPath);
+    return 0;
+}
@@ -0,0 +1,134 @@
+// Test the runtime configuration and per-channel overrides.
+
+#include "testglue.h"
+
+#define N 200
+
+// Takes ownership of a reference to each channel
+void Echo(eb_chan in, eb_chan out) {
+    for (const void *val; eb_chan_recv(in, &val) == eb_chan_res_ok;) {
+        assert(eb_chan_send(out, val) == eb_chan_res_ok);
+    }
+    eb_chan_close(out);
+    eb_chan_release(in);
+    eb_chan_release(out);
+}
+
+// Bounces N values through an echo thread, over unbuffered and buffered channels
+void PingPong(size_t in_spin_attempts) {
+    for (size_t cap = 0; cap < 2; cap++) {
+        eb_chan in = eb_chan_create(cap);
+        eb_chan out = eb_chan_create(cap);
+        eb_chan_set_spin_attempts(in, in_spin_attempts);
+        go( Echo(eb_chan_retain(in), eb_chan_retain(out)) );
+        for (intptr_t i = 0; i < N; i++) {
+            const void *val;
+            assert(eb_chan_send(in, (const void *)i) == eb_chan_res_ok);
+            assert(eb_chan_recv(out, &val) == eb_chan_res_ok);
+            assert((intptr_t)val == i);
+        }
+        eb_chan_close(in);
+        assert(eb_chan_recv(out, NULL) == eb_chan_res_closed);
+        eb_chan_release(in);
+        eb_chan_release(out);
+    }
+}
+
+// Takes ownership of a reference to the channel
+void Recv(eb_chan c) {
+    assert(eb_chan_recv(c, NULL) == eb_chan_res_closed);
+    eb_chan_release(c);
+}
+
+// Counts the reallocations caused by parking two receivers on a new channel. Returns false if it can't tell when the
+// receivers have parked, because per-channel statistics are compiled out.
+bool ParkTwo(uint64_t *reallocs) {
+    eb_chan c = eb_chan_create(0);
+    eb_chan_counters counters;
+    if (!eb_chan_stats(c, &counters)) {
+        eb_chan_release(c);
+        return false;
+    }
+    
+    eb_chan_alloc_counts before, after;
+    eb_chan_alloc_stats(&before);
+    go( Recv(eb_chan_retain(c)) );
+    go( Recv(eb_chan_retain(c)) );
+    while (eb_chan_stats(c, &counters) && counters.parks < 2) {
+        usleep(1000);
+    }
+    eb_chan_alloc_stats(&after);
+    eb_chan_close(c);
+    eb_chan_release(c);
+    *reallocs = after.reallocs - before.reallocs;
+    return true;
+}
+
+int main() {
+    // The environment is applied when the first channel is created; invalid values are ignored
+    setenv("EB_CHAN_SPIN_ATTEMPTS", "7", 1);
+    setenv("EB_CHAN_YIELD", "always", 1);
+    setenv("EB_CHAN_PORT_POOL_CAP", "lots", 1);
+    setenv("EB_CHAN_WAITER_LIST_CAP", "0", 1);
+    eb_chan_release(eb_chan_create(0));
+    
+    eb_chan_config config;
+    eb_chan_config_get(&config);
+    assert(config.spin_attempts == 7);
+    assert(config.yield_policy == eb_chan_yield_always);
+    assert(config.port_pool_cap == 16);
+    assert(config.waiter_list_cap == 16);
+    
+    // The environment is only read once
+    setenv("EB_CHAN_SPIN_ATTEMPTS", "8", 1);
+    eb_chan_release(eb_chan_create(0));
+    eb_chan_config_get(&config);
+    assert(config.spin_attempts == 7);
+    
+    // Invalid configurations are rejected without changing anything
+    eb_chan_config bad = config;
+    bad.port_pool_cap = EB_CHAN_PORT_POOL_MAX + 1;
+    assert(!eb_chan_config_set(&bad));
+    bad = config;
+    bad.waiter_list_cap = 0;
+    assert(!eb_chan_config_set(&bad));
+    bad = config;
+    bad.yield_policy = (eb_chan_yield_policy)42;
+    assert(!eb_chan_config_set(&bad));
+    eb_chan_config_get(&bad);
+    assert(!memcmp(&bad, &config, sizeof(config)));
+    
+    // Channels work with every yield policy and spin budget, including per-channel overrides
+    const eb_chan_yield_policy policies[] = {eb_chan_yield_auto, eb_chan_yield_always, eb_chan_yield_never};
+    const size_t attempts[] = {0, 1, 500};
+    for (size_t p = 0; p < sizeof(policies) / sizeof(*policies); p++) {
+        for (size_t a = 0; a < sizeof(attempts) / sizeof(*attempts); a++) {
+            config.yield_policy = policies[p];
+            config.spin_attempts = attempts[a];
+            assert(eb_chan_config_set(&config));
+            PingPong(EB_CHAN_SPIN_ATTEMPTS_DEFAULT);
+            PingPong(0);
+            PingPong(100000);
+        }
+    }
+    
+    // The waiter lists start out with the configured capacity
+    config.waiter_list_cap = 1;
+    assert(eb_chan_config_set(&config));
+    uint64_t small = 0, large = 0;
+    if (ParkTwo(&small)) {
+        config.waiter_list_cap = 16;
+        assert(eb_chan_config_set(&config));
+        assert(ParkTwo(&large));
+        assert(small == large + 1);
+    }
+    
+    // Ports keep working with pooling disabled
+    config.port_pool_cap = 0;
+    assert(eb_chan_config_set(&config));
+    PingPong(EB_CHAN_SPIN_ATTEMPTS_DEFAULT);
+    config.port_pool_cap = EB_CHAN_PORT_POOL_MAX;
+    assert(eb_chan_config_set(&config));
+    PingPong(EB_CHAN_SPIN_ATTEMPTS_DEFAULT);
+    return 0;
+}
@@ -0,0 +1,76 @@
+// Test eb_chan_debug_dump() and the stall watchdog.
+
+#include "testglue.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static eb_chan g_parked_chan = NULL;
+static eb_chan g_full_chan = NULL;
+static int g_nparked = 0;
+static int g_nfull = 0;
+
+void Waiter(eb_chan c) {
+    const void *val;
+    assert(eb_chan_recv(c, &val) == eb_chan_res_ok);
+    assert(val == (const void *)42);
+}
+
+static void hook(const eb_chan_stall *stall, void *ctx) {
+    assert(ctx == &g_nparked);
+    if (stall->type == eb_chan_stall_parked && stall->chan == g_parked_chan) {
+        assert(!stall->send);
+        assert(stall->tid > 0);
+        assert(stall->duration >= 10000000);
+        tg_atomic_add(&g_nparked, 1);
+    } else if (stall->type == eb_chan_stall_buf_full && stall->chan == g_full_chan) {
+        assert(stall->duration >= 10000000);
+        tg_atomic_add(&g_nfull, 1);
+    }
+}
+
+int main() {
+    eb_chan full = eb_chan_create(1);
+    assert(eb_chan_send(full, NULL) == eb_chan_res_ok);
+    eb_chan c = eb_chan_create(0);
+    g_full_chan = full;
+    g_parked_chan = c;
+    
+    assert(eb_chan_watchdog_start(10000000, 10000000, hook, &g_nparked));
+    // Only one watchdog at a time
+    assert(!eb_chan_watchdog_start(10000000, 10000000, hook, &g_nparked));
+    
+    go( Waiter(c) );
+    usleep(100000);
+    
+    // Each stall is reported once
+    assert(g_nparked == 1);
+    assert(g_nfull == 1);
+    
+    // The parked receiver shows up in the dump
+    char path[] = "/tmp/eb_chan_dump_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    assert(eb_chan_debug_dump(fd) >= 1);
+    close(fd);
+    
+    FILE *f = fopen(path, "r");
+    assert(f);
+    static char buf[1 << 16];
+    size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+    buf[len] = 0;
+    fclose(f);
+    unlink(path);
+    
+    char expected[64];
+    snprintf(expected, sizeof(expected), "eb_chan %p: unbuffered", (void *)c);
+    assert(strstr(buf, expected));
+    assert(strstr(buf, "recv waiter: thread "));
+    assert(strstr(buf, "parked for "));
+    snprintf(expected, sizeof(expected), "ops: recv %p", (void *)c);
+    assert(strstr(buf, expected));
+    
+    eb_chan_watchdog_stop();
+    assert(eb_chan_send(c, (const void *)42) == eb_chan_res_ok);
+    return 0;
+}
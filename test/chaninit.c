@@ -0,0 +1,77 @@
+// Test channels initialized within caller-provided storage.
+
+#include "testglue.h"
+
+#define N 100
+
+struct conn {
+    int id;
+    struct eb_chan_storage unbuf_storage;
+    struct eb_chan_storage buf_storage;
+    const void *ring[N];
+};
+
+static struct eb_chan_storage g_static_storage;
+
+void Sender(eb_chan c) {
+    for (intptr_t i = 0; i < N; i++) {
+        assert(eb_chan_send(c, (const void *)i) == eb_chan_res_ok);
+    }
+}
+
+int main() {
+    struct conn *conn = calloc(1, sizeof(*conn));
+    
+    // Unbuffered, embedded in a struct
+    eb_chan unbuf = eb_chan_init(&conn->unbuf_storage, NULL, 0);
+    assert(unbuf);
+    assert(eb_chan_buf_cap(unbuf) == 0);
+    go( Sender(unbuf) );
+    for (intptr_t i = 0; i < N; i++) {
+        const void *val;
+        assert(eb_chan_recv(unbuf, &val) == eb_chan_res_ok);
+        assert((intptr_t)val == i);
+    }
+    
+    // Buffered, with the ring in caller memory
+    eb_chan buf = eb_chan_init(&conn->buf_storage, conn->ring, N);
+    assert(buf);
+    assert(sizeof(conn->ring) >= EB_CHAN_RING_SIZE(N));
+    for (intptr_t i = 0; i < N; i++) {
+        assert(eb_chan_try_send(buf, (const void *)i) == eb_chan_res_ok);
+    }
+    assert(eb_chan_try_send(buf, NULL) == eb_chan_res_stalled);
+    assert(eb_chan_buf_len(buf) == N);
+    assert(conn->ring[N-1] == (const void *)(N-1));
+    
+    // Select across the embedded channels
+    eb_chan_op recv_unbuf = eb_chan_op_recv(unbuf);
+    eb_chan_op recv_buf = eb_chan_op_recv(buf);
+    assert(eb_chan_select(eb_nsec_forever, &recv_unbuf, &recv_buf) == &recv_buf);
+    assert(recv_buf.res == eb_chan_res_ok && recv_buf.val == (const void *)0);
+    
+    // Closing works as usual
+    assert(eb_chan_close(unbuf) == eb_chan_res_ok);
+    assert(eb_chan_recv(unbuf, NULL) == eb_chan_res_closed);
+    
+    eb_chan_deinit(unbuf);
+    eb_chan_deinit(buf);
+    free(conn);
+    
+    // Buffered, in static storage with a library-allocated ring; outstanding references keep the channel alive
+    eb_chan stat = eb_chan_init(&g_static_storage, NULL, 3);
+    assert(stat);
+    eb_chan_retain(stat);
+    eb_chan_deinit(stat);
+    assert(eb_chan_send(stat, (const void *)42) == eb_chan_res_ok);
+    const void *val;
+    assert(eb_chan_recv(stat, &val) == eb_chan_res_ok && val == (const void *)42);
+    eb_chan_release(stat);
+    
+    // The storage can be reused once every reference is released
+    stat = eb_chan_init(&g_static_storage, NULL, 0);
+    assert(stat);
+    eb_chan_deinit(stat);
+    
+    return 0;
+}
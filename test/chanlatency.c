@@ -0,0 +1,60 @@
+// Test the per-channel latency histograms.
+
+#include "testglue.h"
+#include <time.h>
+
+#define N 1000
+
+void Sender(eb_chan c) {
+    for (intptr_t i = 0; i < N; i++) {
+        assert(eb_chan_send(c, (const void *)i) == eb_chan_res_ok);
+    }
+}
+
+int main() {
+    eb_chan_latency l;
+    
+    // Measurement is off by default
+    eb_chan c = eb_chan_create(4);
+    assert(!eb_chan_latency_stats(c, &l));
+    if (!eb_chan_latency_enable(c)) {
+        // Latency measurement is compiled out
+        return 0;
+    }
+    // Enabling twice is harmless
+    assert(eb_chan_latency_enable(c));
+    assert(eb_chan_latency_stats(c, &l));
+    assert(l.count == 0 && l.p50 == 0 && l.max == 0);
+    
+    // Buffered: values sit in the buffer for ~10ms
+    for (intptr_t i = 0; i < 4; i++) {
+        assert(eb_chan_try_send(c, (const void *)i) == eb_chan_res_ok);
+    }
+    struct timespec ts = {.tv_sec = 0, .tv_nsec = 10000000};
+    nanosleep(&ts, NULL);
+    for (intptr_t i = 0; i < 4; i++) {
+        assert(eb_chan_try_recv(c, NULL) == eb_chan_res_ok);
+    }
+    
+    assert(eb_chan_latency_stats(c, &l));
+    assert(l.count == 4);
+    assert(l.p50 >= 9000000 && l.p50 <= l.p99 && l.p99 <= l.p999 && l.p999 <= l.max);
+    assert(l.max < eb_nsec_per_sec);
+    assert(eb_chan_latency_percentile(c, 0) >= 9000000);
+    
+    // Unbuffered, both with the receiver waiting and with the sender waiting
+    c = eb_chan_create(0);
+    assert(eb_chan_latency_enable(c));
+    go( Sender(c) );
+    for (intptr_t i = 0; i < N; i++) {
+        const void *val;
+        assert(eb_chan_recv(c, &val) == eb_chan_res_ok);
+        assert((intptr_t)val == i);
+    }
+    
+    assert(eb_chan_latency_stats(c, &l));
+    assert(l.count == N);
+    assert(l.p50 <= l.p90 && l.p90 <= l.p99 && l.p99 <= l.max);
+    
+    return 0;
+}
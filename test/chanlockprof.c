@@ -0,0 +1,58 @@
+// Test the spinlock contention profiler (which is only compiled in with EB_CHAN_LOCKPROF=1).
+
+#include "testglue.h"
+
+#define N 100000
+
+void Sender(eb_chan c) {
+    for (intptr_t i = 0; i < N; i++) {
+        assert(eb_chan_send(c, (const void *)i) == eb_chan_res_ok);
+    }
+}
+
+void Receiver(eb_chan c, eb_chan done) {
+    for (intptr_t i = 0; i < N; i++) {
+        assert(eb_chan_recv(c, NULL) == eb_chan_res_ok);
+    }
+    assert(eb_chan_send(done, NULL) == eb_chan_res_ok);
+}
+
+static void check(const eb_chan_lock_counts *l) {
+    assert(l->spins >= l->contended);
+    assert(!l->contended || l->spins > 0);
+    assert(!l->wait_cycles || l->wait_ns || l->wait_cycles < 1000);
+}
+
+int main() {
+    eb_chan_lock_report r;
+    eb_chan_lock_counts pool;
+    
+    eb_chan c = eb_chan_create(1);
+    if (!eb_chan_lock_stats(c, &r)) {
+        // The profiler is compiled out
+        assert(!r.chan.contended && !r.sends.spins);
+        assert(!eb_chan_port_pool_lock_stats(&pool));
+        return 0;
+    }
+    
+    // Nothing's contended yet
+    assert(!r.chan.contended && !r.sends.contended && !r.recvs.contended);
+    
+    eb_chan done = eb_chan_create(0);
+    for (int i = 0; i < 4; i++) {
+        go( Sender(c) );
+        go( Receiver(c, done) );
+    }
+    for (int i = 0; i < 4; i++) {
+        assert(eb_chan_recv(done, NULL) == eb_chan_res_ok);
+    }
+    
+    assert(eb_chan_lock_stats(c, &r));
+    check(&r.chan);
+    check(&r.sends);
+    check(&r.recvs);
+    assert(eb_chan_port_pool_lock_stats(&pool));
+    check(&pool);
+    
+    return 0;
+}
@@ -0,0 +1,112 @@
+// Test the Prometheus metrics exporter.
+
+#include "testglue.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+
+// Reads everything from 'fd' into 'buf'
+static size_t read_all(int fd, char *buf, size_t cap) {
+    size_t len = 0;
+    for (;;) {
+        ssize_t r = read(fd, buf + len, cap - 1 - len);
+        if (r <= 0) {
+            break;
+        }
+        len += r;
+    }
+    buf[len] = 0;
+    return len;
+}
+
+static void check_metrics(const char *m, eb_chan c) {
+    char line[256];
+    snprintf(line, sizeof(line), "eb_chan_buffer_length{chan=\"%p\",name=\"jobs \\\"main\\\"\"} 2\n", (void *)c);
+    assert(strstr(m, line));
+    snprintf(line, sizeof(line), "eb_chan_buffer_capacity{chan=\"%p\",name=\"jobs \\\"main\\\"\"} 4\n", (void *)c);
+    assert(strstr(m, line));
+    snprintf(line, sizeof(line), "eb_chan_parked_waiters{chan=\"%p\",name=\"jobs \\\"main\\\"\",op=\"recv\"} 0\n", (void *)c);
+    assert(strstr(m, line));
+    assert(strstr(m, "# TYPE eb_chan_parked_waiters gauge\n"));
+    assert(strstr(m, "# TYPE eb_chan_port_pool_hits_total counter\n"));
+    assert(strstr(m, "\neb_chan_port_pool_capacity "));
+    
+    // Each family is written once
+    const char *type = strstr(m, "# TYPE eb_chan_closed gauge\n");
+    assert(type && !strstr(type + 1, "# TYPE eb_chan_closed gauge\n"));
+    
+    eb_chan_counters counters;
+    if (eb_chan_stats(c, &counters)) {
+        snprintf(line, sizeof(line), "eb_chan_sends_total{chan=\"%p\",name=\"jobs \\\"main\\\"\"} 3\n", (void *)c);
+        assert(strstr(m, line));
+    }
+}
+
+int main() {
+    static char m[1 << 16];
+    
+    eb_chan c = eb_chan_create(4);
+    assert(eb_chan_set_name(c, "jobs \"main\""));
+    eb_chan unnamed = eb_chan_create(0);
+    for (int i = 0; i < 3; i++) {
+        assert(eb_chan_send(c, NULL) == eb_chan_res_ok);
+    }
+    assert(eb_chan_recv(c, NULL) == eb_chan_res_ok);
+    
+    // Write to a pipe
+    int fds[2];
+    assert(!pipe(fds));
+    assert(eb_chan_metrics_write(fds[1]));
+    close(fds[1]);
+    read_all(fds[0], m, sizeof(m));
+    close(fds[0]);
+    check_metrics(m, c);
+    
+    char line[128];
+    snprintf(line, sizeof(line), "eb_chan_closed{chan=\"%p\"} 0\n", (void *)unnamed);
+    assert(strstr(m, line));
+    
+    // Write to a file
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/eb_chan_metrics_%d.prom", (int)getpid());
+    assert(eb_chan_metrics_write_file(path));
+    int fd = open(path, O_RDONLY);
+    assert(fd >= 0);
+    read_all(fd, m, sizeof(m));
+    close(fd);
+    unlink(path);
+    check_metrics(m, c);
+    
+    // Serve over a Unix domain socket, via HTTP
+    snprintf(path, sizeof(path), "/tmp/eb_chan_metrics_%d.sock", (int)getpid());
+    assert(eb_chan_metrics_serve(path));
+    assert(!eb_chan_metrics_serve(path));
+    
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strcpy(addr.sun_path, path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert(fd >= 0);
+    assert(!connect(fd, (struct sockaddr *)&addr, sizeof(addr)));
+    static const char k_req[] = "GET /metrics HTTP/1.0\r\n\r\n";
+    assert(write(fd, k_req, sizeof(k_req) - 1) == sizeof(k_req) - 1);
+    read_all(fd, m, sizeof(m));
+    close(fd);
+    assert(!strncmp(m, "HTTP/1.0 200 OK\r\n", 17));
+    check_metrics(m, c);
+    
+    eb_chan_metrics_stop();
+    assert(access(path, F_OK));
+    
+    // Removing the name removes the label
+    assert(eb_chan_set_name(c, NULL));
+    assert(!pipe(fds));
+    assert(eb_chan_metrics_write(fds[1]));
+    close(fds[1]);
+    read_all(fds[0], m, sizeof(m));
+    close(fds[0]);
+    assert(!strstr(m, "name=\""));
+    
+    eb_chan_release(c);
+    eb_chan_release(unnamed);
+    return 0;
+}
@@ -0,0 +1,48 @@
+// Test that prepared threads don't allocate in the hot path after warm-up.
+
+#include "testglue.h"
+
+#define N 1000
+
+void Echo(eb_chan in, eb_chan out) {
+    assert(eb_chan_thread_prepare(eb_chan_prepare_strict));
+    for (const void *val; eb_chan_recv(in, &val) == eb_chan_res_ok;) {
+        assert(eb_chan_send(out, val) == eb_chan_res_ok);
+    }
+    eb_chan_close(out);
+}
+
+int main() {
+    eb_chan in = eb_chan_create(0);
+    eb_chan out = eb_chan_create(1);
+    assert(eb_chan_reserve(in, 4));
+    assert(eb_chan_reserve(out, 4));
+    
+    assert(eb_chan_thread_prepare(eb_chan_prepare_strict));
+    go( Echo(in, out) );
+    
+    // Warm up, which also guarantees that Echo() has prepared its thread
+    assert(eb_chan_send(in, NULL) == eb_chan_res_ok);
+    assert(eb_chan_recv(out, NULL) == eb_chan_res_ok);
+    
+    eb_chan_alloc_counts before, after;
+    eb_chan_alloc_stats(&before);
+    for (intptr_t i = 0; i < N; i++) {
+        const void *val;
+        assert(eb_chan_send(in, (const void *)i) == eb_chan_res_ok);
+        assert(eb_chan_recv(out, &val) == eb_chan_res_ok);
+        assert((intptr_t)val == i);
+        
+        // Blocking selects with a timeout don't allocate either
+        eb_chan_op op = eb_chan_op_recv(out);
+        assert(eb_chan_select(1000, &op) == NULL);
+    }
+    eb_chan_alloc_stats(&after);
+    assert(after.allocs == before.allocs);
+    assert(after.reallocs == before.reallocs);
+    assert(after.frees == before.frees);
+    
+    eb_chan_close(in);
+    assert(eb_chan_recv(out, NULL) == eb_chan_res_closed);
+    return 0;
+}
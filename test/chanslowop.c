@@ -0,0 +1,69 @@
+// Test the slow-op hook.
+
+#include "testglue.h"
+#include <unistd.h>
+
+static size_t g_reports = 0;
+static eb_chan_slow_op g_last;
+
+void Hook(const eb_chan_slow_op *op) {
+    g_reports++;
+    g_last = *op;
+}
+
+void Sender(eb_chan c) {
+    // Leave the receiver parked for a while
+    usleep(20000);
+    assert(eb_chan_send(c, NULL) == eb_chan_res_ok);
+}
+
+int main() {
+    eb_chan_set_slow_op_hook(5000000, Hook);
+    
+    // A receive that parks until the sender arrives is reported
+    eb_chan c = eb_chan_create(0);
+    go( Sender(c) );
+    assert(eb_chan_recv(c, NULL) == eb_chan_res_ok);
+    assert(g_reports == 1);
+    assert(g_last.type == eb_chan_slow_op_recv);
+    assert(g_last.nops == 1 && g_last.ops[0]->chan == c);
+    assert(g_last.result == g_last.ops[0]);
+    assert(g_last.duration >= 10000000);
+    assert(g_last.park >= 10000000);
+    assert(g_last.spin + g_last.park + g_last.wake <= g_last.duration + 1000);
+    assert(!g_last.suppressed);
+    
+    // Fast ops aren't reported
+    eb_chan c2 = eb_chan_create(1);
+    assert(eb_chan_try_send(c2, NULL) == eb_chan_res_ok);
+    assert(eb_chan_try_recv(c2, NULL) == eb_chan_res_ok);
+    assert(eb_chan_try_recv(c2, NULL) == eb_chan_res_stalled);
+    assert(g_reports == 1);
+    
+    // A select that times out is reported without a result
+    eb_chan_op r = eb_chan_op_recv(c2), s = eb_chan_op_send(c, NULL);
+    assert(eb_chan_select(10000000, &r, &s) == NULL);
+    assert(g_reports == 2);
+    assert(g_last.type == eb_chan_slow_op_select && g_last.nops == 2);
+    assert(!g_last.result);
+    
+    // A burst of slow ops is rate-limited, and the next report counts the ones that were suppressed
+    eb_chan_set_slow_op_hook(1000000, Hook);
+    g_reports = 0;
+    for (int i = 0; i < 15; i++) {
+        assert(eb_chan_select(2000000, &r) == NULL);
+    }
+    assert(g_reports >= 10 && g_reports < 15);
+    size_t reports = g_reports;
+    usleep(200000);
+    assert(eb_chan_select(2000000, &r) == NULL);
+    assert(g_reports == reports + 1);
+    assert(reports + g_last.suppressed == 15);
+    
+    // Removing the hook stops reporting
+    eb_chan_set_slow_op_hook(0, NULL);
+    assert(eb_chan_select(2000000, &r) == NULL);
+    assert(g_reports == reports + 1);
+    
+    return 0;
+}
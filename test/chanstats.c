@@ -0,0 +1,82 @@
+// Test the per-channel statistics.
+
+#include "testglue.h"
+
+#define N 1000
+
+void Sender(eb_chan c) {
+    for (intptr_t i = 0; i < N; i++) {
+        assert(eb_chan_send(c, (const void *)i) == eb_chan_res_ok);
+    }
+    // Closing lets the receiver know that our counts are final
+    assert(eb_chan_close(c) == eb_chan_res_ok);
+}
+
+static volatile int g_enabling = 0;
+
+// Enables latency measurement, which timestamps every slot of the channel's buffer with the channel's lock held
+void Enabler(eb_chan c) {
+    eb_chan_latency_enable(c);
+    g_enabling = 0;
+}
+
+int main() {
+    eb_chan_counters s;
+    
+    // Buffered
+    eb_chan c = eb_chan_create(4);
+    for (intptr_t i = 0; i < 3; i++) {
+        assert(eb_chan_try_send(c, (const void *)i) == eb_chan_res_ok);
+    }
+    assert(eb_chan_recv(c, NULL) == eb_chan_res_ok);
+    assert(eb_chan_close(c) == eb_chan_res_ok);
+    while (eb_chan_recv(c, NULL) == eb_chan_res_ok);
+    assert(eb_chan_send(c, NULL) == eb_chan_res_closed);
+    
+    if (!eb_chan_stats(c, &s)) {
+        // Statistics are compiled out
+        return 0;
+    }
+    
+    assert(s.sends == 3);
+    assert(s.recvs == 3);
+    assert(s.closes_observed == 2);
+    assert(s.buf_len_max == 3);
+    // Occupancies of 1/4, 2/4 and 3/4
+    assert(s.occupancy[0] == 1 && s.occupancy[2] == 1 && s.occupancy[4] == 1);
+    assert(s.occupancy[1] == 0 && s.occupancy[7] == 0);
+    
+    // Unbuffered, where the receiver has to park
+    c = eb_chan_create(0);
+    go( Sender(c) );
+    for (intptr_t i = 0; i < N; i++) {
+        const void *val;
+        assert(eb_chan_recv(c, &val) == eb_chan_res_ok);
+        assert((intptr_t)val == i);
+    }
+    assert(eb_chan_recv(c, NULL) == eb_chan_res_closed);
+    
+    assert(eb_chan_stats(c, &s));
+    assert(s.sends == N);
+    assert(s.recvs == N);
+    assert(s.wakeups <= s.parks + s.sends + s.recvs);
+    assert(s.buf_len_max == 0);
+    
+    // Blocking ops that find the channel's lock held count a retry for each failed attempt. Each round holds a new
+    // channel's lock for a while, until a blocking receive runs into it.
+    memset(&s, 0, sizeof(s));
+    for (int i = 0; i < 100 && !s.lock_failures; i++) {
+        c = eb_chan_create(1 << 20);
+        g_enabling = 1;
+        go( Enabler(c) );
+        while (g_enabling) {
+            assert(eb_chan_send(c, NULL) == eb_chan_res_ok);
+            assert(eb_chan_recv(c, NULL) == eb_chan_res_ok);
+        }
+        assert(eb_chan_stats(c, &s));
+        assert(s.retries == s.lock_failures);
+        eb_chan_release(c);
+    }
+    
+    return 0;
+}
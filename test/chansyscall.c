@@ -0,0 +1,54 @@
+// Test system call accounting.
+
+#include "testglue.h"
+#include <unistd.h>
+
+void Sender(eb_chan c) {
+    // Leave the receiver parked for a while
+    usleep(20000);
+    assert(eb_chan_send(c, NULL) == eb_chan_res_ok);
+}
+
+int main() {
+    eb_chan_syscall_counts s;
+    
+    eb_chan_syscall_stats_reset();
+    if (!eb_chan_syscall_stats(&s)) {
+        // Counting is compiled out
+        assert(!s.ops && !s.syscalls);
+        return 0;
+    }
+    assert(!s.ops && !s.syscalls);
+    
+    // Ops that don't block don't make system calls
+    eb_chan c = eb_chan_create(1);
+    assert(eb_chan_try_send(c, NULL) == eb_chan_res_ok);
+    assert(eb_chan_try_recv(c, NULL) == eb_chan_res_ok);
+    assert(eb_chan_try_recv(c, NULL) == eb_chan_res_stalled);
+    assert(eb_chan_syscall_stats(&s));
+    assert(s.ops == 2);
+    assert(!s.sem_posts && !s.sem_waits && !s.sem_timedwaits);
+    
+    // A receive that parks until the sender arrives waits on its semaphore, and the sender posts it
+    eb_chan_syscall_stats_reset();
+    eb_chan c2 = eb_chan_create(0);
+    go( Sender(c2) );
+    assert(eb_chan_recv(c2, NULL) == eb_chan_res_ok);
+    assert(eb_chan_syscall_stats(&s));
+    assert(s.ops >= 1);
+    assert(s.sem_waits >= 1 && s.sem_posts >= 1);
+    assert(s.syscalls >= s.sem_waits + s.sem_posts);
+    assert(s.syscalls_per_op > 0);
+    assert(s.voluntary_switches >= 1);
+    
+    // A select that times out makes timed waits (the sender's op may or may not be counted by now)
+    eb_chan_syscall_stats_reset();
+    eb_chan_op op = eb_chan_op_recv(c2);
+    assert(eb_chan_select(1000000, &op) == NULL);
+    assert(eb_chan_syscall_stats(&s));
+    assert(s.ops <= 1 && s.sem_timedwaits >= 1);
+    
+    eb_chan_release(c);
+    eb_chan_release(c2);
+    return 0;
+}
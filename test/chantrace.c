@@ -0,0 +1,63 @@
+// Test the flight recorder's Chrome trace export.
+
+#include "testglue.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define N 100
+
+void Sender(eb_chan c) {
+    for (intptr_t i = 0; i < N; i++) {
+        assert(eb_chan_send(c, (const void *)i) == eb_chan_res_ok);
+    }
+    assert(eb_chan_close(c) == eb_chan_res_ok);
+}
+
+int main() {
+    if (!eb_chan_trace_start()) {
+        // The recorder is compiled out
+        return 0;
+    }
+    
+    eb_chan c = eb_chan_create(0);
+    go( Sender(c) );
+    while (eb_chan_recv(c, NULL) == eb_chan_res_ok);
+    
+    // A select that times out
+    eb_chan c2 = eb_chan_create(0);
+    eb_chan_op op = eb_chan_op_recv(c2);
+    assert(eb_chan_select(1000000, &op) == NULL);
+    
+    eb_chan_trace_stop();
+    // Nothing is recorded while stopped
+    eb_chan_op op2 = eb_chan_op_recv(c2);
+    assert(eb_chan_select(0, &op2) == NULL);
+    
+    char path[] = "/tmp/eb_chan_trace_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+    assert(eb_chan_trace_dump(path));
+    
+    FILE *f = fopen(path, "r");
+    assert(f);
+    static char buf[1 << 20];
+    size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+    buf[len] = 0;
+    fclose(f);
+    unlink(path);
+    
+    assert(!strncmp(buf, "{", 1));
+    assert(strstr(buf, "\"traceEvents\":["));
+    assert(strstr(buf, "\"name\":\"select\",\"ph\":\"B\""));
+    assert(strstr(buf, "\"name\":\"select\",\"ph\":\"E\""));
+    assert(strstr(buf, "\"name\":\"park\",\"ph\":\"B\""));
+    assert(strstr(buf, "\"signaled\":false"));
+    assert(strstr(buf, "\"name\":\"close\""));
+    assert(strstr(buf, "\"state\":\"ack\""));
+    assert(strstr(buf, "\"op\":null"));
+    assert(!strcmp(buf + len - 4, "\n]}\n"));
+    
+    return 0;
+}
@@ -2,6 +2,7 @@
 
 // Torture test for goroutines.
 // Make a lot of goroutines, threaded together, and tear them down cleanly.
+// As a workload (see bench/macro), the chain length is the first argument.
 
 #include "testglue.h"
 
@@ -11,8 +12,8 @@ void f(eb_chan left, eb_chan right) {
     eb_chan_send(left, val);
 }
 
-int main() {
-	const int n = 2040;
+int main(int argc, const char *argv[]) {
+	const int n = (argc > 1 ? atoi(argv[1]) : 2040);
 	eb_chan leftmost = eb_chan_create(0);
 	eb_chan right = leftmost;
 	eb_chan left = leftmost;
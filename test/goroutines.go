@@ -6,6 +6,7 @@
 
 // Torture test for goroutines.
 // Make a lot of goroutines, threaded together, and tear them down cleanly.
+// As a workload (see bench/macro), the chain length is the first argument.
 
 package main
 
@@ -8,8 +8,10 @@
 // Original code in Newsqueak by Doug McIlroy.
 // See Squinting at Power Series by Doug McIlroy,
 //   http://www.cs.bell-labs.com/who/rsc/thread/squint.pdf
+// As a workload (see bench/macro), the number of terms that are checked is the first argument.
 
 #include "testglue.h"
+#include <ctype.h>
 
 typedef struct  {
 	int64_t num; // numerator
@@ -670,16 +672,20 @@ void check(PS U, rat c, int count, const char *str) {
 	}
 }
 
-const int N=10;
-void checka(PS U, rat *a, const char *str) {
-	for (int i = 0; i < N; i++) {
+int N=10;
+void checkn(PS U, rat *a, int n, const char *str) {
+	for (int i = 0; i < n; i++) {
 		check(U, a[i], 1, str);
 	}
 }
 
+void checka(PS U, rat *a, const char *str) {
+	checkn(U, a, N, str);
+}
+
 int main(int argc, const char *argv[]) {
 	Init();
-	if (argc > 1) {  // print
+	if (argc > 1 && !isdigit((unsigned char)argv[1][0])) {  // print
 		printf("Ones: "); printn(Ones, 10);
 		printf("Twos: "); printn(Twos, 10);
 		printf("Add: "); printn(Add(Ones, Twos), 10);
@@ -692,6 +698,9 @@ int main(int argc, const char *argv[]) {
 		printf("MonSubst: "); printn(MonSubst(Ones, neg(one), 2), 10);
 		printf("ATan: "); printn(Integ(zero, MonSubst(Ones, neg(one), 2)), 10);
 	} else {  // test
+        if (argc > 1 && atoi(argv[1]) > N) {
+            N = atoi(argv[1]);
+        }
         check(Ones, one, 5, "Ones");
         check(Add(Ones, Ones), itor(2), 0, "Add Ones Ones");  // 1 1 1 1 1
         check(Add(Ones, Twos), itor(3), 0, "Add Ones Twos"); // 3 3 3 3 3
@@ -725,7 +734,7 @@ int main(int argc, const char *argv[]) {
         a[7] = i2tor(37633,5040);
         a[8] = i2tor(43817,4480);
         a[9] = i2tor(4596553,362880);
-        checka(e, a, "Exp");  // 1 1 3/2 13/6 73/24
+        checkn(e, a, 10, "Exp");  // 1 1 3/2 13/6 73/24 (only the first 10 terms are tabulated)
         PS at = Integ(zero, MonSubst(Ones, neg(one), 2));
         for (int c = 1, i = 0; i < N; i++) {
             if (i%2 == 0) {
@@ -10,12 +10,16 @@
 // A power series is a channel, along which flow rational
 // coefficients.  A denominator of zero signifies the end.
 // Original code in Newsqueak by Doug McIlroy.
+// As a workload (see bench/macro), the number of terms that are checked is the first argument.
 // See Squinting at Power Series by Doug McIlroy,
 //   http://www.cs.bell-labs.com/who/rsc/thread/squint.pdf
 
 package main
 
-import "os"
+import (
+	"os"
+	"strconv"
+)
 
 type rat struct  {
 	num, den  int64	// numerator, denominator
@@ -627,16 +631,24 @@ func check(U PS, c rat, count int, str string) {
 	}
 }
 
-const N=10
-func checka(U PS, a []rat, str string) {
-	for i := 0; i < N; i++ {
+var N = 10
+func checkn(U PS, a []rat, n int, str string) {
+	for i := 0; i < n; i++ {
 		check(U, a[i], 1, str)
 	}
 }
 
+func checka(U PS, a []rat, str string) {
+	checkn(U, a, N, str)
+}
+
 func main() {
 	Init()
-	if len(os.Args) > 1 {  // print
+	terms, err := 0, error(nil)
+	if len(os.Args) > 1 {
+		terms, err = strconv.Atoi(os.Args[1])
+	}
+	if len(os.Args) > 1 && err != nil {  // print
 		print("Ones: "); printn(Ones, 10)
 		print("Twos: "); printn(Twos, 10)
 		print("Add: "); printn(Add(Ones, Twos), 10)
@@ -649,6 +661,9 @@ func main() {
 		print("MonSubst: "); printn(MonSubst(Ones, neg(one), 2), 10)
 		print("ATan: "); printn(Integ(zero, MonSubst(Ones, neg(one), 2)), 10)
 	} else {  // test
+		if terms > N {
+			N = terms
+		}
 		check(Ones, one, 5, "Ones")
 		check(Add(Ones, Ones), itor(2), 0, "Add Ones Ones")  // 1 1 1 1 1
 		check(Add(Ones, Twos), itor(3), 0, "Add Ones Twos") // 3 3 3 3 3
@@ -682,7 +697,7 @@ func main() {
 		a[7] = i2tor(37633,5040)
 		a[8] = i2tor(43817,4480)
 		a[9] = i2tor(4596553,362880)
-		checka(e, a, "Exp")  // 1 1 3/2 13/6 73/24
+		checkn(e, a, 10, "Exp")  // 1 1 3/2 13/6 73/24 (only the first 10 terms are tabulated)
 		at := Integ(zero, MonSubst(Ones, neg(one), 2))
 		for c, i := 1, 0; i < N; i++ {
 			if i%2 == 0 {
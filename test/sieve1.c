@@ -5,6 +5,7 @@
 // Generate primes up to 100 using channels, checking the results.
 // This sieve consists of a linear chain of divisibility filters,
 // equivalent to trial-dividing each n by all primes p ≤ n.
+// As a workload (see bench/macro), the number of primes is the first argument.
 
 #include "testglue.h"
 
@@ -41,14 +42,30 @@ void Sieve(eb_chan primes) {
 	}
 }
 
-int main() {
+// Check primes beyond the table by trial division.
+int isPrime(int n) {
+	for (int d = 2; d*d <= n; d++) {
+		if (n%d == 0) {
+			return 0;
+		}
+	}
+	return n > 1;
+}
+
+int main(int argc, const char *argv[]) {
 	eb_chan primes = eb_chan_create(0);
 	go( Sieve(primes) );
 	int a[] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61, 67, 71, 73, 79, 83, 89, 97};
-	for (int i = 0; i < (sizeof(a) / sizeof(*a)); i++) {
+	int n = (argc > 1 ? atoi(argv[1]) : (sizeof(a) / sizeof(*a)));
+	for (int i = 0, last = 0; i < n; i++) {
         const void *x;
         assert(eb_chan_recv(primes, &x) == eb_chan_res_ok);
-        assert((int)(intptr_t)x == a[i]);
+        if (i < (sizeof(a) / sizeof(*a))) {
+            assert((int)(intptr_t)x == a[i]);
+        } else {
+            assert((int)(intptr_t)x > last && isPrime((int)(intptr_t)x));
+        }
+        last = (int)(intptr_t)x;
 //        printf("%ju good (%p)\n", (uintmax_t)i, x);
 	}
 }
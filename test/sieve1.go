@@ -9,9 +9,15 @@
 // Generate primes up to 100 using channels, checking the results.
 // This sieve consists of a linear chain of divisibility filters,
 // equivalent to trial-dividing each n by all primes p ≤ n.
+// As a workload (see bench/macro), the number of primes is the first argument.
 
 package main
 
+import (
+	"os"
+	"strconv"
+)
+
 // Send the sequence 2, 3, 4, ... to channel 'ch'.
 func Generate(ch chan<- int) {
 	for i := 2; ; i++ {
@@ -47,10 +53,35 @@ func main() {
 	primes := make(chan int)
 	go Sieve(primes)
 	a := []int{2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61, 67, 71, 73, 79, 83, 89, 97}
-	for i := 0; i < len(a); i++ {
-		if x := <-primes; x != a[i] {
+	var n = len(a)
+	if len(os.Args) > 1 {
+		var err error
+		n, err = strconv.Atoi(os.Args[1])
+		if err != nil {
+			print("bad arg\n")
+			os.Exit(1)
+		}
+	}
+	for i, last := 0, 0; i < n; i++ {
+		x := <-primes
+		if i < len(a) && x != a[i] {
 			println(x, " != ", a[i])
 			panic("fail")
 		}
+		if i >= len(a) && (x <= last || !isPrime(x)) {
+			println(x, " isn't the next prime")
+			panic("fail")
+		}
+		last = x
+	}
+}
+
+// Check primes beyond the table by trial division.
+func isPrime(n int) bool {
+	for d := 2; d*d <= n; d++ {
+		if n%d == 0 {
+			return false
+		}
 	}
+	return n > 1
 }
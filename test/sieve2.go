@@ -9,12 +9,15 @@
 // Generate primes up to 100 using channels, checking the results.
 // This sieve is Eratosthenesque and only considers odd candidates.
 // See discussion at <http://blog.onideas.ws/eratosthenes.go>.
+// As a workload (see bench/macro), the number of primes is the first argument.
 
 package main
 
 import (
 	"container/heap"
 	"container/ring"
+	"os"
+	"strconv"
 )
 
 // Return a chan of odd numbers, starting from 5.
@@ -179,10 +182,35 @@ func Sieve() chan int {
 func main() {
 	primes := Sieve()
 	a := []int{2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61, 67, 71, 73, 79, 83, 89, 97}
-	for i := 0; i < len(a); i++ {
-		if x := <-primes; x != a[i] {
+	var n = len(a)
+	if len(os.Args) > 1 {
+		var err error
+		n, err = strconv.Atoi(os.Args[1])
+		if err != nil {
+			print("bad arg\n")
+			os.Exit(1)
+		}
+	}
+	for i, last := 0, 0; i < n; i++ {
+		x := <-primes
+		if i < len(a) && x != a[i] {
 			println(x, " != ", a[i])
 			panic("fail")
 		}
+		if i >= len(a) && (x <= last || !isPrime(x)) {
+			println(x, " isn't the next prime")
+			panic("fail")
+		}
+		last = x
+	}
+}
+
+// Check primes beyond the table by trial division.
+func isPrime(n int) bool {
+	for d := 2; d*d <= n; d++ {
+		if n%d == 0 {
+			return false
+		}
 	}
+	return n > 1
 }